@@ -20,31 +20,47 @@
  * DEALINGS IN THE SOFTWARE.
  */
 
-#include "o65file.h"
+#include "o65view.h"
+#include "o65hash.h"
+#include "o65validate.h"
+#include "o65compress.h"
 #include "elfmos.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-static int disassemble = 0;
+/** Information about how to dump files */
+typedef struct
+{
+    /** Library context to load the files with */
+    o65_context_t context;
+
+    /** Non-zero to disassemble the .text segment */
+    int disassemble;
+
+} dump_info_t;
 
-static int dump_file(const char *filename);
+static int dump_file(dump_info_t *info, const char *filename);
 
 int main(int argc, char *argv[])
 {
+    dump_info_t info;
     int arg;
     int first;
     int named;
     int exit_val = 0;
 
     /* Need at least one command-line argument other than "-d" */
+    o65_context_init(&(info.context));
+    info.disassemble = 0;
     arg = 1;
     if (arg < argc && (!strcmp(argv[1], "-d") || !strcmp(argv[1], "--disassemble"))) {
-        disassemble = 1;
+        info.disassemble = 1;
         ++arg;
     }
     if (arg >= argc) {
         fprintf(stderr, "Usage: %s [-d|--disassemble] file1 ...\n", argv[0]);
+        fprintf(stderr, "A filename of '-' reads from standard input.\n");
         return 1;
     }
 
@@ -58,21 +74,12 @@ int main(int argc, char *argv[])
             printf("\n");
         if (named)
             printf("%s:\n\n", argv[arg]);
-        if (!dump_file(argv[arg]))
+        if (!dump_file(&info, argv[arg]))
             exit_val = 1;
     }
     return exit_val;
 }
 
-static void file_error(FILE *file, const char *filename)
-{
-    if (feof(file))
-        fprintf(stderr, "%s: unexpected EOF\n", filename);
-    else
-        perror(filename);
-    fclose(file);
-}
-
 static void dump_string(const uint8_t *data, int len)
 {
     while (len > 0) {
@@ -85,21 +92,18 @@ static void dump_string(const uint8_t *data, int len)
     }
 }
 
-static int dump_nul_string(FILE *file)
+static void dump_nul_string(const uint8_t **data, const uint8_t *end)
 {
     int ch;
-    for (;;) {
-        ch = getc(file);
-        if (ch < 0)
-            return -1;
-        else if (ch == 0)
+    while (*data < end) {
+        ch = *(*data)++;
+        if (ch == 0)
             break;
         else if (ch >= ' ' && ch <= 0x7E)
             putc(ch, stdout);
-        else if (ch != 0)
+        else
             printf("\\x%02x", ch);
     }
-    return 1;
 }
 
 static void dump_hex(const uint8_t *data, int len)
@@ -122,37 +126,38 @@ static void dump_hex_line
     printf("\n");
 }
 
-static void dump_option(const o65_option_t *option)
+static void dump_option
+    (const o65_image_view_t *view, const o65_option_view_t *option)
 {
     printf("    ");
     switch (option->type) {
     case O65_OPT_FILENAME:
         printf("Filename: ");
-        dump_string(option->data, option->len - 2);
+        dump_string(option->data, (int)(option->len));
         break;
 
     case O65_OPT_OS:
         printf("Operating System Information:");
-        dump_hex(option->data, option->len - 2);
+        dump_hex(option->data, (int)(option->len));
         break;
 
     case O65_OPT_PROGRAM:
         printf("Assembler/Linker: ");
-        dump_string(option->data, option->len - 2);
+        dump_string(option->data, (int)(option->len));
         break;
 
     case O65_OPT_AUTHOR:
         printf("Author: ");
-        dump_string(option->data, option->len - 2);
+        dump_string(option->data, (int)(option->len));
         break;
 
     case O65_OPT_CREATED:
         printf("Created: ");
-        dump_string(option->data, option->len - 2);
+        dump_string(option->data, (int)(option->len));
         break;
 
     case O65_OPT_ELF_MACHINE:
-        if (option->len >= 8 && option->data[0] == 0x66 &&
+        if (option->len >= 6 && option->data[0] == 0x66 &&
                 option->data[1] == 0x19) {
             /* Dump the ELF MOS flags */
             struct elf_mos_flag
@@ -193,20 +198,55 @@ static void dump_option(const o65_option_t *option)
             }
         } else {
             /* Not a 6502, so dump the options in hexadecimal */
-            if (option->len == 8) {
+            if (option->len == 6) {
                 printf("ELF Machine: 0x%x\n", o65_read_uint16(option->data));
                 printf("    ELF Machine Flags: 0x%lx",
                        (unsigned long)(o65_read_uint32(option->data + 2)));
             } else {
                 printf("ELF Machine Option:");
-                dump_hex(option->data, option->len - 2);
+                dump_hex(option->data, (int)(option->len));
             }
         }
         break;
 
+    case O65_OPT_CONTENT_HASH:
+        if (option->len == O65_CONTENT_HASH_SIZE) {
+            printf("Content Hash: 0x%08lx%08lx",
+                   (unsigned long)(o65_read_uint32(option->data + 4)),
+                   (unsigned long)(o65_read_uint32(option->data)));
+            if (o65_verify_content_hash(view) == 1)
+                printf(" (OK)");
+            else
+                printf(" (MISMATCH)");
+        } else {
+            printf("Content Hash Option:");
+            dump_hex(option->data, (int)(option->len));
+        }
+        break;
+
+    case O65_OPT_COMPRESSED:
+        if (option->len == O65_COMPRESSED_OPT_LEN - 2 &&
+                option->data[0] == O65_SEGMENT_LZ) {
+            printf("Compressed Segments: LZ");
+        } else {
+            printf("Compressed Segments Option:");
+            dump_hex(option->data, (int)(option->len));
+        }
+        break;
+
+    case O65_OPT_PADDING:
+        if (o65_padding_alignment(view) != 0) {
+            printf("Padding: segments aligned to %lu bytes",
+                   (unsigned long)o65_padding_alignment(view));
+        } else {
+            printf("Padding Option:");
+            dump_hex(option->data, (int)(option->len));
+        }
+        break;
+
     default:
         printf("Option %d:", option->type);
-        dump_hex(option->data, option->len - 2);
+        dump_hex(option->data, (int)(option->len));
         break;
     }
     printf("\n");
@@ -368,22 +408,42 @@ static int can_disassemble(const o65_header_t *header)
     }
 }
 
-static int dump_segment
-    (FILE *file, const char *name, const o65_header_t *header,
-     o65_size_t base, o65_size_t len, int is_text)
+static void dump_segment
+    (const dump_info_t *info, const char *name,
+     const o65_image_view_t *view, o65_size_t base,
+     const o65_span_t *segment, o65_size_t len, int is_text)
 {
-    uint8_t *data = NULL;
+    const o65_header_t *header = &(view->header);
+    const uint8_t *data = segment->data;
+    uint8_t *decoded = NULL;
     o65_size_t posn;
 
     /* Print the name and size of the segment */
-    printf("\n%s: %lu bytes\n", name, (unsigned long)len);
-
-    /* Read the segment data */
-    if (o65_read_segment(file, &data, len) < 0)
-        return -1;
+    if (segment->size == len) {
+        printf("\n%s: %lu bytes\n", name, (unsigned long)len);
+    } else if (!(view->compressed)) {
+        /* The file is truncated, so dump what there is of the segment */
+        printf("\n%s: %lu bytes, %lu present\n", name,
+               (unsigned long)len, (unsigned long)(segment->size));
+        len = segment->size;
+    } else {
+        printf("\n%s: %lu bytes, %lu compressed\n", name,
+               (unsigned long)len, (unsigned long)(segment->size));
+    }
+    if (view->compressed) {
+        /* Decompress the segment so that it can be dumped */
+        decoded = (uint8_t *)malloc(len ? len : 1);
+        if (!decoded || !o65_lz_decode_segment
+                (decoded, len, segment->data, segment->size)) {
+            printf("    Could not decompress the segment\n");
+            free(decoded);
+            return;
+        }
+        data = decoded;
+    }
 
     /* Dump the contents of the segment */
-    if (is_text && disassemble && can_disassemble(header)) {
+    if (is_text && info->disassemble && can_disassemble(header)) {
         disasseble_segment(header, base, data, len);
     } else {
         posn = 0;
@@ -396,158 +456,205 @@ static int dump_segment
             dump_hex_line(header, base, data + posn, len - posn);
         }
     }
-    free(data);
-    return 1;
+    free(decoded);
 }
 
-static int dump_undefined_symbols(FILE *file, const o65_header_t *header)
+static void dump_undefined_symbols(const o65_image_view_t *view)
 {
+    const uint8_t *data = view->externs.data;
+    const uint8_t *end = data + view->externs.size;
     o65_size_t index;
-    o65_size_t count;
-    int result;
-
-    /* Read the number of undefined symbols */
-    if (o65_read_count(file, header, &count) < 0)
-        return -1;
 
     /* This is easy if there are no undefined symbols */
-    if (count == 0) {
+    if (view->num_externs == 0) {
         printf("\nUndefined Symbols: none\n");
-        return 1;
+        return;
     }
 
     /* Dump the names of the undefined symbols */
     printf("\nUndefined Symbols:\n");
-    for (index = 0; index < count; ++index) {
+    for (index = 0; index < view->num_externs; ++index) {
         printf("    %lu: ", (unsigned long)index);
-        result = dump_nul_string(file);
-        if (result <= 0)
-            return result;
+        dump_nul_string(&data, end);
         printf("\n");
+        if (data >= end)
+            break;
     }
-    return 1;
 }
 
-static int dump_relocs
-    (FILE *file, const char *name, const o65_header_t *header,
-     o65_size_t addr)
+static void dump_relocs
+    (const char *name, const o65_image_view_t *view,
+     const o65_span_t *relocs, o65_size_t base, o65_size_t size)
 {
-    o65_reloc_t reloc;
+    const o65_header_t *header = &(view->header);
+    o65_reloc_iter_t iter;
+    o65_reloc_entry_t entry;
     int result;
 
-    /* Relocations actually start at the segment base - 1 */
-    --addr;
-
-    /* Read and dump all relocations for the segment */
+    /* Dump all relocations for the segment */
     printf("\n%s.relocs:\n", name);
-    for (;;) {
-        /* Read the next relocation entry */
-        result = o65_read_reloc(file, header, &reloc);
-        if (result <= 0)
-            return result;
-        else if (reloc.offset == 0)
-            break;
-
-        /* Determine the next address to be relocated */
-        if (reloc.offset == 255) {
-            /* 255 indicates "skip ahead by 254 bytes" */
-            addr += 254;
-            continue;
-        } else {
-            addr += reloc.offset;
-        }
+    o65_reloc_iter_init
+        (&iter, header, relocs, base, size, view->num_externs);
+    while ((result = o65_reloc_iter_next(&iter, &entry)) > 0) {
         if ((header->mode & O65_MODE_32BIT) != 0)
-            printf("    %08lx: ", (unsigned long)addr);
+            printf("    %08lx: ", (unsigned long)(entry.address));
         else
-            printf("    %04lx: ", (unsigned long)addr);
+            printf("    %04lx: ", (unsigned long)(entry.address));
 
         /* Print the segment that the relocation destination points to */
-        if ((reloc.type & O65_RELOC_SEGID) == O65_SEGID_UNDEF) {
-            printf("undef %lu", (unsigned long)reloc.undefid);
+        if (entry.segid == O65_SEGID_UNDEF) {
+            printf("undef %lu", (unsigned long)(entry.undefid));
         } else {
             char segname[O65_NAME_MAX];
-            o65_get_segment_name(reloc.type & O65_RELOC_SEGID, segname);
+            o65_get_segment_name(entry.segid, segname);
             printf("%s", segname);
         }
 
         /* Print the relocation type plus any extra information */
         printf(", ");
-        switch (reloc.type & O65_RELOC_TYPE) {
+        switch (entry.type) {
         case O65_RELOC_WORD:        printf("WORD"); break;
         case O65_RELOC_LOW:         printf("LOW"); break;
         case O65_RELOC_SEGADR:      printf("SEGADR"); break;
 
         case O65_RELOC_HIGH:
             if ((header->mode & O65_MODE_PAGED) == 0)
-                printf("HIGH %02x", reloc.extra);
+                printf("HIGH %02x", entry.extra);
             else
                 printf("HIGH");
             break;
 
         case O65_RELOC_SEG:
-            printf("SEG %04x", reloc.extra);
+            printf("SEG %04x", entry.extra);
             break;
 
         default:
-            printf("RELOC-%02x", reloc.type & O65_RELOC_TYPE);
+            printf("RELOC-%02x", entry.type);
             break;
         }
         printf("\n");
     }
-    return 1;
+
+    /* Report relocations that are outside the segment or refer to
+     * externals that do not exist. */
+    if (result < 0 && iter.error == O65_RELOC_ERROR_RANGE)
+        printf("    invalid relocation: out of range\n");
+    else if (result < 0 && iter.error == O65_RELOC_ERROR_EXTERN)
+        printf("    invalid relocation: undefined external reference\n");
 }
 
-static int dump_exported_symbols(FILE *file, const o65_header_t *header)
+static void dump_exported_symbols(const o65_image_view_t *view)
 {
+    const o65_header_t *header = &(view->header);
+    const uint8_t *data = view->exports.data;
+    const uint8_t *end = data + view->exports.size;
+    const o65_codec_t *codec = o65_get_codec(header);
     char segname[O65_NAME_MAX];
     o65_size_t index;
-    o65_size_t count;
     o65_size_t value;
-    int result;
-    int ch;
-
-    /* Read the number of exported symbols */
-    if (o65_read_count(file, header, &count) < 0)
-        return -1;
 
     /* This is easy if there are no undefined symbols */
-    if (count == 0) {
+    if (view->num_exports == 0) {
         printf("\nExported Symbols: none\n");
-        return 1;
+        return;
     }
 
     /* Dump the names of the undefined symbols */
     printf("\nExported Symbols:\n");
-    for (index = 0; index < count; ++index) {
+    for (index = 0; index < view->num_exports; ++index) {
         /* Dump the name of the symbol */
         printf("    ");
-        result = dump_nul_string(file);
-        if (result <= 0)
-            return result;
+        dump_nul_string(&data, end);
 
         /* Dump the segment identifier for the symbol */
-        if ((ch = getc(file)) == EOF)
-            return -1;
-        o65_get_segment_name(ch, segname);
+        if (data >= end) {
+            printf("\n");
+            break;
+        }
+        o65_get_segment_name(*data++, segname);
         printf(", %s", segname);
+        if ((size_t)(end - data) < codec->count_size) {
+            printf("\n");
+            break;
+        }
 
         /* Dump the value for the symbol */
-        if (o65_read_count(file, header, &value) < 0)
-            return -1;
+        value = codec->get_count(data);
+        data += codec->count_size;
         if ((header->mode & O65_MODE_32BIT) == 0)
             printf(", 0x%04lx\n", (unsigned long)value);
         else
             printf(", 0x%08lx\n", (unsigned long)value);
     }
-    return 1;
 }
 
-static int dump_image(FILE *file, const o65_header_t *header)
+static void dump_validation(const o65_image_view_t *view)
 {
-    o65_option_t option;
-    char cpu[O65_NAME_MAX];
-    int result;
+    o65_image_view_t copy = *view;
+    o65_validate_error_t error;
+    const char *reason;
+
+    if (o65_validate(&copy, &error))
+        return;
+    switch (error.error) {
+    case O65_VALIDATE_ERROR_HEADER:
+        reason = "inconsistent header"; break;
+    case O65_VALIDATE_ERROR_TRUNCATED:
+        reason = "truncated relocation table"; break;
+    case O65_VALIDATE_ERROR_RELOC_TYPE:
+        reason = "unknown relocation type"; break;
+    case O65_VALIDATE_ERROR_RELOC_SEGID:
+        reason = "invalid relocation segment"; break;
+    case O65_VALIDATE_ERROR_RELOC_RANGE:
+        reason = "relocation out of range"; break;
+    case O65_VALIDATE_ERROR_RELOC_EXTERN:
+        reason = "undefined external reference"; break;
+    case O65_VALIDATE_ERROR_EXPORT_SEGID:
+        reason = "invalid exported symbol segment"; break;
+    default:
+        reason = "invalid exported symbols"; break;
+    }
+    printf("\nValidation: %s at offset 0x%lx\n",
+           reason, (unsigned long)(error.offset));
+}
+
+/**
+ * @brief Extends the part of a broken image that was being looked for
+ * to the end of the file, so that whatever is there can be dumped.
+ *
+ * @param[in,out] view The view of the broken image.
+ * @param[in] end Points to the end of the file.
+ *
+ * @return The part of the image that was extended, or NULL if none.
+ */
+static const o65_span_t *extend_broken_view
+    (o65_image_view_t *view, const uint8_t *end)
+{
+    o65_span_t *spans[] = {
+        &(view->options), &(view->text), &(view->data), &(view->externs),
+        &(view->text_relocs), &(view->data_relocs), &(view->exports)
+    };
+    int index = (int)(sizeof(spans) / sizeof(spans[0]));
+    while (index > 0) {
+        --index;
+        if (spans[index]->data) {
+            spans[index]->size = (size_t)(end - spans[index]->data);
+            return spans[index];
+        }
+    }
+    return NULL;
+}
+
+static void dump_image
+    (const dump_info_t *info, const o65_image_view_t *view,
+     const o65_span_t *broken)
+{
+    const o65_header_t *header = &(view->header);
+    o65_option_iter_t iter;
+    o65_option_view_t option;
     int have_options;
+    int padded;
+    char cpu[O65_NAME_MAX];
 
     /* Dump the fields in the header */
     printf("Header:\n");
@@ -599,89 +706,114 @@ static int dump_image(FILE *file, const o65_header_t *header)
         printf("    stack = 0x%04x\n", header->stack);
     }
 
-    /* Read and dump the header options */
+    /* Dump the header options.  If the image is broken, then we stop
+     * at the first part that could not be found. */
+    if (!(view->options.data))
+        return;
+    o65_option_iter_init(&iter, &(view->options));
     have_options = 0;
-    for (;;) {
-        result = o65_read_option(file, &option);
-        if (result <= 0)
-            return result;
-        if (option.len == 0)
-            break;
+    padded = 0;
+    while (o65_option_iter_next(&iter, &option) > 0) {
         if (!have_options) {
             printf("\nOptions:\n");
             have_options = 1;
         }
-        dump_option(&option);
+        /* Large amounts of padding are split over several options,
+         * so only report the first one */
+        if (option.type == O65_OPT_PADDING) {
+            if (padded)
+                continue;
+            padded = 1;
+        }
+        dump_option(view, &option);
     }
 
     /* Dump the contents of the text and data segments */
-    result = dump_segment(file, ".text", header, header->tbase, header->tlen, 1);
-    if (result <= 0)
-        return result;
-    result = dump_segment(file, ".data", header, header->dbase, header->dlen, 0);
-    if (result <= 0)
-        return result;
-
-    /* Dump any undefined symbols */
-    result = dump_undefined_symbols(file, header);
-    if (result <= 0)
-        return result;
+    if (!(view->text.data))
+        return;
+    dump_segment(info, ".text", view, header->tbase, &(view->text),
+                 header->tlen, 1);
+    if (!(view->data.data))
+        return;
+    dump_segment(info, ".data", view, header->dbase, &(view->data),
+                 header->dlen, 0);
+
+    /* Dump any undefined symbols, unless their count is truncated */
+    if (!(view->externs.data) ||
+            (broken == &(view->externs) && !(view->num_externs)))
+        return;
+    dump_undefined_symbols(view);
 
     /* Dump the relocation tables for the text and data segments */
-    result = dump_relocs(file, ".text", header, header->tbase);
-    if (result <= 0)
-        return result;
-    result = dump_relocs(file, ".data", header, header->dbase);
-    if (result <= 0)
-        return result;
-
-    /* Dump the list of exported symbols */
-    return dump_exported_symbols(file, header);
+    if (!(view->text_relocs.data))
+        return;
+    dump_relocs(".text", view, &(view->text_relocs), header->tbase, header->tlen);
+    if (!(view->data_relocs.data))
+        return;
+    dump_relocs(".data", view, &(view->data_relocs), header->dbase, header->dlen);
+
+    /* Dump the list of exported symbols, unless their count is truncated */
+    if (!(view->exports.data) ||
+            (broken == &(view->exports) && !(view->num_exports)))
+        return;
+    dump_exported_symbols(view);
+
+    /* Report any structural problems that were not obvious above */
+    if (!broken)
+        dump_validation(view);
 }
 
-static int dump_file(const char *filename)
+static int dump_file(dump_info_t *info, const char *filename)
 {
-    FILE *file;
-    o65_header_t header;
+    o65_mapped_file_t file;
+    o65_image_view_t view;
+    size_t posn;
+    const o65_span_t *broken;
+    size_t len;
+    int header_ok;
     int result;
 
-    /* Try to open the file */
-    if ((file = fopen(filename, "rb")) == NULL) {
+    /* Try to map the file into memory */
+    if (o65_map_file(&file, &(info->context), filename) < 0) {
         perror(filename);
         return 0;
     }
 
     /* Dump the file's contents.  There may be multiple chained images. */
+    posn = 0;
     do {
-        /* Read and validate the ".o65" file header */
-        result = o65_read_header(file, &header);
-        if (result < 0) {
-            file_error(file, filename);
-            return 0;
-        } else if (result == 0) {
-            fprintf(stderr, "%s: not in .o65 format\n", filename);
-            fclose(file);
+        /* Parse and validate the next ".o65" image */
+        result = o65_view_image(&view, file.data + posn, file.size - posn);
+        if (result <= 0) {
+            /* Dump as much of a broken image as we can find */
+            header_ok = (o65_parse_header(view.start, file.size - posn,
+                                          &(view.header), &len) > 0);
+            if (header_ok) {
+                broken = extend_broken_view(&view, file.data + file.size);
+                dump_image(info, &view, broken);
+            }
+            fflush(stdout);
+            if (result < 0)
+                fprintf(stderr, "%s: unexpected EOF\n", filename);
+            else if (!header_ok)
+                fprintf(stderr, "%s: not in .o65 format\n", filename);
+            else
+                fprintf(stderr, "%s: invalid format\n", filename);
+            o65_unmap_file(&file);
             return 0;
         }
 
         /* Dump the contents of this image in the chain. */
-        result = dump_image(file, &header);
-        if (result < 0) {
-            file_error(file, filename);
-            return 0;
-        } else if (result == 0) {
-            fprintf(stderr, "%s: invalid format\n", filename);
-            fclose(file);
-            return 0;
-        }
+        dump_image(info, &view, NULL);
+        posn += view.size;
 
         /* Print a separator if there is another image in the chain. */
-        if ((header.mode & O65_MODE_CHAIN) != 0) {
+        if ((view.header.mode & O65_MODE_CHAIN) != 0) {
             printf("\n");
         }
-    } while ((header.mode & O65_MODE_CHAIN) != 0);
+    } while ((view.header.mode & O65_MODE_CHAIN) != 0);
 
     /* Done */
-    fclose(file);
+    o65_unmap_file(&file);
     return 1;
 }
@@ -29,19 +29,27 @@
 #include <unistd.h>
 #include <fcntl.h>
 #include <string.h>
+#include <errno.h>
 #include <time.h>
 #include <getopt.h>
 #include "o65file.h"
+#include "o65view.h"
+#include "o65arena.h"
+#include "o65writer.h"
+#include "o65hash.h"
+#include "o65compress.h"
 #include "elfmos.h"
 
-#define short_options "a:bdhl:o:s:"
+#define short_options "a:bdhl:o:p:s:z"
 static struct option long_options[] = {
     {"author-name",         required_argument,  0,  'a'},
     {"bss-zero",            no_argument,        0,  'b'},
+    {"compress",            no_argument,        0,  'z'},
     {"creation-date",       no_argument,        0,  'd'},
     {"hosted",              no_argument,        0,  'h'},
     {"linker-name",         required_argument,  0,  'l'},
     {"os-info",             required_argument,  0,  'o'},
+    {"page-align",          required_argument,  0,  'p'},
     {"stack-size",          required_argument,  0,  's'},
     {0,                     0,                  0,    0},
 };
@@ -54,17 +62,20 @@ typedef struct
     /** ELF file descriptor */
     Elf *elf;
 
-    /** File descriptor for the underlying input file */
+    /** File descriptor for the underlying input file, or -1 for stdin */
     int fd;
 
+    /** Contents of the input file if it was read from standard input */
+    o65_mapped_file_t input;
+
     /** General purpose flag for section callbacks */
     int flag;
 
     /** Name of the ELF file, for error reporting */
     const char *filename;
 
-    /** File pointer for the output file */
-    FILE *outfile;
+    /** Writer that encodes the output file in memory */
+    o65_writer_t writer;
 
     /** Header information for the final ".o65" file. */
     o65_header_t header;
@@ -120,23 +131,11 @@ typedef struct
     /** Size of the .zp segment. */
     o65_size_t zeropage_size;
 
-    /** Buffer containing all relocations in ".o65" format. */
-    o65_reloc_t *reloc;
-
-    /** Current size of the relocation buffer. */
-    o65_size_t reloc_size;
-
-    /** Allocation size of the relocation buffer. */
-    o65_size_t reloc_alloc_size;
-
-    /** Number of bytes of .text relocation data.  The rest is for .data. */
-    o65_size_t text_reloc_size;
+    /** Relocations for the .text segment, at absolute addresses. */
+    o65_reloc_encoder_t text_relocs;
 
-    /** Address of the last relocation that was performed. */
-    o65_size_t last_reloc_address;
-
-    /** Current segment that is being relocated. */
-    uint8_t reloc_segment;
+    /** Relocations for the .data segment, at absolute addresses. */
+    o65_reloc_encoder_t data_relocs;
 
     /** Index of the section that contains the section header string table. */
     size_t hstrtab;
@@ -167,6 +166,19 @@ typedef struct
      *  addresses of the llvm-mos imaginary registers. */
     int hosted;
 
+    /** Alignment of the segments within the output file, or zero
+     *  if the segments should not be padded to a page boundary. */
+    size_t page_align;
+
+    /** Non-zero to compress the .text and .data segments. */
+    int compress;
+
+    /** Arena that all memory for the image is allocated from. */
+    o65_arena_t arena;
+
+    /** Library context that all memory is allocated with. */
+    o65_context_t context;
+
 } image_info_t;
 
 static void usage(const char *progname);
@@ -204,6 +216,7 @@ int main(int argc, char *argv[])
         case 'b': bsszero = 1; break;
         case 'd': info.add_creation_date = 1; break;
         case 'h': info.hosted = 1; break;
+        case 'z': info.compress = 1; break;
 
         case 'l':
             o65_set_string_option
@@ -218,6 +231,16 @@ int main(int argc, char *argv[])
             }
             break;
 
+        case 'p':
+            info.page_align = strtoul(optarg, NULL, 0);
+            if (info.page_align < 2 ||
+                    (info.page_align & (info.page_align - 1)) != 0) {
+                fprintf(stderr, "%s: page alignment '%s' is not a power of two\n",
+                        progname, optarg);
+                return 1;
+            }
+            break;
+
         case 's':
             info.header.stack = strtoul(optarg, NULL, 0);
             break;
@@ -236,6 +259,9 @@ int main(int argc, char *argv[])
     input_file = argv[optind];
     if ((argc - optind) >= 2) {
         output_file = argv[optind + 1];
+    } else if (!strcmp(input_file, "-")) {
+        /* Converting from standard input, so write to standard output */
+        output_file = "-";
     } else {
         /* Synthesise an output filename by removing .elf from the input name,
          * or by adding .o65 if the input filename doesn't end in .elf. */
@@ -256,19 +282,39 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    /* Open the input ELF file and fetch the header */
-    fd = open(input_file, O_RDONLY, 0);
-    if (fd < 0) {
-        perror(input_file);
-        return 1;
+    /* Open the input ELF file and fetch the header.  libelf reads files
+     * with pread(), which does not work on pipes, so standard input is
+     * read into memory first and the ELF file is parsed from there. */
+    o65_context_init(&info.context);
+    if (!strcmp(input_file, "-")) {
+        fd = -1;
+        if (o65_map_file(&info.input, &info.context, input_file) < 0) {
+            perror(input_file);
+            return 1;
+        }
+        elf = elf_memory((char *)(info.input.data), info.input.size);
+    } else {
+        fd = open(input_file, O_RDONLY, 0);
+        if (fd < 0) {
+            perror(input_file);
+            return 1;
+        }
+        elf = elf_begin(fd, ELF_C_READ, NULL);
     }
-    elf = elf_begin(fd, ELF_C_READ, NULL);
     if (!elf) {
         fprintf(stderr, "%s: %s\n", input_file, elf_errmsg(elf_errno()));
-        close(fd);
+        if (fd >= 0)
+            close(fd);
+        o65_unmap_file(&info.input);
         return 1;
     }
 
+    /* Set up the library state for the conversion */
+    o65_arena_init(&info.arena, &info.context, 0);
+    o65_writer_init(&info.writer, &info.context);
+    o65_reloc_encoder_init(&info.text_relocs, &info.context);
+    o65_reloc_encoder_init(&info.data_relocs, &info.context);
+
     /* Validate the ELF file for suitability to our purposes */
     info.elf = elf;
     info.filename = input_file;
@@ -314,6 +360,8 @@ int main(int argc, char *argv[])
 static void usage(const char *progname)
 {
     fprintf(stderr, "Usage: %s [options] input.elf [output.o65]\n\n", progname);
+    fprintf(stderr, "A filename of '-' reads from standard input or writes to standard output.\n");
+    fprintf(stderr, "The output defaults to standard output if the input is standard input.\n\n");
 
     fprintf(stderr, "    --author-name AUTHOR, -a AUTHOR\n");
     fprintf(stderr, "        Set the name of the author in the header options.\n\n");
@@ -321,6 +369,9 @@ static void usage(const char *progname)
     fprintf(stderr, "    --bss-zero, -b\n");
     fprintf(stderr, "        Force the bss segment to be zeroed by the OS.\n\n");
 
+    fprintf(stderr, "    --compress, -z\n");
+    fprintf(stderr, "        Compress the text and data segments with the LZ codec.\n\n");
+
     fprintf(stderr, "    --creation-date, -d\n");
     fprintf(stderr, "        Add the file creation date in the header options.\n\n");
 
@@ -334,6 +385,10 @@ static void usage(const char *progname)
     fprintf(stderr, "    --os-info 'HEXBYTES', -o 'HEXBYTES'\n");
     fprintf(stderr, "        Sets the operating system header option.\n\n");
 
+    fprintf(stderr, "    --page-align SIZE, -p SIZE\n");
+    fprintf(stderr, "        Pad the header options so that the segments start on a\n");
+    fprintf(stderr, "        SIZE byte boundary in the file; e.g. 4096 for host pages.\n\n");
+
     fprintf(stderr, "    --stack-size NUM, -s NUM\n");
     fprintf(stderr, "        Declare the size of the stack to the operating system.\n\n");
 }
@@ -391,18 +446,14 @@ static int set_os_option(image_info_t *info, const char *str)
  */
 static void free_image(image_info_t *info)
 {
-    if (info->outfile)
-        fclose(info->outfile);
+    o65_writer_free(&(info->writer));
+    o65_reloc_encoder_free(&(info->text_relocs));
+    o65_reloc_encoder_free(&(info->data_relocs));
     elf_end(info->elf);
-    close(info->fd);
-    if (info->text_segment)
-        free(info->text_segment);
-    if (info->reloc)
-        free(info->reloc);
-    if (info->undef_name_ids)
-        free(info->undef_name_ids);
-    if (info->undef_names)
-        free(info->undef_names);
+    if (info->fd >= 0)
+        close(info->fd);
+    o65_unmap_file(&(info->input));
+    o65_arena_free(&(info->arena));
 }
 
 /**
@@ -726,7 +777,12 @@ static int load_segments(image_info_t *info)
              * base address is the same as the base of the .text segment */
             info->text_address = phdr->p_vaddr;
             info->text_size = phdr->p_memsz;
-            info->text_segment = calloc(phdr->p_memsz, 1);
+            info->text_segment = o65_arena_calloc
+                (&(info->arena), phdr->p_memsz, 1);
+            if (!(info->text_segment)) {
+                fprintf(stderr, "out of memory\n");
+                return 0;
+            }
             memcpy(info->text_segment, raw->d_buf, phdr->p_filesz);
             first = 0;
         } else {
@@ -740,8 +796,13 @@ static int load_segments(image_info_t *info)
                         info->filename);
                 return 0;
             }
-            info->text_segment = realloc
-                (info->text_segment, info->text_size + phdr->p_memsz);
+            info->text_segment = o65_arena_realloc
+                (&(info->arena), info->text_segment, info->text_size,
+                 info->text_size + phdr->p_memsz);
+            if (!(info->text_segment)) {
+                fprintf(stderr, "out of memory\n");
+                return 0;
+            }
             memset(info->text_segment + info->text_size, 0, phdr->p_memsz);
             memcpy(info->text_segment + info->text_size,
                    raw->d_buf, phdr->p_filesz);
@@ -783,26 +844,6 @@ static int load_segments(image_info_t *info)
     return 1;
 }
 
-/**
- * @brief Adds a ".o65" relocation to the final image.
- *
- * @param[in,out] info Information about the image we are converting.
- * @param[in] reloc The relocation to be added.
- */
-static void add_o65_relocation(image_info_t *info, const o65_reloc_t *reloc)
-{
-    if (info->reloc_size >= info->reloc_alloc_size) {
-        info->reloc_alloc_size += 256;
-        info->reloc = (o65_reloc_t *)realloc
-            (info->reloc, sizeof(o65_reloc_t) * info->reloc_alloc_size);
-        if (!info->reloc) {
-            fprintf(stderr, "out of memory\n");
-            exit(1);
-        }
-    }
-    info->reloc[(info->reloc_size)++] = *reloc;
-}
-
 /**
  * @brief Resolves an undefined symbol to an index in the external
  * references table of the final ".o65" file.
@@ -837,13 +878,15 @@ static int resolve_undefined(image_info_t *info, Elf32_Word name, uint32_t *id)
 
     /* Add the symbol to the external reference table for ".o65" */
     if (info->num_undef_names >= info->max_undef_names) {
-        info->max_undef_names += 32;
-        info->undef_name_ids = (Elf32_Word *)
-            realloc(info->undef_name_ids,
-                    info->max_undef_names * sizeof(Elf32_Word));
-        info->undef_names = (char **)
-            realloc(info->undef_names,
-                    info->max_undef_names * sizeof(char *));
+        size_t old_size = info->max_undef_names;
+        info->max_undef_names = old_size ? old_size * 2 : 32;
+        info->undef_name_ids = (Elf32_Word *)o65_arena_realloc
+            (&(info->arena), info->undef_name_ids,
+             old_size * sizeof(Elf32_Word),
+             info->max_undef_names * sizeof(Elf32_Word));
+        info->undef_names = (char **)o65_arena_realloc
+            (&(info->arena), info->undef_names, old_size * sizeof(char *),
+             info->max_undef_names * sizeof(char *));
         if (!(info->undef_name_ids) || !(info->undef_names)) {
             fprintf(stderr, "out of memory\n");
             exit(1);
@@ -855,26 +898,6 @@ static int resolve_undefined(image_info_t *info, Elf32_Word name, uint32_t *id)
     return 1;
 }
 
-/**
- * @brief Compares two relocations on ascending order of virtual address.
- *
- * @param[in] r1 Points to the first relocation.
- * @param[in] r2 Points to the second relocation.
- *
- * @return -1, 0, or 1 depending upon the relationship between @a r1 and @a r2.
- */
-static int compare_rela(const void *r1, const void *r2)
-{
-    const Elf32_Rela *rel1 = (const Elf32_Rela *)r1;
-    const Elf32_Rela *rel2 = (const Elf32_Rela *)r2;
-    if (rel1->r_offset < rel2->r_offset)
-        return -1;
-    else if (rel1->r_offset > rel2->r_offset)
-        return 1;
-    else
-        return 0;
-}
-
 /**
  * @brief Callback for processing the contents of a "RELA" section.
  *
@@ -887,7 +910,6 @@ static void section_callback_reloc
     (image_info_t *info, Elf_Scn *scn, Elf32_Shdr *shdr, const char *name)
 {
     Elf_Data *data;
-    Elf32_Rela *rel_table;
     const Elf32_Rela *rel;
     const Elf32_Sym *sym;
     size_t count;
@@ -903,19 +925,10 @@ static void section_callback_reloc
     if (!data || data->d_size < sizeof(Elf32_Rela))
         return;
     count = data->d_size / sizeof(Elf32_Rela);
-    rel_table = calloc(count, sizeof(Elf32_Rela));
-    if (!rel_table) {
-        fprintf(stderr, "out of memory\n");
-        exit(1);
-    }
-    memcpy(rel_table, data->d_buf, count * sizeof(Elf32_Rela));
 
-    /* Sort the relocation table on ascending order of address because the
-     * ".o65" relocation system needs strict ordering to work properly. */
-    qsort(rel_table, count, sizeof(Elf32_Rela), compare_rela);
-
-    /* Process the relocations */
-    for (rel = rel_table; count > 0; --count, ++rel) {
+    /* Process the relocations.  They can be in any order because the
+     * relocation encoders will sort them when the file is written. */
+    for (rel = data->d_buf; count > 0; --count, ++rel) {
         /* Find the next address to be relocated, and which segment it is in */
         address = rel->r_offset;
         if (address >= info->text_address &&
@@ -930,38 +943,9 @@ static void section_callback_reloc
             info->flag = 0;
             continue;
         }
-        if (from_segment != info->reloc_segment) {
-            /* We have switched from .text to .data */
-            if (from_segment != O65_SEGID_DATA) {
-                fprintf(stderr, "%s: cannot relocate .text after .data\n",
-                        info->filename);
-                info->flag = 0;
-                continue;
-            }
-            info->reloc_segment = from_segment;
-            info->last_reloc_address = info->data_address - 1;
-        }
-
-        /* Relocation addresses cannot be repeated */
-        if (address <= info->last_reloc_address) {
-            fprintf(stderr, "%s: warning: duplicate relocation at 0x%lx\n",
-                    info->filename, (unsigned long)address);
-            continue;
-        }
-
-        /* Output "skip" relocations if the distance from the last
-         * relocation is greater than 254 bytes. */
-        while ((address - info->last_reloc_address) > 254) {
-            out_rel.offset = 255; /* Special value that means "skip 254" */
-            out_rel.type = 0;
-            out_rel.extra = 0;
-            out_rel.undefid = 0;
-            add_o65_relocation(info, &out_rel);
-            info->last_reloc_address += 254;
-        }
 
         /* Clear the output relocation details, ready to fill them in */
-        out_rel.offset = (uint8_t)(address - info->last_reloc_address);
+        out_rel.offset = 0;
         out_rel.extra = 0;
         out_rel.undefid = 0;
 
@@ -984,7 +968,6 @@ static void section_callback_reloc
         if (sym->st_shndx == SHN_ABS) {
             /* If the symbol is absolute, then there is nothing to do.
              * We assume that the ELF linker already fixed up the value. */
-            info->last_reloc_address = address;
             continue;
         } else if (sym->st_shndx == SHN_UNDEF) {
             /* Undefined symbol */
@@ -996,7 +979,6 @@ static void section_callback_reloc
                 }
             } else {
                 info->flag = 0;
-                info->last_reloc_address = address;
                 continue;
             }
         } else if (symbol_address >= info->zeropage_address &&
@@ -1069,22 +1051,18 @@ static void section_callback_reloc
             fprintf(stderr, "%s: unsupported relocation type %d\n",
                     info->filename, (int)(ELF32_R_TYPE(rel->r_info)));
             info->flag = 0;
-            info->last_reloc_address = address;
             continue;
         }
 
-        /* Add the relocation to the image */
-        add_o65_relocation(info, &out_rel);
-
-        /* Update the length of the .text relocation table */
-        if (from_segment == O65_SEGID_TEXT) {
-            info->text_reloc_size = info->reloc_size;
+        /* Add the relocation to the encoder for the segment */
+        if (o65_reloc_encoder_add
+                (from_segment == O65_SEGID_TEXT ? &(info->text_relocs)
+                                                : &(info->data_relocs),
+                 address, &out_rel) < 0) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
         }
-
-        /* Update the last address that was relocated */
-        info->last_reloc_address = address;
     }
-    free(rel_table);
 }
 
 /**
@@ -1098,8 +1076,6 @@ static int convert_relocations(image_info_t *info)
 {
     /* Find all "RELA" sections and convert the contents */
     info->flag = 1;
-    info->last_reloc_address = info->text_address - 1;
-    info->reloc_segment = O65_SEGID_TEXT;
     section_iterator(info, SHT_RELA, section_callback_reloc);
     return info->flag;
 }
@@ -1143,26 +1119,26 @@ static void set_creation_date(image_info_t *info)
 }
 
 /**
- * @brief Writes a list of ".o65" relocations to the output file.
+ * @brief Writes the relocations for a segment to the output file.
  *
  * @param[in,out] info Information about the image we are converting.
- * @param[in] relocs Points to the array of relocations to write.
- * @param[in] count Number of relocations to write.
+ * @param[in,out] encoder The relocations for the segment.
+ * @param[in] base Base address of the segment.
  *
- * @return Non-zero if the relocations were written, zero on filesystem error.
+ * All relocation addresses were checked against the segment bounds
+ * when they were added, so the only possible failure is out of memory.
  */
-static int write_relocations
-    (image_info_t *info, const o65_reloc_t *relocs, o65_size_t count)
+static void write_relocations
+    (image_info_t *info, o65_reloc_encoder_t *encoder, o65_size_t base)
 {
-    o65_reloc_t end = { .offset = 0 };
-    for (; count > 0; --count, ++relocs) {
-        if (o65_write_reloc(info->outfile, &(info->header), relocs) < 0)
-            return 0;
+    if (o65_reloc_encoder_write(encoder, &(info->writer), base) < 0) {
+        fprintf(stderr, "out of memory\n");
+        exit(1);
     }
-    if (o65_write_reloc(info->outfile, &(info->header), &end) < 0) {
-        return 0;
+    if (encoder->duplicates != 0) {
+        fprintf(stderr, "%s: warning: %lu duplicate relocations ignored\n",
+                info->filename, (unsigned long)(encoder->duplicates));
     }
-    return 1;
 }
 
 /**
@@ -1172,15 +1148,21 @@ static int write_relocations
  * @param[in] filename Name of the file to write to.
  *
  * @return Non-zero if the image was written, zero on filesystem error.
+ *
+ * The whole file is encoded in memory first and then written with
+ * a single system call.
  */
 static int write_o65(image_info_t *info, const char *filename)
 {
+    o65_writer_t *writer = &(info->writer);
+    o65_option_t hash_option;
+    o65_option_t compressed_option;
+    size_t compressed_posn = 0;
+    size_t text_size;
+    size_t data_size;
     int lib6502 = 0;
     size_t index;
-
-    /* Open the output file */
-    if ((info->outfile = fopen(filename, "wb")) == NULL)
-        return 0;
+    int fd;
 
     /* Set the creation date header option */
     set_creation_date(info);
@@ -1194,70 +1176,63 @@ static int write_o65(image_info_t *info, const char *filename)
     }
 
     /* Write the header */
-    if (o65_write_header(info->outfile, &(info->header)) < 0)
-        return 0;
+    o65_writer_header(writer, &(info->header));
 
     /* Write the header options */
-    if (info->os.len != 0) {
-        if (o65_write_option(info->outfile, &(info->os)) < 0)
-            return 0;
+    if (info->os.len != 0)
+        o65_writer_option(writer, &(info->os));
+    if (info->linker.len != 0)
+        o65_writer_option(writer, &(info->linker));
+    if (info->author.len != 0)
+        o65_writer_option(writer, &(info->author));
+    if (info->created.len != 0)
+        o65_writer_option(writer, &(info->created));
+    if (info->elf_machine.len != 0)
+        o65_writer_option(writer, &(info->elf_machine));
+    memset(&hash_option, 0, sizeof(hash_option));
+    hash_option.len = O65_CONTENT_HASH_OPT_LEN;
+    hash_option.type = O65_OPT_CONTENT_HASH;
+    o65_writer_option(writer, &hash_option);
+    if (info->compress) {
+        /* The stored sizes are filled in once the segments are encoded */
+        memset(&compressed_option, 0, sizeof(compressed_option));
+        compressed_option.len = O65_COMPRESSED_OPT_LEN;
+        compressed_option.type = O65_OPT_COMPRESSED;
+        compressed_option.data[0] = O65_SEGMENT_LZ;
+        compressed_posn = writer->size;
+        o65_writer_option(writer, &compressed_option);
     }
-    if (info->linker.len != 0) {
-        if (o65_write_option(info->outfile, &(info->linker)) < 0)
-            return 0;
-    }
-    if (info->author.len != 0) {
-        if (o65_write_option(info->outfile, &(info->author)) < 0)
-            return 0;
-    }
-    if (info->created.len != 0) {
-        if (o65_write_option(info->outfile, &(info->created)) < 0)
-            return 0;
-    }
-    if (info->elf_machine.len != 0) {
-        if (o65_write_option(info->outfile, &(info->elf_machine)) < 0)
-            return 0;
-    }
-    if (o65_write_option(info->outfile, NULL) < 0) {
-        return 0;
-    }
-
-    /* Write the .text segment */
-    if (info->text_size > 0) {
-        if (fwrite(info->text_segment, 1, info->text_size, info->outfile)
-                != info->text_size) {
-            return 0;
-        }
-    }
-
-    /* Write the .data segment */
-    if (info->data_size > 0) {
-        if (fwrite(info->data_segment, 1, info->data_size, info->outfile)
-                != info->data_size) {
-            return 0;
+    if (info->page_align != 0)
+        o65_writer_padding(writer, info->page_align);
+    o65_writer_option(writer, NULL);
+
+    /* Write the .text and .data segments */
+    if (info->compress) {
+        o65_lz_encode_segment
+            (writer, info->text_segment, info->text_size, &text_size);
+        o65_lz_encode_segment
+            (writer, info->data_segment, info->data_size, &data_size);
+        if (!(writer->error)) {
+            o65_write_uint32(writer->data + compressed_posn + 3,
+                             (uint32_t)text_size);
+            o65_write_uint32(writer->data + compressed_posn + 7,
+                             (uint32_t)data_size);
         }
+    } else {
+        o65_writer_bytes(writer, info->text_segment, info->text_size);
+        o65_writer_bytes(writer, info->data_segment, info->data_size);
     }
 
     /* Write the external references list */
     if (info->hosted) {
         /* We need an extra external for the imaginary register table */
-        if (o65_write_count
-                (info->outfile, &(info->header), info->num_undef_names + 1) < 0) {
-            return 0;
-        }
-        if (o65_write_string(info->outfile, "__IMAG_REGS") < 0) {
-            return 0;
-        }
+        o65_writer_count(writer, info->num_undef_names + 1);
+        o65_writer_string(writer, "__IMAG_REGS");
     } else {
-        if (o65_write_count
-                (info->outfile, &(info->header), info->num_undef_names) < 0) {
-            return 0;
-        }
+        o65_writer_count(writer, info->num_undef_names);
     }
     for (index = 0; index < info->num_undef_names; ++index) {
-        if (o65_write_string(info->outfile, info->undef_names[index]) < 0) {
-            return 0;
-        }
+        o65_writer_string(writer, info->undef_names[index]);
         if (!strcmp(info->undef_names[index], "LIB6502")) {
             /* This appears to be a program that uses lib6502.  Make sure
              * that we add a lib6502-compatible "main" entry point below. */
@@ -1266,46 +1241,41 @@ static int write_o65(image_info_t *info, const char *filename)
     }
 
     /* Write the relocation tables */
-    if (!write_relocations(info, info->reloc, info->text_reloc_size)) {
-        return 0;
-    }
-    if (!write_relocations(info, info->reloc + info->text_reloc_size,
-                           info->reloc_size - info->text_reloc_size)) {
-        return 0;
-    }
+    write_relocations(info, &(info->text_relocs), info->text_address);
+    write_relocations(info, &(info->data_relocs), info->data_address);
 
     /* Write the exported globals.  Only one so far for the main entry point. */
     if (lib6502) {
         /* Entry point must be called "main" when using lib6502 */
-        if (o65_write_count(info->outfile, &(info->header), 1) < 0) {
-            return 0;
-        }
-        if (o65_write_exported_symbol
-                (info->outfile, &(info->header), "main",
-                 O65_SEGID_TEXT, info->entry_point) < 0) {
-            return 0;
-        }
+        o65_writer_count(writer, 1);
+        o65_writer_exported_symbol
+            (writer, "main", O65_SEGID_TEXT, info->entry_point);
     } else if (info->entry_point != info->text_address) {
         /* Entry point is not at the start of the text segment,
          * so output an exported global called "_start" */
-        if (o65_write_count(info->outfile, &(info->header), 1) < 0) {
-            return 0;
-        }
-        if (o65_write_exported_symbol
-                (info->outfile, &(info->header), "_start",
-                 O65_SEGID_TEXT, info->entry_point) < 0) {
-            return 0;
-        }
+        o65_writer_count(writer, 1);
+        o65_writer_exported_symbol
+            (writer, "_start", O65_SEGID_TEXT, info->entry_point);
     } else {
         /* Entry point is at the start of the text segment,
          * so there is no need to name it explicitly. */
-        if (o65_write_count(info->outfile, &(info->header), 0) < 0) {
-            return 0;
-        }
+        o65_writer_count(writer, 0);
     }
 
-    /* Clean up and exit */
-    fclose(info->outfile);
-    info->outfile = NULL;
-    return 1;
+    /* Fill in the content hash now that the whole image is encoded */
+    if (!(writer->error))
+        o65_update_content_hash(writer->data, writer->size);
+
+    /* Write the encoded image to the output file in one go */
+    if (!strcmp(filename, "-"))
+        return o65_writer_flush(writer, STDOUT_FILENO) >= 0;
+    if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+        return 0;
+    if (o65_writer_flush(writer, fd) < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return 0;
+    }
+    return close(fd) >= 0;
 }
@@ -0,0 +1,789 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65_HPP
+#define O65_HPP
+
+/*
+ * Header-only C++17 layer over the o65 library.
+ *
+ * Everything here is a thin inline wrapper around the C API: handles
+ * release their resources in their destructors, views refer directly
+ * into the underlying buffers, and iterators decode lazily without
+ * allocating memory.  Errors are reported with the same return codes
+ * as the C API rather than with exceptions.
+ */
+
+#include "o65view.h"
+#include "o65model.h"
+#include "o65compress.h"
+#include "o65validate.h"
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+#include <utility>
+#if __has_include(<span>)
+#include <span>
+#endif
+
+namespace o65 {
+
+#if defined(__cpp_lib_span)
+
+/** Non-owning view of a contiguous sequence of elements */
+template <typename T>
+using span = std::span<T>;
+
+#else
+
+/**
+ * @brief Non-owning view of a contiguous sequence of elements.
+ *
+ * This is the subset of C++20's std::span that is needed here,
+ * for compilers that do not provide it yet.
+ */
+template <typename T>
+class span
+{
+public:
+    using element_type = T;
+    using value_type = std::remove_cv_t<T>;
+    using size_type = std::size_t;
+    using pointer = T *;
+    using reference = T &;
+    using iterator = T *;
+
+    constexpr span() noexcept : ptr_(nullptr), size_(0) {}
+    constexpr span(T *ptr, std::size_t size) noexcept
+        : ptr_(ptr), size_(size) {}
+
+    constexpr T *data() const noexcept { return ptr_; }
+    constexpr std::size_t size() const noexcept { return size_; }
+    constexpr bool empty() const noexcept { return size_ == 0; }
+    constexpr T *begin() const noexcept { return ptr_; }
+    constexpr T *end() const noexcept { return ptr_ + size_; }
+    constexpr T &operator[](std::size_t index) const noexcept
+    {
+        return ptr_[index];
+    }
+    constexpr span subspan(std::size_t offset, std::size_t count) const noexcept
+    {
+        return span(ptr_ + offset, count);
+    }
+
+private:
+    T *ptr_;
+    std::size_t size_;
+};
+
+#endif
+
+/** Read-only view of a region of bytes */
+using bytes = span<const std::uint8_t>;
+
+/**
+ * @brief Converts a C span into a C++ span.
+ *
+ * @param[in] s The C span.
+ *
+ * @return A view of the same bytes.
+ */
+inline bytes to_bytes(const o65_span_t &s) noexcept
+{
+    return bytes(s.data, s.size);
+}
+
+/**
+ * @brief Move-only buffer that was allocated with a library context.
+ *
+ * Used for the results of functions such as o65_decompress() and
+ * o65_image_serialize(), which must be freed with o65_context_free().
+ */
+class buffer
+{
+public:
+    buffer() noexcept = default;
+    buffer(o65_context_t *context, std::uint8_t *data, std::size_t size) noexcept
+        : context_(context), data_(data), size_(size) {}
+    buffer(const buffer &) = delete;
+    buffer &operator=(const buffer &) = delete;
+    buffer(buffer &&other) noexcept
+        : context_(other.context_), data_(other.data_), size_(other.size_)
+    {
+        other.data_ = nullptr;
+        other.size_ = 0;
+    }
+    buffer &operator=(buffer &&other) noexcept
+    {
+        if (this != &other) {
+            reset();
+            context_ = other.context_;
+            data_ = other.data_;
+            size_ = other.size_;
+            other.data_ = nullptr;
+            other.size_ = 0;
+        }
+        return *this;
+    }
+    ~buffer() { reset(); }
+
+    /** Frees the contents of the buffer */
+    void reset() noexcept
+    {
+        o65_context_free(context_, data_);
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    /** Releases ownership of the contents to the caller */
+    std::uint8_t *release() noexcept
+    {
+        std::uint8_t *data = data_;
+        data_ = nullptr;
+        size_ = 0;
+        return data;
+    }
+
+    std::uint8_t *data() noexcept { return data_; }
+    const std::uint8_t *data() const noexcept { return data_; }
+    std::size_t size() const noexcept { return size_; }
+    bool empty() const noexcept { return size_ == 0; }
+    bytes view() const noexcept { return bytes(data_, size_); }
+    span<std::uint8_t> mutable_view() noexcept
+    {
+        return span<std::uint8_t>(data_, size_);
+    }
+
+private:
+    o65_context_t *context_ = nullptr;
+    std::uint8_t *data_ = nullptr;
+    std::size_t size_ = 0;
+};
+
+/**
+ * @brief Decompresses data, or copies it if it is not compressed.
+ *
+ * @param[out] out Returns the decompressed data.
+ * @param[in] data The data to decompress.
+ * @param[in] context Context for allocation, or nullptr.
+ *
+ * @return The same as o65_decompress().
+ */
+inline int decompress
+    (buffer &out, bytes data, o65_context_t *context = nullptr) noexcept
+{
+    std::uint8_t *ptr = nullptr;
+    std::size_t size = 0;
+    int result = o65_decompress(context, data.data(), data.size(), &ptr, &size);
+    out = buffer(context, ptr, size);
+    return result;
+}
+
+/**
+ * @brief Move-only handle to a ".o65" file that is mapped into memory.
+ */
+class mapped_file
+{
+public:
+    mapped_file() noexcept { std::memset(&file_, 0, sizeof(file_)); }
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+    mapped_file(mapped_file &&other) noexcept : file_(other.file_)
+    {
+        std::memset(&other.file_, 0, sizeof(other.file_));
+    }
+    mapped_file &operator=(mapped_file &&other) noexcept
+    {
+        if (this != &other) {
+            o65_unmap_file(&file_);
+            file_ = other.file_;
+            std::memset(&other.file_, 0, sizeof(other.file_));
+        }
+        return *this;
+    }
+    ~mapped_file() { o65_unmap_file(&file_); }
+
+    /**
+     * @brief Maps a file into memory, replacing any previous file.
+     *
+     * @param[in] filename Name of the file to map.
+     * @param[in] context Context for options and allocation, or nullptr.
+     *
+     * @return The same as o65_map_file().
+     */
+    int map(const char *filename, o65_context_t *context = nullptr) noexcept
+    {
+        o65_unmap_file(&file_);
+        return o65_map_file(&file_, context, filename);
+    }
+
+    /** Unmaps the file */
+    void reset() noexcept { o65_unmap_file(&file_); }
+
+    bytes view() const noexcept { return bytes(file_.data, file_.size); }
+    bool compressed() const noexcept { return file_.compressed != 0; }
+    const o65_mapped_file_t &get() const noexcept { return file_; }
+
+private:
+    o65_mapped_file_t file_;
+};
+
+/**
+ * @brief Forward iterator over the relocations in an encoded table.
+ *
+ * The iterator ends at the end of the table, or at the first invalid
+ * entry.  Check error() on the iterator, or on the reloc_range that it
+ * came from, to tell the two apart.
+ */
+class reloc_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = o65_reloc_entry_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const o65_reloc_entry_t *;
+    using reference = const o65_reloc_entry_t &;
+
+    /** Constructs an end iterator */
+    reloc_iterator() noexcept : error_(nullptr), at_end_(true)
+    {
+        std::memset(&iter_, 0, sizeof(iter_));
+        std::memset(&entry_, 0, sizeof(entry_));
+    }
+
+    /**
+     * @brief Constructs an iterator that starts at the first relocation.
+     *
+     * @param[in] iter C iterator positioned at the start of the table.
+     * @param[out] error Set to the reason why the iteration stopped
+     * when it stops, or nullptr if not required.
+     */
+    explicit reloc_iterator
+            (const o65_reloc_iter_t &iter, int *error = nullptr) noexcept
+        : iter_(iter), error_(error), at_end_(false)
+    {
+        std::memset(&entry_, 0, sizeof(entry_));
+        advance();
+    }
+
+    reference operator*() const noexcept { return entry_; }
+    pointer operator->() const noexcept { return &entry_; }
+    reloc_iterator &operator++() noexcept { advance(); return *this; }
+    reloc_iterator operator++(int) noexcept
+    {
+        reloc_iterator prev = *this;
+        advance();
+        return prev;
+    }
+    bool operator==(const reloc_iterator &other) const noexcept
+    {
+        if (at_end_ || other.at_end_)
+            return at_end_ == other.at_end_;
+        return iter_.ptr == other.iter_.ptr;
+    }
+    bool operator!=(const reloc_iterator &other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+    /** Gets the reason why the iteration stopped, or zero */
+    int error() const noexcept { return iter_.error; }
+
+private:
+    o65_reloc_iter_t iter_;
+    o65_reloc_entry_t entry_;
+    int *error_;
+    bool at_end_;
+
+    void advance() noexcept
+    {
+        if (!at_end_ && o65_reloc_iter_next(&iter_, &entry_) <= 0) {
+            at_end_ = true;
+            if (error_)
+                *error_ = iter_.error;
+        }
+    }
+};
+
+/**
+ * @brief Range of relocations for use in range-based for loops.
+ *
+ * Iterators from begin() report back to the range when they stop, so
+ * that error() can be checked after a loop over the range.  The range
+ * must outlive its iterators.
+ */
+class reloc_range
+{
+public:
+    explicit reloc_range(const o65_reloc_iter_t &iter) noexcept
+        : iter_(iter), error_(0) {}
+    reloc_iterator begin() const noexcept
+    {
+        error_ = 0;
+        return reloc_iterator(iter_, &error_);
+    }
+    reloc_iterator end() const noexcept { return reloc_iterator(); }
+
+    /** Gets the reason why the last iteration stopped, or zero */
+    int error() const noexcept { return error_; }
+
+private:
+    o65_reloc_iter_t iter_;
+    mutable int error_;
+};
+
+/**
+ * @brief Forward iterator over the names of the external references.
+ *
+ * The names point directly into the image.
+ */
+class extern_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = std::string_view;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const std::string_view *;
+    using reference = const std::string_view &;
+
+    extern_iterator() noexcept = default;
+    extern_iterator(const char *ptr, o65_size_t remaining) noexcept
+        : ptr_(ptr), remaining_(remaining) { load(); }
+
+    reference operator*() const noexcept { return name_; }
+    pointer operator->() const noexcept { return &name_; }
+    extern_iterator &operator++() noexcept
+    {
+        ptr_ += name_.size() + 1;
+        --remaining_;
+        load();
+        return *this;
+    }
+    extern_iterator operator++(int) noexcept
+    {
+        extern_iterator prev = *this;
+        ++(*this);
+        return prev;
+    }
+    bool operator==(const extern_iterator &other) const noexcept
+    {
+        return remaining_ == other.remaining_;
+    }
+    bool operator!=(const extern_iterator &other) const noexcept
+    {
+        return remaining_ != other.remaining_;
+    }
+
+private:
+    const char *ptr_ = nullptr;
+    o65_size_t remaining_ = 0;
+    std::string_view name_;
+
+    /* o65_view_image() has already checked that the names are terminated */
+    void load() noexcept
+    {
+        if (remaining_)
+            name_ = std::string_view(ptr_);
+    }
+};
+
+/**
+ * @brief Exported symbol whose name points directly into the image.
+ */
+struct export_ref
+{
+    std::string_view name;  /**< Name of the symbol */
+    std::uint8_t segid;     /**< Segment identifier; e.g. O65_SEGID_TEXT */
+    o65_size_t value;       /**< Value of the symbol */
+};
+
+/**
+ * @brief Forward iterator over the exported symbols.
+ */
+class export_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = export_ref;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const export_ref *;
+    using reference = const export_ref &;
+
+    export_iterator() noexcept = default;
+    export_iterator
+            (const o65_codec_t *codec, const char *ptr, o65_size_t remaining) noexcept
+        : codec_(codec), ptr_(ptr), remaining_(remaining) { load(); }
+
+    reference operator*() const noexcept { return export_; }
+    pointer operator->() const noexcept { return &export_; }
+    export_iterator &operator++() noexcept
+    {
+        ptr_ += export_.name.size() + 2 + codec_->count_size;
+        --remaining_;
+        load();
+        return *this;
+    }
+    export_iterator operator++(int) noexcept
+    {
+        export_iterator prev = *this;
+        ++(*this);
+        return prev;
+    }
+    bool operator==(const export_iterator &other) const noexcept
+    {
+        return remaining_ == other.remaining_;
+    }
+    bool operator!=(const export_iterator &other) const noexcept
+    {
+        return remaining_ != other.remaining_;
+    }
+
+private:
+    const o65_codec_t *codec_ = nullptr;
+    const char *ptr_ = nullptr;
+    o65_size_t remaining_ = 0;
+    export_ref export_ = {};
+
+    /* o65_view_image() has already checked the extent of each export */
+    void load() noexcept
+    {
+        if (remaining_) {
+            export_.name = std::string_view(ptr_);
+            const std::uint8_t *rest = reinterpret_cast<const std::uint8_t *>
+                (ptr_ + export_.name.size() + 1);
+            export_.segid = rest[0];
+            export_.value = codec_->get_count(rest + 1);
+        }
+    }
+};
+
+/**
+ * @brief Forward iterator over the header options.
+ *
+ * The iterator ends at the end of the options, or at the first
+ * invalid option.
+ */
+class option_iterator
+{
+public:
+    using iterator_category = std::forward_iterator_tag;
+    using value_type = o65_option_view_t;
+    using difference_type = std::ptrdiff_t;
+    using pointer = const o65_option_view_t *;
+    using reference = const o65_option_view_t &;
+
+    option_iterator() noexcept : at_end_(true)
+    {
+        std::memset(&iter_, 0, sizeof(iter_));
+        std::memset(&option_, 0, sizeof(option_));
+    }
+    explicit option_iterator(const o65_span_t &options) noexcept
+        : at_end_(false)
+    {
+        o65_option_iter_init(&iter_, &options);
+        std::memset(&option_, 0, sizeof(option_));
+        advance();
+    }
+
+    reference operator*() const noexcept { return option_; }
+    pointer operator->() const noexcept { return &option_; }
+    option_iterator &operator++() noexcept { advance(); return *this; }
+    option_iterator operator++(int) noexcept
+    {
+        option_iterator prev = *this;
+        advance();
+        return prev;
+    }
+    bool operator==(const option_iterator &other) const noexcept
+    {
+        if (at_end_ || other.at_end_)
+            return at_end_ == other.at_end_;
+        return iter_.ptr == other.iter_.ptr;
+    }
+    bool operator!=(const option_iterator &other) const noexcept
+    {
+        return !(*this == other);
+    }
+
+private:
+    o65_option_iter_t iter_;
+    o65_option_view_t option_;
+    bool at_end_;
+
+    void advance() noexcept
+    {
+        if (!at_end_ && o65_option_iter_next(&iter_, &option_) <= 0)
+            at_end_ = true;
+    }
+};
+
+/**
+ * @brief Pair of iterators for use in range-based for loops.
+ */
+template <typename Iterator>
+class range
+{
+public:
+    range(Iterator first, Iterator last) noexcept
+        : first_(first), last_(last) {}
+    Iterator begin() const noexcept { return first_; }
+    Iterator end() const noexcept { return last_; }
+
+private:
+    Iterator first_;
+    Iterator last_;
+};
+
+/**
+ * @brief View of a ".o65" image in memory.
+ *
+ * The view does not own the memory, which must remain valid for as long
+ * as the view or anything obtained from it is in use.
+ */
+class image_view
+{
+public:
+    image_view() noexcept { std::memset(&view_, 0, sizeof(view_)); }
+
+    /**
+     * @brief Parses an image from a buffer.
+     *
+     * @param[in] buf The buffer containing the image.
+     *
+     * @return The same as o65_view_image().
+     */
+    int parse(bytes buf) noexcept
+    {
+        return o65_view_image(&view_, buf.data(), buf.size());
+    }
+
+    /**
+     * @brief Validates the image, enabling the fast relocation path.
+     *
+     * @param[out] error Returns the reason for a failure, or nullptr.
+     *
+     * @return The same as o65_validate().
+     */
+    int validate(o65_validate_error_t *error = nullptr) noexcept
+    {
+        return o65_validate(&view_, error);
+    }
+
+    const o65_header_t &header() const noexcept { return view_.header; }
+    bytes image() const noexcept { return bytes(view_.start, view_.size); }
+    bytes text() const noexcept { return to_bytes(view_.text); }
+    bytes data() const noexcept { return to_bytes(view_.data); }
+    bool verified() const noexcept { return view_.verified != 0; }
+
+    /** Returns true if text() and data() hold compressed segments */
+    bool compressed() const noexcept { return view_.compressed != 0; }
+
+    /** Returns true if another image follows this one in the chain */
+    bool has_next() const noexcept
+    {
+        return (view_.header.mode & O65_MODE_CHAIN) != 0;
+    }
+
+    /** Gets the bytes after this image, where the next image starts */
+    bytes rest(bytes buf) const noexcept
+    {
+        std::size_t offset = static_cast<std::size_t>
+            ((view_.start + view_.size) - buf.data());
+        return bytes(buf.data() + offset, buf.size() - offset);
+    }
+
+    range<option_iterator> options() const noexcept
+    {
+        return range<option_iterator>
+            (option_iterator(view_.options), option_iterator());
+    }
+
+    /** Gets the alignment from the padding option, or zero if none */
+    std::size_t padding_alignment() const noexcept
+    {
+        return o65_padding_alignment(&view_);
+    }
+
+    /** Gets the page-aligned offsets of the segments within a file */
+    bool segment_offsets
+        (bytes file, std::size_t page_size,
+         o65_segment_offsets_t &text, o65_segment_offsets_t &data) const noexcept
+    {
+        return o65_segment_offsets
+            (&view_, file.data(), page_size, &text, &data) != 0;
+    }
+
+    /** Finds the first header option of a specific type */
+    bool find_option(std::uint8_t type, o65_option_view_t &option) const noexcept
+    {
+        return o65_find_option(&view_.options, type, &option) != 0;
+    }
+
+    o65_size_t num_externs() const noexcept { return view_.num_externs; }
+    range<extern_iterator> externs() const noexcept
+    {
+        const char *ptr = reinterpret_cast<const char *>(view_.externs.data);
+        return range<extern_iterator>
+            (extern_iterator(ptr, view_.num_externs), extern_iterator());
+    }
+
+    o65_size_t num_exports() const noexcept { return view_.num_exports; }
+    range<export_iterator> exports() const noexcept
+    {
+        const char *ptr = reinterpret_cast<const char *>(view_.exports.data);
+        const o65_codec_t *codec = o65_get_codec(&view_.header);
+        return range<export_iterator>
+            (export_iterator(codec, ptr, view_.num_exports), export_iterator());
+    }
+
+    reloc_range text_relocs() const noexcept
+    {
+        return relocs(view_.text_relocs, view_.header.tbase, view_.header.tlen);
+    }
+    reloc_range data_relocs() const noexcept
+    {
+        return relocs(view_.data_relocs, view_.header.dbase, view_.header.dlen);
+    }
+
+    o65_image_view_t &get() noexcept { return view_; }
+    const o65_image_view_t &get() const noexcept { return view_; }
+
+private:
+    o65_image_view_t view_;
+
+    reloc_range relocs
+        (const o65_span_t &table, o65_size_t base, o65_size_t size) const noexcept
+    {
+        o65_reloc_iter_t iter;
+        o65_reloc_iter_init
+            (&iter, &view_.header, &table, base, size, view_.num_externs);
+        return reloc_range(iter);
+    }
+};
+
+/**
+ * @brief Move-only handle to an editable image from o65model.h.
+ */
+class image
+{
+public:
+    image() noexcept = default;
+    explicit image(o65_image_t *ptr) noexcept : image_(ptr) {}
+    image(const image &) = delete;
+    image &operator=(const image &) = delete;
+    image(image &&other) noexcept : image_(other.image_)
+    {
+        other.image_ = nullptr;
+    }
+    image &operator=(image &&other) noexcept
+    {
+        if (this != &other) {
+            o65_image_free(image_);
+            image_ = other.image_;
+            other.image_ = nullptr;
+        }
+        return *this;
+    }
+    ~image() { o65_image_free(image_); }
+
+    /**
+     * @brief Creates a new empty image, replacing any previous image.
+     *
+     * @param[in] context Context to allocate the image with, or nullptr.
+     *
+     * @return true on success, or false if out of memory.
+     */
+    bool create(o65_context_t *context = nullptr) noexcept
+    {
+        reset(o65_image_new(context));
+        return image_ != nullptr;
+    }
+
+    /**
+     * @brief Parses an image and all chained images from a buffer.
+     *
+     * @param[in] buf The buffer containing the images.
+     * @param[in] context Context to allocate the images with, or nullptr.
+     *
+     * @return The same as o65_image_parse().
+     */
+    int parse(bytes buf, o65_context_t *context = nullptr) noexcept
+    {
+        o65_image_t *ptr = nullptr;
+        int result = o65_image_parse(&ptr, context, buf.data(), buf.size());
+        reset(ptr);
+        return result;
+    }
+
+    /**
+     * @brief Serializes the image and all chained images.
+     *
+     * @param[out] out Returns the serialized data.
+     *
+     * @return The same as o65_image_serialize().
+     */
+    int serialize(buffer &out) noexcept
+    {
+        std::uint8_t *data = nullptr;
+        std::size_t size = 0;
+        int result = o65_image_serialize(image_, &data, &size);
+        out = buffer(image_->arena.context, data, size);
+        return result;
+    }
+
+    /** Replaces the image with another, freeing the previous one */
+    void reset(o65_image_t *ptr = nullptr) noexcept
+    {
+        o65_image_free(image_);
+        image_ = ptr;
+    }
+
+    /** Releases ownership of the image to the caller */
+    o65_image_t *release() noexcept
+    {
+        o65_image_t *ptr = image_;
+        image_ = nullptr;
+        return ptr;
+    }
+
+    o65_image_t *get() const noexcept { return image_; }
+    o65_image_t *operator->() const noexcept { return image_; }
+    explicit operator bool() const noexcept { return image_ != nullptr; }
+
+    span<std::uint8_t> text() const noexcept
+    {
+        return span<std::uint8_t>(image_->text, image_->header.tlen);
+    }
+    span<std::uint8_t> data() const noexcept
+    {
+        return span<std::uint8_t>(image_->data, image_->header.dlen);
+    }
+
+private:
+    o65_image_t *image_ = nullptr;
+};
+
+} /* namespace o65 */
+
+#endif
@@ -0,0 +1,130 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef O65ARENA_H
+#define O65ARENA_H
+
+#include "o65context.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default size of the blocks in an arena */
+#define O65_ARENA_BLOCK_SIZE 65536
+
+/**
+ * @brief Block of memory within an arena.
+ */
+typedef struct o65_arena_block_s o65_arena_block_t;
+
+/**
+ * @brief Bump allocator that releases all of its memory in one call.
+ *
+ * Memory is carved sequentially out of large blocks.  Individual
+ * allocations cannot be freed, but the whole arena can be freed at once
+ * with o65_arena_free().  A zeroed arena is ready to use with the
+ * default block size and the default context.
+ */
+typedef struct
+{
+    o65_arena_block_t *blocks;  /**< List of blocks, current block first */
+    size_t block_size;          /**< Size of new blocks, 0 for the default */
+    o65_context_t *context;     /**< Context to allocate blocks with */
+
+} o65_arena_t;
+
+/**
+ * @brief Initializes an arena.
+ *
+ * @param[out] arena The arena to initialize.
+ * @param[in] context Context to allocate blocks with, or NULL.
+ * @param[in] block_size Size of the blocks to allocate, or zero to use
+ * O65_ARENA_BLOCK_SIZE.
+ */
+void o65_arena_init
+    (o65_arena_t *arena, o65_context_t *context, size_t block_size);
+
+/**
+ * @brief Allocates memory from an arena.
+ *
+ * @param[in,out] arena The arena to allocate from.
+ * @param[in] size Number of bytes to allocate.
+ *
+ * @return A pointer to the memory, suitably aligned for any type,
+ * or NULL if out of memory.
+ */
+void *o65_arena_alloc(o65_arena_t *arena, size_t size);
+
+/**
+ * @brief Allocates zeroed memory for an array from an arena.
+ *
+ * @param[in,out] arena The arena to allocate from.
+ * @param[in] count Number of elements in the array.
+ * @param[in] size Size of each element in bytes.
+ *
+ * @return A pointer to the memory, or NULL if out of memory.
+ */
+void *o65_arena_calloc(o65_arena_t *arena, size_t count, size_t size);
+
+/**
+ * @brief Resizes an allocation within an arena.
+ *
+ * @param[in,out] arena The arena to allocate from.
+ * @param[in] ptr Points to the previous allocation, or NULL.
+ * @param[in] old_size Size of the previous allocation.
+ * @param[in] new_size New size for the allocation.
+ *
+ * @return A pointer to the resized memory, or NULL if out of memory.
+ *
+ * If @a ptr was the most recent allocation from the arena and there is
+ * room in the block, then the allocation is resized in place.
+ * Otherwise the contents are copied to a new allocation.
+ */
+void *o65_arena_realloc
+    (o65_arena_t *arena, void *ptr, size_t old_size, size_t new_size);
+
+/**
+ * @brief Copies a string into an arena.
+ *
+ * @param[in,out] arena The arena to allocate from.
+ * @param[in] str Points to the string data to copy.
+ * @param[in] len Length of the string data, excluding the NUL terminator.
+ *
+ * @return A NUL-terminated copy of the string, or NULL if out of memory.
+ */
+char *o65_arena_strndup(o65_arena_t *arena, const char *str, size_t len);
+
+/**
+ * @brief Frees all memory that was allocated from an arena.
+ *
+ * @param[in,out] arena The arena to free.  It can be used again afterwards.
+ */
+void o65_arena_free(o65_arena_t *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
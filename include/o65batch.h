@@ -0,0 +1,92 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65BATCH_H
+#define O65BATCH_H
+
+#include "o65context.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Default number of files that are loaded concurrently by a batch */
+#define O65_BATCH_CONCURRENCY 16
+
+/**
+ * @brief Callback that receives the contents of a file from a batch.
+ *
+ * @param[in] user_data User data that was supplied to o65_load_batch().
+ * @param[in] index Index of the file in the list of filenames.
+ * @param[in] data Contents of the file, or NULL if it could not be read.
+ * @param[in] size Number of bytes in @a data.
+ * @param[in] error Zero if the file was read, or the errno value for
+ * the reason why it could not be read.
+ *
+ * @return 1 to continue loading files, or any other value to stop.
+ *
+ * The contents are only valid until the callback returns, so the
+ * callback must copy anything that it needs to keep.
+ */
+typedef int (*o65_batch_callback_t)
+    (void *user_data, size_t index, const uint8_t *data, size_t size,
+     int error);
+
+/**
+ * @brief Loads the contents of a list of files, overlapping the
+ * filesystem latency of the files with each other.
+ *
+ * @param[in,out] context Context for allocation and options, or NULL.
+ * @param[in] filenames Names of the files to load.
+ * @param[in] count Number of files to load.
+ * @param[in] concurrency Maximum number of files to load at once,
+ * or zero for O65_BATCH_CONCURRENCY.
+ * @param[in] callback Function to call as each file is loaded.
+ * @param[in] user_data User data to pass to @a callback.
+ *
+ * @return 1 if every file was passed to @a callback, the return value of
+ * @a callback if it asked to stop, or -1 if the batch could not be
+ * started because of a lack of memory or threads.
+ *
+ * Files are delivered in the order in which they finish loading, which
+ * may not be the order of @a filenames.  Failures to read individual files
+ * are reported through the callback rather than stopping the batch.
+ *
+ * The callback is always invoked on the calling thread, one file at a
+ * time, so it does not need to be thread-safe.  The loading itself is
+ * done with io_uring if the library was built with liburing and the
+ * kernel supports it, or with a pool of threads otherwise.  In the
+ * latter case, each thread allocates with its own copy of @a context,
+ * so the allocator must be thread-safe.  Any error that the threads
+ * record is copied back to @a context before this function returns.
+ */
+int o65_load_batch
+    (o65_context_t *context, const char * const *filenames, size_t count,
+     unsigned concurrency, o65_batch_callback_t callback, void *user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
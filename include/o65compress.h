@@ -0,0 +1,346 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65COMPRESS_H
+#define O65COMPRESS_H
+
+#include "o65context.h"
+#include "o65writer.h"
+#include "o65view.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Compression formats that are recognized for ".o65" input.
+ */
+typedef enum
+{
+    O65_COMPRESSION_NONE,   /**< Not compressed */
+    O65_COMPRESSION_GZIP,   /**< gzip stream, decoded with zlib */
+    O65_COMPRESSION_ZLIB,   /**< zlib-wrapped deflate stream */
+    O65_COMPRESSION_LZ      /**< Built-in LZ frame format */
+
+} o65_compression_t;
+
+/** Number of bytes that are needed to detect the compression format */
+#define O65_COMPRESSION_MAGIC_SIZE 4
+
+/** Magic number at the start of an LZ frame */
+#define O65_LZ_MAGIC "\x89O6Z"
+
+/** Maximum number of uncompressed bytes in each block of an LZ frame */
+#define O65_LZ_BLOCK_SIZE 65536
+
+/**
+ * @brief Gets the maximum size of the LZ-compressed form of some data.
+ *
+ * @param[in] size Number of bytes of uncompressed data.
+ *
+ * @return The maximum size of the compressed data.
+ */
+#define o65_lz_bound(size) ((size) + (size) / 255 + 16)
+
+/**
+ * @brief Compresses a block of data with the LZ codec.
+ *
+ * @param[out] dst Buffer to write the compressed data to.
+ * @param[in] dst_size Size of the @a dst buffer.
+ * @param[in] src Points to the data to compress.
+ * @param[in] size Number of bytes of data to compress.
+ *
+ * @return The number of bytes of compressed data, or zero if the
+ * compressed data does not fit in @a dst_size bytes.  Output will always
+ * fit if @a dst_size is at least o65_lz_bound(@a size).
+ */
+size_t o65_lz_compress
+    (uint8_t *dst, size_t dst_size, const uint8_t *src, size_t size);
+
+/**
+ * @brief Decompresses a block of data that was compressed with the LZ codec.
+ *
+ * @param[out] dst Buffer to write the decompressed data to.
+ * @param[in] dst_size Size of the @a dst buffer.
+ * @param[in] src Points to the compressed data.
+ * @param[in] size Number of bytes of compressed data.
+ * @param[out] len Returns the number of bytes of decompressed data.
+ *
+ * @return 1 if the data was decompressed, or 0 if the compressed data is
+ * invalid or the decompressed data would not fit in @a dst_size bytes.
+ *
+ * Every access is bounds-checked, so it is safe to decompress
+ * untrusted data.
+ */
+int o65_lz_decompress
+    (uint8_t *dst, size_t dst_size, const uint8_t *src, size_t size,
+     size_t *len);
+
+/**
+ * @brief Encodes data as an LZ frame.
+ *
+ * @param[in,out] writer The writer to encode the frame into.
+ * @param[in] data Points to the data to compress.
+ * @param[in] size Number of bytes of data to compress.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ *
+ * The frame is a sequence of independently-compressed blocks, so it can
+ * be decoded in a streaming fashion without holding the whole input.
+ */
+int o65_lz_encode_frame
+    (o65_writer_t *writer, const uint8_t *data, size_t size);
+
+/** Compression method in an O65_OPT_COMPRESSED option for the LZ codec */
+#define O65_SEGMENT_LZ 1
+
+/** Total length of an O65_OPT_COMPRESSED option, including the header */
+#define O65_COMPRESSED_OPT_LEN 11
+
+/**
+ * @brief Encodes the contents of a segment as a single LZ block.
+ *
+ * @param[in,out] writer The writer to encode the segment into.
+ * @param[in] data Points to the contents of the segment.
+ * @param[in] size Number of bytes in the segment.
+ * @param[out] stored_size Returns the number of bytes that were written.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ *
+ * If compression does not make the segment smaller, then it is stored
+ * as-is and @a stored_size will be the same as @a size.
+ */
+int o65_lz_encode_segment
+    (o65_writer_t *writer, const uint8_t *data, size_t size,
+     size_t *stored_size);
+
+/**
+ * @brief Decodes the contents of a segment that was encoded with
+ * o65_lz_encode_segment().
+ *
+ * @param[out] dst Buffer to write the decoded segment to.
+ * @param[in] size Size of the decoded segment; e.g. the "tlen" value.
+ * @param[in] src Points to the stored form of the segment.
+ * @param[in] stored_size Number of bytes in the stored form.
+ *
+ * @return 1 if the segment was decoded, or 0 if the stored form is
+ * invalid or does not decode to exactly @a size bytes.
+ */
+int o65_lz_decode_segment
+    (uint8_t *dst, size_t size, const uint8_t *src, size_t stored_size);
+
+/**
+ * @brief Gets the number of bytes that the segments occupy in the file.
+ *
+ * @param[in] options Span containing the header options.
+ * @param[in] header The image header.
+ * @param[out] text_size Returns the stored size of the .text segment.
+ * @param[out] data_size Returns the stored size of the .data segment.
+ *
+ * @return 1 if the segments are compressed, 0 if they are not, or -1
+ * if the O65_OPT_COMPRESSED option is invalid.
+ *
+ * If the segments are not compressed, then the sizes are the "tlen"
+ * and "dlen" values from the header.
+ */
+int o65_get_stored_sizes
+    (const o65_span_t *options, const o65_header_t *header,
+     size_t *text_size, size_t *data_size);
+
+/**
+ * @brief Incremental decoder for a segment that was encoded with
+ * o65_lz_encode_segment().
+ *
+ * The decoded output is written directly to its final location, which
+ * also serves as the history for matches.  The compressed input can be
+ * supplied in chunks of any size, such as the segment events from the
+ * push parser.
+ */
+typedef struct
+{
+    uint8_t *dst;           /**< Buffer that receives the decoded segment */
+    size_t size;            /**< Size of the decoded segment */
+    size_t posn;            /**< Number of bytes that have been decoded */
+    size_t remaining;       /**< Number of stored bytes still to come */
+    size_t count;           /**< Literal or match length being decoded */
+    size_t offset;          /**< Match offset being decoded */
+    uint8_t token;          /**< Token for the current sequence */
+    int state;              /**< Current decoder state */
+
+} o65_lz_stream_t;
+
+/**
+ * @brief Initializes an incremental segment decoder.
+ *
+ * @param[out] stream The decoder to initialize.
+ * @param[out] dst Buffer to write the decoded segment to.
+ * @param[in] size Size of the decoded segment.
+ * @param[in] stored_size Number of bytes in the stored form.
+ */
+void o65_lz_stream_init
+    (o65_lz_stream_t *stream, uint8_t *dst, size_t size, size_t stored_size);
+
+/**
+ * @brief Feeds a chunk of the stored form of a segment to a decoder.
+ *
+ * @param[in,out] stream The decoder.
+ * @param[in] buf Points to the chunk.
+ * @param[in] len Number of bytes in the chunk.
+ *
+ * @return 1 if the chunk was decoded, or 0 if the stored form is invalid.
+ * Once the stored form is found to be invalid, every later call
+ * returns 0.
+ */
+int o65_lz_stream_feed(o65_lz_stream_t *stream, const uint8_t *buf, size_t len);
+
+/**
+ * @brief Determines if a segment decoder has decoded the whole segment.
+ *
+ * @param[in] stream The decoder.
+ *
+ * @return 1 if all of the stored form was supplied and exactly the
+ * expected number of bytes were decoded, or 0 otherwise.
+ */
+int o65_lz_stream_finish(const o65_lz_stream_t *stream);
+
+/**
+ * @brief Detects the compression format of some data.
+ *
+ * @param[in] data Points to the start of the data.
+ * @param[in] size Number of bytes that are available, which should be at
+ * least O65_COMPRESSION_MAGIC_SIZE unless the data is shorter than that.
+ *
+ * @return The compression format.
+ */
+o65_compression_t o65_detect_compression(const uint8_t *data, size_t size);
+
+/**
+ * @brief Callback that receives decompressed output.
+ *
+ * @param[in] user_data User data that was supplied to o65_decoder_init().
+ * @param[in] data Points to the next chunk of output.
+ * @param[in] size Number of bytes in the chunk.
+ *
+ * @return 1 to continue decoding, or any other value to stop.
+ */
+typedef int (*o65_output_callback_t)
+    (void *user_data, const uint8_t *data, size_t size);
+
+/**
+ * @brief Streaming decoder for compressed ".o65" input.
+ *
+ * The compression format is detected from the first few bytes.
+ * Input that is not compressed is passed through unchanged, so callers
+ * can always route their input through a decoder.
+ */
+typedef struct
+{
+    o65_context_t *context; /**< Context for allocation */
+    o65_output_callback_t output; /**< Callback for decompressed output */
+    void *user_data;        /**< User data for the callback */
+    o65_compression_t format; /**< Detected compression format */
+    int state;              /**< Current decoder state */
+    int result;             /**< Sticky result once decoding has stopped */
+    uint8_t fixed[8];       /**< Buffer for magic numbers and block headers */
+    size_t fixed_len;       /**< Number of bytes in "fixed" */
+    uint8_t *in;            /**< Buffer for a compressed block */
+    size_t in_len;          /**< Number of bytes in "in" */
+    size_t in_size;         /**< Number of bytes needed in "in" */
+    size_t in_max;          /**< Allocated size of "in" */
+    size_t raw_size;        /**< Uncompressed size of the current block */
+    uint8_t *out;           /**< Buffer for decompressed output */
+    void *zstream;          /**< zlib stream state, if zlib is in use */
+
+} o65_decoder_t;
+
+/**
+ * @brief Initializes a streaming decoder.
+ *
+ * @param[out] decoder The decoder to initialize.
+ * @param[in] context Context for allocation, or NULL.
+ * @param[in] output Callback that receives the decompressed output.
+ * @param[in] user_data User data to pass to @a output.
+ */
+void o65_decoder_init
+    (o65_decoder_t *decoder, o65_context_t *context,
+     o65_output_callback_t output, void *user_data);
+
+/**
+ * @brief Feeds a chunk of input into a streaming decoder.
+ *
+ * @param[in,out] decoder The decoder.
+ * @param[in] buf Points to the chunk, which can be any size.
+ * @param[in] size Number of bytes in the chunk.
+ *
+ * @return 1 if more input is needed, 0 if the input is invalid or
+ * uses a format that the library was not built with, -1 if out of memory,
+ * or the value that the output callback returned to stop decoding.
+ * Once decoding has stopped, the same result is returned by every
+ * later call.
+ */
+int o65_decoder_feed(o65_decoder_t *decoder, const uint8_t *buf, size_t size);
+
+/**
+ * @brief Tells a streaming decoder that there is no more input.
+ *
+ * @param[in,out] decoder The decoder.
+ *
+ * @return 1 if the compressed stream was complete, -1 if it was truncated,
+ * or the same result as o65_decoder_feed() if decoding stopped earlier.
+ */
+int o65_decoder_finish(o65_decoder_t *decoder);
+
+/**
+ * @brief Frees the memory that was used by a streaming decoder.
+ *
+ * @param[in,out] decoder The decoder.
+ */
+void o65_decoder_free(o65_decoder_t *decoder);
+
+/**
+ * @brief Decompresses a whole buffer.
+ *
+ * @param[in,out] context Context for allocation, or NULL.
+ * @param[in] data Points to the compressed data.
+ * @param[in] size Number of bytes of compressed data.
+ * @param[out] out Returns the decompressed data, which must be freed
+ * with o65_context_free().
+ * @param[out] out_size Returns the size of the decompressed data.
+ *
+ * @return 1 if the data was decompressed, 0 if the data is invalid,
+ * truncated, or uses a format that the library was not built with,
+ * or -1 if out of memory.  If the result is 0, then @a out contains
+ * the output that could be decoded before the error.
+ *
+ * Data that is not compressed is copied to @a out unchanged.
+ */
+int o65_decompress
+    (o65_context_t *context, const uint8_t *data, size_t size,
+     uint8_t **out, size_t *out_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
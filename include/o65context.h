@@ -0,0 +1,132 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65CONTEXT_H
+#define O65CONTEXT_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocator function for a library context.
+ *
+ * @param[in] user_data User data for the allocator.
+ * @param[in] ptr Previous allocation to resize or free, or NULL.
+ * @param[in] size New size for the allocation, or zero to free @a ptr.
+ *
+ * @return A pointer to the allocated memory, or NULL if out of memory
+ * or the memory was freed.
+ *
+ * The semantics are the same as realloc(), except that a size of zero
+ * always frees the memory and returns NULL.
+ */
+typedef void *(*o65_alloc_func_t)(void *user_data, void *ptr, size_t size);
+
+/**
+ * @brief Context that carries the allocator, options, and error state
+ * for the library.
+ *
+ * The library has no global state of its own, so objects that are
+ * created with different contexts can be used on different threads at
+ * the same time.  A single context must not be used by more than one
+ * thread at once.  Library functions that do work on other threads,
+ * such as o65_load_batch(), give each thread its own copy of the context
+ * and copy "error" back on the calling thread, but the allocator is still
+ * shared and must be thread-safe.
+ *
+ * Anywhere that a context is accepted, NULL selects the default of
+ * malloc(), no options, and reporting errors via errno only.
+ * The context must remain valid for as long as the objects that were
+ * created with it.
+ */
+typedef struct
+{
+    o65_alloc_func_t alloc; /**< Allocator function */
+    void *alloc_data;       /**< User data for the allocator */
+    unsigned options;       /**< Library options; e.g. O65_OPTION_NO_MMAP */
+    int error;              /**< errno value for the last failure, or zero */
+
+} o65_context_t;
+
+/** Read files into memory with read() instead of mapping them with mmap() */
+#define O65_OPTION_NO_MMAP  0x0001
+
+/** Load batches of files with a thread pool even if io_uring is available */
+#define O65_OPTION_NO_URING 0x0002
+
+/**
+ * @brief Initializes a context with the default allocator and options.
+ *
+ * @param[out] context The context to initialize.
+ */
+void o65_context_init(o65_context_t *context);
+
+/**
+ * @brief Allocates memory using a context's allocator.
+ *
+ * @param[in,out] context The context, or NULL for the default.
+ * @param[in] size Number of bytes to allocate.
+ *
+ * @return A pointer to the memory, or NULL if out of memory.
+ */
+void *o65_context_alloc(o65_context_t *context, size_t size);
+
+/**
+ * @brief Resizes memory using a context's allocator.
+ *
+ * @param[in,out] context The context, or NULL for the default.
+ * @param[in] ptr Points to the previous allocation, or NULL.
+ * @param[in] size New size for the allocation, which must not be zero.
+ *
+ * @return A pointer to the resized memory, or NULL if out of memory.
+ * The previous allocation is still valid if NULL is returned.
+ */
+void *o65_context_realloc(o65_context_t *context, void *ptr, size_t size);
+
+/**
+ * @brief Frees memory using a context's allocator.
+ *
+ * @param[in,out] context The context, or NULL for the default.
+ * @param[in] ptr Points to the memory to free, or NULL.
+ */
+void o65_context_free(o65_context_t *context, void *ptr);
+
+/**
+ * @brief Records a failure in a context.
+ *
+ * @param[in,out] context The context, or NULL for the default.
+ * @param[in] error The errno value for the failure.
+ *
+ * @return Always -1.
+ *
+ * Both "context->error" and errno are set to @a error.
+ */
+int o65_context_fail(o65_context_t *context, int error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
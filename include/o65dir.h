@@ -0,0 +1,192 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65DIR_H
+#define O65DIR_H
+
+#include "o65file.h"
+#include "o65context.h"
+#include <stddef.h>
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Identifiers for the sections of a ".o65" image.
+ */
+typedef enum
+{
+    O65_SECTION_HEADER,     /**< Fixed-size header */
+    O65_SECTION_OPTIONS,    /**< Header options, including the zero at end */
+    O65_SECTION_TEXT,       /**< Contents of the .text segment */
+    O65_SECTION_DATA,       /**< Contents of the .data segment */
+    O65_SECTION_EXTERNS,    /**< External reference count and names */
+    O65_SECTION_TEXT_RELOCS,/**< .text relocations, including the zero at end */
+    O65_SECTION_DATA_RELOCS,/**< .data relocations, including the zero at end */
+    O65_SECTION_EXPORTS,    /**< Exported symbol count and definitions */
+    O65_SECTION_END         /**< End of the image */
+
+} o65_section_t;
+
+/**
+ * @brief Directory of the byte offsets of the sections of a ".o65" image.
+ *
+ * Section N runs from "offsets[N]" up to "offsets[N + 1]".
+ */
+typedef struct
+{
+    o65_header_t header;    /**< Header, after byte-swapping */
+    o65_size_t num_externs; /**< Number of external references */
+    o65_size_t num_exports; /**< Number of exported symbols */
+    int compressed;         /**< Non-zero if the segments are compressed */
+    off_t offsets[O65_SECTION_END + 1]; /**< File offset of each section */
+
+} o65_image_dir_t;
+
+/**
+ * @brief Handle to a ".o65" file that has been opened for lazy access.
+ *
+ * If the file contains chained images, then there is one entry in
+ * "images" for each image in the chain.
+ */
+typedef struct
+{
+    int fd;                 /**< File descriptor for reading the sections */
+    const uint8_t *data;    /**< Contents of the file if it is in memory */
+    off_t size;             /**< Size of the file in bytes */
+    o65_size_t num_images;  /**< Number of images in the file */
+    o65_image_dir_t *images;/**< Directories for each of the images */
+    o65_context_t *context; /**< Context the directory was opened with */
+
+} o65_dir_t;
+
+/**
+ * @brief Opens a ".o65" file and builds a directory of its sections.
+ *
+ * @param[out] dir Returns the directory for the file.
+ * @param[in] context Context for allocation and errors, or NULL.
+ * @param[in] filename Name of the file to open.
+ *
+ * @return 1 if the file was opened, 0 if the file is not in the .o65
+ * format, or -1 for a filesystem error, EOF, or out of memory with the
+ * reason in errno.
+ *
+ * Only the header and the variable-length tables are read to find the
+ * section boundaries.  The .text and .data segments are skipped over
+ * without reading them.  The file must be seekable.
+ *
+ * All images in a chained file are found in the same scan, so that
+ * callers can go straight to any image in the chain.
+ */
+int o65_open(o65_dir_t *dir, o65_context_t *context, const char *filename);
+
+/**
+ * @brief Builds a directory of the sections of a ".o65" file in memory.
+ *
+ * @param[out] dir Returns the directory for the file.
+ * @param[in] context Context for allocation and errors, or NULL.
+ * @param[in] data Points to the contents of the file.
+ * @param[in] size Size of the file in bytes.
+ *
+ * @return 1 if the directory was built, 0 if the file is not in the .o65
+ * format, or -1 for EOF or out of memory.  The errno is ENOMEM if out
+ * of memory, or unchanged otherwise.
+ *
+ * This is the same as o65_open(), but for a file that has already been
+ * mapped or read into memory; e.g. with o65_map_file().  This works for
+ * files that were decompressed or read from a pipe, which cannot be
+ * read a second time from the filesystem.  The @a data must remain
+ * valid until the directory is closed.
+ */
+int o65_open_memory
+    (o65_dir_t *dir, o65_context_t *context, const uint8_t *data, size_t size);
+
+/**
+ * @brief Closes a ".o65" file that was opened with o65_open()
+ * or o65_open_memory().
+ *
+ * @param[in,out] dir The directory for the file to close.
+ */
+void o65_close(o65_dir_t *dir);
+
+/**
+ * @brief Scans a single image within an open ".o65" file.
+ *
+ * @param[in] fd File descriptor to read from.
+ * @param[in] offset Offset of the start of the image within the file.
+ * @param[in] size Size of the file in bytes.
+ * @param[out] image Returns the directory for the image.
+ *
+ * @return 1 if the image was scanned, 0 if the image is not in the .o65
+ * format, or -1 for a filesystem error or EOF.
+ */
+int o65_scan_image
+    (int fd, off_t offset, off_t size, o65_image_dir_t *image);
+
+/**
+ * @brief Gets the size of a section in an image.
+ *
+ * @param[in] image The image directory.
+ * @param[in] section The section to get the size of.
+ *
+ * @return The size of the section in bytes.
+ */
+size_t o65_section_size(const o65_image_dir_t *image, o65_section_t section);
+
+/**
+ * @brief Reads the contents of a section from an image.
+ *
+ * @param[in] dir The open file to read from.
+ * @param[in] image The image directory within the file.
+ * @param[in] section The section to read.
+ * @param[out] buf Buffer to read into, which must be at least
+ * o65_section_size() bytes in size.
+ *
+ * @return 1 on success, or -1 for a filesystem error or EOF.
+ */
+int o65_read_section
+    (const o65_dir_t *dir, const o65_image_dir_t *image,
+     o65_section_t section, uint8_t *buf);
+
+/**
+ * @brief Loads the contents of a section from an image into a new buffer.
+ *
+ * @param[in] dir The open file to read from.
+ * @param[in] image The image directory within the file.
+ * @param[in] section The section to load.
+ * @param[out] buf Returns the buffer, which must be freed with
+ * o65_context_free() on the directory's context.
+ * @param[out] size Returns the size of the buffer.
+ *
+ * @return 1 on success, or -1 for a filesystem error, EOF, or out of memory.
+ */
+int o65_load_section
+    (const o65_dir_t *dir, const o65_image_dir_t *image,
+     o65_section_t section, uint8_t **buf, size_t *size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,150 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65EXPORTS_H
+#define O65EXPORTS_H
+
+#include "o65strings.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Hash table of exported symbols, keyed by name.
+ *
+ * The table is open-addressed with linear probing.  Names are interned
+ * into a string pool, which can be shared between several tables and
+ * with o65_decode_externs() so that lookups of interned names only
+ * need to compare pointers.
+ *
+ * Exports from several images can be added to the same table.  If more
+ * than one image exports the same name, then the first one is kept.
+ */
+typedef struct
+{
+    o65_export_entry_t *slots;  /**< Slots in the table; name is NULL if empty */
+    size_t table_size;          /**< Number of slots, which is a power of two */
+    size_t count;               /**< Number of exports in the table */
+    o65_string_pool_t *pool;    /**< Pool to intern the names into */
+    o65_context_t *context;     /**< Context to allocate the slots with */
+
+} o65_export_table_t;
+
+/**
+ * @brief Initializes an export table.
+ *
+ * @param[out] table The export table to initialize.
+ * @param[in] context Context for allocation, or NULL.
+ * @param[in] pool String pool to intern the names into, which must
+ * remain valid for as long as the table is in use.
+ */
+void o65_export_table_init
+    (o65_export_table_t *table, o65_context_t *context,
+     o65_string_pool_t *pool);
+
+/**
+ * @brief Frees an export table.
+ *
+ * @param[in,out] table The export table to free.  The string pool is
+ * not freed.
+ */
+void o65_export_table_free(o65_export_table_t *table);
+
+/**
+ * @brief Adds a single exported symbol to an export table.
+ *
+ * @param[in,out] table The export table.
+ * @param[in] name Points to the name of the symbol.
+ * @param[in] len Length of the name.
+ * @param[in] segid Segment identifier; e.g. O65_SEGID_TEXT.
+ * @param[in] value Value of the symbol.
+ *
+ * @return 1 if the symbol was added, 0 if the name was already in the
+ * table, or -1 if out of memory.
+ */
+int o65_export_table_add
+    (o65_export_table_t *table, const char *name, size_t len,
+     uint8_t segid, o65_size_t value);
+
+/**
+ * @brief Adds all of the exported symbols from an image to an export table.
+ *
+ * @param[in,out] table The export table.
+ * @param[in] view The image to add the exports for.
+ *
+ * @return 1 if the exports were added, 0 if the exports table in the
+ * image is truncated, or -1 if out of memory.
+ */
+int o65_export_table_add_image
+    (o65_export_table_t *table, const o65_image_view_t *view);
+
+/**
+ * @brief Looks up an exported symbol by name.
+ *
+ * @param[in] table The export table.
+ * @param[in] name Points to the name of the symbol.
+ * @param[in] len Length of the name.
+ *
+ * @return The details of the symbol, or NULL if it is not in the table.
+ */
+const o65_export_entry_t *o65_export_table_find
+    (const o65_export_table_t *table, const char *name, size_t len);
+
+/**
+ * @brief Looks up an exported symbol by interned name.
+ *
+ * @param[in] table The export table.
+ * @param[in] name The name, interned into the same pool as the table.
+ *
+ * @return The details of the symbol, or NULL if it is not in the table.
+ *
+ * The precomputed hash in @a name is used and names are compared by
+ * pointer, so no string data is touched.
+ */
+const o65_export_entry_t *o65_export_table_find_string
+    (const o65_export_table_t *table, const o65_string_t *name);
+
+/**
+ * @brief Looks up many interned names at once.
+ *
+ * @param[in] table The export table.
+ * @param[in] names Array of names, interned into the same pool as the
+ * table; e.g. from o65_decode_externs().
+ * @param[in] count Number of names to look up.
+ * @param[out] results Array of @a count entries that returns the details
+ * of each symbol, or NULL for symbols that are not in the table.
+ *
+ * @return The number of names that were found.
+ *
+ * The slots for a group of names are prefetched before any of them are
+ * probed, so the cache misses for the group overlap with each other.
+ */
+size_t o65_export_table_find_batch
+    (const o65_export_table_t *table, o65_string_t * const *names,
+     size_t count, const o65_export_entry_t **results);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
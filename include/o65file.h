@@ -95,7 +95,10 @@ typedef struct
  *
  * @return The 16-bit value.
  */
-uint16_t o65_read_uint16(const uint8_t *buf);
+static inline uint16_t o65_read_uint16(const uint8_t *buf)
+{
+    return buf[0] | (((uint16_t)(buf[1])) << 8);
+}
 
 /**
  * @brief Reads a 24-bit value in little-endian byte order.
@@ -104,7 +107,11 @@ uint16_t o65_read_uint16(const uint8_t *buf);
  *
  * @return The 24-bit value.
  */
-uint32_t o65_read_uint24(const uint8_t *buf);
+static inline uint32_t o65_read_uint24(const uint8_t *buf)
+{
+    return buf[0] | (((uint32_t)(buf[1])) << 8) |
+           (((uint32_t)(buf[2])) << 16);
+}
 
 /**
  * @brief Reads a 32-bit value in little-endian byte order.
@@ -113,7 +120,11 @@ uint32_t o65_read_uint24(const uint8_t *buf);
  *
  * @return The 32-bit value.
  */
-uint32_t o65_read_uint32(const uint8_t *buf);
+static inline uint32_t o65_read_uint32(const uint8_t *buf)
+{
+    return buf[0] | (((uint32_t)(buf[1])) << 8) |
+           (((uint32_t)(buf[2])) << 16) | (((uint32_t)(buf[3])) << 24);
+}
 
 /**
  * @brief Writes a 16-bit value in little-endian byte order.
@@ -121,7 +132,11 @@ uint32_t o65_read_uint32(const uint8_t *buf);
  * @param[in] buf Points to the buffer to write to.
  * @param[in] value The 16-bit value to write.
  */
-void o65_write_uint16(uint8_t *buf, uint16_t value);
+static inline void o65_write_uint16(uint8_t *buf, uint16_t value)
+{
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+}
 
 /**
  * @brief Writes a 24-bit value in little-endian byte order.
@@ -129,7 +144,12 @@ void o65_write_uint16(uint8_t *buf, uint16_t value);
  * @param[in] buf Points to the buffer to write to.
  * @param[in] value The 24-bit value to write.
  */
-void o65_write_uint24(uint8_t *buf, uint32_t value);
+static inline void o65_write_uint24(uint8_t *buf, uint32_t value)
+{
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+    buf[2] = (uint8_t)(value >> 16);
+}
 
 /**
  * @brief Writes a 32-bit value in little-endian byte order.
@@ -137,7 +157,13 @@ void o65_write_uint24(uint8_t *buf, uint32_t value);
  * @param[in] buf Points to the buffer to write to.
  * @param[in] value The 32-bit value to write.
  */
-void o65_write_uint32(uint8_t *buf, uint32_t value);
+static inline void o65_write_uint32(uint8_t *buf, uint32_t value)
+{
+    buf[0] = (uint8_t)value;
+    buf[1] = (uint8_t)(value >> 8);
+    buf[2] = (uint8_t)(value >> 16);
+    buf[3] = (uint8_t)(value >> 24);
+}
 
 /**
  * @brief Reads the header from a ".o65" file.
@@ -150,6 +176,21 @@ void o65_write_uint32(uint8_t *buf, uint32_t value);
  */
 int o65_read_header(FILE *file, o65_header_t *header);
 
+/**
+ * @brief Parses the header of a ".o65" file from a memory buffer.
+ *
+ * @param[in] buf Points to the start of the header.
+ * @param[in] size Number of bytes that are available in @a buf.
+ * @param[out] header Returns the header details on success.
+ * @param[out] len Returns the length of the header in bytes.  If the
+ * buffer is too short, then this is set to the number of bytes needed.
+ *
+ * @return 1 if the header was parsed, 0 if the header is invalid,
+ * or -1 if @a buf is too short to contain the whole header.
+ */
+int o65_parse_header
+    (const uint8_t *buf, size_t size, o65_header_t *header, size_t *len);
+
 /**
  * @brief Writes a header to a ".o65" file.
  *
@@ -166,6 +207,20 @@ int o65_read_header(FILE *file, o65_header_t *header);
  */
 int o65_write_header(FILE *file, o65_header_t *header);
 
+/**
+ * @brief Encodes a header for a ".o65" file into a memory buffer.
+ *
+ * @param[out] buf Buffer to encode into, which must be at least
+ * O65_HEADER_SIZE_32 bytes in size.
+ * @param[in,out] header The header details.
+ *
+ * @return The number of bytes that were encoded into @a buf.
+ *
+ * The "mode" field may be modified in the same way as for
+ * o65_write_header().
+ */
+size_t o65_encode_header(uint8_t *buf, o65_header_t *header);
+
 /**
  * @brief Reads a header option from a ".o65" file.
  *
@@ -213,6 +268,22 @@ void o65_set_string_option
 int o65_read_reloc
     (FILE *file, const o65_header_t *header, o65_reloc_t *reloc);
 
+/**
+ * @brief Parses a relocation declaration from a memory buffer.
+ *
+ * @param[in] buf Points to the start of the relocation.
+ * @param[in] size Number of bytes that are available in @a buf.
+ * @param[in] header File header, containing global relocation options.
+ * @param[out] reloc Returns the relocation details on success.
+ * @param[out] len Returns the number of bytes that were consumed.
+ *
+ * @return 1 if the relocation was parsed, or -1 if @a buf is too short
+ * to contain the whole relocation.
+ */
+int o65_parse_reloc
+    (const uint8_t *buf, size_t size, const o65_header_t *header,
+     o65_reloc_t *reloc, size_t *len);
+
 /**
  * @brief Writes a relocation declaration to a ".o65" file.
  *
@@ -225,6 +296,19 @@ int o65_read_reloc
 int o65_write_reloc
     (FILE *file, const o65_header_t *header, const o65_reloc_t *reloc);
 
+/**
+ * @brief Encodes a relocation declaration into a memory buffer.
+ *
+ * @param[out] buf Buffer to encode into, which must be at least
+ * O65_MAX_RELOC_SIZE bytes in size.
+ * @param[in] header File header, containing global relocation options.
+ * @param[in] reloc The relocation details to encode.
+ *
+ * @return The number of bytes that were encoded into @a buf.
+ */
+size_t o65_encode_reloc
+    (uint8_t *buf, const o65_header_t *header, const o65_reloc_t *reloc);
+
 /**
  * @brief Reads the contents of the .text or .data segment from a ".o65" file.
  *
@@ -260,6 +344,66 @@ int o65_read_count(FILE *file, const o65_header_t *header, o65_size_t *count);
  */
 int o65_write_count(FILE *file, const o65_header_t *header, o65_size_t count);
 
+/**
+ * @brief Encoders and decoders that are specialized for a header mode.
+ *
+ * The O65_MODE_32BIT and O65_MODE_PAGED bits are tested once when the
+ * codec is selected with o65_get_codec(), rather than every time that
+ * a relocation or count is encoded or decoded.
+ */
+typedef struct
+{
+    /** Size of count values, export values, and undefined references */
+    size_t count_size;
+
+    /**
+     * @brief Gets the total size of a relocation entry from its type byte.
+     *
+     * @param[in] type The relocation type and segment identifier.
+     *
+     * @return The size of the entry, including the offset and type bytes.
+     */
+    size_t (*reloc_size)(uint8_t type);
+
+    /**
+     * @brief Parses a relocation entry; same as o65_parse_reloc().
+     */
+    int (*parse_reloc)
+        (const uint8_t *buf, size_t size, o65_reloc_t *reloc, size_t *len);
+
+    /**
+     * @brief Encodes a relocation entry; same as o65_encode_reloc().
+     */
+    size_t (*encode_reloc)(uint8_t *buf, const o65_reloc_t *reloc);
+
+    /**
+     * @brief Gets a count value from a buffer.
+     *
+     * @param[in] buf Points to the count value.
+     *
+     * @return The count value.
+     */
+    o65_size_t (*get_count)(const uint8_t *buf);
+
+    /**
+     * @brief Puts a count value into a buffer.
+     *
+     * @param[out] buf Points to the buffer to write to.
+     * @param[in] count The count value.
+     */
+    void (*put_count)(uint8_t *buf, o65_size_t count);
+
+} o65_codec_t;
+
+/**
+ * @brief Gets the codec to use for the mode in a ".o65" file header.
+ *
+ * @param[in] header File header, containing the mode word.
+ *
+ * @return A pointer to the codec, which is statically allocated.
+ */
+const o65_codec_t *o65_get_codec(const o65_header_t *header);
+
 /**
  * @brief Reads a NUL-terminated string from a ".o65" file.
  *
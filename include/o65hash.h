@@ -0,0 +1,151 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65HASH_H
+#define O65HASH_H
+
+#include "o65view.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Size of the content hash in the O65_OPT_CONTENT_HASH option */
+#define O65_CONTENT_HASH_SIZE 8
+
+/** Total length of the O65_OPT_CONTENT_HASH option */
+#define O65_CONTENT_HASH_OPT_LEN (O65_CONTENT_HASH_SIZE + 2)
+
+/**
+ * @brief State for computing a 64-bit hash incrementally.
+ *
+ * The hash is the XXH64 algorithm.  Input is consumed in 32-byte stripes
+ * across four independent lanes, so the compiler can keep the lanes in
+ * separate registers or vectorize them.
+ */
+typedef struct
+{
+    uint64_t lanes[4];      /**< Accumulators for the four lanes */
+    uint64_t seed;          /**< Seed that the hash was started with */
+    uint64_t total;         /**< Total number of bytes that were hashed */
+    uint8_t buffer[32];     /**< Buffered bytes of a partial stripe */
+    size_t buffer_len;      /**< Number of bytes in "buffer" */
+
+} o65_hash_t;
+
+/**
+ * @brief Starts computing a hash.
+ *
+ * @param[out] hash The hash state to initialize.
+ * @param[in] seed Seed for the hash, which is normally zero.
+ */
+void o65_hash_init(o65_hash_t *hash, uint64_t seed);
+
+/**
+ * @brief Adds data to a hash.
+ *
+ * @param[in,out] hash The hash state.
+ * @param[in] data Points to the data to add.
+ * @param[in] size Number of bytes of data to add.
+ */
+void o65_hash_update(o65_hash_t *hash, const void *data, size_t size);
+
+/**
+ * @brief Gets the final value of a hash.
+ *
+ * @param[in] hash The hash state, which is not modified.
+ *
+ * @return The 64-bit hash value.
+ */
+uint64_t o65_hash_final(const o65_hash_t *hash);
+
+/**
+ * @brief Hashes a buffer in a single call.
+ *
+ * @param[in] data Points to the data to hash.
+ * @param[in] size Number of bytes of data to hash.
+ * @param[in] seed Seed for the hash, which is normally zero.
+ *
+ * @return The 64-bit hash value.
+ */
+uint64_t o65_hash64(const void *data, size_t size, uint64_t seed);
+
+/**
+ * @brief Computes the content hash of an image.
+ *
+ * @param[in] view The image to hash.
+ *
+ * @return The 64-bit content hash.
+ *
+ * The hash covers the fixed-size header and everything after the header
+ * options: the segments, externs, relocation tables, and exports.
+ * The header options are not included, so the hash does not change
+ * when only the creation date or other metadata changes.
+ */
+uint64_t o65_content_hash(const o65_image_view_t *view);
+
+/**
+ * @brief Finds the content hash in the header options for an image.
+ *
+ * @param[in] options Span containing the header options.
+ * @param[out] hash Returns the content hash if found.
+ *
+ * @return 1 if the hash was found, or 0 if the options do not
+ * contain a valid O65_OPT_CONTENT_HASH option.
+ *
+ * Only the header options are needed, so callers can compare the hash
+ * against a cached value without reading the rest of the file.
+ */
+int o65_find_content_hash(const o65_span_t *options, uint64_t *hash);
+
+/**
+ * @brief Verifies the content hash of an image.
+ *
+ * @param[in] view The image to verify.
+ *
+ * @return 1 if the hash matches, 0 if it does not match, or -1 if
+ * the image does not have a content hash option.
+ */
+int o65_verify_content_hash(const o65_image_view_t *view);
+
+/**
+ * @brief Writes a content hash into an encoded image.
+ *
+ * @param[in,out] buf Points to the start of the encoded image.
+ * @param[in] size Number of bytes in the encoded image.
+ *
+ * @return 1 if the hash was written, 0 if the image is invalid or it
+ * does not have a content hash option, or -1 if the image is truncated.
+ *
+ * The image must already contain an O65_OPT_CONTENT_HASH option to
+ * act as a placeholder.  The hash is computed and written over the
+ * placeholder in place.
+ */
+int o65_update_content_hash(uint8_t *buf, size_t size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -76,6 +76,12 @@ typedef struct
 
 } o65_header_32_t;
 
+/** Size of the raw ".o65" file header with 16-bit fields */
+#define O65_HEADER_SIZE_16  26
+
+/** Size of the raw ".o65" file header with 32-bit fields */
+#define O65_HEADER_SIZE_32  44
+
 /* Bytes in the "magic" field */
 #define O65_MAGIC_1         0x01    /**< First magic string byte */
 #define O65_MAGIC_2         0x00    /**< Second magic string byte */
@@ -121,6 +127,9 @@ typedef struct
 
 /* Custom header options */
 #define O65_OPT_ELF_MACHINE 'E' /**< ELF machine type and flags */
+#define O65_OPT_CONTENT_HASH 'H' /**< 64-bit hash of the image contents */
+#define O65_OPT_PADDING     'P' /**< Padding that aligns the segments */
+#define O65_OPT_COMPRESSED  'Z' /**< Sizes of the compressed segments */
 
 /* Operating system types */
 #define O65_OS_OSA65        1   /**< OSA/65 */
@@ -137,6 +146,9 @@ typedef struct
 #define O65_RELOC_SEGADR    0xC0    /**< 24-bit segment address */
 #define O65_RELOC_SEG       0xA0    /**< Segment byte of a 24-bit address */
 
+/** Maximum number of bytes in a single encoded relocation entry */
+#define O65_MAX_RELOC_SIZE  8
+
 /* Segment identifiers in relocation type bytes */
 #define O65_SEGID_UNDEF     0   /**< From the undefined references list */
 #define O65_SEGID_ABS       1   /**< Absolute value */
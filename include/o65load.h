@@ -0,0 +1,200 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65LOAD_H
+#define O65LOAD_H
+
+#include "o65file.h"
+#include "o65view.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Addresses that an image should be loaded to.
+ *
+ * Zero for any of the .text, .data, or .bss addresses selects the
+ * default location for that segment.
+ */
+typedef struct
+{
+    o65_size_t text_address;    /**< .text address, 0 for the header's tbase */
+    o65_size_t data_address;    /**< .data address, 0 to follow .text */
+    o65_size_t bss_address;     /**< .bss address, 0 to follow .data */
+    o65_size_t zeropage_address;/**< Address of the zero page segment */
+
+} o65_load_addresses_t;
+
+/**
+ * @brief Final layout of the segments of an image in the target's memory.
+ */
+typedef struct
+{
+    o65_header_t header;        /**< Header of the image being laid out */
+    o65_size_t alignment;       /**< Alignment of the segments */
+    o65_size_t text_address;    /**< Address of the .text segment */
+    o65_size_t text_size;       /**< Size of .text after alignment */
+    o65_size_t data_address;    /**< Address of the .data segment */
+    o65_size_t data_size;       /**< Size of .data after alignment */
+    o65_size_t data_load_size;  /**< Size of .data, plus .bss if it is zeroed */
+    o65_size_t bss_address;     /**< Address of the .bss segment */
+    o65_size_t bss_size;        /**< Size of .bss after alignment */
+    o65_size_t zeropage_address;/**< Address of the zero page segment */
+    int error;                  /**< Reason for the last failure, or zero */
+    o65_size_t error_value;     /**< Value that caused the last failure */
+    o65_context_t *context;     /**< Context for temporary allocations */
+
+} o65_layout_t;
+
+/** Image is an object file, which cannot be relocated */
+#define O65_LOAD_ERROR_OBJECT       1
+
+/** .text load address is zero */
+#define O65_LOAD_ERROR_ADDRESS      2
+
+/** .text load address is not aligned; "error_value" is the address */
+#define O65_LOAD_ERROR_ALIGN_TEXT   3
+
+/** .data load address is not aligned; "error_value" is the address */
+#define O65_LOAD_ERROR_ALIGN_DATA   4
+
+/** .bss load address is not aligned; "error_value" is the address */
+#define O65_LOAD_ERROR_ALIGN_BSS    5
+
+/** One or more externals could not be resolved */
+#define O65_LOAD_ERROR_UNRESOLVED   6
+
+/** Relocation has an invalid segment; "error_value" is the segment ID */
+#define O65_LOAD_ERROR_SEGID        7
+
+/** Relocation patches bytes outside its segment */
+#define O65_LOAD_ERROR_RANGE        8
+
+/** Relocation refers to an invalid external; "error_value" is the index */
+#define O65_LOAD_ERROR_EXTERN       9
+
+/** Relocation table ends before its zero terminator */
+#define O65_LOAD_ERROR_TRUNCATED    10
+
+/** Compressed segment is invalid; "error_value" is the segment ID */
+#define O65_LOAD_ERROR_SEGMENT      11
+
+/** Segment does not fit in memory; "error_value" is the segment ID */
+#define O65_LOAD_ERROR_SIZE         12
+
+/**
+ * @brief Callback that resolves the address of an external reference.
+ *
+ * @param[in] user_data User data that was supplied to o65_relocate().
+ * @param[in] index Index of the external reference in the image.
+ * @param[in] name NUL-terminated name of the external reference.
+ * @param[out] value Returns the address of the external reference.
+ *
+ * @return 1 if the reference was resolved, or 0 if it is unknown.
+ */
+typedef int (*o65_resolve_callback_t)
+    (void *user_data, o65_size_t index, const char *name, o65_size_t *value);
+
+/**
+ * @brief Lays out the segments of an image for loading.
+ *
+ * @param[out] layout Returns the layout of the image.
+ * @param[in] context Context for temporary allocations, or NULL.
+ * @param[in] header Header of the image.
+ * @param[in] addresses Addresses to load the segments to.
+ *
+ * @return 1 if the image can be loaded at the addresses, or 0 if not
+ * with the reason in "layout->error".
+ *
+ * On success, the caller must provide "layout->text_size" bytes of
+ * memory for .text and "layout->data_load_size" bytes for .data.
+ */
+int o65_layout_image
+    (o65_layout_t *layout, o65_context_t *context,
+     const o65_header_t *header, const o65_load_addresses_t *addresses);
+
+/**
+ * @brief Resolves the external references of an image.
+ *
+ * @param[in,out] layout Layout of the image, for error reporting.
+ * @param[in] view View of the image in memory.
+ * @param[out] externs Returns the address of each external reference,
+ * which must have space for "view->num_externs" entries.
+ * @param[in] resolve Callback that resolves each external reference.
+ * @param[in] user_data User data to pass to @a resolve.
+ *
+ * @return 1 if all references were resolved, or 0 if not.
+ *
+ * The callback is invoked for every reference, even after one of them
+ * fails, so that all unresolved names can be reported in one pass.
+ */
+int o65_resolve_externs
+    (o65_layout_t *layout, const o65_image_view_t *view,
+     o65_size_t *externs, o65_resolve_callback_t resolve, void *user_data);
+
+/**
+ * @brief Copies an image into memory and relocates it, using external
+ * references that were resolved previously.
+ *
+ * @param[in,out] layout Layout of the image from o65_layout_image().
+ * @param[in] view View of the image in memory.
+ * @param[out] text Memory to load .text into, "layout->text_size" bytes.
+ * @param[out] data Memory to load .data into, "layout->data_load_size" bytes.
+ * @param[in] externs Addresses of the external references.
+ *
+ * @return 1 if the image was relocated, or 0 if the relocation tables
+ * are invalid or the segments do not fit in the layout, with the reason
+ * in "layout->error".
+ *
+ * This is useful when the same image is loaded many times at different
+ * addresses, as the external references only need to be resolved once.
+ */
+int o65_relocate_resolved
+    (o65_layout_t *layout, const o65_image_view_t *view,
+     uint8_t *text, uint8_t *data, const o65_size_t *externs);
+
+/**
+ * @brief Copies an image into memory and relocates it.
+ *
+ * @param[in,out] layout Layout of the image from o65_layout_image().
+ * @param[in] view View of the image in memory.
+ * @param[out] text Memory to load .text into, "layout->text_size" bytes.
+ * @param[out] data Memory to load .data into, "layout->data_load_size" bytes.
+ * @param[in] resolve Callback that resolves each external reference,
+ * or NULL if the image has no external references.
+ * @param[in] user_data User data to pass to @a resolve.
+ *
+ * @return 1 if the image was relocated, 0 if the image is invalid or
+ * has unresolved references with the reason in "layout->error",
+ * or -1 if out of memory.
+ */
+int o65_relocate
+    (o65_layout_t *layout, const o65_image_view_t *view,
+     uint8_t *text, uint8_t *data,
+     o65_resolve_callback_t resolve, void *user_data);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,157 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef O65MODEL_H
+#define O65MODEL_H
+
+#include "o65view.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Information about an exported symbol in an image.
+ */
+typedef struct
+{
+    char *name;             /**< Name of the symbol */
+    uint8_t segid;          /**< Segment identifier; e.g. O65_SEGID_TEXT */
+    o65_size_t value;       /**< Value of the symbol */
+
+} o65_export_t;
+
+/**
+ * @brief Complete ".o65" image that has been loaded into memory.
+ *
+ * The sizes of the .text and .data segments are given by the "tlen"
+ * and "dlen" fields of the header.  Relocation addresses are absolute,
+ * in terms of the "tbase" and "dbase" fields of the header.
+ *
+ * All memory for the image, including the image structure itself,
+ * is allocated from "arena".  Anything that is added to the image
+ * afterwards should also be allocated from "arena".
+ */
+typedef struct o65_image_s o65_image_t;
+struct o65_image_s
+{
+    /** Header for the image */
+    o65_header_t header;
+
+    /** Number of header options */
+    o65_size_t num_options;
+
+    /** Header options */
+    o65_option_t *options;
+
+    /** Contents of the .text segment */
+    uint8_t *text;
+
+    /** Contents of the .data segment */
+    uint8_t *data;
+
+    /** Number of external references */
+    o65_size_t num_externs;
+
+    /** Names of the external references */
+    char **externs;
+
+    /** Relocations for the .text segment, in any address order */
+    o65_reloc_table_t text_relocs;
+
+    /** Relocations for the .data segment, in any address order */
+    o65_reloc_table_t data_relocs;
+
+    /** Number of exported symbols */
+    o65_size_t num_exports;
+
+    /** Exported symbols */
+    o65_export_t *exports;
+
+    /** Next image in the chain, or NULL if this is the last image */
+    o65_image_t *next;
+
+    /** Arena that all memory for this image is allocated from */
+    o65_arena_t arena;
+};
+
+/**
+ * @brief Creates a new empty image.
+ *
+ * @param[in] context Context to allocate the image with, or NULL.
+ *
+ * @return The new image, or NULL if out of memory.
+ */
+o65_image_t *o65_image_new(o65_context_t *context);
+
+/**
+ * @brief Parses a ".o65" image and all chained images from a buffer.
+ *
+ * @param[out] image Returns a pointer to the first image in the chain.
+ * @param[in] context Context to allocate the images with, or NULL.
+ * @param[in] buf Points to the start of the first image.
+ * @param[in] size Number of bytes that are available in @a buf.
+ *
+ * @return 1 if the image was parsed, 0 if the image is invalid,
+ * or -1 if @a buf ends before the image does or out of memory.
+ *
+ * The image is a complete copy, so @a buf can be released afterwards.
+ */
+int o65_image_parse
+    (o65_image_t **image, o65_context_t *context,
+     const uint8_t *buf, size_t size);
+
+/**
+ * @brief Serializes a ".o65" image and all chained images to a buffer.
+ *
+ * @param[in,out] image The first image in the chain.
+ * @param[out] buf Returns a pointer to the serialized data, which must
+ * be freed with o65_context_free() on the first image's context when
+ * no longer required.
+ * @param[out] size Returns the size of the serialized data.
+ *
+ * @return 1 if the image was serialized, 0 if the image is invalid
+ * because a relocation is before the start of its segment,
+ * or -1 if out of memory.
+ *
+ * Relocations are sorted into address order as they are encoded, and
+ * duplicate relocations at the same address are dropped.
+ *
+ * The "mode" field in the header of each image may be modified in the
+ * same way as for o65_write_header().  The O65_MODE_CHAIN bit is set
+ * for every image in the chain except the last.
+ */
+int o65_image_serialize(o65_image_t *image, uint8_t **buf, size_t *size);
+
+/**
+ * @brief Frees an image and all chained images.
+ *
+ * @param[in] image The first image in the chain, or NULL.
+ */
+void o65_image_free(o65_image_t *image);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,193 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65PUSH_H
+#define O65PUSH_H
+
+#include "o65file.h"
+#include "o65view.h"
+#include "o65context.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Types of events that are reported by the push parser.
+ */
+typedef enum
+{
+    O65_EVENT_HEADER,       /**< Image header has been parsed */
+    O65_EVENT_OPTION,       /**< Header option */
+    O65_EVENT_TEXT,         /**< Chunk of the .text segment */
+    O65_EVENT_DATA,         /**< Chunk of the .data segment */
+    O65_EVENT_EXTERN,       /**< Name of an external reference */
+    O65_EVENT_TEXT_RELOC,   /**< Relocation for the .text segment */
+    O65_EVENT_DATA_RELOC,   /**< Relocation for the .data segment */
+    O65_EVENT_EXPORT,       /**< Exported symbol definition */
+    O65_EVENT_END           /**< End of the image */
+
+} o65_event_type_t;
+
+/**
+ * @brief Event that is reported by the push parser.
+ *
+ * Pointers in the event are only valid for the duration of the callback.
+ */
+typedef struct
+{
+    o65_event_type_t type;  /**< Type of event */
+    const o65_header_t *header; /**< Header for the image being parsed */
+
+    /** Option number, extern or export index, relocation index, or
+     *  offset of the chunk within the segment */
+    o65_size_t index;
+
+    /** Absolute address of the relocation, or the address of the first
+     *  byte of the segment chunk if the segments are not compressed */
+    o65_size_t address;
+
+    /** Segment chunk data, or the name of the extern or export */
+    const uint8_t *data;
+
+    /** Size of the segment chunk, or the length of the name
+     *  (not including the NUL terminator) */
+    size_t size;
+
+    o65_option_view_t option; /**< Option for O65_EVENT_OPTION */
+    o65_reloc_t reloc;      /**< Relocation details for reloc events */
+    uint8_t segid;          /**< Segment identifier for O65_EVENT_EXPORT */
+    o65_size_t value;       /**< Value for O65_EVENT_EXPORT */
+
+} o65_event_t;
+
+/**
+ * @brief Callback function that receives parser events.
+ *
+ * @param[in] user_data User data pointer supplied to o65_push_init().
+ * @param[in] event The event.
+ *
+ * @return 1 to continue parsing, or any other value to stop parsing,
+ * which will then be returned from o65_push_feed().
+ */
+typedef int (*o65_event_callback_t)(void *user_data, const o65_event_t *event);
+
+/**
+ * @brief State of an incremental push parser for ".o65" data.
+ *
+ * The contents of this structure are private to the parser.
+ */
+typedef struct
+{
+    int state;              /**< Current parser state */
+    int result;             /**< Sticky result once parsing has stopped */
+    o65_header_t header;    /**< Header for the current image */
+    const o65_codec_t *codec; /**< Codec for the mode in the header */
+    o65_event_callback_t callback; /**< Event callback */
+    void *user_data;        /**< User data for the callback */
+    o65_size_t text_size;   /**< Stored size of the .text segment */
+    o65_size_t data_size;   /**< Stored size of the .data segment */
+    int compressed;         /**< Non-zero if the segments are compressed */
+    o65_size_t count;       /**< Number of items left in the current section */
+    o65_size_t index;       /**< Index of the next item in the section */
+    o65_size_t address;     /**< Address of the last relocation */
+    size_t need;            /**< Number of bytes needed for the record */
+    size_t fixed_len;       /**< Number of bytes in "fixed" */
+    uint8_t fixed[O65_MAX_OPT_SIZE]; /**< Fixed-size record buffer */
+    uint8_t *name;          /**< Buffer for NUL-terminated names */
+    size_t name_len;        /**< Length of the name so far */
+    size_t name_max;        /**< Allocated size of "name" */
+    o65_context_t *context; /**< Context to allocate "name" with */
+
+} o65_push_parser_t;
+
+/**
+ * @brief Initializes a push parser.
+ *
+ * @param[out] parser The parser to initialize.
+ * @param[in] context Context to allocate memory with, or NULL.
+ * @param[in] callback Function that is called for each event.
+ * @param[in] user_data User data pointer to pass to @a callback.
+ */
+void o65_push_init
+    (o65_push_parser_t *parser, o65_context_t *context,
+     o65_event_callback_t callback, void *user_data);
+
+/**
+ * @brief Feeds a chunk of input data to a push parser.
+ *
+ * @param[in,out] parser The parser.
+ * @param[in] buf Points to the data.
+ * @param[in] size Number of bytes of data; may be zero.
+ *
+ * @return 1 if the data was consumed, 0 if the data is invalid, -1 if
+ * out of memory, or the value returned from the callback if it asked
+ * for parsing to stop.  Once parsing stops, the same value will be
+ * returned for all further calls.
+ *
+ * Records may be split across chunks at any byte boundary.  Segment
+ * contents are passed to the callback directly from @a buf without
+ * being copied.  If the image has an O65_OPT_COMPRESSED option, then
+ * the segment events carry the compressed form, which can be passed
+ * to o65_lz_stream_feed() to decode it as it arrives.  Chained images
+ * are parsed one after the other, and anything after the last image in
+ * the chain is ignored.
+ */
+int o65_push_feed(o65_push_parser_t *parser, const uint8_t *buf, size_t size);
+
+/**
+ * @brief Feeds decompressed output from a decoder into a push parser.
+ *
+ * @param[in] parser Points to the o65_push_parser_t to feed.
+ * @param[in] buf Points to the data.
+ * @param[in] size Number of bytes of data.
+ *
+ * @return The same as o65_push_feed().
+ *
+ * This function can be passed to o65_decoder_init() as the output
+ * callback to parse a compressed stream without buffering all of it.
+ */
+int o65_push_output(void *parser, const uint8_t *buf, size_t size);
+
+/**
+ * @brief Indicates that there is no more input for a push parser.
+ *
+ * @param[in,out] parser The parser.
+ *
+ * @return 1 if the input ended cleanly after the last image, -1 if the
+ * input was truncated, or the result that stopped parsing earlier.
+ */
+int o65_push_finish(o65_push_parser_t *parser);
+
+/**
+ * @brief Frees the memory that was allocated by a push parser.
+ *
+ * @param[in,out] parser The parser.
+ */
+void o65_push_free(o65_push_parser_t *parser);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
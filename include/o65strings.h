@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65STRINGS_H
+#define O65STRINGS_H
+
+#include "o65view.h"
+#include "o65arena.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief String that has been interned into a string pool.
+ *
+ * There is only one entry in a pool for each distinct string, so two
+ * interned strings from the same pool are equal if and only if the
+ * pointers to their entries are equal.
+ */
+typedef struct
+{
+    const char *name;       /**< NUL-terminated copy of the string */
+    size_t len;             /**< Length of the string, excluding the NUL */
+    uint64_t hash;          /**< Hash of the string, from o65_hash64() */
+    void *data;             /**< Data associated with the string by the caller */
+
+} o65_string_t;
+
+/**
+ * @brief Pool of interned strings.
+ *
+ * The strings are held in an open-addressing hash table with linear
+ * probing.  A zeroed pool is ready to use with the default context.
+ */
+typedef struct
+{
+    o65_string_t **table;   /**< Hash table of entries, NULL for empty slots */
+    size_t table_size;      /**< Number of slots, which is a power of two */
+    size_t count;           /**< Number of strings in the pool */
+    o65_arena_t arena;      /**< Arena that the entries are allocated from */
+    o65_context_t *context; /**< Context to allocate the hash table with */
+
+} o65_string_pool_t;
+
+/**
+ * @brief Exported symbol that has been decoded with its name interned.
+ */
+typedef struct
+{
+    o65_string_t *name;     /**< Interned name of the symbol */
+    uint8_t segid;          /**< Segment identifier; e.g. O65_SEGID_TEXT */
+    o65_size_t value;       /**< Value of the symbol */
+
+} o65_export_entry_t;
+
+/**
+ * @brief Initializes a string pool.
+ *
+ * @param[out] pool The string pool to initialize.
+ * @param[in] context Context for allocation, or NULL.
+ */
+void o65_string_pool_init(o65_string_pool_t *pool, o65_context_t *context);
+
+/**
+ * @brief Frees a string pool and all of the strings within it.
+ *
+ * @param[in,out] pool The string pool to free.  It can be used again
+ * afterwards.
+ */
+void o65_string_pool_free(o65_string_pool_t *pool);
+
+/**
+ * @brief Interns a string into a pool.
+ *
+ * @param[in,out] pool The string pool.
+ * @param[in] name Points to the string data, which does not need to be
+ * NUL-terminated.
+ * @param[in] len Length of the string data.
+ *
+ * @return The entry for the string, or NULL if out of memory.
+ *
+ * If the string is already in the pool, then the existing entry is
+ * returned.  There is no limit on the length of the string.
+ */
+o65_string_t *o65_string_intern
+    (o65_string_pool_t *pool, const char *name, size_t len);
+
+/**
+ * @brief Finds a string in a pool without adding it.
+ *
+ * @param[in] pool The string pool.
+ * @param[in] name Points to the string data.
+ * @param[in] len Length of the string data.
+ *
+ * @return The entry for the string, or NULL if it is not in the pool.
+ */
+o65_string_t *o65_string_find
+    (const o65_string_pool_t *pool, const char *name, size_t len);
+
+/**
+ * @brief Decodes the names of the external references in an image.
+ *
+ * @param[in,out] pool The string pool to intern the names into.
+ * @param[in] view The image.
+ * @param[out] names Array of "view->num_externs" entries that returns
+ * the interned name of each external reference.
+ *
+ * @return 1 if the names were decoded, 0 if the table is truncated,
+ * or -1 if out of memory.
+ *
+ * The whole table is scanned in one pass with memchr() rather than
+ * copying the names out one at a time.
+ */
+int o65_decode_externs
+    (o65_string_pool_t *pool, const o65_image_view_t *view,
+     o65_string_t **names);
+
+/**
+ * @brief Decodes the exported symbols in an image.
+ *
+ * @param[in,out] pool The string pool to intern the names into.
+ * @param[in] view The image.
+ * @param[out] exports Array of "view->num_exports" entries that returns
+ * the details of each exported symbol.
+ *
+ * @return 1 if the symbols were decoded, 0 if the table is truncated,
+ * or -1 if out of memory.
+ */
+int o65_decode_exports
+    (o65_string_pool_t *pool, const o65_image_view_t *view,
+     o65_export_entry_t *exports);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65VALIDATE_H
+#define O65VALIDATE_H
+
+#include "o65view.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/** Header fields are inconsistent; e.g. a segment wraps around memory */
+#define O65_VALIDATE_ERROR_HEADER       1
+
+/** Relocation table ends before its zero terminator */
+#define O65_VALIDATE_ERROR_TRUNCATED    2
+
+/** Relocation has an unknown type */
+#define O65_VALIDATE_ERROR_RELOC_TYPE   3
+
+/** Relocation has an invalid segment identifier */
+#define O65_VALIDATE_ERROR_RELOC_SEGID  4
+
+/** Relocation patches bytes outside its segment */
+#define O65_VALIDATE_ERROR_RELOC_RANGE  5
+
+/** Relocation refers to an external that does not exist */
+#define O65_VALIDATE_ERROR_RELOC_EXTERN 6
+
+/** Exported symbol has an invalid segment identifier */
+#define O65_VALIDATE_ERROR_EXPORT_SEGID 7
+
+/** Exports table ends before the last symbol does */
+#define O65_VALIDATE_ERROR_EXPORTS      8
+
+/**
+ * @brief Details of why o65_validate() rejected an image.
+ */
+typedef struct
+{
+    int error;              /**< Reason for the failure, or zero */
+    size_t offset;          /**< Offset of the problem from the image start */
+
+} o65_validate_error_t;
+
+/**
+ * @brief Validates the structure of an image.
+ *
+ * @param[in,out] view View of the image from o65_view_image().
+ * @param[out] error Returns the reason for a failure, or NULL.
+ *
+ * @return 1 if the image is valid, or 0 if it is not.
+ *
+ * The header, relocation tables, and exports are checked in a single
+ * pass.  Every relocation must have a known type, a segment identifier
+ * that can be relocated, an external reference that exists, and must
+ * patch bytes within the .text or .data segment as given by the header.
+ *
+ * On success, "view->verified" is set.  The relocation functions in
+ * o65load.h can then apply the relocations without checking each entry
+ * again.  The image must not be modified after it is validated.
+ */
+int o65_validate(o65_image_view_t *view, o65_validate_error_t *error);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,451 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#ifndef O65VIEW_H
+#define O65VIEW_H
+
+#include "o65file.h"
+#include "o65arena.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Pointer and length of a region of an image in memory.
+ */
+typedef struct
+{
+    const uint8_t *data;    /**< Points to the first byte of the region */
+    size_t size;            /**< Number of bytes in the region */
+
+} o65_span_t;
+
+/**
+ * @brief View of the parts of a ".o65" image that is held in memory.
+ *
+ * All of the spans point directly into the buffer that was parsed,
+ * so the buffer must remain valid for as long as the view is in use.
+ *
+ * If "compressed" is set, then the .text and .data spans hold the
+ * compressed form of the segments, which can be decoded with
+ * o65_lz_decode_segment().
+ */
+typedef struct
+{
+    o65_header_t header;    /**< Header, after byte-swapping */
+    const uint8_t *start;   /**< Points to the magic number for the image */
+    size_t size;            /**< Total size of the image in bytes */
+    o65_span_t options;     /**< Header options, excluding the zero at end */
+    o65_span_t text;        /**< Stored contents of the .text segment */
+    o65_span_t data;        /**< Stored contents of the .data segment */
+    o65_size_t num_externs; /**< Number of external references */
+    o65_span_t externs;     /**< NUL-terminated names of the externals */
+    o65_span_t text_relocs; /**< .text relocations, including the zero at end */
+    o65_span_t data_relocs; /**< .data relocations, including the zero at end */
+    o65_size_t num_exports; /**< Number of exported symbols */
+    o65_span_t exports;     /**< Exported symbol definitions */
+    int verified;           /**< Non-zero if o65_validate() accepted the image */
+    int compressed;         /**< Non-zero if the segments are compressed */
+
+} o65_image_view_t;
+
+/**
+ * @brief Header option that is viewed in place within an image.
+ */
+typedef struct
+{
+    uint8_t type;           /**< Option type; e.g. O65_OPT_OS */
+    const uint8_t *data;    /**< Points to the payload of the option */
+    size_t len;             /**< Length of the payload in bytes */
+
+} o65_option_view_t;
+
+/**
+ * @brief Iterator over the header options in an image.
+ */
+typedef struct
+{
+    const uint8_t *ptr;     /**< Next option to be returned */
+    const uint8_t *end;     /**< End of the header options */
+
+} o65_option_iter_t;
+
+/**
+ * @brief Contents of a ".o65" file that has been mapped into memory.
+ */
+typedef struct
+{
+    const uint8_t *data;    /**< Points to the contents of the file */
+    size_t size;            /**< Size of the file in bytes */
+    int mapped;             /**< Non-zero if mmap() was used, zero if read() */
+    int compressed;         /**< Non-zero if the contents were decompressed */
+    o65_context_t *context; /**< Context that the file was loaded with */
+
+} o65_mapped_file_t;
+
+/**
+ * @brief Maps the contents of a ".o65" file into memory.
+ *
+ * @param[out] file Returns the details of the mapped file.
+ * @param[in] context Context for options and allocation, or NULL.
+ * @param[in] filename Name of the file to map, or "-" for standard input.
+ *
+ * @return 1 if the file was mapped, or -1 for a filesystem error with
+ * the reason in errno.
+ *
+ * If the file cannot be mapped with mmap(), such as for pipes and
+ * character devices, or the O65_OPTION_NO_MMAP option is set, then the
+ * contents will be read into a buffer instead.  Standard input is always
+ * read into a buffer, so it can be a pipe that does not support seeking.
+ *
+ * If the file is compressed with gzip, zlib, or the LZ frame format,
+ * then it is decompressed into a buffer.  The errno will be ENOTSUP
+ * if the library was built without support for the compression format.
+ */
+int o65_map_file
+    (o65_mapped_file_t *file, o65_context_t *context, const char *filename);
+
+/**
+ * @brief Unmaps a ".o65" file from memory.
+ *
+ * @param[in,out] file The mapped file to release.
+ */
+void o65_unmap_file(o65_mapped_file_t *file);
+
+/**
+ * @brief Parses a ".o65" image in memory into a view of its parts.
+ *
+ * @param[out] view Returns the view of the image.
+ * @param[in] buf Points to the start of the image.
+ * @param[in] size Number of bytes that are available in @a buf.
+ *
+ * @return 1 if the image was parsed, 0 if the image is invalid,
+ * or -1 if @a buf ends before the image does.
+ *
+ * If the O65_MODE_CHAIN bit is set in the header, then the next image
+ * in the chain starts at "view->start + view->size".
+ *
+ * If the image is invalid or truncated, then the parts that were found
+ * before the problem are still filled in.  The part that was being looked
+ * for when the problem was found has a "data" pointer but a size of zero,
+ * and the parts after it have a NULL "data" pointer.  If the problem is
+ * in the count of external references or exported symbols, then "data"
+ * points at the count.  This lets tools show as much as possible of a
+ * broken image.
+ */
+int o65_view_image(o65_image_view_t *view, const uint8_t *buf, size_t size);
+
+/**
+ * @brief Initializes an iterator over header options.
+ *
+ * @param[out] iter The iterator to initialize.
+ * @param[in] options Span containing the header options, such as
+ * "view->options" from o65_view_image().
+ */
+void o65_option_iter_init(o65_option_iter_t *iter, const o65_span_t *options);
+
+/**
+ * @brief Gets the next header option from an iterator.
+ *
+ * @param[in,out] iter The iterator.
+ * @param[out] option Returns the option, which points into the
+ * original buffer rather than being copied.
+ *
+ * @return 1 if an option was returned, 0 at the end of the options,
+ * or -1 if the options are invalid.
+ */
+int o65_option_iter_next(o65_option_iter_t *iter, o65_option_view_t *option);
+
+/**
+ * @brief Finds the first header option of a specific type.
+ *
+ * @param[in] options Span containing the header options.
+ * @param[in] type The option type to look for; e.g. O65_OPT_ELF_MACHINE.
+ * @param[out] option Returns the option if found.
+ *
+ * @return 1 if the option was found, or 0 if not.
+ *
+ * The search stops at the first match, and none of the options
+ * are copied.
+ */
+int o65_find_option
+    (const o65_span_t *options, uint8_t type, o65_option_view_t *option);
+
+/**
+ * @brief Gets the alignment that the segments of an image were padded to.
+ *
+ * @param[in] view The image view.
+ *
+ * @return The alignment in bytes from the O65_OPT_PADDING option,
+ * or 0 if the image does not have a valid padding option.
+ *
+ * The alignment is relative to the start of the file that contains
+ * the image, not the start of the image itself.
+ */
+size_t o65_padding_alignment(const o65_image_view_t *view);
+
+/**
+ * @brief Location of a segment within a file, rounded out to pages.
+ */
+typedef struct
+{
+    size_t offset;          /**< Offset of the segment within the file */
+    size_t size;            /**< Size of the segment in bytes */
+    size_t map_offset;      /**< Offset rounded down to a page boundary */
+    size_t map_size;        /**< Size rounded up to cover whole pages */
+
+} o65_segment_offsets_t;
+
+/**
+ * @brief Gets the page-aligned offsets of the .text and .data segments.
+ *
+ * @param[in] view The image view.
+ * @param[in] base Start of the file that contains the image, which may
+ * be before the image if it is part of a chain.
+ * @param[in] page_size Size of a host page, which must be a power of two.
+ * @param[out] text Returns the offsets of the .text segment.
+ * @param[out] data Returns the offsets of the .data segment.
+ *
+ * @return 1 if the .text segment starts on a page boundary, or 0 if
+ * it does not.  The offsets are returned in both cases.
+ *
+ * The "map_offset" and "map_size" fields are suitable for passing to
+ * mmap() on the original file, with the segment then starting
+ * "offset - map_offset" bytes into the mapping.  The .data segment
+ * follows the .text segment directly, so it usually starts part way
+ * into its first page.  The offsets are meaningless if the file was
+ * decompressed when it was loaded or if the segments are compressed.
+ */
+int o65_segment_offsets
+    (const o65_image_view_t *view, const uint8_t *base, size_t page_size,
+     o65_segment_offsets_t *text, o65_segment_offsets_t *data);
+
+/**
+ * @brief Relocation table that has been decoded into parallel arrays.
+ *
+ * Skip entries have already been folded into the addresses, so every
+ * entry in the table is an actual relocation.  The table must be
+ * zeroed before first use, and can be reused for multiple tables.
+ *
+ * If "arena" is set, then the arrays are allocated from that arena
+ * instead of with the context, and will be freed along with the arena.
+ */
+typedef struct
+{
+    o65_size_t count;       /**< Number of relocations in the table */
+    o65_size_t max_count;   /**< Number of entries that are allocated */
+    o65_size_t *address;    /**< Absolute address of each relocation */
+    uint8_t *type;          /**< Relocation type; e.g. O65_RELOC_WORD */
+    uint8_t *segid;         /**< Segment identifier; e.g. O65_SEGID_TEXT */
+    uint16_t *extra;        /**< Extra low bytes for HIGH and SEG types */
+    uint32_t *undefid;      /**< External reference for O65_SEGID_UNDEF */
+    o65_arena_t *arena;     /**< Arena to allocate from, or NULL */
+    o65_context_t *context; /**< Context to allocate from if no arena */
+
+} o65_reloc_table_t;
+
+/**
+ * @brief Decodes a whole relocation table in a single pass.
+ *
+ * @param[in,out] table The table to decode into.  Any previous contents
+ * will be replaced.
+ * @param[in] header File header, containing global relocation options.
+ * @param[in] relocs Span containing the encoded relocation table,
+ * including the zero byte at the end of the table.
+ * @param[in] base Base address of the segment that is being relocated.
+ *
+ * @return 1 if the table was decoded, 0 if the table is truncated,
+ * or -1 if out of memory.
+ */
+int o65_decode_relocs
+    (o65_reloc_table_t *table, const o65_header_t *header,
+     const o65_span_t *relocs, o65_size_t base);
+
+/**
+ * @brief Frees the arrays that were allocated for a relocation table.
+ *
+ * @param[in,out] table The table to free.
+ */
+void o65_free_relocs(o65_reloc_table_t *table);
+
+/**
+ * @brief Checkpoint within an encoded relocation table.
+ *
+ * Decoding can resume at "offset" as though the last relocation that
+ * was decoded was at "address".
+ */
+typedef struct
+{
+    size_t offset;          /**< Byte offset of the next entry in the table */
+    o65_size_t address;     /**< Address of the previous relocation */
+    o65_size_t index;       /**< Number of relocations before this point */
+
+} o65_reloc_checkpoint_t;
+
+/**
+ * @brief Side index of checkpoints for random access into a relocation table.
+ *
+ * The index refers to the encoded table, which must remain valid for
+ * as long as the index is in use.
+ */
+typedef struct
+{
+    o65_header_t header;    /**< Header, for the relocation options */
+    o65_span_t relocs;      /**< The encoded relocation table */
+    o65_size_t base;        /**< Base address of the segment */
+    o65_size_t count;       /**< Number of checkpoints in the index */
+    o65_reloc_checkpoint_t *checkpoints; /**< Checkpoints in address order */
+    o65_context_t *context; /**< Context the checkpoints were allocated with */
+
+} o65_reloc_index_t;
+
+/** Default number of relocations between index checkpoints */
+#define O65_RELOC_INDEX_ENTRIES 64
+
+/**
+ * @brief Builds a checkpoint index for a relocation table.
+ *
+ * @param[out] index Returns the index.
+ * @param[in] context Context to allocate the index with, or NULL.
+ * @param[in] header File header, containing global relocation options.
+ * @param[in] relocs Span containing the encoded relocation table.
+ * @param[in] base Base address of the segment that is being relocated.
+ * @param[in] every_entries Number of relocations between checkpoints,
+ * or zero to not place checkpoints by entry count.
+ * @param[in] every_bytes Number of bytes of address space between
+ * checkpoints, or zero to not place checkpoints by address.
+ *
+ * @return 1 if the index was built, 0 if the table is truncated,
+ * or -1 if out of memory.
+ *
+ * If both @a every_entries and @a every_bytes are zero, then a checkpoint
+ * is placed every O65_RELOC_INDEX_ENTRIES relocations.
+ */
+int o65_reloc_index_build
+    (o65_reloc_index_t *index, o65_context_t *context,
+     const o65_header_t *header,
+     const o65_span_t *relocs, o65_size_t base,
+     o65_size_t every_entries, o65_size_t every_bytes);
+
+/**
+ * @brief Decodes the relocations that touch a range of addresses.
+ *
+ * @param[in,out] table The table to decode into.  Any previous contents
+ * will be replaced.
+ * @param[in] index The checkpoint index for the relocation table.
+ * @param[in] start First address in the range.
+ * @param[in] end Address just past the end of the range.
+ *
+ * @return 1 if the relocations were decoded, 0 if the table is truncated,
+ * or -1 if out of memory.
+ *
+ * A relocation touches the range if any of the bytes that it patches are
+ * within the range; e.g. a WORD relocation at "start - 1" is included.
+ */
+int o65_decode_relocs_range
+    (o65_reloc_table_t *table, const o65_reloc_index_t *index,
+     o65_size_t start, o65_size_t end);
+
+/**
+ * @brief Frees a checkpoint index.
+ *
+ * @param[in,out] index The index to free.
+ */
+void o65_reloc_index_free(o65_reloc_index_t *index);
+
+/**
+ * @brief Fully resolved relocation that is returned by a relocation iterator.
+ */
+typedef struct
+{
+    o65_size_t address;     /**< Absolute address of the relocation */
+    o65_size_t offset;      /**< Offset of the relocation within the segment */
+    uint8_t type;           /**< Relocation type; e.g. O65_RELOC_WORD */
+    uint8_t segid;          /**< Target segment; e.g. O65_SEGID_TEXT */
+    uint8_t width;          /**< Number of bytes that are patched */
+    uint16_t extra;         /**< Extra low bytes for HIGH and SEG types */
+    uint32_t undefid;       /**< External reference for O65_SEGID_UNDEF */
+
+} o65_reloc_entry_t;
+
+/** Relocation table ends before its zero terminator */
+#define O65_RELOC_ERROR_TRUNCATED   1
+
+/** Relocation patches bytes outside the segment */
+#define O65_RELOC_ERROR_RANGE       2
+
+/** Relocation refers to an external that does not exist */
+#define O65_RELOC_ERROR_EXTERN      3
+
+/**
+ * @brief Iterator over the relocations in an encoded relocation table.
+ *
+ * The iterator checks that every relocation is within the bounds of the
+ * segment and refers to a valid external, so callers can patch the
+ * segment without checking each entry again.
+ */
+typedef struct
+{
+    const uint8_t *ptr;     /**< Next byte of the encoded table */
+    const uint8_t *end;     /**< End of the encoded table */
+    const o65_codec_t *codec; /**< Codec for the header mode */
+    o65_size_t base;        /**< Base address of the segment */
+    o65_size_t offset;      /**< Offset of the last relocation from "base" */
+    o65_size_t size;        /**< Size of the segment in bytes */
+    o65_size_t num_externs; /**< Number of external references */
+    int error;              /**< Reason why the iterator stopped, or zero */
+
+} o65_reloc_iter_t;
+
+/**
+ * @brief Initializes an iterator over a relocation table.
+ *
+ * @param[out] iter The iterator to initialize.
+ * @param[in] header File header, containing global relocation options.
+ * @param[in] relocs Span containing the encoded relocation table.
+ * @param[in] base Base address of the segment that is being relocated.
+ * @param[in] size Size of the segment that is being relocated.
+ * @param[in] num_externs Number of external references in the image.
+ */
+void o65_reloc_iter_init
+    (o65_reloc_iter_t *iter, const o65_header_t *header,
+     const o65_span_t *relocs, o65_size_t base, o65_size_t size,
+     o65_size_t num_externs);
+
+/**
+ * @brief Gets the next relocation from an iterator.
+ *
+ * @param[in,out] iter The iterator.
+ * @param[out] entry Returns the details of the relocation.
+ *
+ * @return 1 if a relocation was returned, 0 at the end of the table,
+ * or -1 if the table is invalid with the reason in "iter->error".
+ */
+int o65_reloc_iter_next(o65_reloc_iter_t *iter, o65_reloc_entry_t *entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,285 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#ifndef O65WRITER_H
+#define O65WRITER_H
+
+#include "o65file.h"
+#include "o65context.h"
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Writer that encodes a ".o65" file into a growable memory buffer.
+ *
+ * Errors are sticky: once an allocation fails, every later call will
+ * fail too, so callers can check for errors once at the end.
+ */
+typedef struct
+{
+    uint8_t *data;          /**< Data that has been encoded so far */
+    size_t size;            /**< Number of bytes that have been encoded */
+    size_t max_size;        /**< Allocated size of the buffer */
+    int error;              /**< Non-zero if an allocation has failed */
+    o65_header_t header;    /**< Header for the image being encoded */
+    const o65_codec_t *codec; /**< Codec for the mode in the header */
+    o65_context_t *context; /**< Context to allocate the buffer with */
+
+} o65_writer_t;
+
+/**
+ * @brief Initializes a writer.
+ *
+ * @param[out] writer The writer to initialize.
+ * @param[in] context Context to allocate the buffer with, or NULL.
+ */
+void o65_writer_init(o65_writer_t *writer, o65_context_t *context);
+
+/**
+ * @brief Frees the memory that was used by a writer.
+ *
+ * @param[in,out] writer The writer to free.  It can be used again afterwards.
+ */
+void o65_writer_free(o65_writer_t *writer);
+
+/**
+ * @brief Reserves space at the end of a writer's buffer.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] len Number of bytes to reserve.
+ *
+ * @return A pointer to the reserved space, or NULL if out of memory.
+ *
+ * The pointer is only valid until the next call on the writer.
+ */
+uint8_t *o65_writer_reserve(o65_writer_t *writer, size_t len);
+
+/**
+ * @brief Encodes the header for an image.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in,out] header The header details, which may be modified in the
+ * same way as for o65_write_header().
+ *
+ * @return 0 on success, or -1 if out of memory.
+ *
+ * The final header is remembered by the writer and is used to encode
+ * counts and relocations for the rest of the image.
+ */
+int o65_writer_header(o65_writer_t *writer, o65_header_t *header);
+
+/**
+ * @brief Encodes a header option.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] option The option to encode, or NULL to terminate the
+ * option list.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ */
+int o65_writer_option(o65_writer_t *writer, const o65_option_t *option);
+
+/**
+ * @brief Encodes padding options that align the segments of the image.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] alignment The alignment in bytes; e.g. 4096 for host pages.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ *
+ * This must be the last option before the option list is terminated.
+ * One or more O65_OPT_PADDING options are written so that the .text
+ * segment starts at a multiple of "alignment" from the start of the
+ * writer's buffer.  Nothing is written if the alignment is not a power
+ * of two that is 2 or greater.
+ */
+int o65_writer_padding(o65_writer_t *writer, size_t alignment);
+
+/**
+ * @brief Copies raw bytes, such as the contents of a segment.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] data Points to the data to copy.
+ * @param[in] len Number of bytes to copy.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ */
+int o65_writer_bytes(o65_writer_t *writer, const void *data, size_t len);
+
+/**
+ * @brief Encodes a 16-bit or 32-bit count value.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] count The count to encode.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ */
+int o65_writer_count(o65_writer_t *writer, o65_size_t count);
+
+/**
+ * @brief Encodes a NUL-terminated string.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] str The string to encode.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ */
+int o65_writer_string(o65_writer_t *writer, const char *str);
+
+/**
+ * @brief Encodes a relocation declaration.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] reloc The relocation details to encode.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ */
+int o65_writer_reloc(o65_writer_t *writer, const o65_reloc_t *reloc);
+
+/**
+ * @brief Encodes an exported symbol definition.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] name The name of the symbol.
+ * @param[in] segID The segment identifier; e.g. O65_SEGID_TEXT.
+ * @param[in] offset The offset into the segment of the exported symbol.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ */
+int o65_writer_exported_symbol
+    (o65_writer_t *writer, const char *name, uint8_t segID, o65_size_t offset);
+
+/**
+ * @brief Flushes the encoded data to a file descriptor.
+ *
+ * @param[in,out] writer The writer.
+ * @param[in] fd The file descriptor to write to.
+ *
+ * @return 0 on success, or -1 for an earlier allocation failure or a
+ * filesystem error, with the reason in errno.
+ *
+ * The data is written with a single write() call unless the file
+ * descriptor accepts a partial write.  The writer is empty afterwards.
+ */
+int o65_writer_flush(o65_writer_t *writer, int fd);
+
+/**
+ * @brief Takes ownership of the encoded data from a writer.
+ *
+ * @param[in,out] writer The writer, which will be empty afterwards.
+ * @param[out] size Returns the number of bytes of encoded data.
+ *
+ * @return A pointer to the encoded data, which must be freed with
+ * o65_context_free() on the writer's context, or NULL if nothing was
+ * encoded or an allocation failed earlier.
+ */
+uint8_t *o65_writer_take(o65_writer_t *writer, size_t *size);
+
+/**
+ * @brief Relocation at an absolute address that is waiting to be encoded.
+ */
+typedef struct
+{
+    o65_size_t address;     /**< Absolute address of the relocation */
+    uint32_t undefid;       /**< Identifier for an undefined reference */
+    uint16_t extra;         /**< Extra value for HIGH and SEG relocations */
+    uint8_t type;           /**< Relocation type and segment identifier */
+
+} o65_reloc_fixup_t;
+
+/**
+ * @brief Collects relocations at absolute addresses and encodes them
+ * into the delta/skip form of a ".o65" relocation table.
+ *
+ * Relocations can be added in any order.  They are sorted when the
+ * table is encoded, and duplicates at the same address are dropped,
+ * keeping the first one that was added.
+ */
+typedef struct
+{
+    o65_reloc_fixup_t *fixups; /**< Relocations that have been added */
+    size_t count;           /**< Number of relocations that have been added */
+    size_t max_count;       /**< Number of relocations that are allocated */
+    size_t duplicates;      /**< Number of duplicates dropped by encoding */
+    int error;              /**< Non-zero if an allocation has failed */
+    o65_context_t *context; /**< Context to allocate the relocations with */
+
+} o65_reloc_encoder_t;
+
+/**
+ * @brief Initializes a relocation encoder.
+ *
+ * @param[out] encoder The encoder to initialize.
+ * @param[in] context Context to allocate the relocations with, or NULL.
+ */
+void o65_reloc_encoder_init
+    (o65_reloc_encoder_t *encoder, o65_context_t *context);
+
+/**
+ * @brief Frees the memory that was used by a relocation encoder.
+ *
+ * @param[in,out] encoder The encoder to free.  It can be used again
+ * afterwards.
+ */
+void o65_reloc_encoder_free(o65_reloc_encoder_t *encoder);
+
+/**
+ * @brief Adds a relocation to an encoder.
+ *
+ * @param[in,out] encoder The encoder.
+ * @param[in] address Absolute address of the relocation.
+ * @param[in] reloc The relocation type, segment, and extra details.
+ * The "offset" field is ignored.
+ *
+ * @return 0 on success, or -1 if out of memory.
+ */
+int o65_reloc_encoder_add
+    (o65_reloc_encoder_t *encoder, o65_size_t address,
+     const o65_reloc_t *reloc);
+
+/**
+ * @brief Sorts the relocations in an encoder and encodes them as a
+ * relocation table, including the zero byte at the end of the table.
+ *
+ * @param[in,out] encoder The encoder.
+ * @param[in,out] writer The writer to encode into, which must already
+ * have been given the image header.
+ * @param[in] base Base address of the segment that is being relocated.
+ *
+ * @return 1 if the table was encoded, 0 if a relocation is before
+ * @a base, or -1 if out of memory.
+ *
+ * The relocations are left in sorted order with the duplicates removed,
+ * with the number of duplicates in "encoder->duplicates".
+ */
+int o65_reloc_encoder_write
+    (o65_reloc_encoder_t *encoder, o65_writer_t *writer, o65_size_t base);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
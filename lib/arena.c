@@ -0,0 +1,197 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "o65arena.h"
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+
+/** Alignment of all allocations from an arena */
+#define O65_ARENA_ALIGN 16
+
+struct o65_arena_block_s
+{
+    /** Next block in the arena */
+    o65_arena_block_t *next;
+
+    /** Number of bytes of the block that have been allocated */
+    size_t used;
+
+    /** Total number of bytes that are available in the block */
+    size_t size;
+
+    /** Offset of the most recent allocation, for in-place resizing */
+    size_t last;
+};
+
+/** Size of the block header, rounded up to the allocation alignment */
+#define BLOCK_HEADER_SIZE \
+    ((sizeof(o65_arena_block_t) + O65_ARENA_ALIGN - 1) & ~(O65_ARENA_ALIGN - 1))
+
+/** Largest allocation that can be rounded up and given a block header
+ *  without overflowing a size_t */
+#define MAX_ALLOC_SIZE \
+    (SIZE_MAX - O65_ARENA_ALIGN - BLOCK_HEADER_SIZE)
+
+/** Gets a pointer to the memory at an offset within a block */
+#define BLOCK_DATA(block, offset) \
+    (((uint8_t *)(block)) + BLOCK_HEADER_SIZE + (offset))
+
+void o65_arena_init
+    (o65_arena_t *arena, o65_context_t *context, size_t block_size)
+{
+    arena->blocks = NULL;
+    arena->block_size = block_size;
+    arena->context = context;
+}
+
+/**
+ * @brief Allocates a new block for an arena.
+ *
+ * @param[in] arena The arena.
+ * @param[in] size Number of bytes that the block must be able to hold.
+ *
+ * @return The new block, or NULL if out of memory.
+ */
+static o65_arena_block_t *new_block(o65_arena_t *arena, size_t size)
+{
+    o65_arena_block_t *block;
+    if (size > MAX_ALLOC_SIZE) {
+        o65_context_fail(arena->context, ENOMEM);
+        return NULL;
+    }
+    block = (o65_arena_block_t *)o65_context_alloc
+        (arena->context, BLOCK_HEADER_SIZE + size);
+    if (block) {
+        block->next = NULL;
+        block->used = 0;
+        block->size = size;
+        block->last = 0;
+    }
+    return block;
+}
+
+void *o65_arena_alloc(o65_arena_t *arena, size_t size)
+{
+    o65_arena_block_t *block = arena->blocks;
+    size_t block_size = arena->block_size ? arena->block_size
+                                          : O65_ARENA_BLOCK_SIZE;
+    size_t offset;
+
+    /* Round the size up so that the next allocation is also aligned */
+    if (size > MAX_ALLOC_SIZE) {
+        o65_context_fail(arena->context, ENOMEM);
+        return NULL;
+    }
+    size = (size + O65_ARENA_ALIGN - 1) & ~((size_t)(O65_ARENA_ALIGN - 1));
+    if (!size)
+        size = O65_ARENA_ALIGN;
+
+    /* Bump the pointer in the current block if there is room */
+    if (block && (block->size - block->used) >= size) {
+        offset = block->used;
+        block->used += size;
+        block->last = offset;
+        return BLOCK_DATA(block, offset);
+    }
+
+    /* Large allocations get a block of their own, which is placed after
+     * the current block so that the rest of it can still be used. */
+    if (size > block_size / 4) {
+        o65_arena_block_t *large = new_block(arena, size);
+        if (!large)
+            return NULL;
+        large->used = size;
+        if (block) {
+            large->next = block->next;
+            block->next = large;
+        } else {
+            arena->blocks = large;
+        }
+        return BLOCK_DATA(large, 0);
+    }
+
+    /* Start a new block */
+    if ((block = new_block(arena, block_size)) == NULL)
+        return NULL;
+    block->next = arena->blocks;
+    arena->blocks = block;
+    block->used = size;
+    return BLOCK_DATA(block, 0);
+}
+
+void *o65_arena_calloc(o65_arena_t *arena, size_t count, size_t size)
+{
+    void *ptr;
+    if (size && count > ((size_t)-1) / size)
+        return NULL;
+    ptr = o65_arena_alloc(arena, count * size);
+    if (ptr)
+        memset(ptr, 0, count * size);
+    return ptr;
+}
+
+void *o65_arena_realloc
+    (o65_arena_t *arena, void *ptr, size_t old_size, size_t new_size)
+{
+    o65_arena_block_t *block = arena->blocks;
+    void *new_ptr;
+
+    /* Resize in place if this was the last allocation in the current block */
+    if (ptr && block && ptr == BLOCK_DATA(block, block->last)) {
+        size_t size = (new_size + O65_ARENA_ALIGN - 1) &
+                      ~((size_t)(O65_ARENA_ALIGN - 1));
+        if (size && size <= (block->size - block->last)) {
+            block->used = block->last + size;
+            return ptr;
+        }
+    }
+
+    /* Allocate new memory and copy the contents across */
+    new_ptr = o65_arena_alloc(arena, new_size);
+    if (new_ptr && ptr)
+        memcpy(new_ptr, ptr, old_size < new_size ? old_size : new_size);
+    return new_ptr;
+}
+
+char *o65_arena_strndup(o65_arena_t *arena, const char *str, size_t len)
+{
+    char *copy = (char *)o65_arena_alloc(arena, len + 1);
+    if (copy) {
+        memcpy(copy, str, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+void o65_arena_free(o65_arena_t *arena)
+{
+    o65_arena_block_t *block = arena->blocks;
+    o65_arena_block_t *next;
+    while (block != NULL) {
+        next = block->next;
+        o65_context_free(arena->context, block);
+        block = next;
+    }
+    arena->blocks = NULL;
+}
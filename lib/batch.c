@@ -0,0 +1,634 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65batch.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <pthread.h>
+#include <string.h>
+#include <limits.h>
+#ifdef HAVE_LIBURING
+#include <liburing.h>
+#endif
+
+/** Size of the buffer to start with when the size of a file is unknown */
+#define READ_CHUNK_SIZE 65536
+
+/**
+ * @brief State that is shared between all of the files in a batch.
+ */
+typedef struct
+{
+    o65_context_t *context;         /**< Context for allocation */
+    const char * const *filenames;  /**< Names of the files to load */
+    size_t count;                   /**< Number of files to load */
+    o65_batch_callback_t callback;  /**< Callback to deliver files to */
+    void *user_data;                /**< User data for the callback */
+    int result;                     /**< Result to return from the batch */
+
+} batch_t;
+
+/**
+ * @brief Passes a loaded file to the batch callback and then frees it.
+ *
+ * @param[in,out] batch The batch.
+ * @param[in] index Index of the file.
+ * @param[in] data Contents of the file, or NULL.
+ * @param[in] size Size of the file contents.
+ * @param[in] error Zero, or the errno value for the reason for failure.
+ *
+ * The callback is not invoked if an earlier callback asked to stop.
+ */
+static void deliver
+    (batch_t *batch, size_t index, uint8_t *data, size_t size, int error)
+{
+    if (batch->result == 1) {
+        batch->result = batch->callback
+            (batch->user_data, index, error ? NULL : data, size, error);
+    }
+    o65_context_free(batch->context, data);
+}
+
+/**
+ * @brief Reads the rest of an open file into a buffer.
+ *
+ * @param[in,out] context Context for allocation.
+ * @param[in] fd File descriptor to read from.
+ * @param[in,out] data Buffer that holds the contents, or NULL.
+ * @param[in,out] max_size Allocated size of @a data.
+ * @param[in,out] size Number of bytes of @a data that are in use.
+ *
+ * @return Zero on success, or an errno value on failure.  If the file
+ * size is known, then @a max_size should be one more than the size so
+ * that the end of the file is found without reallocating.
+ */
+static int read_rest
+    (o65_context_t *context, int fd, uint8_t **data,
+     size_t *max_size, size_t *size)
+{
+    uint8_t *new_data;
+    ssize_t len;
+    for (;;) {
+        if (*size >= *max_size) {
+            size_t new_max = *max_size ? *max_size * 2 : READ_CHUNK_SIZE;
+            new_data = (uint8_t *)o65_context_realloc(context, *data, new_max);
+            if (!new_data)
+                return ENOMEM;
+            *data = new_data;
+            *max_size = new_max;
+        }
+        len = read(fd, *data + *size, *max_size - *size);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            return errno;
+        } else if (len == 0) {
+            return 0;
+        }
+        *size += (size_t)len;
+    }
+}
+
+/**
+ * @brief Gets the size to allocate for reading a file.
+ *
+ * @param[in] fd File descriptor for the file.
+ *
+ * @return One more than the size of a regular file so that the end of the
+ * file can be detected without reallocating, or zero if the size is unknown.
+ */
+static size_t initial_size(int fd)
+{
+    struct stat st;
+    if (fstat(fd, &st) >= 0 && S_ISREG(st.st_mode))
+        return (size_t)(st.st_size) + 1;
+    return 0;
+}
+
+/**
+ * @brief Reads the entire contents of a file.
+ *
+ * @param[in,out] context Context for allocation.
+ * @param[in] filename Name of the file to read.
+ * @param[out] data Returns the contents of the file.
+ * @param[out] size Returns the size of the file.
+ *
+ * @return Zero on success, or an errno value on failure.
+ */
+static int read_file
+    (o65_context_t *context, const char *filename,
+     uint8_t **data, size_t *size)
+{
+    size_t max_size;
+    int error;
+    int fd;
+
+    *data = NULL;
+    *size = 0;
+    if ((fd = open(filename, O_RDONLY, 0)) < 0)
+        return errno;
+    max_size = initial_size(fd);
+    if (max_size) {
+        *data = (uint8_t *)o65_context_alloc(context, max_size);
+        if (!(*data)) {
+            close(fd);
+            return ENOMEM;
+        }
+    }
+    error = read_rest(context, fd, data, &max_size, size);
+    close(fd);
+    return error;
+}
+
+/**
+ * @brief Completed file that is waiting to be delivered.
+ */
+typedef struct pool_item_s pool_item_t;
+struct pool_item_s
+{
+    pool_item_t *next;  /**< Next item in the completion queue */
+    uint8_t *data;      /**< Contents of the file */
+    size_t size;        /**< Size of the file */
+    int error;          /**< Zero, or the errno value for a failure */
+};
+
+/**
+ * @brief State for loading a batch with a pool of threads.
+ */
+typedef struct
+{
+    batch_t *batch;         /**< The batch being loaded */
+    pool_item_t *items;     /**< One item for each file in the batch */
+    pool_item_t *head;      /**< First item in the completion queue */
+    pool_item_t *tail;      /**< Last item in the completion queue */
+    size_t next;            /**< Index of the next file to load */
+    size_t queued;          /**< Number of items in the completion queue */
+    size_t limit;           /**< Maximum number of items to queue */
+    unsigned active;        /**< Number of worker threads still running */
+    int stop;               /**< Non-zero to stop loading files */
+    pthread_mutex_t lock;   /**< Lock that protects the pool state */
+    pthread_cond_t ready;   /**< Signalled when an item is queued */
+    pthread_cond_t space;   /**< Signalled when an item is taken or stopping */
+
+} pool_t;
+
+/**
+ * @brief State of a worker thread in a pool.
+ *
+ * A context must not be used by more than one thread at once, so each
+ * worker allocates with its own copy of the batch's context.
+ */
+typedef struct
+{
+    pool_t *pool;           /**< The pool that the worker belongs to */
+    pthread_t thread;       /**< Thread that is running the worker */
+    o65_context_t context;  /**< Worker's copy of the batch's context */
+
+} pool_worker_t;
+
+/**
+ * @brief Worker thread that loads files for a pool.
+ *
+ * @param[in] arg Points to the pool_worker_t for the thread.
+ *
+ * @return Always NULL.
+ */
+static void *pool_worker(void *arg)
+{
+    pool_worker_t *worker = (pool_worker_t *)arg;
+    pool_t *pool = worker->pool;
+    pool_item_t *item;
+    size_t index;
+
+    pthread_mutex_lock(&(pool->lock));
+    for (;;) {
+        /* Wait until there is room to queue another file, so that a slow
+         * callback does not cause every file to be held in memory */
+        while (!(pool->stop) && pool->next < pool->batch->count &&
+               pool->queued >= pool->limit) {
+            pthread_cond_wait(&(pool->space), &(pool->lock));
+        }
+        if (pool->stop || pool->next >= pool->batch->count)
+            break;
+        index = (pool->next)++;
+        pthread_mutex_unlock(&(pool->lock));
+
+        /* Read the file without holding the lock */
+        item = &(pool->items[index]);
+        item->error = read_file
+            (&(worker->context), pool->batch->filenames[index],
+             &(item->data), &(item->size));
+
+        /* Add the file to the completion queue */
+        pthread_mutex_lock(&(pool->lock));
+        item->next = NULL;
+        if (pool->tail)
+            pool->tail->next = item;
+        else
+            pool->head = item;
+        pool->tail = item;
+        ++(pool->queued);
+        pthread_cond_signal(&(pool->ready));
+    }
+    --(pool->active);
+    pthread_cond_signal(&(pool->ready));
+    pthread_mutex_unlock(&(pool->lock));
+    return NULL;
+}
+
+/**
+ * @brief Loads a batch of files with a pool of threads.
+ *
+ * @param[in,out] batch The batch to load.
+ * @param[in] concurrency Number of threads to use.
+ *
+ * @return 1 if the batch was loaded, or -1 if the pool could not be
+ * started with the reason recorded in the context.  The callback's
+ * result is in "batch->result".
+ */
+static int load_pool(batch_t *batch, unsigned concurrency)
+{
+    pool_t pool;
+    pool_worker_t *workers;
+    pool_worker_t *worker;
+    pool_item_t *item;
+    unsigned num_threads;
+    unsigned index;
+    int error = 0;
+
+    /* There is no point starting more threads than there are files */
+    if (concurrency > batch->count)
+        concurrency = (unsigned)(batch->count);
+
+    /* Set up the pool */
+    memset(&pool, 0, sizeof(pool));
+    pool.batch = batch;
+    pool.limit = concurrency;
+    pool.items = (pool_item_t *)o65_context_alloc
+        (batch->context, batch->count * sizeof(pool_item_t));
+    workers = (pool_worker_t *)o65_context_alloc
+        (batch->context, concurrency * sizeof(pool_worker_t));
+    if (!(pool.items) || !workers) {
+        o65_context_free(batch->context, pool.items);
+        o65_context_free(batch->context, workers);
+        return -1;
+    }
+    for (index = 0; index < concurrency; ++index) {
+        worker = &(workers[index]);
+        worker->pool = &pool;
+        if (batch->context)
+            worker->context = *(batch->context);
+        else
+            o65_context_init(&(worker->context));
+        worker->context.error = 0;
+    }
+    pthread_mutex_init(&(pool.lock), NULL);
+    pthread_cond_init(&(pool.ready), NULL);
+    pthread_cond_init(&(pool.space), NULL);
+
+    /* Start the worker threads.  Carry on with fewer threads if some of
+     * them cannot be started, as long as there is at least one. */
+    pthread_mutex_lock(&(pool.lock));
+    for (num_threads = 0; num_threads < concurrency; ++num_threads) {
+        worker = &(workers[num_threads]);
+        error = pthread_create(&(worker->thread), NULL, pool_worker, worker);
+        if (error != 0)
+            break;
+        ++(pool.active);
+    }
+
+    /* Deliver the files on this thread as they are completed */
+    while (num_threads > 0) {
+        while (!(pool.head) && pool.active > 0)
+            pthread_cond_wait(&(pool.ready), &(pool.lock));
+        if ((item = pool.head) == NULL)
+            break;
+        if ((pool.head = item->next) == NULL)
+            pool.tail = NULL;
+        --(pool.queued);
+        pthread_cond_signal(&(pool.space));
+        pthread_mutex_unlock(&(pool.lock));
+        deliver(batch, (size_t)(item - pool.items),
+                item->data, item->size, item->error);
+        pthread_mutex_lock(&(pool.lock));
+        if (batch->result != 1 && !(pool.stop)) {
+            pool.stop = 1;
+            pthread_cond_broadcast(&(pool.space));
+        }
+    }
+    pthread_mutex_unlock(&(pool.lock));
+
+    /* Wait for the threads to exit, copy back the errors that the workers
+     * recorded in their contexts, and clean up */
+    for (index = 0; index < num_threads; ++index) {
+        worker = &(workers[index]);
+        pthread_join(worker->thread, NULL);
+        if (worker->context.error && batch->context)
+            batch->context->error = worker->context.error;
+    }
+    pthread_cond_destroy(&(pool.space));
+    pthread_cond_destroy(&(pool.ready));
+    pthread_mutex_destroy(&(pool.lock));
+    o65_context_free(batch->context, workers);
+    o65_context_free(batch->context, pool.items);
+    if (!num_threads)
+        return o65_context_fail(batch->context, error);
+    return 1;
+}
+
+#ifdef HAVE_LIBURING
+
+/**
+ * @brief State of a file that is being loaded with io_uring.
+ */
+typedef struct
+{
+    size_t index;       /**< Index of the file in the batch */
+    int fd;             /**< File descriptor, or -1 while opening */
+    uint8_t *data;      /**< Buffer for the contents of the file */
+    size_t size;        /**< Number of bytes that have been read so far */
+    size_t max_size;    /**< Allocated size of the buffer */
+    int busy;           /**< Non-zero if the file is being loaded */
+
+} uring_slot_t;
+
+/**
+ * @brief Finishes loading a file with io_uring.
+ *
+ * @param[in,out] batch The batch.
+ * @param[in,out] slot The slot for the file, which is free afterwards.
+ * @param[in] error Zero, or the errno value for a failure.
+ */
+static void uring_finish(batch_t *batch, uring_slot_t *slot, int error)
+{
+    if (slot->fd >= 0)
+        close(slot->fd);
+    deliver(batch, slot->index, slot->data, slot->size, error);
+    slot->fd = -1;
+    slot->data = NULL;
+    slot->busy = 0;
+}
+
+/**
+ * @brief Queues a read for the rest of a file with io_uring.
+ *
+ * @param[in,out] ring The ring to queue the read on.
+ * @param[in,out] slot The slot for the file.
+ */
+static void uring_read(struct io_uring *ring, uring_slot_t *slot)
+{
+    struct io_uring_sqe *sqe = io_uring_get_sqe(ring);
+    size_t len = slot->max_size - slot->size;
+
+    /* Very large files are read with several operations */
+    if (len > UINT_MAX)
+        len = UINT_MAX;
+    io_uring_prep_read(sqe, slot->fd, slot->data + slot->size,
+                       (unsigned)len, (uint64_t)(slot->size));
+    io_uring_sqe_set_data(sqe, slot);
+}
+
+/**
+ * @brief Handles the completion of an operation on a file with io_uring.
+ *
+ * @param[in,out] batch The batch.
+ * @param[in,out] ring The ring to queue the next operation on.
+ * @param[in,out] slot The slot for the file.
+ * @param[in] res Result of the operation.
+ *
+ * @return Non-zero if the file is finished and the slot is free,
+ * or zero if another operation was queued for the file.
+ */
+static int uring_complete
+    (batch_t *batch, struct io_uring *ring, uring_slot_t *slot, int res)
+{
+    uint8_t *new_data;
+    size_t new_max;
+
+    if (res < 0) {
+        uring_finish(batch, slot, -res);
+        return 1;
+    }
+    if (slot->fd < 0) {
+        /* The open has finished.  Stop here if the batch is stopping. */
+        slot->fd = res;
+        if (batch->result != 1) {
+            uring_finish(batch, slot, 0);
+            return 1;
+        }
+
+        /* Files of unknown size, such as pipes, are read synchronously */
+        slot->max_size = initial_size(slot->fd);
+        if (!(slot->max_size)) {
+            uring_finish(batch, slot, read_rest
+                (batch->context, slot->fd, &(slot->data),
+                 &(slot->max_size), &(slot->size)));
+            return 1;
+        }
+        slot->data = (uint8_t *)o65_context_alloc
+            (batch->context, slot->max_size);
+        if (!(slot->data)) {
+            uring_finish(batch, slot, ENOMEM);
+            return 1;
+        }
+    } else {
+        /* A read has finished.  The buffer is one byte larger than the
+         * file, so we are at the end once the buffer is full except for
+         * the last byte.  Reads of very large files may come up short
+         * before then, in which case we read the rest. */
+        slot->size += (size_t)res;
+        if (res == 0 || slot->size == slot->max_size - 1 ||
+                batch->result != 1) {
+            uring_finish(batch, slot, 0);
+            return 1;
+        }
+        if (slot->size < slot->max_size) {
+            uring_read(ring, slot);
+            return 0;
+        }
+
+        /* The file has grown since we found its size; keep reading */
+        new_max = slot->max_size * 2;
+        new_data = (uint8_t *)o65_context_realloc
+            (batch->context, slot->data, new_max);
+        if (!new_data) {
+            uring_finish(batch, slot, ENOMEM);
+            return 1;
+        }
+        slot->data = new_data;
+        slot->max_size = new_max;
+    }
+    uring_read(ring, slot);
+    return 0;
+}
+
+/**
+ * @brief Loads a batch of files with io_uring.
+ *
+ * @param[in,out] batch The batch to load.
+ * @param[in] concurrency Number of files to have in flight at once.
+ *
+ * @return 1 if the batch was loaded, 0 if io_uring is not available,
+ * or -1 if out of memory with the reason recorded in the context.
+ * The callback's result is in "batch->result".
+ */
+static int load_uring(batch_t *batch, unsigned concurrency)
+{
+    struct io_uring ring;
+    struct io_uring_sqe *sqe;
+    struct io_uring_cqe *cqe;
+    uring_slot_t *slots;
+    uring_slot_t **free_slots;
+    uring_slot_t *slot;
+    unsigned num_free;
+    unsigned pending = 0;
+    unsigned index;
+    size_t next = 0;
+    int failed = 0;
+    int res;
+
+    /* Set up the ring.  Each file has at most one operation in flight. */
+    if (io_uring_queue_init(concurrency, &ring, 0) < 0)
+        return 0;
+    slots = (uring_slot_t *)o65_context_alloc
+        (batch->context, concurrency * sizeof(uring_slot_t));
+    free_slots = (uring_slot_t **)o65_context_alloc
+        (batch->context, concurrency * sizeof(uring_slot_t *));
+    if (!slots || !free_slots) {
+        o65_context_free(batch->context, slots);
+        o65_context_free(batch->context, free_slots);
+        io_uring_queue_exit(&ring);
+        return -1;
+    }
+    memset(slots, 0, concurrency * sizeof(uring_slot_t));
+    for (index = 0; index < concurrency; ++index)
+        free_slots[index] = &(slots[index]);
+    num_free = concurrency;
+
+    /* Keep the ring full of files until they have all been loaded.
+     * Once the callback asks to stop, no more files are started but
+     * we still need to wait for the operations that are in flight. */
+    for (;;) {
+        while (batch->result == 1 && !failed && next < batch->count &&
+               num_free > 0) {
+            slot = free_slots[--num_free];
+            slot->index = next;
+            slot->fd = -1;
+            slot->data = NULL;
+            slot->size = 0;
+            slot->max_size = 0;
+            slot->busy = 1;
+            sqe = io_uring_get_sqe(&ring);
+            io_uring_prep_openat
+                (sqe, AT_FDCWD, batch->filenames[next], O_RDONLY, 0);
+            io_uring_sqe_set_data(sqe, slot);
+            ++pending;
+            ++next;
+        }
+        if (!pending)
+            break;
+        io_uring_submit(&ring);
+        res = io_uring_wait_cqe(&ring, &cqe);
+        if (res < 0) {
+            if (res == -EINTR)
+                continue;
+
+            /* Stop starting new operations, but the kernel may still be
+             * writing into the buffers so wait for the rest to finish.
+             * Give up if waiting on the ring fails a second time. */
+            if (failed)
+                break;
+            failed = 1;
+            continue;
+        }
+        slot = (uring_slot_t *)io_uring_cqe_get_data(cqe);
+        res = cqe->res;
+        io_uring_cqe_seen(&ring, cqe);
+        --pending;
+        if (failed) {
+            /* Report the file as failed now that it is finished */
+            if (slot->fd < 0 && res >= 0)
+                slot->fd = res;
+            uring_finish(batch, slot, EIO);
+            free_slots[num_free++] = slot;
+        } else if (uring_complete(batch, &ring, slot, res)) {
+            free_slots[num_free++] = slot;
+        } else {
+            ++pending;
+        }
+    }
+
+    /* Clean up.  If operations are still in flight because the ring
+     * could not be drained, then the kernel may write into their buffers
+     * after the ring is torn down, so those buffers are leaked instead of
+     * being freed.  Those files and any that were not started because of
+     * the failure are reported as failed. */
+    io_uring_queue_exit(&ring);
+    for (index = 0; index < concurrency; ++index) {
+        slot = &(slots[index]);
+        if (slot->busy) {
+            slot->data = NULL;
+            uring_finish(batch, slot, EIO);
+        }
+    }
+    for (; next < batch->count; ++next)
+        deliver(batch, next, NULL, 0, EIO);
+    o65_context_free(batch->context, free_slots);
+    o65_context_free(batch->context, slots);
+    return 1;
+}
+
+#endif /* HAVE_LIBURING */
+
+int o65_load_batch
+    (o65_context_t *context, const char * const *filenames, size_t count,
+     unsigned concurrency, o65_batch_callback_t callback, void *user_data)
+{
+    batch_t batch;
+    int result = 0;
+
+    /* Set up the batch state */
+    batch.context = context;
+    batch.filenames = filenames;
+    batch.count = count;
+    batch.callback = callback;
+    batch.user_data = user_data;
+    batch.result = 1;
+    if (!count)
+        return 1;
+    if (!concurrency)
+        concurrency = O65_BATCH_CONCURRENCY;
+
+    /* Try io_uring first, and then fall back to a thread pool */
+#ifdef HAVE_LIBURING
+    if (!context || !(context->options & O65_OPTION_NO_URING))
+        result = load_uring(&batch, concurrency);
+#endif
+    if (result == 0)
+        result = load_pool(&batch, concurrency);
+    if (result < 0)
+        return -1;
+    return batch.result;
+}
@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65file.h"
+
+/*
+ * Each codec function is written once as an inline function with "wide"
+ * and "paged" parameters, and then instantiated for each combination of
+ * the mode bits.  The compiler folds the constant parameters away so that
+ * the specialized versions have no mode tests.
+ */
+
+static inline size_t reloc_size
+    (uint8_t type, int wide, int paged)
+{
+    size_t size = 2;
+    if ((type & O65_RELOC_SEGID) == O65_SEGID_UNDEF)
+        size += wide ? 4 : 2;
+    switch (type & O65_RELOC_TYPE) {
+    case O65_RELOC_HIGH:    size += paged ? 0 : 1; break;
+    case O65_RELOC_SEG:     size += 2; break;
+    default:                break;
+    }
+    return size;
+}
+
+static inline int parse_reloc
+    (const uint8_t *buf, size_t size, o65_reloc_t *reloc, size_t *len,
+     int wide, int paged)
+{
+    size_t posn;
+
+    /* Clear the relocation details in case of error */
+    reloc->offset = 0;
+    reloc->type = 0;
+    reloc->extra = 0;
+    reloc->undefid = 0;
+    *len = 0;
+
+    /* Get the relocation offset */
+    if (size < 1)
+        return -1;
+    reloc->offset = buf[0];
+
+    /* Zero for the end of the table, 255 for a skip-ahead entry */
+    if (reloc->offset == 0 || reloc->offset == 255) {
+        *len = 1;
+        return 1;
+    }
+
+    /* Get the type/segment byte and check that the rest is present */
+    if (size < 2)
+        return -1;
+    reloc->type = buf[1];
+    posn = reloc_size(reloc->type, wide, paged);
+    if (size < posn)
+        return -1;
+    *len = posn;
+
+    /* Undefined relocations are followed by the external symbol index */
+    posn = 2;
+    if ((reloc->type & O65_RELOC_SEGID) == O65_SEGID_UNDEF) {
+        if (wide) {
+            reloc->undefid = o65_read_uint32(buf + posn);
+            posn += 4;
+        } else {
+            reloc->undefid = o65_read_uint16(buf + posn);
+            posn += 2;
+        }
+    }
+
+    /* Extract the low bytes for HIGH and SEG relocations */
+    switch (reloc->type & O65_RELOC_TYPE) {
+    case O65_RELOC_HIGH:
+        if (!paged)
+            reloc->extra = buf[posn];
+        break;
+
+    case O65_RELOC_SEG:
+        reloc->extra = o65_read_uint16(buf + posn);
+        break;
+
+    default: break;
+    }
+    return 1;
+}
+
+static inline size_t encode_reloc
+    (uint8_t *buf, const o65_reloc_t *reloc, int wide, int paged)
+{
+    size_t posn;
+
+    /* Zero and 255 are special single-byte relocations */
+    buf[0] = reloc->offset;
+    if (reloc->offset == 0 || reloc->offset == 255)
+        return 1;
+
+    /* Encode the relocation type and parameters */
+    buf[1] = reloc->type;
+    posn = 2;
+    if ((reloc->type & O65_RELOC_SEGID) == O65_SEGID_UNDEF) {
+        /* Encode the identifier of the external reference */
+        if (wide) {
+            o65_write_uint32(buf + posn, reloc->undefid);
+            posn += 4;
+        } else {
+            o65_write_uint16(buf + posn, reloc->undefid);
+            posn += 2;
+        }
+    }
+    switch (reloc->type & O65_RELOC_TYPE) {
+    case O65_RELOC_HIGH:
+        /* Include the low byte of the relocation address if not paged */
+        if (!paged)
+            buf[posn++] = (uint8_t)(reloc->extra);
+        break;
+
+    case O65_RELOC_SEG:
+        /* Include the two low bytes of the relocation address */
+        o65_write_uint16(buf + posn, reloc->extra);
+        posn += 2;
+        break;
+
+    default: break;
+    }
+    return posn;
+}
+
+static o65_size_t get_count_16(const uint8_t *buf)
+{
+    return o65_read_uint16(buf);
+}
+
+static o65_size_t get_count_32(const uint8_t *buf)
+{
+    return o65_read_uint32(buf);
+}
+
+static void put_count_16(uint8_t *buf, o65_size_t count)
+{
+    o65_write_uint16(buf, count);
+}
+
+static void put_count_32(uint8_t *buf, o65_size_t count)
+{
+    o65_write_uint32(buf, count);
+}
+
+/* Instantiate the relocation functions for a combination of mode bits */
+#define O65_CODEC(name, wide, paged) \
+    static size_t reloc_size_##name(uint8_t type) \
+    { \
+        return reloc_size(type, (wide), (paged)); \
+    } \
+    static int parse_reloc_##name \
+        (const uint8_t *buf, size_t size, o65_reloc_t *reloc, size_t *len) \
+    { \
+        return parse_reloc(buf, size, reloc, len, (wide), (paged)); \
+    } \
+    static size_t encode_reloc_##name(uint8_t *buf, const o65_reloc_t *reloc) \
+    { \
+        return encode_reloc(buf, reloc, (wide), (paged)); \
+    }
+O65_CODEC(16, 0, 0)
+O65_CODEC(16_paged, 0, 1)
+O65_CODEC(32, 1, 0)
+O65_CODEC(32_paged, 1, 1)
+
+/* Codecs, indexed by (32BIT ? 2 : 0) + (PAGED ? 1 : 0) */
+static o65_codec_t const codecs[4] = {
+    {2, reloc_size_16, parse_reloc_16, encode_reloc_16,
+     get_count_16, put_count_16},
+    {2, reloc_size_16_paged, parse_reloc_16_paged, encode_reloc_16_paged,
+     get_count_16, put_count_16},
+    {4, reloc_size_32, parse_reloc_32, encode_reloc_32,
+     get_count_32, put_count_32},
+    {4, reloc_size_32_paged, parse_reloc_32_paged, encode_reloc_32_paged,
+     get_count_32, put_count_32}
+};
+
+const o65_codec_t *o65_get_codec(const o65_header_t *header)
+{
+    unsigned index = 0;
+    if (header->mode & O65_MODE_32BIT)
+        index += 2;
+    if (header->mode & O65_MODE_PAGED)
+        index += 1;
+    return &(codecs[index]);
+}
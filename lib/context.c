@@ -0,0 +1,89 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65context.h"
+#include <errno.h>
+#include <stdlib.h>
+
+/**
+ * @brief Default allocator, which uses the C library.
+ *
+ * @param[in] user_data Not used.
+ * @param[in] ptr Previous allocation to resize or free, or NULL.
+ * @param[in] size New size for the allocation, or zero to free @a ptr.
+ *
+ * @return A pointer to the allocated memory, or NULL.
+ */
+static void *default_alloc(void *user_data, void *ptr, size_t size)
+{
+    (void)user_data;
+    if (!size) {
+        free(ptr);
+        return NULL;
+    }
+    return realloc(ptr, size);
+}
+
+void o65_context_init(o65_context_t *context)
+{
+    context->alloc = default_alloc;
+    context->alloc_data = NULL;
+    context->options = 0;
+    context->error = 0;
+}
+
+void *o65_context_alloc(o65_context_t *context, size_t size)
+{
+    return o65_context_realloc(context, NULL, size);
+}
+
+void *o65_context_realloc(o65_context_t *context, void *ptr, size_t size)
+{
+    void *new_ptr;
+    if (!size)
+        size = 1;
+    if (context && context->alloc)
+        new_ptr = context->alloc(context->alloc_data, ptr, size);
+    else
+        new_ptr = realloc(ptr, size);
+    if (!new_ptr)
+        o65_context_fail(context, ENOMEM);
+    return new_ptr;
+}
+
+void o65_context_free(o65_context_t *context, void *ptr)
+{
+    if (!ptr)
+        return;
+    if (context && context->alloc)
+        context->alloc(context->alloc_data, ptr, 0);
+    else
+        free(ptr);
+}
+
+int o65_context_fail(o65_context_t *context, int error)
+{
+    if (context)
+        context->error = error;
+    errno = error;
+    return -1;
+}
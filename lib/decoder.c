@@ -0,0 +1,458 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65compress.h"
+#include <string.h>
+#include <limits.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+/* Decoder states */
+#define STATE_DETECT        0   /**< Reading the magic number */
+#define STATE_PASS          1   /**< Passing uncompressed input through */
+#define STATE_INFLATE       2   /**< Inflating a gzip or zlib stream */
+#define STATE_INFLATE_END   3   /**< At the end of a gzip or zlib stream */
+#define STATE_LZ_HEADER     4   /**< Reading an LZ block header */
+#define STATE_LZ_BLOCK      5   /**< Reading the data for an LZ block */
+#define STATE_LZ_END        6   /**< At the end of an LZ frame */
+
+/** Size of the buffer for decompressed output */
+#define OUT_BUFFER_SIZE O65_LZ_BLOCK_SIZE
+
+o65_compression_t o65_detect_compression(const uint8_t *data, size_t size)
+{
+    if (size >= 2 && data[0] == 0x1F && data[1] == 0x8B)
+        return O65_COMPRESSION_GZIP;
+    if (size >= 2 && data[0] == 0x78 &&
+            ((((unsigned)(data[0])) << 8) | data[1]) % 31 == 0)
+        return O65_COMPRESSION_ZLIB;
+    if (size >= O65_COMPRESSION_MAGIC_SIZE &&
+            !memcmp(data, O65_LZ_MAGIC, O65_COMPRESSION_MAGIC_SIZE))
+        return O65_COMPRESSION_LZ;
+    return O65_COMPRESSION_NONE;
+}
+
+void o65_decoder_init
+    (o65_decoder_t *decoder, o65_context_t *context,
+     o65_output_callback_t output, void *user_data)
+{
+    memset(decoder, 0, sizeof(o65_decoder_t));
+    decoder->context = context;
+    decoder->output = output;
+    decoder->user_data = user_data;
+    decoder->state = STATE_DETECT;
+    decoder->result = 1;
+}
+
+void o65_decoder_free(o65_decoder_t *decoder)
+{
+#ifdef HAVE_ZLIB
+    if (decoder->zstream) {
+        inflateEnd((z_stream *)(decoder->zstream));
+        o65_context_free(decoder->context, decoder->zstream);
+    }
+#endif
+    o65_context_free(decoder->context, decoder->in);
+    o65_context_free(decoder->context, decoder->out);
+    decoder->zstream = NULL;
+    decoder->in = NULL;
+    decoder->out = NULL;
+    decoder->in_max = 0;
+}
+
+/**
+ * @brief Passes decompressed output to the output callback.
+ *
+ * @param[in,out] decoder The decoder.
+ * @param[in] data Points to the output.
+ * @param[in] size Number of bytes of output.
+ */
+static void emit(o65_decoder_t *decoder, const uint8_t *data, size_t size)
+{
+    int result;
+    if (size > 0 && decoder->result == 1) {
+        result = decoder->output(decoder->user_data, data, size);
+        if (result != 1)
+            decoder->result = result;
+    }
+}
+
+/**
+ * @brief Makes sure that the output buffer has been allocated.
+ *
+ * @param[in,out] decoder The decoder.
+ *
+ * @return Non-zero if OK, or zero if out of memory.
+ */
+static int alloc_output(o65_decoder_t *decoder)
+{
+    if (!(decoder->out)) {
+        decoder->out = (uint8_t *)o65_context_alloc
+            (decoder->context, OUT_BUFFER_SIZE);
+        if (!(decoder->out)) {
+            decoder->result = -1;
+            return 0;
+        }
+    }
+    return 1;
+}
+
+#ifdef HAVE_ZLIB
+
+/**
+ * @brief Allocates memory for zlib from the decoder's context.
+ */
+static voidpf zlib_alloc(voidpf opaque, uInt items, uInt size)
+{
+    if (size && items > ((size_t)-1) / size)
+        return Z_NULL;
+    return o65_context_alloc((o65_context_t *)opaque, (size_t)items * size);
+}
+
+/**
+ * @brief Frees memory for zlib to the decoder's context.
+ */
+static void zlib_free(voidpf opaque, voidpf ptr)
+{
+    o65_context_free((o65_context_t *)opaque, ptr);
+}
+
+/**
+ * @brief Starts inflating a gzip or zlib stream.
+ *
+ * @param[in,out] decoder The decoder.
+ */
+static void start_inflate(o65_decoder_t *decoder)
+{
+    z_stream *zs;
+    if (!alloc_output(decoder))
+        return;
+    zs = (z_stream *)o65_context_alloc(decoder->context, sizeof(z_stream));
+    if (!zs) {
+        decoder->result = -1;
+        return;
+    }
+    memset(zs, 0, sizeof(z_stream));
+    zs->zalloc = zlib_alloc;
+    zs->zfree = zlib_free;
+    zs->opaque = decoder->context;
+
+    /* Add 32 to the window bits to detect gzip or zlib automatically */
+    if (inflateInit2(zs, MAX_WBITS + 32) != Z_OK) {
+        o65_context_free(decoder->context, zs);
+        decoder->result = -1;
+        return;
+    }
+    decoder->zstream = zs;
+    decoder->state = STATE_INFLATE;
+}
+
+/**
+ * @brief Inflates a chunk of input.
+ *
+ * @param[in,out] decoder The decoder.
+ * @param[in] buf Points to the input.
+ * @param[in] size Number of bytes of input, which must fit in a uInt.
+ */
+static void inflate_input(o65_decoder_t *decoder, const uint8_t *buf, size_t size)
+{
+    z_stream *zs = (z_stream *)(decoder->zstream);
+    int ret;
+
+    zs->next_in = (Bytef *)buf;
+    zs->avail_in = (uInt)size;
+    for (;;) {
+        /* gzip files can have several members, one after the other */
+        if (decoder->state == STATE_INFLATE_END) {
+            if (!(zs->avail_in))
+                break;
+            if (decoder->format != O65_COMPRESSION_GZIP ||
+                    inflateReset(zs) != Z_OK) {
+                decoder->result = 0;
+                break;
+            }
+            decoder->state = STATE_INFLATE;
+        }
+
+        /* Inflate as much as we can into the output buffer */
+        zs->next_out = decoder->out;
+        zs->avail_out = OUT_BUFFER_SIZE;
+        ret = inflate(zs, Z_NO_FLUSH);
+        emit(decoder, decoder->out, OUT_BUFFER_SIZE - zs->avail_out);
+        if (ret == Z_STREAM_END) {
+            decoder->state = STATE_INFLATE_END;
+        } else if (ret == Z_MEM_ERROR) {
+            decoder->result = -1;
+        } else if (ret != Z_OK && ret != Z_BUF_ERROR) {
+            decoder->result = 0;
+        }
+        if (decoder->result != 1)
+            break;
+
+        /* Stop when the input is used up and there is no pending output */
+        if (decoder->state == STATE_INFLATE && !(zs->avail_in) &&
+                zs->avail_out != 0)
+            break;
+    }
+}
+
+#endif /* HAVE_ZLIB */
+
+/**
+ * @brief Starts decoding once the compression format is known.
+ *
+ * @param[in,out] decoder The decoder.
+ */
+static void start_format(o65_decoder_t *decoder)
+{
+    decoder->format = o65_detect_compression
+        (decoder->fixed, decoder->fixed_len);
+    switch (decoder->format) {
+    case O65_COMPRESSION_NONE:
+        decoder->state = STATE_PASS;
+        emit(decoder, decoder->fixed, decoder->fixed_len);
+        break;
+
+    case O65_COMPRESSION_GZIP:
+    case O65_COMPRESSION_ZLIB:
+#ifdef HAVE_ZLIB
+        start_inflate(decoder);
+        if (decoder->result == 1)
+            inflate_input(decoder, decoder->fixed, decoder->fixed_len);
+#else
+        decoder->result = 0;
+#endif
+        break;
+
+    case O65_COMPRESSION_LZ:
+        decoder->state = STATE_LZ_HEADER;
+        break;
+    }
+    decoder->fixed_len = 0;
+}
+
+/**
+ * @brief Parses the header for an LZ block.
+ *
+ * @param[in,out] decoder The decoder.
+ */
+static void start_lz_block(o65_decoder_t *decoder)
+{
+    size_t raw_size = o65_read_uint32(decoder->fixed);
+    size_t stored_size = o65_read_uint32(decoder->fixed + 4);
+    uint8_t *in;
+
+    /* An uncompressed size of zero ends the frame */
+    decoder->fixed_len = 0;
+    if (!raw_size) {
+        if (stored_size)
+            decoder->result = 0;
+        decoder->state = STATE_LZ_END;
+        return;
+    }
+    if (raw_size > O65_LZ_BLOCK_SIZE || !stored_size ||
+            stored_size > o65_lz_bound(raw_size)) {
+        decoder->result = 0;
+        return;
+    }
+
+    /* Make sure that there is room for the compressed block */
+    if (stored_size > decoder->in_max) {
+        in = (uint8_t *)o65_context_realloc
+            (decoder->context, decoder->in, o65_lz_bound(O65_LZ_BLOCK_SIZE));
+        if (!in) {
+            decoder->result = -1;
+            return;
+        }
+        decoder->in = in;
+        decoder->in_max = o65_lz_bound(O65_LZ_BLOCK_SIZE);
+    }
+    decoder->raw_size = raw_size;
+    decoder->in_size = stored_size;
+    decoder->in_len = 0;
+    decoder->state = STATE_LZ_BLOCK;
+}
+
+/**
+ * @brief Decodes a whole LZ block.
+ *
+ * @param[in,out] decoder The decoder.
+ * @param[in] data Points to the block data.
+ */
+static void decode_lz_block(o65_decoder_t *decoder, const uint8_t *data)
+{
+    size_t len;
+    decoder->state = STATE_LZ_HEADER;
+    if (decoder->in_size == decoder->raw_size) {
+        /* The block was stored without compression */
+        emit(decoder, data, decoder->raw_size);
+        return;
+    }
+    if (!alloc_output(decoder))
+        return;
+    if (!o65_lz_decompress(decoder->out, decoder->raw_size,
+                           data, decoder->in_size, &len) ||
+            len != decoder->raw_size) {
+        decoder->result = 0;
+        return;
+    }
+    emit(decoder, decoder->out, len);
+}
+
+int o65_decoder_feed(o65_decoder_t *decoder, const uint8_t *buf, size_t size)
+{
+    size_t len;
+    while (size > 0 && decoder->result == 1) {
+        switch (decoder->state) {
+        case STATE_DETECT:
+            /* Collect enough bytes to detect the format */
+            len = O65_COMPRESSION_MAGIC_SIZE - decoder->fixed_len;
+            if (len > size)
+                len = size;
+            memcpy(decoder->fixed + decoder->fixed_len, buf, len);
+            decoder->fixed_len += len;
+            buf += len;
+            size -= len;
+            if (decoder->fixed_len >= O65_COMPRESSION_MAGIC_SIZE)
+                start_format(decoder);
+            break;
+
+        case STATE_PASS:
+            emit(decoder, buf, size);
+            size = 0;
+            break;
+
+#ifdef HAVE_ZLIB
+        case STATE_INFLATE:
+        case STATE_INFLATE_END:
+            len = size < (size_t)UINT_MAX ? size : (size_t)UINT_MAX;
+            inflate_input(decoder, buf, len);
+            buf += len;
+            size -= len;
+            break;
+#endif
+
+        case STATE_LZ_HEADER:
+            len = 8 - decoder->fixed_len;
+            if (len > size)
+                len = size;
+            memcpy(decoder->fixed + decoder->fixed_len, buf, len);
+            decoder->fixed_len += len;
+            buf += len;
+            size -= len;
+            if (decoder->fixed_len >= 8)
+                start_lz_block(decoder);
+            break;
+
+        case STATE_LZ_BLOCK:
+            /* Decode directly from the input if we have the whole block */
+            if (!(decoder->in_len) && size >= decoder->in_size) {
+                decode_lz_block(decoder, buf);
+                buf += decoder->in_size;
+                size -= decoder->in_size;
+                break;
+            }
+            len = decoder->in_size - decoder->in_len;
+            if (len > size)
+                len = size;
+            memcpy(decoder->in + decoder->in_len, buf, len);
+            decoder->in_len += len;
+            buf += len;
+            size -= len;
+            if (decoder->in_len >= decoder->in_size)
+                decode_lz_block(decoder, decoder->in);
+            break;
+
+        default:
+            /* Trailing garbage after the end of the compressed stream */
+            decoder->result = 0;
+            break;
+        }
+    }
+    return decoder->result;
+}
+
+int o65_decoder_finish(o65_decoder_t *decoder)
+{
+    if (decoder->result != 1)
+        return decoder->result;
+
+    /* The input was too short to detect the format the usual way.  It may
+     * still be the start of a gzip or zlib stream that was cut off, so
+     * check the state that this leaves the decoder in like any other. */
+    if (decoder->state == STATE_DETECT && decoder->fixed_len > 0) {
+        start_format(decoder);
+        if (decoder->result != 1)
+            return decoder->result;
+    }
+    switch (decoder->state) {
+    case STATE_DETECT:
+    case STATE_PASS:
+    case STATE_INFLATE_END:
+    case STATE_LZ_END:
+        break;
+
+    default:
+        /* The compressed stream was truncated */
+        decoder->result = -1;
+        break;
+    }
+    return decoder->result;
+}
+
+/**
+ * @brief Output callback that appends to a writer.
+ */
+static int write_output(void *user_data, const uint8_t *data, size_t size)
+{
+    return o65_writer_bytes((o65_writer_t *)user_data, data, size) < 0 ? -1 : 1;
+}
+
+int o65_decompress
+    (o65_context_t *context, const uint8_t *data, size_t size,
+     uint8_t **out, size_t *out_size)
+{
+    o65_decoder_t decoder;
+    o65_writer_t writer;
+    int result;
+
+    /* Run the data through a decoder into a writer */
+    o65_writer_init(&writer, context);
+    o65_decoder_init(&decoder, context, write_output, &writer);
+    result = o65_decoder_feed(&decoder, data, size);
+    if (result == 1)
+        result = o65_decoder_finish(&decoder);
+    else if (result == -1)
+        result = -2;
+    o65_decoder_free(&decoder);
+
+    /* Out of memory is reported by the decoder or the writer */
+    if (result == -2 || writer.error) {
+        o65_writer_free(&writer);
+        *out = NULL;
+        *out_size = 0;
+        return -1;
+    }
+    *out = o65_writer_take(&writer, out_size);
+    return result == 1 ? 1 : 0;
+}
@@ -0,0 +1,508 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65dir.h"
+#include "o65compress.h"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/** Size of the read-ahead buffer for scanning the variable-length parts */
+#define SCAN_BUFFER_SIZE 4096
+
+/**
+ * @brief State for scanning forward through a file with pread(),
+ * or through a copy of the file that is already in memory.
+ */
+typedef struct
+{
+    int fd;                         /**< File descriptor to read from */
+    const uint8_t *data;            /**< Contents of the file, or NULL */
+    off_t posn;                     /**< Offset of the next byte to scan */
+    off_t size;                     /**< Size of the file */
+    off_t buf_start;                /**< Offset of the first byte in "buf" */
+    size_t buf_len;                 /**< Number of valid bytes in "buf" */
+    uint8_t buf[SCAN_BUFFER_SIZE];  /**< Read-ahead buffer */
+
+} scanner_t;
+
+/**
+ * @brief Reads a block of bytes from a file at a specific offset.
+ *
+ * @param[in] fd File descriptor to read from.
+ * @param[out] buf Buffer to read into.
+ * @param[in] len Number of bytes to read.
+ * @param[in] offset Offset within the file to read from.
+ *
+ * @return 1 on success, or -1 for a filesystem error or EOF.
+ */
+static int read_at(int fd, uint8_t *buf, size_t len, off_t offset)
+{
+    ssize_t result;
+    while (len > 0) {
+        result = pread(fd, buf, len, offset);
+        if (result < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        } else if (result == 0) {
+            return -1;
+        }
+        buf += result;
+        len -= (size_t)result;
+        offset += result;
+    }
+    return 1;
+}
+
+/**
+ * @brief Reads a block of bytes from the file or memory behind a scanner.
+ *
+ * @param[in] scanner The scanner.
+ * @param[out] buf Buffer to read into.
+ * @param[in] len Number of bytes to read, which must be within the file.
+ * @param[in] offset Offset within the file to read from.
+ *
+ * @return 1 on success, or -1 for a filesystem error or EOF.
+ */
+static int scan_read
+    (const scanner_t *scanner, uint8_t *buf, size_t len, off_t offset)
+{
+    if (scanner->data) {
+        memcpy(buf, scanner->data + offset, len);
+        return 1;
+    }
+    return read_at(scanner->fd, buf, len, offset);
+}
+
+/**
+ * @brief Gets the next byte from a scanner.
+ *
+ * @param[in,out] scanner The scanner.
+ * @param[out] value Returns the byte.
+ *
+ * @return 1 on success, or -1 for a filesystem error or EOF.
+ */
+static int scan_byte(scanner_t *scanner, uint8_t *value)
+{
+    off_t offset = scanner->posn - scanner->buf_start;
+    if (offset < 0 || offset >= (off_t)(scanner->buf_len)) {
+        /* Refill the read-ahead buffer at the current position */
+        off_t len = scanner->size - scanner->posn;
+        if (len <= 0)
+            return -1;
+        if (len > SCAN_BUFFER_SIZE)
+            len = SCAN_BUFFER_SIZE;
+        if (scan_read(scanner, scanner->buf, (size_t)len, scanner->posn) < 0)
+            return -1;
+        scanner->buf_start = scanner->posn;
+        scanner->buf_len = (size_t)len;
+        offset = 0;
+    }
+    *value = scanner->buf[offset];
+    ++(scanner->posn);
+    return 1;
+}
+
+/**
+ * @brief Gets a block of bytes from a scanner.
+ *
+ * @param[in,out] scanner The scanner.
+ * @param[out] buf Buffer to copy the bytes to.
+ * @param[in] len Number of bytes to get.
+ *
+ * @return 1 on success, or -1 for a filesystem error or EOF.
+ */
+static int scan_bytes(scanner_t *scanner, uint8_t *buf, size_t len)
+{
+    while (len > 0) {
+        if (scan_byte(scanner, buf) < 0)
+            return -1;
+        ++buf;
+        --len;
+    }
+    return 1;
+}
+
+/**
+ * @brief Skips bytes in a scanner without reading them.
+ *
+ * @param[in,out] scanner The scanner.
+ * @param[in] len Number of bytes to skip.
+ *
+ * @return 1 on success, or -1 if the skip goes past the end of the file.
+ */
+static int scan_skip(scanner_t *scanner, o65_size_t len)
+{
+    if ((scanner->size - scanner->posn) < (off_t)len)
+        return -1;
+    scanner->posn += len;
+    return 1;
+}
+
+/**
+ * @brief Gets a 16-bit or 32-bit count value from a scanner.
+ *
+ * @param[in,out] scanner The scanner.
+ * @param[in] codec Codec for the header mode.
+ * @param[out] count Returns the count value.
+ *
+ * @return 1 on success, or -1 for a filesystem error or EOF.
+ */
+static int scan_count
+    (scanner_t *scanner, const o65_codec_t *codec, o65_size_t *count)
+{
+    uint8_t buf[4];
+    if (scan_bytes(scanner, buf, codec->count_size) < 0)
+        return -1;
+    *count = codec->get_count(buf);
+    return 1;
+}
+
+/**
+ * @brief Skips over a NUL-terminated string in a scanner.
+ *
+ * @param[in,out] scanner The scanner.
+ *
+ * @return 1 on success, or -1 for a filesystem error or EOF.
+ */
+static int scan_string(scanner_t *scanner)
+{
+    uint8_t ch;
+    do {
+        if (scan_byte(scanner, &ch) < 0)
+            return -1;
+    } while (ch != 0);
+    return 1;
+}
+
+/**
+ * @brief Skips over a relocation table in a scanner.
+ *
+ * @param[in,out] scanner The scanner.
+ * @param[in] codec Codec for the header mode.
+ *
+ * @return 1 on success, or -1 for a filesystem error or EOF.
+ */
+static int scan_relocs(scanner_t *scanner, const o65_codec_t *codec)
+{
+    uint8_t offset;
+    uint8_t type;
+    for (;;) {
+        if (scan_byte(scanner, &offset) < 0)
+            return -1;
+        if (offset == 0)
+            break;
+        if (offset == 255)
+            continue;
+        if (scan_byte(scanner, &type) < 0)
+            return -1;
+        if (scan_skip(scanner, codec->reloc_size(type) - 2) < 0)
+            return -1;
+    }
+    return 1;
+}
+
+/**
+ * @brief Scans a single image with a scanner.
+ *
+ * @param[in,out] scanner The scanner, positioned at the start of the image.
+ * @param[out] image Returns the directory for the image.
+ *
+ * @return 1 if the image was scanned, 0 if the image is not in the .o65
+ * format, or -1 for a filesystem error or EOF.
+ */
+static int scan_image(scanner_t *scanner, o65_image_dir_t *image)
+{
+    const o65_codec_t *codec;
+    uint8_t buf[O65_HEADER_SIZE_32];
+    uint8_t option[O65_MAX_OPT_SIZE];
+    o65_span_t span;
+    o65_size_t index;
+    uint8_t len;
+    size_t header_len;
+    size_t text_size;
+    size_t data_size;
+    int result;
+
+    /* Clear the directory before we start */
+    memset(image, 0, sizeof(o65_image_dir_t));
+
+    /* Read and parse the header */
+    image->offsets[O65_SECTION_HEADER] = scanner->posn;
+    if (scan_bytes(scanner, buf, 8) < 0)
+        return -1;
+    result = o65_parse_header(buf, 8, &(image->header), &header_len);
+    if (result >= 0)
+        return result;
+    if (scan_bytes(scanner, buf + 8, header_len - 8) < 0)
+        return -1;
+    result = o65_parse_header(buf, header_len, &(image->header), &header_len);
+    if (result <= 0)
+        return result;
+    codec = o65_get_codec(&(image->header));
+
+    /* Skip the header options, except for the one that gives the sizes
+     * of the segments if they are compressed */
+    image->offsets[O65_SECTION_OPTIONS] = scanner->posn;
+    text_size = image->header.tlen;
+    data_size = image->header.dlen;
+    for (;;) {
+        if (scan_byte(scanner, &len) < 0)
+            return -1;
+        if (len == 0)
+            break;
+        if (len < 2)
+            return 0;
+        option[0] = len;
+        if (scan_byte(scanner, &(option[1])) < 0)
+            return -1;
+        if (option[1] != O65_OPT_COMPRESSED || image->compressed) {
+            if (scan_skip(scanner, len - 2) < 0)
+                return -1;
+            continue;
+        }
+        if (scan_bytes(scanner, option + 2, len - 2) < 0)
+            return -1;
+        span.data = option;
+        span.size = len;
+        result = o65_get_stored_sizes
+            (&span, &(image->header), &text_size, &data_size);
+        if (result < 0)
+            return 0;
+        image->compressed = result;
+    }
+
+    /* Skip the .text and .data segments without reading them */
+    image->offsets[O65_SECTION_TEXT] = scanner->posn;
+    if (scan_skip(scanner, (o65_size_t)text_size) < 0)
+        return -1;
+    image->offsets[O65_SECTION_DATA] = scanner->posn;
+    if (scan_skip(scanner, (o65_size_t)data_size) < 0)
+        return -1;
+
+    /* Skip the names of the external references */
+    image->offsets[O65_SECTION_EXTERNS] = scanner->posn;
+    if (scan_count(scanner, codec, &(image->num_externs)) < 0)
+        return -1;
+    for (index = 0; index < image->num_externs; ++index) {
+        if (scan_string(scanner) < 0)
+            return -1;
+    }
+
+    /* Skip the relocation tables */
+    image->offsets[O65_SECTION_TEXT_RELOCS] = scanner->posn;
+    if (scan_relocs(scanner, codec) < 0)
+        return -1;
+    image->offsets[O65_SECTION_DATA_RELOCS] = scanner->posn;
+    if (scan_relocs(scanner, codec) < 0)
+        return -1;
+
+    /* Skip the exported symbol definitions */
+    image->offsets[O65_SECTION_EXPORTS] = scanner->posn;
+    if (scan_count(scanner, codec, &(image->num_exports)) < 0)
+        return -1;
+    for (index = 0; index < image->num_exports; ++index) {
+        if (scan_string(scanner) < 0)
+            return -1;
+        if (scan_skip(scanner, 1) < 0) /* Segment identifier */
+            return -1;
+        if (scan_skip(scanner, codec->count_size) < 0)
+            return -1;
+    }
+
+    /* Done */
+    image->offsets[O65_SECTION_END] = scanner->posn;
+    return 1;
+}
+
+int o65_scan_image
+    (int fd, off_t offset, off_t size, o65_image_dir_t *image)
+{
+    scanner_t scanner;
+    scanner.fd = fd;
+    scanner.data = NULL;
+    scanner.posn = offset;
+    scanner.size = size;
+    scanner.buf_start = 0;
+    scanner.buf_len = 0;
+    return scan_image(&scanner, image);
+}
+
+/**
+ * @brief Scans all of the images in a chain.
+ *
+ * @param[in,out] dir The directory to add the images to.
+ * @param[in,out] scanner The scanner, positioned at the start of the file.
+ *
+ * @return 1 if the images were scanned, 0 if an image is not in the .o65
+ * format, or -1 for a filesystem error, EOF, or out of memory.
+ */
+static int scan_chain(o65_dir_t *dir, scanner_t *scanner)
+{
+    o65_image_dir_t *images;
+    o65_size_t max_images = 0;
+    int result;
+
+    for (;;) {
+        if (dir->num_images >= max_images) {
+            max_images = max_images ? max_images * 2 : 4;
+            images = (o65_image_dir_t *)o65_context_realloc
+                (dir->context, dir->images,
+                 max_images * sizeof(o65_image_dir_t));
+            if (!images)
+                return -1;
+            dir->images = images;
+        }
+        images = &(dir->images[dir->num_images]);
+        result = scan_image(scanner, images);
+        if (result <= 0)
+            return result;
+        ++(dir->num_images);
+        if ((images->header.mode & O65_MODE_CHAIN) == 0)
+            return 1;
+        scanner->posn = images->offsets[O65_SECTION_END];
+    }
+}
+
+/**
+ * @brief Cleans up a directory if scanning its images failed.
+ *
+ * @param[in,out] dir The directory.
+ * @param[in] result The result of scanning the images.
+ *
+ * @return @a result.
+ */
+static int finish_open(o65_dir_t *dir, int result)
+{
+    if (result <= 0) {
+        int saved_errno = errno;
+        o65_close(dir);
+        if (result < 0 && saved_errno)
+            o65_context_fail(dir->context, saved_errno);
+        errno = saved_errno;
+    }
+    return result;
+}
+
+int o65_open(o65_dir_t *dir, o65_context_t *context, const char *filename)
+{
+    struct stat st;
+    scanner_t scanner;
+
+    /* Clear the directory before we start */
+    memset(dir, 0, sizeof(o65_dir_t));
+    dir->context = context;
+
+    /* Open the file and find its size */
+    if ((dir->fd = open(filename, O_RDONLY, 0)) < 0)
+        return o65_context_fail(context, errno);
+    if (fstat(dir->fd, &st) < 0) {
+        int saved_errno = errno;
+        o65_close(dir);
+        return o65_context_fail(context, saved_errno);
+    }
+    dir->size = st.st_size;
+
+    /* Scan all of the images in the chain */
+    scanner.fd = dir->fd;
+    scanner.data = NULL;
+    scanner.posn = 0;
+    scanner.size = dir->size;
+    scanner.buf_start = 0;
+    scanner.buf_len = 0;
+    return finish_open(dir, scan_chain(dir, &scanner));
+}
+
+int o65_open_memory
+    (o65_dir_t *dir, o65_context_t *context, const uint8_t *data, size_t size)
+{
+    scanner_t scanner;
+
+    /* Clear the directory before we start */
+    memset(dir, 0, sizeof(o65_dir_t));
+    dir->fd = -1;
+    dir->data = data;
+    dir->size = (off_t)size;
+    dir->context = context;
+
+    /* Scan all of the images in the chain */
+    scanner.fd = -1;
+    scanner.data = data;
+    scanner.posn = 0;
+    scanner.size = dir->size;
+    scanner.buf_start = 0;
+    scanner.buf_len = 0;
+    return finish_open(dir, scan_chain(dir, &scanner));
+}
+
+void o65_close(o65_dir_t *dir)
+{
+    if (dir->fd >= 0)
+        close(dir->fd);
+    o65_context_free(dir->context, dir->images);
+    dir->fd = -1;
+    dir->data = NULL;
+    dir->num_images = 0;
+    dir->images = NULL;
+}
+
+size_t o65_section_size(const o65_image_dir_t *image, o65_section_t section)
+{
+    if (section >= O65_SECTION_END)
+        return 0;
+    return (size_t)(image->offsets[section + 1] - image->offsets[section]);
+}
+
+int o65_read_section
+    (const o65_dir_t *dir, const o65_image_dir_t *image,
+     o65_section_t section, uint8_t *buf)
+{
+    size_t size = o65_section_size(image, section);
+    if (!size)
+        return 1;
+    if (dir->data) {
+        memcpy(buf, dir->data + image->offsets[section], size);
+        return 1;
+    }
+    return read_at(dir->fd, buf, size, image->offsets[section]);
+}
+
+int o65_load_section
+    (const o65_dir_t *dir, const o65_image_dir_t *image,
+     o65_section_t section, uint8_t **buf, size_t *size)
+{
+    *size = o65_section_size(image, section);
+    *buf = (uint8_t *)o65_context_alloc(dir->context, *size);
+    if (!(*buf))
+        return -1;
+    if (o65_read_section(dir, image, section, *buf) < 0) {
+        int saved_errno = errno;
+        o65_context_free(dir->context, *buf);
+        *buf = NULL;
+        errno = saved_errno;
+        return -1;
+    }
+    return 1;
+}
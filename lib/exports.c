@@ -0,0 +1,227 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65exports.h"
+#include "o65hash.h"
+#include <string.h>
+
+/** Initial number of slots in the hash table */
+#define TABLE_INITIAL_SIZE 64
+
+/** Number of names to prefetch at once during batch lookups */
+#define BATCH_SIZE 8
+
+#if defined(__GNUC__)
+#define prefetch(addr) __builtin_prefetch((addr))
+#else
+#define prefetch(addr) do { (void)(addr); } while (0)
+#endif
+
+void o65_export_table_init
+    (o65_export_table_t *table, o65_context_t *context,
+     o65_string_pool_t *pool)
+{
+    memset(table, 0, sizeof(o65_export_table_t));
+    table->pool = pool;
+    table->context = context;
+}
+
+void o65_export_table_free(o65_export_table_t *table)
+{
+    o65_context_free(table->context, table->slots);
+    table->slots = NULL;
+    table->table_size = 0;
+    table->count = 0;
+}
+
+/**
+ * @brief Finds the slot for an interned name.
+ *
+ * @param[in] table The export table, which must have slots.
+ * @param[in] name The interned name to look for.
+ *
+ * @return The slot containing the name, or the empty slot where it
+ * should be inserted.
+ */
+static o65_export_entry_t *find_slot
+    (const o65_export_table_t *table, const o65_string_t *name)
+{
+    size_t mask = table->table_size - 1;
+    size_t index = (size_t)(name->hash) & mask;
+    while (table->slots[index].name && table->slots[index].name != name)
+        index = (index + 1) & mask;
+    return &(table->slots[index]);
+}
+
+/**
+ * @brief Doubles the size of the hash table.
+ *
+ * @param[in,out] table The export table.
+ *
+ * @return 1 on success, or -1 if out of memory.
+ */
+static int grow_table(o65_export_table_t *table)
+{
+    size_t new_size = table->table_size ? table->table_size * 2
+                                        : TABLE_INITIAL_SIZE;
+    o65_export_entry_t *old_slots = table->slots;
+    size_t old_size = table->table_size;
+    size_t index;
+
+    table->slots = (o65_export_entry_t *)o65_context_alloc
+        (table->context, new_size * sizeof(o65_export_entry_t));
+    if (!(table->slots)) {
+        table->slots = old_slots;
+        return -1;
+    }
+    memset(table->slots, 0, new_size * sizeof(o65_export_entry_t));
+    table->table_size = new_size;
+    for (index = 0; index < old_size; ++index) {
+        if (old_slots[index].name)
+            *find_slot(table, old_slots[index].name) = old_slots[index];
+    }
+    o65_context_free(table->context, old_slots);
+    return 1;
+}
+
+/**
+ * @brief Adds an export with an interned name to the table.
+ *
+ * @param[in,out] table The export table.
+ * @param[in] entry The export to add.
+ *
+ * @return 1 if the export was added, 0 if the name was already in the
+ * table, or -1 if out of memory.
+ */
+static int add_entry(o65_export_table_t *table, const o65_export_entry_t *entry)
+{
+    o65_export_entry_t *slot;
+
+    /* Keep the table at most three-quarters full */
+    if ((table->count + 1) * 4 > table->table_size * 3) {
+        if (grow_table(table) < 0)
+            return -1;
+    }
+    slot = find_slot(table, entry->name);
+    if (slot->name)
+        return 0;
+    *slot = *entry;
+    ++(table->count);
+    return 1;
+}
+
+int o65_export_table_add
+    (o65_export_table_t *table, const char *name, size_t len,
+     uint8_t segid, o65_size_t value)
+{
+    o65_export_entry_t entry;
+    entry.name = o65_string_intern(table->pool, name, len);
+    if (!(entry.name))
+        return -1;
+    entry.segid = segid;
+    entry.value = value;
+    return add_entry(table, &entry);
+}
+
+int o65_export_table_add_image
+    (o65_export_table_t *table, const o65_image_view_t *view)
+{
+    o65_export_entry_t local_exports[64];
+    o65_export_entry_t *exports = local_exports;
+    o65_size_t index;
+    int result;
+
+    /* Decode and intern all of the exports in a single pass */
+    if (view->num_exports > 64) {
+        exports = (o65_export_entry_t *)o65_context_alloc
+            (table->context, view->num_exports * sizeof(o65_export_entry_t));
+        if (!exports)
+            return -1;
+    }
+    result = o65_decode_exports(table->pool, view, exports);
+
+    /* Add the exports to the table */
+    for (index = 0; result > 0 && index < view->num_exports; ++index) {
+        if (add_entry(table, &(exports[index])) < 0)
+            result = -1;
+    }
+    if (exports != local_exports)
+        o65_context_free(table->context, exports);
+    return result;
+}
+
+const o65_export_entry_t *o65_export_table_find
+    (const o65_export_table_t *table, const char *name, size_t len)
+{
+    const o65_string_t *interned;
+
+    /* A name that was never interned cannot be in the table */
+    if (!(table->count))
+        return NULL;
+    interned = o65_string_find(table->pool, name, len);
+    if (!interned)
+        return NULL;
+    return o65_export_table_find_string(table, interned);
+}
+
+const o65_export_entry_t *o65_export_table_find_string
+    (const o65_export_table_t *table, const o65_string_t *name)
+{
+    const o65_export_entry_t *slot;
+    if (!(table->count))
+        return NULL;
+    slot = find_slot(table, name);
+    return slot->name ? slot : NULL;
+}
+
+size_t o65_export_table_find_batch
+    (const o65_export_table_t *table, o65_string_t * const *names,
+     size_t count, const o65_export_entry_t **results)
+{
+    size_t mask = table->table_size - 1;
+    size_t found = 0;
+    size_t group;
+    size_t index;
+
+    if (!(table->count)) {
+        for (index = 0; index < count; ++index)
+            results[index] = NULL;
+        return 0;
+    }
+    while (count > 0) {
+        /* Prefetch the home slots for the next group of names */
+        group = count < BATCH_SIZE ? count : BATCH_SIZE;
+        for (index = 0; index < group; ++index)
+            prefetch(&(table->slots[(size_t)(names[index]->hash) & mask]));
+
+        /* Probe for the names, which should now be in the cache */
+        for (index = 0; index < group; ++index) {
+            results[index] = o65_export_table_find_string(table, names[index]);
+            if (results[index])
+                ++found;
+        }
+        names += group;
+        results += group;
+        count -= group;
+    }
+    return found;
+}
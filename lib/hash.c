@@ -0,0 +1,255 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65hash.h"
+#include <string.h>
+
+/* Constants for the XXH64 algorithm */
+#define PRIME64_1 0x9E3779B185EBCA87ULL
+#define PRIME64_2 0xC2B2AE3D27D4EB4FULL
+#define PRIME64_3 0x165667B19E3779F9ULL
+#define PRIME64_4 0x85EBCA77C2B2AE63ULL
+#define PRIME64_5 0x27D4EB2F165667C5ULL
+
+/** Rotates a 64-bit value left */
+#define ROTL64(x, n) (((x) << (n)) | ((x) >> (64 - (n))))
+
+/**
+ * @brief Reads a 64-bit value in little-endian byte order.
+ */
+static inline uint64_t read_uint64(const uint8_t *buf)
+{
+    return ((uint64_t)o65_read_uint32(buf)) |
+           (((uint64_t)o65_read_uint32(buf + 4)) << 32);
+}
+
+/**
+ * @brief Mixes a 64-bit input word into a lane accumulator.
+ */
+static inline uint64_t hash_round(uint64_t acc, uint64_t input)
+{
+    acc += input * PRIME64_2;
+    acc = ROTL64(acc, 31);
+    return acc * PRIME64_1;
+}
+
+/**
+ * @brief Merges a lane accumulator into the final hash.
+ */
+static inline uint64_t merge_round(uint64_t acc, uint64_t lane)
+{
+    acc ^= hash_round(0, lane);
+    return acc * PRIME64_1 + PRIME64_4;
+}
+
+/**
+ * @brief Hashes whole 32-byte stripes into the four lanes.
+ *
+ * @param[in,out] lanes The lane accumulators.
+ * @param[in] data Points to the stripes.
+ * @param[in] count Number of stripes to hash.
+ *
+ * The lanes do not depend upon each other, so each iteration of the
+ * inner loop can be done in parallel.
+ */
+static void hash_stripes(uint64_t lanes[4], const uint8_t *data, size_t count)
+{
+    uint64_t v0 = lanes[0];
+    uint64_t v1 = lanes[1];
+    uint64_t v2 = lanes[2];
+    uint64_t v3 = lanes[3];
+    while (count > 0) {
+        v0 = hash_round(v0, read_uint64(data));
+        v1 = hash_round(v1, read_uint64(data + 8));
+        v2 = hash_round(v2, read_uint64(data + 16));
+        v3 = hash_round(v3, read_uint64(data + 24));
+        data += 32;
+        --count;
+    }
+    lanes[0] = v0;
+    lanes[1] = v1;
+    lanes[2] = v2;
+    lanes[3] = v3;
+}
+
+void o65_hash_init(o65_hash_t *hash, uint64_t seed)
+{
+    hash->lanes[0] = seed + PRIME64_1 + PRIME64_2;
+    hash->lanes[1] = seed + PRIME64_2;
+    hash->lanes[2] = seed;
+    hash->lanes[3] = seed - PRIME64_1;
+    hash->seed = seed;
+    hash->total = 0;
+    hash->buffer_len = 0;
+}
+
+void o65_hash_update(o65_hash_t *hash, const void *data, size_t size)
+{
+    const uint8_t *ptr = (const uint8_t *)data;
+    size_t len;
+
+    hash->total += size;
+
+    /* Complete a partial stripe from last time */
+    if (hash->buffer_len > 0) {
+        len = 32 - hash->buffer_len;
+        if (len > size)
+            len = size;
+        memcpy(hash->buffer + hash->buffer_len, ptr, len);
+        hash->buffer_len += len;
+        ptr += len;
+        size -= len;
+        if (hash->buffer_len < 32)
+            return;
+        hash_stripes(hash->lanes, hash->buffer, 1);
+        hash->buffer_len = 0;
+    }
+
+    /* Hash whole stripes directly from the input */
+    if (size >= 32) {
+        hash_stripes(hash->lanes, ptr, size / 32);
+        ptr += size & ~((size_t)31);
+        size &= 31;
+    }
+
+    /* Buffer the leftovers for next time */
+    memcpy(hash->buffer, ptr, size);
+    hash->buffer_len = size;
+}
+
+uint64_t o65_hash_final(const o65_hash_t *hash)
+{
+    const uint8_t *ptr = hash->buffer;
+    size_t size = hash->buffer_len;
+    uint64_t h;
+
+    /* Combine the lanes, or start from the seed for short inputs */
+    if (hash->total >= 32) {
+        h = ROTL64(hash->lanes[0], 1) + ROTL64(hash->lanes[1], 7) +
+            ROTL64(hash->lanes[2], 12) + ROTL64(hash->lanes[3], 18);
+        h = merge_round(h, hash->lanes[0]);
+        h = merge_round(h, hash->lanes[1]);
+        h = merge_round(h, hash->lanes[2]);
+        h = merge_round(h, hash->lanes[3]);
+    } else {
+        h = hash->seed + PRIME64_5;
+    }
+    h += hash->total;
+
+    /* Mix in the bytes of the final partial stripe */
+    while (size >= 8) {
+        h ^= hash_round(0, read_uint64(ptr));
+        h = ROTL64(h, 27) * PRIME64_1 + PRIME64_4;
+        ptr += 8;
+        size -= 8;
+    }
+    if (size >= 4) {
+        h ^= ((uint64_t)o65_read_uint32(ptr)) * PRIME64_1;
+        h = ROTL64(h, 23) * PRIME64_2 + PRIME64_3;
+        ptr += 4;
+        size -= 4;
+    }
+    while (size > 0) {
+        h ^= (*ptr++) * PRIME64_5;
+        h = ROTL64(h, 11) * PRIME64_1;
+        --size;
+    }
+
+    /* Final avalanche */
+    h ^= h >> 33;
+    h *= PRIME64_2;
+    h ^= h >> 29;
+    h *= PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+uint64_t o65_hash64(const void *data, size_t size, uint64_t seed)
+{
+    o65_hash_t hash;
+    o65_hash_init(&hash, seed);
+    o65_hash_update(&hash, data, size);
+    return o65_hash_final(&hash);
+}
+
+uint64_t o65_content_hash(const o65_image_view_t *view)
+{
+    o65_hash_t hash;
+    const uint8_t *end = view->start + view->size;
+    o65_hash_init(&hash, 0);
+    o65_hash_update
+        (&hash, view->start, (size_t)(view->options.data - view->start));
+    o65_hash_update(&hash, view->text.data, (size_t)(end - view->text.data));
+    return o65_hash_final(&hash);
+}
+
+/**
+ * @brief Finds the payload of the content hash option.
+ *
+ * @param[in] options Span containing the header options.
+ *
+ * @return A pointer to the payload, or NULL if there is no valid option.
+ */
+static const uint8_t *find_hash_option(const o65_span_t *options)
+{
+    o65_option_view_t option;
+    if (o65_find_option(options, O65_OPT_CONTENT_HASH, &option) &&
+            option.len == O65_CONTENT_HASH_SIZE)
+        return option.data;
+    return NULL;
+}
+
+int o65_find_content_hash(const o65_span_t *options, uint64_t *hash)
+{
+    const uint8_t *payload = find_hash_option(options);
+    if (!payload)
+        return 0;
+    *hash = read_uint64(payload);
+    return 1;
+}
+
+int o65_verify_content_hash(const o65_image_view_t *view)
+{
+    const uint8_t *payload = find_hash_option(&(view->options));
+    if (!payload)
+        return -1;
+    return read_uint64(payload) == o65_content_hash(view);
+}
+
+int o65_update_content_hash(uint8_t *buf, size_t size)
+{
+    o65_image_view_t view;
+    uint8_t *payload;
+    uint64_t hash;
+    int result;
+
+    result = o65_view_image(&view, buf, size);
+    if (result <= 0)
+        return result;
+    payload = (uint8_t *)find_hash_option(&(view.options));
+    if (!payload)
+        return 0;
+    hash = o65_content_hash(&view);
+    o65_write_uint32(payload, (uint32_t)hash);
+    o65_write_uint32(payload + 4, (uint32_t)(hash >> 32));
+    return 1;
+}
@@ -0,0 +1,436 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65load.h"
+#include "o65compress.h"
+#include <string.h>
+
+/** Number of external references that o65_relocate() resolves on the stack */
+#define LOCAL_EXTERNS 64
+
+/**
+ * @brief Aligns a size value.
+ *
+ * @param[in] size Size value to be aligned.
+ * @param[in] alignment Alignment to use, which must be a power of 2.
+ *
+ * @return The aligned size value.
+ */
+static o65_size_t align_size(o65_size_t size, o65_size_t alignment)
+{
+    return (size + alignment - 1) & ~(alignment - 1);
+}
+
+/**
+ * @brief Reports a failure in a layout.
+ *
+ * @param[out] layout The layout.
+ * @param[in] error The reason for the failure.
+ * @param[in] value The value that caused the failure.
+ *
+ * @return Always zero.
+ */
+static int layout_error(o65_layout_t *layout, int error, o65_size_t value)
+{
+    layout->error = error;
+    layout->error_value = value;
+    return 0;
+}
+
+int o65_layout_image
+    (o65_layout_t *layout, o65_context_t *context,
+     const o65_header_t *header, const o65_load_addresses_t *addresses)
+{
+    o65_size_t mask;
+
+    memset(layout, 0, sizeof(o65_layout_t));
+    layout->context = context;
+    layout->header = *header;
+
+    /* Must be an executable, not an object file, to be able to relocate it */
+    if (header->mode & O65_MODE_OBJ)
+        return layout_error(layout, O65_LOAD_ERROR_OBJECT, 0);
+
+    /* Pick a default load address for the .text segment */
+    layout->text_address = addresses->text_address;
+    if (!(layout->text_address)) {
+        layout->text_address = header->tbase;
+        if (!(layout->text_address))
+            return layout_error(layout, O65_LOAD_ERROR_ADDRESS, 0);
+    }
+
+    /* Select the segment alignment.  Paged images are always aligned
+     * on a page boundary, regardless of the alignment mode. */
+    switch (header->mode & O65_MODE_ALIGN) {
+    case O65_MODE_ALIGN_1:   layout->alignment = 1; break;
+    case O65_MODE_ALIGN_2:   layout->alignment = 2; break;
+    case O65_MODE_ALIGN_4:   layout->alignment = 4; break;
+    case O65_MODE_ALIGN_256: layout->alignment = 256; break;
+    }
+    if (header->mode & O65_MODE_PAGED)
+        layout->alignment = 256;
+
+    /* Validate the alignment of the load addresses */
+    mask = layout->alignment - 1;
+    if (layout->text_address & mask) {
+        return layout_error
+            (layout, O65_LOAD_ERROR_ALIGN_TEXT, layout->text_address);
+    }
+    if (addresses->data_address & mask) {
+        return layout_error
+            (layout, O65_LOAD_ERROR_ALIGN_DATA, addresses->data_address);
+    }
+    if (addresses->bss_address & mask) {
+        return layout_error
+            (layout, O65_LOAD_ERROR_ALIGN_BSS, addresses->bss_address);
+    }
+
+    /* Set the address and size of the .text segment.  An aligned size
+     * that is smaller than the original has wrapped around. */
+    layout->text_size = align_size(header->tlen, layout->alignment);
+    if (layout->text_size < header->tlen)
+        return layout_error(layout, O65_LOAD_ERROR_SIZE, O65_SEGID_TEXT);
+
+    /* Set the address and size of the .data segment */
+    if (addresses->data_address) {
+        layout->data_address = addresses->data_address;
+    } else {
+        layout->data_address = layout->text_address + layout->text_size;
+    }
+    layout->data_size = align_size(header->dlen, layout->alignment);
+    if (layout->data_size < header->dlen)
+        return layout_error(layout, O65_LOAD_ERROR_SIZE, O65_SEGID_DATA);
+    layout->data_load_size = layout->data_size;
+
+    /* Set the address and size of the .bss segment.  We ignore the
+     * load address override if the "bsszero" mode is set because we
+     * need to clear that region with zeroes as part of the final
+     * relocated image.  We cannot do that if .bss is located elsewhere. */
+    layout->bss_size = align_size(header->blen, layout->alignment);
+    if (layout->bss_size < header->blen)
+        return layout_error(layout, O65_LOAD_ERROR_SIZE, O65_SEGID_BSS);
+    if ((header->mode & O65_MODE_BSSZERO) != 0) {
+        layout->bss_address = layout->data_address + layout->data_size;
+        layout->data_load_size += layout->bss_size;
+        if (layout->data_load_size < layout->bss_size)
+            return layout_error(layout, O65_LOAD_ERROR_SIZE, O65_SEGID_BSS);
+    } else if (addresses->bss_address) {
+        layout->bss_address = addresses->bss_address;
+    } else {
+        layout->bss_address = layout->data_address + layout->data_size;
+    }
+
+    /* Set the address of the zero page segment */
+    layout->zeropage_address = addresses->zeropage_address;
+    return 1;
+}
+
+int o65_resolve_externs
+    (o65_layout_t *layout, const o65_image_view_t *view,
+     o65_size_t *externs, o65_resolve_callback_t resolve, void *user_data)
+{
+    const char *name = (const char *)(view->externs.data);
+    o65_size_t index;
+    int ok = 1;
+
+    /* The view has already checked that the names are NUL-terminated
+     * within the image.  Keep going after a failure so that the callback
+     * gets a chance to report every unresolved name. */
+    for (index = 0; index < view->num_externs; ++index) {
+        externs[index] = 0;
+        if (!resolve || !resolve(user_data, index, name, &(externs[index]))) {
+            if (ok)
+                layout_error(layout, O65_LOAD_ERROR_UNRESOLVED, index);
+            ok = 0;
+        }
+        name += strlen(name) + 1;
+    }
+    return ok;
+}
+
+/**
+ * @brief Applies a single relocation to a segment.
+ *
+ * @param[in,out] data Points to the segment data to patch.
+ * @param[in] addr Offset of the relocation within the segment.
+ * @param[in] type Relocation type; e.g. O65_RELOC_WORD.
+ * @param[in] extra Extra low bytes for HIGH and SEG types.
+ * @param[in] delta Adjustment to apply.
+ */
+static inline void apply_reloc
+    (uint8_t *data, o65_size_t addr, uint8_t type, uint16_t extra,
+     o65_size_t delta)
+{
+    o65_size_t vector;
+
+    /* See the ".o65" format spec for details:
+     * http://www.6502.org/users/andre/o65/fileformat.html */
+    switch (type) {
+    case O65_RELOC_WORD:
+        /* 16-bit word address */
+        vector = o65_read_uint16(data + addr);
+        vector += delta;
+        o65_write_uint16(data + addr, (uint16_t)vector);
+        break;
+
+    case O65_RELOC_SEGADR:
+        /* 24-bit segment address */
+        vector = o65_read_uint24(data + addr);
+        vector += delta;
+        o65_write_uint24(data + addr, vector);
+        break;
+
+    case O65_RELOC_HIGH:
+        /* High byte from the code, low byte from the relocation */
+        vector = (((uint16_t)(data[addr])) << 8) | extra;
+        vector += delta;
+        data[addr] = (uint8_t)(vector >> 8);
+        break;
+
+    case O65_RELOC_LOW:
+        /* Low byte from the code, high byte is irrelevant */
+        vector = data[addr];
+        vector += delta;
+        data[addr] = (uint8_t)vector;
+        break;
+
+    case O65_RELOC_SEG:
+        /* Segment byte from the code, low 16 bits from the relocation */
+        vector = (((uint32_t)(data[addr])) << 16) | extra;
+        vector += delta;
+        data[addr] = (uint8_t)(vector >> 16);
+        break;
+    }
+}
+
+/**
+ * @brief Apply the relocations for a segment.
+ *
+ * @param[in,out] layout Layout of the image.
+ * @param[in] relocs Span containing the encoded relocation table.
+ * @param[in] base Original base address of the segment.
+ * @param[in,out] data Points to the segment data to patch.
+ * @param[in] size Size of the segment.
+ * @param[in] adjust Adjustment to apply for each segment ID.
+ * @param[in] valid Bit mask of the segment ID's that are valid.
+ * @param[in] externs Addresses of the external references.
+ * @param[in] num_externs Number of external references.
+ *
+ * @return 1 on success, or 0 if the relocation table is invalid.
+ */
+static int relocate_segment
+    (o65_layout_t *layout, const o65_span_t *relocs, o65_size_t base,
+     uint8_t *data, o65_size_t size, const o65_size_t *adjust,
+     uint32_t valid, const o65_size_t *externs, o65_size_t num_externs)
+{
+    o65_reloc_iter_t iter;
+    o65_reloc_entry_t entry;
+    o65_size_t delta;
+    int result;
+
+    /* Read and apply all relocations for the segment.  The iterator
+     * checks that each relocation is within the bounds of the segment. */
+    o65_reloc_iter_init
+        (&iter, &(layout->header), relocs, base, size, num_externs);
+    while ((result = o65_reloc_iter_next(&iter, &entry)) > 0) {
+        /* Get the adjustment to apply based on the segment ID.
+         * ABS and other segment ID's are not allowed in relocations. */
+        if (!(valid & (((uint32_t)1) << entry.segid)))
+            return layout_error(layout, O65_LOAD_ERROR_SEGID, entry.segid);
+        if (entry.segid == O65_SEGID_UNDEF)
+            delta = externs[entry.undefid];
+        else
+            delta = adjust[entry.segid];
+
+        /* Apply the relocation */
+        apply_reloc(data, entry.offset, entry.type, entry.extra, delta);
+    }
+
+    /* Report why the iterator stopped if the table is invalid */
+    if (result < 0) {
+        if (iter.error == O65_RELOC_ERROR_RANGE)
+            return layout_error(layout, O65_LOAD_ERROR_RANGE, entry.offset);
+        else if (iter.error == O65_RELOC_ERROR_EXTERN)
+            return layout_error(layout, O65_LOAD_ERROR_EXTERN, entry.undefid);
+        else
+            return layout_error(layout, O65_LOAD_ERROR_TRUNCATED, 0);
+    }
+    return 1;
+}
+
+/**
+ * @brief Apply the relocations for a segment that has been validated.
+ *
+ * @param[in] header Header of the image.
+ * @param[in] relocs Span containing the encoded relocation table.
+ * @param[in,out] data Points to the segment data to patch.
+ * @param[in] adjust Adjustment to apply for each segment ID.
+ * @param[in] externs Addresses of the external references.
+ *
+ * o65_validate() has already checked the bounds, types, segment ID's,
+ * and external references of every entry, so this decodes the table
+ * directly without checking anything.
+ */
+static void relocate_segment_verified
+    (const o65_header_t *header, const o65_span_t *relocs, uint8_t *data,
+     const o65_size_t *adjust, const o65_size_t *externs)
+{
+    const o65_codec_t *codec = o65_get_codec(header);
+    const uint8_t *ptr = relocs->data;
+    int paged = (header->mode & O65_MODE_PAGED) != 0;
+    o65_size_t addr = ~((o65_size_t)0); /* Relocations start at base - 1 */
+    o65_size_t delta;
+    uint16_t extra;
+    uint8_t type;
+
+    for (;;) {
+        /* Zero ends the table and 255 skips ahead by 254 bytes */
+        if (*ptr == 0)
+            break;
+        if (*ptr == 255) {
+            addr += 254;
+            ++ptr;
+            continue;
+        }
+        addr += *ptr;
+        type = ptr[1];
+        ptr += 2;
+
+        /* Find the adjustment from the segment ID or external */
+        if ((type & O65_RELOC_SEGID) == O65_SEGID_UNDEF) {
+            delta = externs[codec->get_count(ptr)];
+            ptr += codec->count_size;
+        } else {
+            delta = adjust[type & O65_RELOC_SEGID];
+        }
+
+        /* Get the extra low bytes and apply the relocation */
+        type &= O65_RELOC_TYPE;
+        extra = 0;
+        if (type == O65_RELOC_HIGH) {
+            if (!paged)
+                extra = *ptr++;
+        } else if (type == O65_RELOC_SEG) {
+            extra = o65_read_uint16(ptr);
+            ptr += 2;
+        }
+        apply_reloc(data, addr, type, extra, delta);
+    }
+}
+
+int o65_relocate_resolved
+    (o65_layout_t *layout, const o65_image_view_t *view,
+     uint8_t *text, uint8_t *data, const o65_size_t *externs)
+{
+    const o65_header_t *header = &(layout->header);
+    o65_size_t adjust[O65_SEGID_ZEROPAGE + 1];
+    uint32_t valid;
+
+    /* The segments must fit in the memory that the layout describes.
+     * They always do if the layout was made from this image's header. */
+    if (view->header.tlen > layout->text_size)
+        return layout_error(layout, O65_LOAD_ERROR_SIZE, O65_SEGID_TEXT);
+    if (view->header.dlen > layout->data_size ||
+            layout->data_size > layout->data_load_size)
+        return layout_error(layout, O65_LOAD_ERROR_SIZE, O65_SEGID_DATA);
+
+    /* Copy the contents of the .text and .data segments from the image
+     * and zero the alignment padding and the .bss segment if needed.
+     * Compressed segments are decoded straight into place. */
+    if (view->compressed) {
+        if (!o65_lz_decode_segment(text, view->header.tlen,
+                                   view->text.data, view->text.size)) {
+            return layout_error
+                (layout, O65_LOAD_ERROR_SEGMENT, O65_SEGID_TEXT);
+        }
+        if (!o65_lz_decode_segment(data, view->header.dlen,
+                                   view->data.data, view->data.size)) {
+            return layout_error
+                (layout, O65_LOAD_ERROR_SEGMENT, O65_SEGID_DATA);
+        }
+    } else {
+        if (view->header.tlen)
+            memcpy(text, view->text.data, view->header.tlen);
+        if (view->header.dlen)
+            memcpy(data, view->data.data, view->header.dlen);
+    }
+    memset(text + view->header.tlen, 0, layout->text_size - view->header.tlen);
+    memset(data + view->header.dlen, 0,
+           layout->data_load_size - view->header.dlen);
+
+    /* Compute the adjustment for each segment once up front */
+    adjust[O65_SEGID_UNDEF] = 0;
+    adjust[O65_SEGID_ABS] = 0;
+    adjust[O65_SEGID_TEXT] = layout->text_address - header->tbase;
+    adjust[O65_SEGID_DATA] = layout->data_address - header->dbase;
+    adjust[O65_SEGID_BSS] = layout->bss_address - header->bbase;
+    adjust[O65_SEGID_ZEROPAGE] = layout->zeropage_address - header->zbase;
+    valid = (1U << O65_SEGID_UNDEF) | (1U << O65_SEGID_TEXT) |
+            (1U << O65_SEGID_DATA) | (1U << O65_SEGID_BSS) |
+            (1U << O65_SEGID_ZEROPAGE);
+
+    /* Relocate the .text and .data segments, without checking each
+     * entry if o65_validate() has already checked them */
+    if (view->verified) {
+        relocate_segment_verified
+            (header, &(view->text_relocs), text, adjust, externs);
+        relocate_segment_verified
+            (header, &(view->data_relocs), data, adjust, externs);
+        return 1;
+    }
+    if (!relocate_segment(layout, &(view->text_relocs), header->tbase,
+                          text, layout->text_size, adjust, valid,
+                          externs, view->num_externs))
+        return 0;
+    return relocate_segment(layout, &(view->data_relocs), header->dbase,
+                            data, layout->data_size, adjust, valid,
+                            externs, view->num_externs);
+}
+
+int o65_relocate
+    (o65_layout_t *layout, const o65_image_view_t *view,
+     uint8_t *text, uint8_t *data,
+     o65_resolve_callback_t resolve, void *user_data)
+{
+    o65_size_t local_externs[LOCAL_EXTERNS];
+    o65_size_t *externs = local_externs;
+    int result;
+
+    /* Most images only have a handful of external references, so avoid
+     * allocating memory for the resolved addresses unless necessary */
+    if (view->num_externs > LOCAL_EXTERNS) {
+        externs = o65_context_alloc
+            (layout->context, view->num_externs * sizeof(o65_size_t));
+        if (!externs)
+            return -1;
+    }
+
+    /* Resolve the external references and then relocate the image */
+    result = o65_resolve_externs(layout, view, externs, resolve, user_data);
+    if (result > 0)
+        result = o65_relocate_resolved(layout, view, text, data, externs);
+
+    /* Clean up and exit */
+    if (externs != local_externs)
+        o65_context_free(layout->context, externs);
+    return result;
+}
@@ -0,0 +1,491 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65compress.h"
+#include <string.h>
+
+/*
+ * Blocks are a sequence of LZ77 "sequences" in the style of LZ4.
+ * Each sequence starts with a token byte: the high nibble is the number
+ * of literals and the low nibble is the match length minus 4.  A nibble
+ * of 15 is followed by extra length bytes, which are added on until a
+ * byte other than 255 is seen.  The literals follow, then a 16-bit
+ * little-endian match offset, then the extra match length bytes.
+ * The last sequence in a block has literals only.
+ */
+
+/** Shortest match that is worth encoding */
+#define MIN_MATCH 4
+
+/** Furthest distance back that a match can refer to */
+#define MAX_OFFSET 65535
+
+/** Number of bits in the hash table for finding matches */
+#define HASH_BITS 12
+
+/**
+ * @brief Hashes the four bytes at a position in the input.
+ *
+ * @param[in] ptr Points to the bytes to hash.
+ *
+ * @return The hash table index.
+ */
+static uint32_t hash4(const uint8_t *ptr)
+{
+    uint32_t value = ((uint32_t)(ptr[0])) | (((uint32_t)(ptr[1])) << 8) |
+                     (((uint32_t)(ptr[2])) << 16) | (((uint32_t)(ptr[3])) << 24);
+    return (value * 2654435761U) >> (32 - HASH_BITS);
+}
+
+/**
+ * @brief Writes an extended length.
+ *
+ * @param[in,out] op Output pointer.
+ * @param[in] oend End of the output buffer.
+ * @param[in] len Length beyond the 15 that is in the token.
+ *
+ * @return Non-zero if OK, zero if the output buffer is full.
+ */
+static int put_length(uint8_t **op, const uint8_t *oend, size_t len)
+{
+    uint8_t *ptr = *op;
+    while (len >= 255) {
+        if (ptr >= oend)
+            return 0;
+        *ptr++ = 255;
+        len -= 255;
+    }
+    if (ptr >= oend)
+        return 0;
+    *ptr++ = (uint8_t)len;
+    *op = ptr;
+    return 1;
+}
+
+/**
+ * @brief Writes a sequence.
+ *
+ * @param[in,out] op Output pointer.
+ * @param[in] oend End of the output buffer.
+ * @param[in] literals Points to the literals.
+ * @param[in] num_literals Number of literals.
+ * @param[in] offset Match offset, or zero for the last sequence.
+ * @param[in] match_len Match length, including MIN_MATCH.
+ *
+ * @return Non-zero if OK, zero if the output buffer is full.
+ */
+static int put_sequence
+    (uint8_t **op, const uint8_t *oend, const uint8_t *literals,
+     size_t num_literals, size_t offset, size_t match_len)
+{
+    uint8_t *ptr = *op;
+    size_t extra = offset ? match_len - MIN_MATCH : 0;
+    if (ptr >= oend)
+        return 0;
+    *ptr++ = (uint8_t)(((num_literals < 15 ? num_literals : 15) << 4) |
+                       (extra < 15 ? extra : 15));
+    if (num_literals >= 15 && !put_length(&ptr, oend, num_literals - 15))
+        return 0;
+    if ((size_t)(oend - ptr) < num_literals)
+        return 0;
+    memcpy(ptr, literals, num_literals);
+    ptr += num_literals;
+    if (offset) {
+        if ((oend - ptr) < 2)
+            return 0;
+        *ptr++ = (uint8_t)offset;
+        *ptr++ = (uint8_t)(offset >> 8);
+        if (extra >= 15 && !put_length(&ptr, oend, extra - 15))
+            return 0;
+    }
+    *op = ptr;
+    return 1;
+}
+
+size_t o65_lz_compress
+    (uint8_t *dst, size_t dst_size, const uint8_t *src, size_t size)
+{
+    uint32_t table[1 << HASH_BITS];
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *end = src + size;
+    const uint8_t *ref;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + dst_size;
+    size_t match_len;
+    uint32_t hash;
+
+    /* Find matches greedily with a single-entry hash table */
+    memset(table, 0, sizeof(table));
+    while ((size_t)(end - ip) >= MIN_MATCH) {
+        hash = hash4(ip);
+        ref = src + table[hash];
+        table[hash] = (uint32_t)(ip - src);
+        if (ref >= ip || (size_t)(ip - ref) > MAX_OFFSET ||
+                memcmp(ref, ip, MIN_MATCH) != 0) {
+            ++ip;
+            continue;
+        }
+        match_len = MIN_MATCH;
+        while ((ip + match_len) < end && ref[match_len] == ip[match_len])
+            ++match_len;
+        if (!put_sequence(&op, oend, anchor, (size_t)(ip - anchor),
+                          (size_t)(ip - ref), match_len))
+            return 0;
+        ip += match_len;
+        anchor = ip;
+    }
+
+    /* The remaining bytes are output as literals */
+    if (!put_sequence(&op, oend, anchor, (size_t)(end - anchor), 0, 0))
+        return 0;
+    return (size_t)(op - dst);
+}
+
+/**
+ * @brief Reads an extended length.
+ *
+ * @param[in,out] ip Input pointer.
+ * @param[in] iend End of the input.
+ * @param[in,out] len Length to add to.
+ *
+ * @return Non-zero if OK, zero if the input is truncated.
+ */
+static int get_length(const uint8_t **ip, const uint8_t *iend, size_t *len)
+{
+    const uint8_t *ptr = *ip;
+    uint8_t value;
+    do {
+        if (ptr >= iend)
+            return 0;
+        value = *ptr++;
+        *len += value;
+    } while (value == 255);
+    *ip = ptr;
+    return 1;
+}
+
+int o65_lz_decompress
+    (uint8_t *dst, size_t dst_size, const uint8_t *src, size_t size,
+     size_t *len)
+{
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + size;
+    uint8_t *op = dst;
+    const uint8_t *oend = dst + dst_size;
+    const uint8_t *ref;
+    size_t num_literals;
+    size_t match_len;
+    size_t offset;
+    uint8_t token;
+
+    *len = 0;
+    while (ip < iend) {
+        /* Copy the literals */
+        token = *ip++;
+        num_literals = token >> 4;
+        if (num_literals == 15 && !get_length(&ip, iend, &num_literals))
+            return 0;
+        if (num_literals > (size_t)(iend - ip) ||
+                num_literals > (size_t)(oend - op))
+            return 0;
+        memcpy(op, ip, num_literals);
+        ip += num_literals;
+        op += num_literals;
+
+        /* The last sequence has no match */
+        if (ip >= iend)
+            break;
+
+        /* Copy the match, which may overlap the output */
+        if ((iend - ip) < 2)
+            return 0;
+        offset = ip[0] | (((size_t)(ip[1])) << 8);
+        ip += 2;
+        if (!offset || offset > (size_t)(op - dst))
+            return 0;
+        match_len = token & 0x0F;
+        if (match_len == 15 && !get_length(&ip, iend, &match_len))
+            return 0;
+        match_len += MIN_MATCH;
+        if (match_len > (size_t)(oend - op))
+            return 0;
+        ref = op - offset;
+        while (match_len-- > 0)
+            *op++ = *ref++;
+    }
+    *len = (size_t)(op - dst);
+    return 1;
+}
+
+int o65_lz_encode_frame
+    (o65_writer_t *writer, const uint8_t *data, size_t size)
+{
+    size_t block_size;
+    size_t len;
+    uint8_t *ptr;
+
+    if (o65_writer_bytes(writer, O65_LZ_MAGIC, O65_COMPRESSION_MAGIC_SIZE) < 0)
+        return -1;
+    while (size > 0) {
+        /* Compress the next block, or store it if compression does not help */
+        block_size = size < O65_LZ_BLOCK_SIZE ? size : O65_LZ_BLOCK_SIZE;
+        ptr = o65_writer_reserve(writer, 8 + o65_lz_bound(block_size));
+        if (!ptr)
+            return -1;
+        len = o65_lz_compress(ptr + 8, o65_lz_bound(block_size),
+                              data, block_size);
+        if (!len || len >= block_size) {
+            memcpy(ptr + 8, data, block_size);
+            len = block_size;
+        }
+        o65_write_uint32(ptr, (uint32_t)block_size);
+        o65_write_uint32(ptr + 4, (uint32_t)len);
+        writer->size -= o65_lz_bound(block_size) - len;
+        data += block_size;
+        size -= block_size;
+    }
+
+    /* A block with an uncompressed size of zero ends the frame */
+    ptr = o65_writer_reserve(writer, 8);
+    if (!ptr)
+        return -1;
+    memset(ptr, 0, 8);
+    return 0;
+}
+
+int o65_lz_encode_segment
+    (o65_writer_t *writer, const uint8_t *data, size_t size,
+     size_t *stored_size)
+{
+    size_t len;
+    uint8_t *ptr;
+
+    /* Compress the segment, or store it if compression does not help */
+    *stored_size = 0;
+    ptr = o65_writer_reserve(writer, o65_lz_bound(size));
+    if (!ptr)
+        return -1;
+    len = o65_lz_compress(ptr, o65_lz_bound(size), data, size);
+    if (!len || len >= size) {
+        if (size)
+            memcpy(ptr, data, size);
+        len = size;
+    }
+    writer->size -= o65_lz_bound(size) - len;
+    *stored_size = len;
+    return 0;
+}
+
+int o65_lz_decode_segment
+    (uint8_t *dst, size_t size, const uint8_t *src, size_t stored_size)
+{
+    size_t len;
+
+    /* A segment that is the same size as its stored form is not compressed */
+    if (stored_size == size) {
+        if (size)
+            memcpy(dst, src, size);
+        return 1;
+    }
+    if (stored_size > size)
+        return 0;
+    return o65_lz_decompress(dst, size, src, stored_size, &len) && len == size;
+}
+
+int o65_get_stored_sizes
+    (const o65_span_t *options, const o65_header_t *header,
+     size_t *text_size, size_t *data_size)
+{
+    o65_option_view_t option;
+
+    /* Segments are stored as-is unless there is a compression option */
+    *text_size = header->tlen;
+    *data_size = header->dlen;
+    if (!o65_find_option(options, O65_OPT_COMPRESSED, &option))
+        return 0;
+
+    /* The payload is the method and the 32-bit stored segment sizes.
+     * Compression never makes a segment larger than the original. */
+    if (option.len != O65_COMPRESSED_OPT_LEN - 2 ||
+            option.data[0] != O65_SEGMENT_LZ)
+        return -1;
+    *text_size = o65_read_uint32(option.data + 1);
+    *data_size = o65_read_uint32(option.data + 5);
+    if (*text_size > header->tlen || *data_size > header->dlen)
+        return -1;
+    return 1;
+}
+
+/* States for the incremental segment decoder */
+#define LZ_STATE_STORED     0   /**< Copying a segment that is not compressed */
+#define LZ_STATE_TOKEN      1   /**< Waiting for the token of a sequence */
+#define LZ_STATE_LITERAL_LEN 2  /**< Reading extra literal length bytes */
+#define LZ_STATE_LITERALS   3   /**< Copying literals */
+#define LZ_STATE_OFFSET_LO  4   /**< Waiting for the low byte of the offset */
+#define LZ_STATE_OFFSET_HI  5   /**< Waiting for the high byte of the offset */
+#define LZ_STATE_MATCH_LEN  6   /**< Reading extra match length bytes */
+#define LZ_STATE_DONE       7   /**< Last sequence has been decoded */
+#define LZ_STATE_ERROR      8   /**< Stored form is invalid */
+
+void o65_lz_stream_init
+    (o65_lz_stream_t *stream, uint8_t *dst, size_t size, size_t stored_size)
+{
+    stream->dst = dst;
+    stream->size = size;
+    stream->posn = 0;
+    stream->remaining = stored_size;
+    stream->count = 0;
+    stream->offset = 0;
+    stream->token = 0;
+    if (stored_size == size)
+        stream->state = LZ_STATE_STORED;
+    else if (stored_size > size)
+        stream->state = LZ_STATE_ERROR;
+    else
+        stream->state = LZ_STATE_TOKEN;
+}
+
+/**
+ * @brief Copies a match from earlier in the output of a segment decoder.
+ *
+ * @param[in,out] stream The decoder.
+ *
+ * @return 1 if the match was copied, or 0 if it is invalid.
+ */
+static int copy_match(o65_lz_stream_t *stream)
+{
+    uint8_t *op = stream->dst + stream->posn;
+    const uint8_t *ref;
+    size_t match_len = stream->count + MIN_MATCH;
+
+    /* The match may overlap the output, so copy it a byte at a time */
+    if (!stream->offset || stream->offset > stream->posn ||
+            match_len > stream->size - stream->posn)
+        return 0;
+    ref = op - stream->offset;
+    stream->posn += match_len;
+    while (match_len-- > 0)
+        *op++ = *ref++;
+    return 1;
+}
+
+int o65_lz_stream_feed(o65_lz_stream_t *stream, const uint8_t *buf, size_t len)
+{
+    const uint8_t *end = buf + len;
+    size_t chunk;
+    uint8_t value;
+
+    /* The chunk must not extend past the end of the stored form */
+    if (len > stream->remaining)
+        stream->state = LZ_STATE_ERROR;
+    else
+        stream->remaining -= len;
+    while (buf < end) {
+        switch (stream->state) {
+        case LZ_STATE_STORED:
+            chunk = (size_t)(end - buf);
+            memcpy(stream->dst + stream->posn, buf, chunk);
+            stream->posn += chunk;
+            buf += chunk;
+            break;
+
+        case LZ_STATE_TOKEN:
+            stream->token = *buf++;
+            stream->count = stream->token >> 4;
+            stream->state = (stream->count == 15) ? LZ_STATE_LITERAL_LEN
+                                                  : LZ_STATE_LITERALS;
+            break;
+
+        case LZ_STATE_LITERAL_LEN:
+        case LZ_STATE_MATCH_LEN:
+            value = *buf++;
+            stream->count += value;
+            if (value == 255)
+                break;
+            if (stream->state == LZ_STATE_LITERAL_LEN) {
+                stream->state = LZ_STATE_LITERALS;
+            } else if (copy_match(stream)) {
+                stream->state = LZ_STATE_TOKEN;
+            } else {
+                stream->state = LZ_STATE_ERROR;
+            }
+            break;
+
+        case LZ_STATE_LITERALS:
+            chunk = (size_t)(end - buf);
+            if (chunk > stream->count)
+                chunk = stream->count;
+            if (chunk > stream->size - stream->posn) {
+                stream->state = LZ_STATE_ERROR;
+                break;
+            }
+            memcpy(stream->dst + stream->posn, buf, chunk);
+            stream->posn += chunk;
+            stream->count -= chunk;
+            buf += chunk;
+            break;
+
+        case LZ_STATE_OFFSET_LO:
+            stream->offset = *buf++;
+            stream->state = LZ_STATE_OFFSET_HI;
+            break;
+
+        case LZ_STATE_OFFSET_HI:
+            stream->offset |= ((size_t)(*buf++)) << 8;
+            stream->count = stream->token & 0x0F;
+            if (stream->count == 15) {
+                stream->state = LZ_STATE_MATCH_LEN;
+            } else if (copy_match(stream)) {
+                stream->state = LZ_STATE_TOKEN;
+            } else {
+                stream->state = LZ_STATE_ERROR;
+            }
+            break;
+
+        default:
+            /* Nothing can follow the last sequence or an error */
+            stream->state = LZ_STATE_ERROR;
+            return 0;
+        }
+
+        /* Once the literals have been copied, the sequence either ends
+         * the segment or continues with a match offset */
+        if (stream->state == LZ_STATE_LITERALS && stream->count == 0) {
+            if (buf >= end && stream->remaining == 0)
+                stream->state = LZ_STATE_DONE;
+            else
+                stream->state = LZ_STATE_OFFSET_LO;
+        }
+    }
+    return stream->state != LZ_STATE_ERROR;
+}
+
+int o65_lz_stream_finish(const o65_lz_stream_t *stream)
+{
+    /* Like o65_lz_decompress(), the input may end after a match */
+    if (stream->remaining != 0 || stream->posn != stream->size)
+        return 0;
+    return stream->state == LZ_STATE_STORED ||
+           stream->state == LZ_STATE_TOKEN ||
+           stream->state == LZ_STATE_DONE;
+}
@@ -0,0 +1,389 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "o65model.h"
+#include "o65writer.h"
+#include "o65compress.h"
+#include "o65hash.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * @brief Copies a NUL-terminated string out of a parsed image.
+ *
+ * @param[in,out] arena The arena to allocate the copy from.
+ * @param[in,out] ptr Points to the current position in the image.
+ *
+ * @return A copy of the string, or NULL if out of memory.
+ */
+static char *get_string(o65_arena_t *arena, const uint8_t **ptr)
+{
+    size_t len = strlen((const char *)(*ptr));
+    char *str = o65_arena_strndup(arena, (const char *)(*ptr), len);
+    *ptr += len + 1;
+    return str;
+}
+
+/**
+ * @brief Copies the contents of a segment out of a parsed image.
+ *
+ * @param[in,out] arena The arena to allocate the copy from.
+ * @param[out] data Returns the copy of the segment.
+ * @param[in] segment The stored form of the segment.
+ * @param[in] size Size of the segment once it is decoded.
+ * @param[in] compressed Non-zero if the stored form is compressed.
+ *
+ * @return 1 on success, 0 if the compressed segment is invalid,
+ * or -1 if out of memory.
+ */
+static int get_segment
+    (o65_arena_t *arena, uint8_t **data, const o65_span_t *segment,
+     size_t size, int compressed)
+{
+    if ((*data = (uint8_t *)o65_arena_alloc(arena, size)) == NULL)
+        return -1;
+    if (compressed)
+        return o65_lz_decode_segment(*data, size, segment->data, segment->size);
+    if (size)
+        memcpy(*data, segment->data, size);
+    return 1;
+}
+
+/**
+ * @brief Loads a single image from a view.
+ *
+ * @param[out] image The image to load into, which must be empty.
+ * @param[in] view The view of the image to load.
+ *
+ * @return 1 on success, 0 if a compressed segment is invalid,
+ * or -1 if out of memory.
+ */
+static int load_image(o65_image_t *image, const o65_image_view_t *view)
+{
+    const o65_header_t *header = &(view->header);
+    const o65_codec_t *codec = o65_get_codec(header);
+    o65_arena_t *arena = &(image->arena);
+    const uint8_t *ptr;
+    const uint8_t *end;
+    o65_size_t index;
+    int result;
+
+    /* Copy the header */
+    image->header = view->header;
+
+    /* Copy the header options.  The segments are decompressed below,
+     * so the option that describes their compressed form is dropped. */
+    ptr = view->options.data;
+    end = ptr + view->options.size;
+    while (ptr < end) {
+        if (ptr[1] != O65_OPT_COMPRESSED)
+            ++(image->num_options);
+        ptr += *ptr;
+    }
+    if (image->num_options) {
+        image->options = (o65_option_t *)o65_arena_calloc
+            (arena, image->num_options, sizeof(o65_option_t));
+        if (!(image->options))
+            return -1;
+        ptr = view->options.data;
+        for (index = 0; index < image->num_options; ptr += *ptr) {
+            if (ptr[1] != O65_OPT_COMPRESSED)
+                memcpy(&(image->options[index++]), ptr, *ptr);
+        }
+    }
+
+    /* Copy the .text and .data segments, decompressing them if needed */
+    result = get_segment(arena, &(image->text), &(view->text),
+                         header->tlen, view->compressed);
+    if (result <= 0)
+        return result;
+    result = get_segment(arena, &(image->data), &(view->data),
+                         header->dlen, view->compressed);
+    if (result <= 0)
+        return result;
+
+    /* Copy the names of the external references */
+    if (view->num_externs) {
+        image->externs = (char **)o65_arena_calloc
+            (arena, view->num_externs, sizeof(char *));
+        if (!(image->externs))
+            return -1;
+        ptr = view->externs.data;
+        for (index = 0; index < view->num_externs; ++index) {
+            if ((image->externs[index] = get_string(arena, &ptr)) == NULL)
+                return -1;
+            ++(image->num_externs);
+        }
+    }
+
+    /* Decode the relocation tables */
+    if (o65_decode_relocs(&(image->text_relocs), header,
+                          &(view->text_relocs), header->tbase) < 0)
+        return -1;
+    if (o65_decode_relocs(&(image->data_relocs), header,
+                          &(view->data_relocs), header->dbase) < 0)
+        return -1;
+
+    /* Copy the exported symbols */
+    if (view->num_exports) {
+        image->exports = (o65_export_t *)o65_arena_calloc
+            (arena, view->num_exports, sizeof(o65_export_t));
+        if (!(image->exports))
+            return -1;
+        ptr = view->exports.data;
+        for (index = 0; index < view->num_exports; ++index) {
+            o65_export_t *export = &(image->exports[index]);
+            if ((export->name = get_string(arena, &ptr)) == NULL)
+                return -1;
+            ++(image->num_exports);
+            export->segid = *ptr++;
+            export->value = codec->get_count(ptr);
+            ptr += codec->count_size;
+        }
+    }
+    return 1;
+}
+
+o65_image_t *o65_image_new(o65_context_t *context)
+{
+    o65_arena_t arena;
+    o65_image_t *image;
+
+    /* Allocate the image from its own arena and then move the
+     * arena's state into the image for later allocations. */
+    o65_arena_init(&arena, context, 0);
+    image = (o65_image_t *)o65_arena_calloc(&arena, 1, sizeof(o65_image_t));
+    if (!image) {
+        o65_arena_free(&arena);
+        return NULL;
+    }
+    image->arena = arena;
+    image->text_relocs.arena = &(image->arena);
+    image->data_relocs.arena = &(image->arena);
+    return image;
+}
+
+int o65_image_parse
+    (o65_image_t **image, o65_context_t *context,
+     const uint8_t *buf, size_t size)
+{
+    o65_image_view_t view;
+    o65_image_t **link = image;
+    o65_image_t *current;
+    int result;
+
+    *image = NULL;
+    do {
+        /* Parse the next image in the chain in place */
+        result = o65_view_image(&view, buf, size);
+        if (result <= 0)
+            break;
+        buf += view.size;
+        size -= view.size;
+
+        /* Copy the parts of the image into a new image object */
+        if ((current = o65_image_new(context)) == NULL) {
+            result = -1;
+            break;
+        }
+        *link = current;
+        link = &(current->next);
+        result = load_image(current, &view);
+        if (result <= 0)
+            break;
+    } while ((view.header.mode & O65_MODE_CHAIN) != 0);
+    if (result <= 0) {
+        o65_image_free(*image);
+        *image = NULL;
+    }
+    return result;
+}
+
+/**
+ * @brief Encodes a relocation table.
+ *
+ * @param[in,out] writer The writer to encode into.
+ * @param[in] table The relocation table to encode.
+ * @param[in] base Base address of the segment that is being relocated.
+ *
+ * @return 1 on success, 0 if a relocation is before @a base,
+ * or -1 if out of memory.
+ */
+static int put_relocs
+    (o65_writer_t *writer, const o65_reloc_table_t *table, o65_size_t base)
+{
+    o65_reloc_encoder_t encoder;
+    o65_size_t index;
+    o65_reloc_t reloc;
+    int result = 1;
+
+    o65_reloc_encoder_init(&encoder, writer->context);
+    reloc.offset = 0;
+    for (index = 0; index < table->count && result > 0; ++index) {
+        reloc.type = table->type[index] | table->segid[index];
+        reloc.extra = table->extra[index];
+        reloc.undefid = table->undefid[index];
+        if (o65_reloc_encoder_add(&encoder, table->address[index], &reloc) < 0)
+            result = -1;
+    }
+    if (result > 0)
+        result = o65_reloc_encoder_write(&encoder, writer, base);
+    o65_reloc_encoder_free(&encoder);
+    return result;
+}
+
+/**
+ * @brief Determine if an image needs 32-bit mode for its counts and
+ * external reference indexes.
+ *
+ * @param[in] image The image to check.
+ *
+ * @return Non-zero if 32-bit mode is required.
+ */
+static int needs_32bit(const o65_image_t *image)
+{
+    o65_size_t index;
+    if (image->num_externs >= 0x10000U || image->num_exports >= 0x10000U)
+        return 1;
+    for (index = 0; index < image->num_exports; ++index) {
+        if (image->exports[index].value >= 0x10000U)
+            return 1;
+    }
+    for (index = 0; index < image->text_relocs.count; ++index) {
+        if (image->text_relocs.undefid[index] >= 0x10000U)
+            return 1;
+    }
+    for (index = 0; index < image->data_relocs.count; ++index) {
+        if (image->data_relocs.undefid[index] >= 0x10000U)
+            return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Serializes a single image.
+ *
+ * @param[in,out] writer The writer to encode into.
+ * @param[in,out] image The image to serialize.
+ *
+ * @return 1 on success, 0 if the image is invalid, or -1 if out of memory.
+ */
+static int save_image(o65_writer_t *writer, o65_image_t *image)
+{
+    o65_header_t *header = &(image->header);
+    size_t start = writer->size;
+    size_t alignment = 0;
+    o65_size_t index;
+    int result;
+
+    /* Adjust the mode bits and encode the header */
+    if (image->next)
+        header->mode |= O65_MODE_CHAIN;
+    else
+        header->mode &= ~O65_MODE_CHAIN;
+    if (needs_32bit(image))
+        header->mode |= O65_MODE_32BIT;
+    o65_writer_header(writer, header);
+
+    /* Encode the header options.  Padding is recomputed at the end of
+     * the options because the options before it may have changed size. */
+    for (index = 0; index < image->num_options; ++index) {
+        const o65_option_t *option = &(image->options[index]);
+        if (option->len < 2)
+            return 0;
+        if (option->type != O65_OPT_PADDING) {
+            o65_writer_option(writer, option);
+        } else if (!alignment && option->len >= 3 &&
+                   option->data[0] < sizeof(size_t) * 8) {
+            alignment = ((size_t)1) << option->data[0];
+        }
+    }
+    if (alignment)
+        o65_writer_padding(writer, alignment);
+    o65_writer_option(writer, NULL);
+
+    /* Copy the .text and .data segments */
+    o65_writer_bytes(writer, image->text, header->tlen);
+    o65_writer_bytes(writer, image->data, header->dlen);
+
+    /* Encode the names of the external references */
+    o65_writer_count(writer, image->num_externs);
+    for (index = 0; index < image->num_externs; ++index)
+        o65_writer_string(writer, image->externs[index]);
+
+    /* Encode the relocation tables */
+    result = put_relocs(writer, &(image->text_relocs), header->tbase);
+    if (result <= 0)
+        return result;
+    result = put_relocs(writer, &(image->data_relocs), header->dbase);
+    if (result <= 0)
+        return result;
+
+    /* Encode the exported symbols */
+    o65_writer_count(writer, image->num_exports);
+    for (index = 0; index < image->num_exports; ++index) {
+        const o65_export_t *export = &(image->exports[index]);
+        o65_writer_exported_symbol
+            (writer, export->name, export->segid, export->value);
+    }
+
+    /* Errors are sticky, so we only need to check once at the end */
+    if (writer->error)
+        return -1;
+
+    /* Refresh the content hash, if any, as the segments may have changed
+     * or been decompressed since the image was parsed */
+    o65_update_content_hash(writer->data + start, writer->size - start);
+    return 1;
+}
+
+int o65_image_serialize(o65_image_t *image, uint8_t **buf, size_t *size)
+{
+    o65_writer_t writer;
+    int result = 1;
+    o65_writer_init(&writer, image ? image->arena.context : NULL);
+    for (; image != NULL && result > 0; image = image->next)
+        result = save_image(&writer, image);
+    if (result <= 0) {
+        o65_writer_free(&writer);
+        *buf = NULL;
+        *size = 0;
+    } else {
+        *buf = o65_writer_take(&writer, size);
+    }
+    return result;
+}
+
+void o65_image_free(o65_image_t *image)
+{
+    o65_image_t *next;
+    o65_arena_t arena;
+    while (image != NULL) {
+        /* The image lives inside its own arena, so take a copy of the
+         * arena's state before freeing it. */
+        next = image->next;
+        arena = image->arena;
+        o65_arena_free(&arena);
+        image = next;
+    }
+}
@@ -0,0 +1,450 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65push.h"
+#include "o65compress.h"
+#include <string.h>
+
+/* Parser states */
+#define STATE_HEADER        0   /**< Reading the header */
+#define STATE_OPTION        1   /**< Reading a header option */
+#define STATE_TEXT          2   /**< Reading the .text segment */
+#define STATE_DATA          3   /**< Reading the .data segment */
+#define STATE_EXTERN_COUNT  4   /**< Reading the number of externs */
+#define STATE_EXTERN_NAME   5   /**< Reading the name of an extern */
+#define STATE_TEXT_RELOC    6   /**< Reading a .text relocation */
+#define STATE_DATA_RELOC    7   /**< Reading a .data relocation */
+#define STATE_EXPORT_COUNT  8   /**< Reading the number of exports */
+#define STATE_EXPORT_NAME   9   /**< Reading the name of an export */
+#define STATE_EXPORT_VALUE  10  /**< Reading the segment and value of an export */
+#define STATE_DONE          11  /**< Finished the last image in the chain */
+
+void o65_push_init
+    (o65_push_parser_t *parser, o65_context_t *context,
+     o65_event_callback_t callback, void *user_data)
+{
+    memset(parser, 0, sizeof(o65_push_parser_t));
+    parser->context = context;
+    parser->state = STATE_HEADER;
+    parser->result = 1;
+    parser->callback = callback;
+    parser->user_data = user_data;
+    parser->need = 8;
+}
+
+void o65_push_free(o65_push_parser_t *parser)
+{
+    o65_context_free(parser->context, parser->name);
+    parser->name = NULL;
+    parser->name_len = 0;
+    parser->name_max = 0;
+}
+
+/**
+ * @brief Gets a count or value field from the fixed record buffer.
+ *
+ * @param[in] parser The parser.
+ * @param[in] offset Offset of the field within the buffer.
+ *
+ * @return The value of the field.
+ */
+static o65_size_t get_count(const o65_push_parser_t *parser, size_t offset)
+{
+    return parser->codec->get_count(parser->fixed + offset);
+}
+
+/**
+ * @brief Sends an event to the callback.
+ *
+ * @param[in] parser The parser.
+ * @param[in,out] event The event, with all fields except the header set.
+ *
+ * @return The return value from the callback.
+ */
+static int emit(o65_push_parser_t *parser, o65_event_t *event)
+{
+    event->header = &(parser->header);
+    return (*(parser->callback))(parser->user_data, event);
+}
+
+/**
+ * @brief Enters a new section of the image.
+ *
+ * @param[in,out] parser The parser.
+ * @param[in] state The state for the new section.
+ *
+ * @return 1 to continue parsing, or the value to stop parsing with.
+ *
+ * Empty sections are skipped over automatically.
+ */
+static int enter_state(o65_push_parser_t *parser, int state)
+{
+    o65_event_t event;
+    int result;
+    for (;;) {
+        parser->state = state;
+        parser->index = 0;
+        parser->fixed_len = 0;
+        parser->name_len = 0;
+        switch (state) {
+        case STATE_HEADER:
+            parser->need = 8;
+            return 1;
+
+        case STATE_OPTION:
+            parser->need = 1;
+            return 1;
+
+        case STATE_TEXT:
+            parser->count = parser->text_size;
+            if (parser->count)
+                return 1;
+            state = STATE_DATA;
+            break;
+
+        case STATE_DATA:
+            parser->count = parser->data_size;
+            if (parser->count)
+                return 1;
+            state = STATE_EXTERN_COUNT;
+            break;
+
+        case STATE_EXTERN_COUNT:
+        case STATE_EXPORT_COUNT:
+            parser->need = parser->codec->count_size;
+            return 1;
+
+        case STATE_EXTERN_NAME:
+            if (parser->count)
+                return 1;
+            state = STATE_TEXT_RELOC;
+            break;
+
+        case STATE_TEXT_RELOC:
+            parser->address = parser->header.tbase - 1;
+            parser->need = 1;
+            return 1;
+
+        case STATE_DATA_RELOC:
+            parser->address = parser->header.dbase - 1;
+            parser->need = 1;
+            return 1;
+
+        case STATE_EXPORT_NAME:
+            if (parser->count)
+                return 1;
+
+            /* End of the image; continue with the next if chained */
+            memset(&event, 0, sizeof(event));
+            event.type = O65_EVENT_END;
+            if ((result = emit(parser, &event)) != 1)
+                return result;
+            if (parser->header.mode & O65_MODE_CHAIN)
+                state = STATE_HEADER;
+            else
+                state = STATE_DONE;
+            break;
+
+        default:
+            parser->state = STATE_DONE;
+            return 1;
+        }
+    }
+}
+
+/**
+ * @brief Processes a fixed-size record once all of its bytes are available.
+ *
+ * @param[in,out] parser The parser.
+ *
+ * @return 1 to continue parsing, or the value to stop parsing with.
+ *
+ * If the record turns out to be longer than expected, then "need" is
+ * increased and the caller will continue to collect bytes.
+ */
+static int end_record(o65_push_parser_t *parser)
+{
+    o65_event_t event;
+    size_t len;
+    int result;
+
+    memset(&event, 0, sizeof(event));
+    switch (parser->state) {
+    case STATE_HEADER:
+        result = o65_parse_header
+            (parser->fixed, parser->fixed_len, &(parser->header), &len);
+        if (result < 0) {
+            /* Now we know how long the header really is */
+            parser->need = len;
+            return 1;
+        } else if (result == 0) {
+            return 0;
+        }
+        parser->codec = o65_get_codec(&(parser->header));
+        parser->text_size = parser->header.tlen;
+        parser->data_size = parser->header.dlen;
+        parser->compressed = 0;
+        event.type = O65_EVENT_HEADER;
+        if ((result = emit(parser, &event)) != 1)
+            return result;
+        return enter_state(parser, STATE_OPTION);
+
+    case STATE_OPTION:
+        if (parser->fixed_len == 1) {
+            if (parser->fixed[0] == 0)
+                return enter_state(parser, STATE_TEXT);
+            if (parser->fixed[0] < 2)
+                return 0;
+            parser->need = parser->fixed[0];
+            return 1;
+        }
+        if (parser->fixed[1] == O65_OPT_COMPRESSED) {
+            /* The segments are compressed, so their sizes have changed */
+            o65_span_t span;
+            size_t text_size, data_size;
+            span.data = parser->fixed;
+            span.size = parser->fixed_len;
+            if (o65_get_stored_sizes
+                    (&span, &(parser->header), &text_size, &data_size) < 0)
+                return 0;
+            parser->text_size = (o65_size_t)text_size;
+            parser->data_size = (o65_size_t)data_size;
+            parser->compressed = 1;
+        }
+        event.type = O65_EVENT_OPTION;
+        event.index = (parser->index)++;
+        event.option.type = parser->fixed[1];
+        event.option.data = parser->fixed + 2;
+        event.option.len = parser->fixed_len - 2;
+        parser->fixed_len = 0;
+        parser->need = 1;
+        return emit(parser, &event);
+
+    case STATE_EXTERN_COUNT:
+        parser->count = get_count(parser, 0);
+        return enter_state(parser, STATE_EXTERN_NAME);
+
+    case STATE_TEXT_RELOC:
+    case STATE_DATA_RELOC:
+        if (parser->codec->parse_reloc
+                (parser->fixed, parser->fixed_len, &(event.reloc), &len) < 0) {
+            /* Entry is longer than we have so far.  Once the type byte
+             * is available, we know how long the whole entry is. */
+            if (parser->fixed_len < 2)
+                parser->need = 2;
+            else
+                parser->need = parser->codec->reloc_size(parser->fixed[1]);
+            return 1;
+        }
+        parser->fixed_len = 0;
+        parser->need = 1;
+        if (event.reloc.offset == 0) {
+            if (parser->state == STATE_TEXT_RELOC)
+                return enter_state(parser, STATE_DATA_RELOC);
+            else
+                return enter_state(parser, STATE_EXPORT_COUNT);
+        } else if (event.reloc.offset == 255) {
+            parser->address += 254;
+            return 1;
+        }
+        parser->address += event.reloc.offset;
+        if (parser->state == STATE_TEXT_RELOC)
+            event.type = O65_EVENT_TEXT_RELOC;
+        else
+            event.type = O65_EVENT_DATA_RELOC;
+        event.index = (parser->index)++;
+        event.address = parser->address;
+        return emit(parser, &event);
+
+    case STATE_EXPORT_COUNT:
+        parser->count = get_count(parser, 0);
+        return enter_state(parser, STATE_EXPORT_NAME);
+
+    case STATE_EXPORT_VALUE:
+        event.type = O65_EVENT_EXPORT;
+        event.index = (parser->index)++;
+        event.data = parser->name;
+        event.size = parser->name_len - 1;
+        event.segid = parser->fixed[0];
+        event.value = get_count(parser, 1);
+        if ((result = emit(parser, &event)) != 1)
+            return result;
+        if (--(parser->count) == 0)
+            return enter_state(parser, STATE_EXPORT_NAME);
+        parser->state = STATE_EXPORT_NAME;
+        parser->name_len = 0;
+        return 1;
+
+    default: break;
+    }
+    return 0;
+}
+
+/**
+ * @brief Processes a name once its NUL terminator has been seen.
+ *
+ * @param[in,out] parser The parser.
+ *
+ * @return 1 to continue parsing, or the value to stop parsing with.
+ */
+static int end_name(o65_push_parser_t *parser)
+{
+    o65_event_t event;
+    int result;
+
+    if (parser->state == STATE_EXPORT_NAME) {
+        /* The name is followed by the segment and value */
+        parser->state = STATE_EXPORT_VALUE;
+        parser->fixed_len = 0;
+        parser->need = 1 + parser->codec->count_size;
+        return 1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.type = O65_EVENT_EXTERN;
+    event.index = (parser->index)++;
+    event.data = parser->name;
+    event.size = parser->name_len - 1;
+    if ((result = emit(parser, &event)) != 1)
+        return result;
+    if (--(parser->count) == 0)
+        return enter_state(parser, STATE_EXTERN_NAME);
+    parser->name_len = 0;
+    return 1;
+}
+
+/**
+ * @brief Appends bytes to the name buffer.
+ *
+ * @param[in,out] parser The parser.
+ * @param[in] buf Points to the bytes to append.
+ * @param[in] len Number of bytes to append.
+ *
+ * @return Non-zero if OK, or zero if out of memory.
+ */
+static int append_name(o65_push_parser_t *parser, const uint8_t *buf, size_t len)
+{
+    if ((parser->name_max - parser->name_len) < len) {
+        size_t new_max = parser->name_max ? parser->name_max : 64;
+        uint8_t *new_name;
+        while ((new_max - parser->name_len) < len)
+            new_max *= 2;
+        new_name = (uint8_t *)o65_context_realloc
+            (parser->context, parser->name, new_max);
+        if (!new_name)
+            return 0;
+        parser->name = new_name;
+        parser->name_max = new_max;
+    }
+    memcpy(parser->name + parser->name_len, buf, len);
+    parser->name_len += len;
+    return 1;
+}
+
+int o65_push_feed(o65_push_parser_t *parser, const uint8_t *buf, size_t size)
+{
+    const uint8_t *nul;
+    o65_event_t event;
+    size_t len;
+    int result;
+
+    if (parser->result != 1)
+        return parser->result;
+    while (size > 0) {
+        switch (parser->state) {
+        case STATE_TEXT:
+        case STATE_DATA:
+            /* Pass segment contents straight through from the input */
+            len = (size < parser->count) ? size : (size_t)(parser->count);
+            memset(&event, 0, sizeof(event));
+            if (parser->state == STATE_TEXT) {
+                event.type = O65_EVENT_TEXT;
+                event.index = parser->text_size - parser->count;
+                event.address = parser->header.tbase + event.index;
+            } else {
+                event.type = O65_EVENT_DATA;
+                event.index = parser->data_size - parser->count;
+                event.address = parser->header.dbase + event.index;
+            }
+            event.data = buf;
+            event.size = len;
+            buf += len;
+            size -= len;
+            parser->count -= len;
+            result = emit(parser, &event);
+            if (result == 1 && parser->count == 0)
+                result = enter_state(parser, parser->state + 1);
+            break;
+
+        case STATE_EXTERN_NAME:
+        case STATE_EXPORT_NAME:
+            /* Collect the name up to and including the NUL terminator */
+            nul = (const uint8_t *)memchr(buf, 0, size);
+            len = nul ? (size_t)(nul - buf + 1) : size;
+            if (!append_name(parser, buf, len)) {
+                result = -1;
+                break;
+            }
+            buf += len;
+            size -= len;
+            result = nul ? end_name(parser) : 1;
+            break;
+
+        case STATE_DONE:
+            /* Ignore anything after the last image in the chain */
+            return 1;
+
+        default:
+            /* Collect the bytes for a fixed-size record */
+            len = parser->need - parser->fixed_len;
+            if (len > size)
+                len = size;
+            memcpy(parser->fixed + parser->fixed_len, buf, len);
+            parser->fixed_len += len;
+            buf += len;
+            size -= len;
+            result = 1;
+            if (parser->fixed_len >= parser->need)
+                result = end_record(parser);
+            break;
+        }
+        if (result != 1) {
+            parser->result = result;
+            return result;
+        }
+    }
+    return 1;
+}
+
+int o65_push_output(void *parser, const uint8_t *buf, size_t size)
+{
+    return o65_push_feed((o65_push_parser_t *)parser, buf, size);
+}
+
+int o65_push_finish(o65_push_parser_t *parser)
+{
+    if (parser->result != 1)
+        return parser->result;
+    if (parser->state != STATE_DONE)
+        parser->result = -1;
+    return parser->result;
+}
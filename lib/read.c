@@ -24,29 +24,12 @@
 #include <string.h>
 #include <stdlib.h>
 
-uint16_t o65_read_uint16(const uint8_t *buf)
+int o65_parse_header
+    (const uint8_t *buf, size_t size, o65_header_t *header, size_t *len)
 {
-    return buf[0] | (((uint16_t)(buf[1])) << 8);
-}
-
-uint32_t o65_read_uint24(const uint8_t *buf)
-{
-    return buf[0] | (((uint32_t)(buf[1])) << 8) |
-           (((uint32_t)(buf[2])) << 16);
-}
-
-uint32_t o65_read_uint32(const uint8_t *buf)
-{
-    return buf[0] | (((uint32_t)(buf[1])) << 8) |
-           (((uint32_t)(buf[2])) << 16) | (((uint32_t)(buf[3])) << 24);
-}
-
-int o65_read_header(FILE *file, o65_header_t *header)
-{
-    uint8_t buf[36];
-
-    /* Read the first 8 bytes and byte-swap the mode field */
-    if (fread(buf, 1, 8, file) != 8)
+    /* Need at least the magic number and the mode word */
+    *len = 8;
+    if (size < 8)
         return -1;
     header->mode = o65_read_uint16(buf + 6);
 
@@ -65,9 +48,11 @@ int o65_read_header(FILE *file, o65_header_t *header)
         return 0;
 
     /* The rest of the header uses either 16-bit or 32-bit fields */
+    buf += 8;
     if ((header->mode & O65_MODE_32BIT) == 0) {
         /* 16-bit fields */
-        if (fread(buf, 1, 18, file) != 18)
+        *len = O65_HEADER_SIZE_16;
+        if (size < O65_HEADER_SIZE_16)
             return -1;
         header->tbase = o65_read_uint16(buf);
         header->tlen  = o65_read_uint16(buf + 2);
@@ -80,7 +65,8 @@ int o65_read_header(FILE *file, o65_header_t *header)
         header->stack = o65_read_uint16(buf + 16);
     } else {
         /* 32-bit fields */
-        if (fread(buf, 1, 36, file) != 36)
+        *len = O65_HEADER_SIZE_32;
+        if (size < O65_HEADER_SIZE_32)
             return -1;
         header->tbase = o65_read_uint32(buf);
         header->tlen  = o65_read_uint32(buf + 4);
@@ -95,6 +81,25 @@ int o65_read_header(FILE *file, o65_header_t *header)
     return 1;
 }
 
+int o65_read_header(FILE *file, o65_header_t *header)
+{
+    uint8_t buf[O65_HEADER_SIZE_32];
+    size_t len;
+    int result;
+
+    /* Read the first 8 bytes and validate the magic number */
+    if (fread(buf, 1, 8, file) != 8)
+        return -1;
+    result = o65_parse_header(buf, 8, header, &len);
+    if (result >= 0)
+        return result;
+
+    /* Read the rest of the header, now that we know how long it is */
+    if (fread(buf + 8, 1, len - 8, file) != (len - 8))
+        return -1;
+    return o65_parse_header(buf, len, header, &len);
+}
+
 int o65_read_option(FILE *file, o65_option_t *option)
 {
     int ch;
@@ -132,6 +137,9 @@ int o65_read_option(FILE *file, o65_option_t *option)
 int o65_read_reloc
     (FILE *file, const o65_header_t *header, o65_reloc_t *reloc)
 {
+    const o65_codec_t *codec = o65_get_codec(header);
+    uint8_t buf[O65_MAX_RELOC_SIZE];
+    size_t size;
     int ch;
 
     /* Clear the relocation details in case of error */
@@ -146,51 +154,25 @@ int o65_read_reloc
     reloc->offset = (uint8_t)ch;
 
     /* Zero for the end of the table, 255 for a skip-ahead entry */
-    if (ch == 0 || ch == 255)
+    if (reloc->offset == 0 || reloc->offset == 255)
         return 1;
 
-    /* Read the type/segment byte */
+    /* Read the type byte, which tells us how long the rest of the entry is */
     if ((ch = fgetc(file)) == EOF)
         return -1;
-    reloc->type = (uint8_t)ch;
-
-    /* Undefined relocations are followed by the index of the external symbol */
-    if ((reloc->type & O65_RELOC_SEGID) == O65_SEGID_UNDEF) {
-        int size = ((header->mode & O65_MODE_32BIT) == 0) ? 2 : 4;
-        int bit = 0;
-        while (size > 0) {
-            if ((ch = fgetc(file)) == EOF)
-                return -1;
-            reloc->undefid |= (((uint32_t)(ch & 0xFF)) << bit);
-            --size;
-            bit += 8;
-        }
-    }
-
-    /* Determine if we need to read any extra details */
-    switch (reloc->type & O65_RELOC_TYPE) {
-    case O65_RELOC_HIGH:
-        if ((header->mode & O65_MODE_PAGED) == 0) {
-            /* Need the low byte of the HIGH relocation from the file */
-            if ((ch = fgetc(file)) == EOF)
-                return -1;
-            reloc->extra = (uint8_t)ch;
-        }
-        break;
-
-    case O65_RELOC_SEG:
-        /* Need the lower two bytes of the SEG relocation from the file */
-        if ((ch = fgetc(file)) == EOF)
-            return -1;
-        reloc->extra = (uint8_t)ch;
-        if ((ch = fgetc(file)) == EOF)
-            return -1;
-        reloc->extra |= (uint16_t)(ch << 8);
-        break;
+    buf[0] = reloc->offset;
+    buf[1] = (uint8_t)ch;
+    size = codec->reloc_size(buf[1]);
+    if (fread(buf + 2, 1, size - 2, file) != (size - 2))
+        return -1;
+    return codec->parse_reloc(buf, size, reloc, &size);
+}
 
-    default: break;
-    }
-    return 1;
+int o65_parse_reloc
+    (const uint8_t *buf, size_t size, const o65_header_t *header,
+     o65_reloc_t *reloc, size_t *len)
+{
+    return o65_get_codec(header)->parse_reloc(buf, size, reloc, len);
 }
 
 int o65_read_segment(FILE *file, uint8_t **data, o65_size_t size)
@@ -212,16 +194,11 @@ int o65_read_segment(FILE *file, uint8_t **data, o65_size_t size)
 
 int o65_read_count(FILE *file, const o65_header_t *header, o65_size_t *count)
 {
+    const o65_codec_t *codec = o65_get_codec(header);
     uint8_t buf[4];
-    if ((header->mode & O65_MODE_32BIT) == 0) {
-        if (fread(buf, 1, 2, file) != 2)
-            return -1;
-        *count = o65_read_uint16(buf);
-    } else {
-        if (fread(buf, 1, 4, file) != 2)
-            return -1;
-        *count = o65_read_uint32(buf);
-    }
+    if (fread(buf, 1, codec->count_size, file) != codec->count_size)
+        return -1;
+    *count = codec->get_count(buf);
     return 1;
 }
 
@@ -0,0 +1,462 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "o65view.h"
+#include <string.h>
+
+/**
+ * @brief Resizes one of the arrays in a relocation table.
+ *
+ * @param[in] table The relocation table.
+ * @param[in] ptr Points to the array to resize.
+ * @param[in] elem_size Size of each array element.
+ * @param[in] count Number of elements that are required.
+ *
+ * @return A pointer to the resized array, or NULL if out of memory.
+ *
+ * The first "table->count" elements are preserved.
+ */
+static void *resize_array
+    (const o65_reloc_table_t *table, void *ptr,
+     size_t elem_size, o65_size_t count)
+{
+    if (table->arena) {
+        return o65_arena_realloc
+            (table->arena, ptr, table->count * elem_size, count * elem_size);
+    }
+    return o65_context_realloc(table->context, ptr, count * elem_size);
+}
+
+/**
+ * @brief Makes sure that a relocation table has enough space.
+ *
+ * @param[in,out] table The table to expand.
+ * @param[in] count Number of entries that are required.
+ *
+ * @return Non-zero if OK, or zero if out of memory.
+ */
+static int reserve_relocs(o65_reloc_table_t *table, o65_size_t count)
+{
+    void *ptr;
+    if (count <= table->max_count)
+        return 1;
+    ptr = resize_array(table, table->address, sizeof(o65_size_t), count);
+    if (!ptr)
+        return 0;
+    table->address = (o65_size_t *)ptr;
+    if ((ptr = resize_array(table, table->type, 1, count)) == NULL)
+        return 0;
+    table->type = (uint8_t *)ptr;
+    if ((ptr = resize_array(table, table->segid, 1, count)) == NULL)
+        return 0;
+    table->segid = (uint8_t *)ptr;
+    if ((ptr = resize_array(table, table->extra, sizeof(uint16_t), count)) == NULL)
+        return 0;
+    table->extra = (uint16_t *)ptr;
+    if ((ptr = resize_array(table, table->undefid, sizeof(uint32_t), count)) == NULL)
+        return 0;
+    table->undefid = (uint32_t *)ptr;
+    table->max_count = count;
+    return 1;
+}
+
+/**
+ * @brief Decodes a whole relocation table for a specific header mode.
+ *
+ * @param[in,out] table The table to decode into.
+ * @param[in] codec Codec for the header mode.
+ * @param[in] relocs Span containing the encoded relocation table.
+ * @param[in] base Base address of the segment that is being relocated.
+ * @param[in] wide Non-zero if O65_MODE_32BIT is set.
+ * @param[in] paged Non-zero if O65_MODE_PAGED is set.
+ *
+ * @return 1 if the table was decoded, 0 if the table is truncated,
+ * or -1 if out of memory.
+ *
+ * This is always called with constant "wide" and "paged" arguments,
+ * so that the compiler can remove the mode tests from the loop.
+ */
+static inline int decode_relocs
+    (o65_reloc_table_t *table, const o65_codec_t *codec,
+     const o65_span_t *relocs, o65_size_t base, int wide, int paged)
+{
+    const uint8_t *ptr = relocs->data;
+    const uint8_t *end = ptr + relocs->size;
+    const uint8_t *fast_end;
+    const unsigned undef_size = wide ? 4 : 2;
+    const unsigned high_size = paged ? 0 : 1;
+    o65_size_t addr = base - 1;
+    o65_size_t count = 0;
+    uint8_t offset;
+    uint8_t type;
+    uint32_t undefid;
+    uint16_t extra;
+
+    /* Every relocation other than a skip is at least two bytes in size,
+     * which gives us an upper bound on the number of table entries. */
+    table->count = 0;
+    if (!reserve_relocs(table, relocs->size / 2 + 1))
+        return -1;
+
+    /* Decode entries without bounds checks while there is enough data
+     * left for the largest possible entry.  The last few entries are
+     * decoded more carefully to catch truncation at the end. */
+    fast_end = (relocs->size >= O65_MAX_RELOC_SIZE)
+             ? (end - O65_MAX_RELOC_SIZE) : ptr;
+    for (;;) {
+        if (ptr < fast_end) {
+            offset = *ptr++;
+            if (offset == 255) {
+                addr += 254;
+                continue;
+            } else if (offset == 0) {
+                break;
+            }
+            type = *ptr++;
+            undefid = 0;
+            extra = 0;
+            if ((type & O65_RELOC_SEGID) == O65_SEGID_UNDEF) {
+                if (wide)
+                    undefid = o65_read_uint32(ptr);
+                else
+                    undefid = o65_read_uint16(ptr);
+                ptr += undef_size;
+            }
+            if ((type & O65_RELOC_TYPE) == O65_RELOC_HIGH) {
+                if (high_size)
+                    extra = *ptr;
+                ptr += high_size;
+            } else if ((type & O65_RELOC_TYPE) == O65_RELOC_SEG) {
+                extra = o65_read_uint16(ptr);
+                ptr += 2;
+            }
+        } else {
+            o65_reloc_t reloc;
+            size_t len;
+            if (codec->parse_reloc(ptr, end - ptr, &reloc, &len) < 0) {
+                table->count = count;
+                return 0;
+            }
+            ptr += len;
+            offset = reloc.offset;
+            if (offset == 255) {
+                addr += 254;
+                continue;
+            } else if (offset == 0) {
+                break;
+            }
+            type = reloc.type;
+            undefid = reloc.undefid;
+            extra = reloc.extra;
+        }
+        addr += offset;
+        table->address[count] = addr;
+        table->type[count] = type & O65_RELOC_TYPE;
+        table->segid[count] = type & O65_RELOC_SEGID;
+        table->extra[count] = extra;
+        table->undefid[count] = undefid;
+        ++count;
+    }
+    table->count = count;
+    return 1;
+}
+
+int o65_decode_relocs
+    (o65_reloc_table_t *table, const o65_header_t *header,
+     const o65_span_t *relocs, o65_size_t base)
+{
+    const o65_codec_t *codec = o65_get_codec(header);
+    switch (header->mode & (O65_MODE_32BIT | O65_MODE_PAGED)) {
+    case 0:
+        return decode_relocs(table, codec, relocs, base, 0, 0);
+    case O65_MODE_PAGED:
+        return decode_relocs(table, codec, relocs, base, 0, 1);
+    case O65_MODE_32BIT:
+        return decode_relocs(table, codec, relocs, base, 1, 0);
+    default:
+        return decode_relocs(table, codec, relocs, base, 1, 1);
+    }
+}
+
+void o65_free_relocs(o65_reloc_table_t *table)
+{
+    o65_arena_t *arena = table->arena;
+    o65_context_t *context = table->context;
+    if (!arena) {
+        o65_context_free(context, table->address);
+        o65_context_free(context, table->type);
+        o65_context_free(context, table->segid);
+        o65_context_free(context, table->extra);
+        o65_context_free(context, table->undefid);
+    }
+    memset(table, 0, sizeof(o65_reloc_table_t));
+    table->arena = arena;
+    table->context = context;
+}
+
+/**
+ * @brief Gets the number of bytes that are patched by a relocation type.
+ *
+ * @param[in] type The relocation type; e.g. O65_RELOC_WORD.
+ *
+ * @return The number of bytes that are patched.
+ */
+static o65_size_t reloc_width(uint8_t type)
+{
+    switch (type & O65_RELOC_TYPE) {
+    case O65_RELOC_WORD:    return 2;
+    case O65_RELOC_SEGADR:  return 3;
+    default:                return 1;
+    }
+}
+
+/**
+ * @brief Adds a checkpoint to a relocation index.
+ *
+ * @param[in,out] index The index to add to.
+ * @param[in,out] max_count Number of checkpoints that are allocated.
+ * @param[in] offset Byte offset of the next entry in the table.
+ * @param[in] address Address of the previous relocation.
+ * @param[in] count Number of relocations before this point.
+ *
+ * @return Non-zero if OK, or zero if out of memory.
+ */
+static int add_checkpoint
+    (o65_reloc_index_t *index, o65_size_t *max_count,
+     size_t offset, o65_size_t address, o65_size_t count)
+{
+    o65_reloc_checkpoint_t *checkpoint;
+    if (index->count >= *max_count) {
+        o65_size_t new_max = *max_count ? *max_count * 2 : 64;
+        checkpoint = (o65_reloc_checkpoint_t *)o65_context_realloc
+            (index->context, index->checkpoints,
+             new_max * sizeof(o65_reloc_checkpoint_t));
+        if (!checkpoint)
+            return 0;
+        index->checkpoints = checkpoint;
+        *max_count = new_max;
+    }
+    checkpoint = &(index->checkpoints[(index->count)++]);
+    checkpoint->offset = offset;
+    checkpoint->address = address;
+    checkpoint->index = count;
+    return 1;
+}
+
+int o65_reloc_index_build
+    (o65_reloc_index_t *index, o65_context_t *context,
+     const o65_header_t *header,
+     const o65_span_t *relocs, o65_size_t base,
+     o65_size_t every_entries, o65_size_t every_bytes)
+{
+    const uint8_t *start = relocs->data;
+    const uint8_t *ptr = start;
+    const uint8_t *end = start + relocs->size;
+    const o65_codec_t *codec = o65_get_codec(header);
+    o65_size_t max_count = 0;
+    o65_size_t addr = base - 1;
+    o65_size_t last_addr = addr;
+    o65_size_t count = 0;
+    o65_size_t last_count = 0;
+    o65_reloc_t reloc;
+    size_t len;
+
+    /* Set up the index */
+    memset(index, 0, sizeof(o65_reloc_index_t));
+    index->context = context;
+    index->header = *header;
+    index->relocs = *relocs;
+    index->base = base;
+    if (!every_entries && !every_bytes)
+        every_entries = O65_RELOC_INDEX_ENTRIES;
+
+    /* There is always a checkpoint at the start of the table */
+    if (!add_checkpoint(index, &max_count, 0, addr, 0))
+        return -1;
+
+    /* Scan the table and drop checkpoints as we go */
+    for (;;) {
+        if (codec->parse_reloc(ptr, end - ptr, &reloc, &len) < 0)
+            return 0;
+        if (reloc.offset == 0)
+            break;
+        ptr += len;
+        if (reloc.offset == 255) {
+            addr += 254;
+            continue;
+        }
+        addr += reloc.offset;
+        ++count;
+        if ((every_entries && (count - last_count) >= every_entries) ||
+                (every_bytes && (addr - last_addr) >= every_bytes)) {
+            if (!add_checkpoint(index, &max_count, ptr - start, addr, count))
+                return -1;
+            last_addr = addr;
+            last_count = count;
+        }
+    }
+    return 1;
+}
+
+int o65_decode_relocs_range
+    (o65_reloc_table_t *table, const o65_reloc_index_t *index,
+     o65_size_t start, o65_size_t end)
+{
+    const o65_reloc_checkpoint_t *checkpoints = index->checkpoints;
+    const o65_codec_t *codec = o65_get_codec(&(index->header));
+    const uint8_t *ptr;
+    const uint8_t *limit = index->relocs.data + index->relocs.size;
+    o65_size_t origin = index->base - 1;
+    o65_size_t lo, hi, mid;
+    o65_size_t first;
+    o65_size_t addr;
+    o65_size_t count = 0;
+    o65_reloc_t reloc;
+    size_t len;
+
+    /* A relocation that starts up to two bytes before the range can still
+     * touch it.  Positions are relative to "base - 1" to avoid wrap-around.
+     * If the range starts before "base - 1" and ends after it, then its
+     * start wraps around to after its end, so clamp it to "base - 1". */
+    table->count = 0;
+    if ((start - origin) > (end - origin))
+        start = origin;
+    if ((end - origin) <= (start - origin))
+        return 1;
+    first = start - origin;
+    first = (first > 3) ? (first - 3) : 0;
+
+    /* Binary search for the last checkpoint that is before the range */
+    lo = 0;
+    hi = index->count;
+    while ((hi - lo) > 1) {
+        mid = lo + (hi - lo) / 2;
+        if ((checkpoints[mid].address - origin) <= first)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    ptr = index->relocs.data + checkpoints[lo].offset;
+    addr = checkpoints[lo].address;
+
+    /* Decode forward until we pass the end of the range */
+    for (;;) {
+        if (codec->parse_reloc(ptr, limit - ptr, &reloc, &len) < 0) {
+            table->count = count;
+            return 0;
+        }
+        ptr += len;
+        if (reloc.offset == 0) {
+            break;
+        } else if (reloc.offset == 255) {
+            addr += 254;
+            continue;
+        }
+        addr += reloc.offset;
+        if ((addr - origin) >= (end - origin))
+            break;
+        if (((addr - origin) + reloc_width(reloc.type)) <= (start - origin))
+            continue;
+        if (count >= table->max_count &&
+                !reserve_relocs(table, count < 16 ? 16 : count * 2)) {
+            table->count = count;
+            return -1;
+        }
+        table->address[count] = addr;
+        table->type[count] = reloc.type & O65_RELOC_TYPE;
+        table->segid[count] = reloc.type & O65_RELOC_SEGID;
+        table->extra[count] = reloc.extra;
+        table->undefid[count] = reloc.undefid;
+        table->count = ++count;
+    }
+    return 1;
+}
+
+void o65_reloc_index_free(o65_reloc_index_t *index)
+{
+    o65_context_free(index->context, index->checkpoints);
+    index->checkpoints = NULL;
+    index->count = 0;
+}
+
+void o65_reloc_iter_init
+    (o65_reloc_iter_t *iter, const o65_header_t *header,
+     const o65_span_t *relocs, o65_size_t base, o65_size_t size,
+     o65_size_t num_externs)
+{
+    iter->ptr = relocs->data;
+    iter->end = relocs->data + relocs->size;
+    iter->codec = o65_get_codec(header);
+    iter->base = base;
+    iter->offset = ~((o65_size_t)0); /* Relocations start at base - 1 */
+    iter->size = size;
+    iter->num_externs = num_externs;
+    iter->error = 0;
+}
+
+int o65_reloc_iter_next(o65_reloc_iter_t *iter, o65_reloc_entry_t *entry)
+{
+    o65_reloc_t reloc;
+    size_t len;
+
+    /* Once the iterator has stopped, it stays stopped */
+    if (iter->error)
+        return -1;
+    for (;;) {
+        if (iter->codec->parse_reloc
+                (iter->ptr, iter->end - iter->ptr, &reloc, &len) < 0) {
+            iter->error = O65_RELOC_ERROR_TRUNCATED;
+            return -1;
+        }
+        if (reloc.offset == 0) {
+            return 0;
+        }
+        iter->ptr += len;
+        if (reloc.offset != 255)
+            break;
+        iter->offset += 254;
+    }
+    iter->offset += reloc.offset;
+
+    /* Fill in the details */
+    entry->address = iter->base + iter->offset;
+    entry->offset = iter->offset;
+    entry->type = reloc.type & O65_RELOC_TYPE;
+    entry->segid = reloc.type & O65_RELOC_SEGID;
+    entry->width = (uint8_t)reloc_width(reloc.type);
+    entry->extra = reloc.extra;
+    entry->undefid = reloc.undefid;
+
+    /* Check that the relocation is within the bounds of the segment */
+    if (iter->offset >= iter->size ||
+            (iter->size - iter->offset) < entry->width) {
+        iter->error = O65_RELOC_ERROR_RANGE;
+        return -1;
+    }
+    if (entry->segid == O65_SEGID_UNDEF &&
+            entry->undefid >= iter->num_externs) {
+        iter->error = O65_RELOC_ERROR_EXTERN;
+        return -1;
+    }
+    return 1;
+}
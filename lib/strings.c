@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65strings.h"
+#include "o65hash.h"
+#include <string.h>
+
+/** Initial number of slots in the hash table */
+#define POOL_INITIAL_SIZE 64
+
+void o65_string_pool_init(o65_string_pool_t *pool, o65_context_t *context)
+{
+    memset(pool, 0, sizeof(o65_string_pool_t));
+    o65_arena_init(&(pool->arena), context, 0);
+    pool->context = context;
+}
+
+void o65_string_pool_free(o65_string_pool_t *pool)
+{
+    o65_context_free(pool->context, pool->table);
+    o65_arena_free(&(pool->arena));
+    pool->table = NULL;
+    pool->table_size = 0;
+    pool->count = 0;
+}
+
+/**
+ * @brief Finds the slot for a string in the hash table.
+ *
+ * @param[in] pool The string pool, which must have a hash table.
+ * @param[in] name Points to the string data.
+ * @param[in] len Length of the string data.
+ * @param[in] hash Hash of the string data.
+ *
+ * @return The slot containing the string, or the empty slot where it
+ * should be inserted.
+ */
+static o65_string_t **find_slot
+    (const o65_string_pool_t *pool, const char *name, size_t len,
+     uint64_t hash)
+{
+    size_t mask = pool->table_size - 1;
+    size_t index = (size_t)hash & mask;
+    o65_string_t *entry;
+    while ((entry = pool->table[index]) != NULL) {
+        if (entry->hash == hash && entry->len == len &&
+                !memcmp(entry->name, name, len))
+            break;
+        index = (index + 1) & mask;
+    }
+    return &(pool->table[index]);
+}
+
+/**
+ * @brief Doubles the size of the hash table.
+ *
+ * @param[in,out] pool The string pool.
+ *
+ * @return 1 on success, or -1 if out of memory.
+ */
+static int grow_table(o65_string_pool_t *pool)
+{
+    size_t new_size = pool->table_size ? pool->table_size * 2
+                                       : POOL_INITIAL_SIZE;
+    o65_string_t **old_table = pool->table;
+    size_t old_size = pool->table_size;
+    o65_string_t *entry;
+    size_t index;
+
+    pool->table = (o65_string_t **)o65_context_alloc
+        (pool->context, new_size * sizeof(o65_string_t *));
+    if (!(pool->table)) {
+        pool->table = old_table;
+        return -1;
+    }
+    memset(pool->table, 0, new_size * sizeof(o65_string_t *));
+    pool->table_size = new_size;
+
+    /* Rehash the existing entries using their precomputed hashes */
+    for (index = 0; index < old_size; ++index) {
+        if ((entry = old_table[index]) != NULL)
+            *find_slot(pool, entry->name, entry->len, entry->hash) = entry;
+    }
+    o65_context_free(pool->context, old_table);
+    return 1;
+}
+
+o65_string_t *o65_string_intern
+    (o65_string_pool_t *pool, const char *name, size_t len)
+{
+    uint64_t hash = o65_hash64(name, len, 0);
+    o65_string_t **slot;
+    o65_string_t *entry;
+
+    /* Keep the table at most three-quarters full */
+    if ((pool->count + 1) * 4 > pool->table_size * 3) {
+        if (grow_table(pool) < 0)
+            return NULL;
+    }
+
+    /* Return the existing entry if the string is already interned */
+    slot = find_slot(pool, name, len, hash);
+    if (*slot)
+        return *slot;
+
+    /* Add a new entry for the string */
+    entry = (o65_string_t *)o65_arena_alloc
+        (&(pool->arena), sizeof(o65_string_t));
+    if (!entry)
+        return NULL;
+    entry->name = o65_arena_strndup(&(pool->arena), name, len);
+    if (!(entry->name))
+        return NULL;
+    entry->len = len;
+    entry->hash = hash;
+    entry->data = NULL;
+    *slot = entry;
+    ++(pool->count);
+    return entry;
+}
+
+o65_string_t *o65_string_find
+    (const o65_string_pool_t *pool, const char *name, size_t len)
+{
+    if (!(pool->count))
+        return NULL;
+    return *find_slot(pool, name, len, o65_hash64(name, len, 0));
+}
+
+int o65_decode_externs
+    (o65_string_pool_t *pool, const o65_image_view_t *view,
+     o65_string_t **names)
+{
+    const char *ptr = (const char *)(view->externs.data);
+    const char *end = ptr + view->externs.size;
+    const char *nul;
+    o65_size_t index;
+
+    for (index = 0; index < view->num_externs; ++index) {
+        nul = memchr(ptr, 0, (size_t)(end - ptr));
+        if (!nul)
+            return 0;
+        names[index] = o65_string_intern(pool, ptr, (size_t)(nul - ptr));
+        if (!(names[index]))
+            return -1;
+        ptr = nul + 1;
+    }
+    return 1;
+}
+
+int o65_decode_exports
+    (o65_string_pool_t *pool, const o65_image_view_t *view,
+     o65_export_entry_t *exports)
+{
+    const o65_codec_t *codec = o65_get_codec(&(view->header));
+    const char *ptr = (const char *)(view->exports.data);
+    const char *end = ptr + view->exports.size;
+    const char *nul;
+    o65_size_t index;
+
+    for (index = 0; index < view->num_exports; ++index) {
+        /* Intern the name of the symbol */
+        nul = memchr(ptr, 0, (size_t)(end - ptr));
+        if (!nul)
+            return 0;
+        exports[index].name = o65_string_intern
+            (pool, ptr, (size_t)(nul - ptr));
+        if (!(exports[index].name))
+            return -1;
+        ptr = nul + 1;
+
+        /* Get the segment identifier and value */
+        if ((size_t)(end - ptr) < 1 + codec->count_size)
+            return 0;
+        exports[index].segid = (uint8_t)(*ptr++);
+        exports[index].value = codec->get_count((const uint8_t *)ptr);
+        ptr += codec->count_size;
+    }
+    return 1;
+}
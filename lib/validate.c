@@ -0,0 +1,198 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65validate.h"
+#include <string.h>
+
+/**
+ * @brief Records why an image failed validation.
+ *
+ * @param[out] error Returns the details of the failure, or NULL.
+ * @param[in] code The error code.
+ * @param[in] view View of the image.
+ * @param[in] ptr Points to the part of the image that is invalid.
+ *
+ * @return Always returns zero.
+ */
+static int fail
+    (o65_validate_error_t *error, int code,
+     const o65_image_view_t *view, const uint8_t *ptr)
+{
+    if (error) {
+        error->error = code;
+        error->offset = (size_t)(ptr - view->start);
+    }
+    return 0;
+}
+
+/**
+ * @brief Checks that a segment does not wrap around the address space.
+ *
+ * @param[in] base Base address of the segment.
+ * @param[in] len Length of the segment.
+ * @param[in] limit Last address in the address space.
+ *
+ * @return Non-zero if the segment is valid.
+ */
+static int check_segment(o65_size_t base, o65_size_t len, o65_size_t limit)
+{
+    return base <= limit && len <= (limit - base) + 1U;
+}
+
+/**
+ * @brief Validates the header of an image.
+ *
+ * @param[in] header The header to validate.
+ *
+ * @return Non-zero if the header is valid.
+ */
+static int check_header(const o65_header_t *header)
+{
+    o65_size_t limit;
+    if (header->mode & O65_MODE_32BIT)
+        limit = 0xFFFFFFFFU;
+    else
+        limit = 0xFFFFU;
+    if (!check_segment(header->tbase, header->tlen, limit) ||
+            !check_segment(header->dbase, header->dlen, limit) ||
+            !check_segment(header->bbase, header->blen, limit) ||
+            !check_segment(header->zbase, header->zlen, limit))
+        return 0;
+
+    /* Simple files have .text, .data, and .bss next to each other */
+    if (header->mode & O65_MODE_SIMPLE) {
+        if (header->dbase != header->tbase + header->tlen ||
+                header->bbase != header->dbase + header->dlen)
+            return 0;
+    }
+    return 1;
+}
+
+/**
+ * @brief Validates a relocation table.
+ *
+ * @param[in] view View of the image.
+ * @param[in] relocs Span containing the encoded relocation table.
+ * @param[in] base Base address of the segment.
+ * @param[in] size Size of the segment.
+ * @param[out] error Returns the reason for a failure, or NULL.
+ *
+ * @return 1 if the table is valid, or 0 if not.
+ */
+static int check_relocs
+    (const o65_image_view_t *view, const o65_span_t *relocs,
+     o65_size_t base, o65_size_t size, o65_validate_error_t *error)
+{
+    /* Segments that a relocation can refer to; ABS is not relocatable */
+    const uint32_t valid =
+        (1U << O65_SEGID_UNDEF) | (1U << O65_SEGID_TEXT) |
+        (1U << O65_SEGID_DATA) | (1U << O65_SEGID_BSS) |
+        (1U << O65_SEGID_ZEROPAGE);
+    o65_reloc_iter_t iter;
+    o65_reloc_entry_t entry;
+    const uint8_t *ptr = relocs->data;
+    int result;
+
+    /* The iterator checks the bounds and the external references */
+    o65_reloc_iter_init
+        (&iter, &(view->header), relocs, base, size, view->num_externs);
+    while ((result = o65_reloc_iter_next(&iter, &entry)) > 0) {
+        switch (entry.type) {
+        case O65_RELOC_WORD:
+        case O65_RELOC_HIGH:
+        case O65_RELOC_LOW:
+        case O65_RELOC_SEGADR:
+        case O65_RELOC_SEG:
+            break;
+
+        default:
+            return fail(error, O65_VALIDATE_ERROR_RELOC_TYPE, view, ptr);
+        }
+        if (!(valid & (1U << entry.segid)))
+            return fail(error, O65_VALIDATE_ERROR_RELOC_SEGID, view, ptr);
+        ptr = iter.ptr;
+    }
+    if (result < 0) {
+        switch (iter.error) {
+        case O65_RELOC_ERROR_RANGE:
+            return fail(error, O65_VALIDATE_ERROR_RELOC_RANGE, view, ptr);
+        case O65_RELOC_ERROR_EXTERN:
+            return fail(error, O65_VALIDATE_ERROR_RELOC_EXTERN, view, ptr);
+        default:
+            return fail(error, O65_VALIDATE_ERROR_TRUNCATED, view, iter.ptr);
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Validates the exported symbols.
+ *
+ * @param[in] view View of the image.
+ * @param[out] error Returns the reason for a failure, or NULL.
+ *
+ * @return 1 if the exports are valid, or 0 if not.
+ */
+static int check_exports
+    (const o65_image_view_t *view, o65_validate_error_t *error)
+{
+    const o65_codec_t *codec = o65_get_codec(&(view->header));
+    const uint8_t *ptr = view->exports.data;
+    const uint8_t *end = ptr + view->exports.size;
+    const uint8_t *nul;
+    o65_size_t index;
+    uint8_t segid;
+
+    for (index = 0; index < view->num_exports; ++index) {
+        nul = memchr(ptr, 0, (size_t)(end - ptr));
+        if (!nul || (size_t)(end - nul) < 2 + codec->count_size)
+            return fail(error, O65_VALIDATE_ERROR_EXPORTS, view, ptr);
+        segid = nul[1];
+        if (segid < O65_SEGID_ABS || segid > O65_SEGID_ZEROPAGE)
+            return fail(error, O65_VALIDATE_ERROR_EXPORT_SEGID, view, nul + 1);
+        ptr = nul + 2 + codec->count_size;
+    }
+    return 1;
+}
+
+int o65_validate(o65_image_view_t *view, o65_validate_error_t *error)
+{
+    const o65_header_t *header = &(view->header);
+
+    view->verified = 0;
+    if (error) {
+        error->error = 0;
+        error->offset = 0;
+    }
+    if (!check_header(header))
+        return fail(error, O65_VALIDATE_ERROR_HEADER, view, view->start);
+    if (!check_relocs(view, &(view->text_relocs),
+                      header->tbase, header->tlen, error))
+        return 0;
+    if (!check_relocs(view, &(view->data_relocs),
+                      header->dbase, header->dlen, error))
+        return 0;
+    if (!check_exports(view, error))
+        return 0;
+    view->verified = 1;
+    return 1;
+}
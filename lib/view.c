@@ -0,0 +1,418 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "o65view.h"
+#include "o65compress.h"
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+/**
+ * @brief Reads the entire contents of a file descriptor into memory.
+ *
+ * @param[out] file Returns the details of the file contents.
+ * @param[in] fd The file descriptor to read from.
+ *
+ * @return 1 on success, or -1 on a filesystem error.
+ */
+static int read_all(o65_mapped_file_t *file, int fd)
+{
+    uint8_t *buf = NULL;
+    uint8_t *new_buf;
+    size_t size = 0;
+    size_t max_size = 0;
+    ssize_t len;
+    for (;;) {
+        if (size >= max_size) {
+            max_size = max_size ? max_size * 2 : 65536;
+            new_buf = (uint8_t *)o65_context_realloc
+                (file->context, buf, max_size);
+            if (!new_buf) {
+                o65_context_free(file->context, buf);
+                return -1;
+            }
+            buf = new_buf;
+        }
+        len = read(fd, buf + size, max_size - size);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            o65_context_fail(file->context, errno);
+            o65_context_free(file->context, buf);
+            return -1;
+        } else if (len == 0) {
+            break;
+        }
+        size += (size_t)len;
+    }
+    file->data = buf;
+    file->size = size;
+    file->mapped = 0;
+    return 1;
+}
+
+/**
+ * @brief Decompresses the contents of a file if it is compressed.
+ *
+ * @param[in,out] file The file contents, which will be replaced with
+ * the decompressed data.
+ *
+ * @return 1 on success, or -1 if out of memory or the compression
+ * format is not supported.
+ *
+ * If the compressed data is corrupt or truncated, then the data that
+ * could be decompressed replaces the file contents.  The image parser
+ * will then report the problem as a truncated or invalid image.
+ */
+static int decompress_file(o65_mapped_file_t *file)
+{
+    o65_compression_t format;
+    uint8_t *data;
+    size_t size;
+
+    format = o65_detect_compression(file->data, file->size);
+    if (format == O65_COMPRESSION_NONE)
+        return 1;
+#ifndef HAVE_ZLIB
+    if (format != O65_COMPRESSION_LZ) {
+        o65_unmap_file(file);
+        return o65_context_fail(file->context, ENOTSUP);
+    }
+#endif
+    if (o65_decompress(file->context, file->data, file->size,
+                       &data, &size) < 0) {
+        o65_unmap_file(file);
+        return -1;
+    }
+    o65_unmap_file(file);
+    file->data = data;
+    file->size = size;
+    file->compressed = 1;
+    return 1;
+}
+
+int o65_map_file
+    (o65_mapped_file_t *file, o65_context_t *context, const char *filename)
+{
+    struct stat st;
+    void *map;
+    int fd;
+    int result;
+
+    /* Clear the file details before we start */
+    file->data = NULL;
+    file->size = 0;
+    file->mapped = 0;
+    file->compressed = 0;
+    file->context = context;
+
+    /* Read standard input into a buffer if the filename is "-" */
+    if (!strcmp(filename, "-")) {
+        if (read_all(file, STDIN_FILENO) < 0)
+            return -1;
+        return decompress_file(file);
+    }
+
+    /* Open the file */
+    if ((fd = open(filename, O_RDONLY, 0)) < 0)
+        return o65_context_fail(context, errno);
+
+    /* Map regular files directly and read everything else */
+    if ((!context || !(context->options & O65_OPTION_NO_MMAP)) &&
+            fstat(fd, &st) >= 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        map = mmap(NULL, (size_t)(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map != MAP_FAILED) {
+            file->data = (const uint8_t *)map;
+            file->size = (size_t)(st.st_size);
+            file->mapped = 1;
+            close(fd);
+            return decompress_file(file);
+        }
+    }
+    result = read_all(file, fd);
+    if (result < 0) {
+        int saved_errno = errno;
+        close(fd);
+        errno = saved_errno;
+        return -1;
+    }
+    close(fd);
+    return decompress_file(file);
+}
+
+void o65_unmap_file(o65_mapped_file_t *file)
+{
+    if (file->mapped)
+        munmap((void *)(file->data), file->size);
+    else if (file->data)
+        o65_context_free(file->context, (void *)(file->data));
+    file->data = NULL;
+    file->size = 0;
+    file->mapped = 0;
+    file->compressed = 0;
+}
+
+void o65_option_iter_init(o65_option_iter_t *iter, const o65_span_t *options)
+{
+    iter->ptr = options->data;
+    iter->end = options->data + options->size;
+}
+
+int o65_option_iter_next(o65_option_iter_t *iter, o65_option_view_t *option)
+{
+    const uint8_t *ptr = iter->ptr;
+    size_t len;
+
+    /* Stop at the end of the options or at the zero terminator */
+    if (ptr >= iter->end || *ptr == 0)
+        return 0;
+
+    /* The length includes the length and type bytes themselves */
+    len = *ptr;
+    if (len < 2 || (size_t)(iter->end - ptr) < len) {
+        iter->ptr = iter->end;
+        return -1;
+    }
+    option->type = ptr[1];
+    option->data = ptr + 2;
+    option->len = len - 2;
+    iter->ptr = ptr + len;
+    return 1;
+}
+
+int o65_find_option
+    (const o65_span_t *options, uint8_t type, o65_option_view_t *option)
+{
+    o65_option_iter_t iter;
+    o65_option_iter_init(&iter, options);
+    while (o65_option_iter_next(&iter, option) > 0) {
+        if (option->type == type)
+            return 1;
+    }
+    return 0;
+}
+
+size_t o65_padding_alignment(const o65_image_view_t *view)
+{
+    o65_option_view_t option;
+
+    /* The payload is the log2 of the alignment, followed by zeroes
+     * that pad out the header options.  A large amount of padding
+     * is split over several options, which all have the same log2. */
+    if (!o65_find_option(&(view->options), O65_OPT_PADDING, &option))
+        return 0;
+    if (option.len < 1 || option.data[0] >= sizeof(size_t) * 8)
+        return 0;
+    return ((size_t)1) << option.data[0];
+}
+
+/**
+ * @brief Rounds the location of a segment out to whole pages.
+ *
+ * @param[out] offsets Returns the offsets of the segment.
+ * @param[in] base Start of the file that contains the segment.
+ * @param[in] segment The segment within the file.
+ * @param[in] page_size Size of a host page, which must be a power of two.
+ */
+static void round_to_pages
+    (o65_segment_offsets_t *offsets, const uint8_t *base,
+     const o65_span_t *segment, size_t page_size)
+{
+    size_t mask = page_size - 1;
+    offsets->offset = (size_t)(segment->data - base);
+    offsets->size = segment->size;
+    offsets->map_offset = offsets->offset & ~mask;
+    offsets->map_size =
+        (offsets->offset + offsets->size - offsets->map_offset + mask) & ~mask;
+}
+
+int o65_segment_offsets
+    (const o65_image_view_t *view, const uint8_t *base, size_t page_size,
+     o65_segment_offsets_t *text, o65_segment_offsets_t *data)
+{
+    round_to_pages(text, base, &(view->text), page_size);
+    round_to_pages(data, base, &(view->data), page_size);
+    return text->offset == text->map_offset;
+}
+
+/**
+ * @brief Gets a 16-bit or 32-bit count value from a buffer.
+ *
+ * @param[in,out] ptr Points to the current position in the buffer.
+ * @param[in] end Points to the end of the buffer.
+ * @param[in] codec Codec for the header mode.
+ * @param[out] count Returns the count value.
+ *
+ * @return 1 on success, or -1 if the buffer is too short.
+ */
+static int get_count
+    (const uint8_t **ptr, const uint8_t *end,
+     const o65_codec_t *codec, o65_size_t *count)
+{
+    if ((size_t)(end - *ptr) < codec->count_size)
+        return -1;
+    *count = codec->get_count(*ptr);
+    *ptr += codec->count_size;
+    return 1;
+}
+
+/**
+ * @brief Skips over a NUL-terminated string in a buffer.
+ *
+ * @param[in,out] ptr Points to the current position in the buffer.
+ * @param[in] end Points to the end of the buffer.
+ *
+ * @return 1 on success, or -1 if the buffer ends before the NUL.
+ */
+static int skip_string(const uint8_t **ptr, const uint8_t *end)
+{
+    const uint8_t *nul = memchr(*ptr, 0, end - *ptr);
+    if (!nul)
+        return -1;
+    *ptr = nul + 1;
+    return 1;
+}
+
+/**
+ * @brief Skips over a relocation table in a buffer.
+ *
+ * @param[out] span Returns the span for the relocation table.
+ * @param[in,out] ptr Points to the current position in the buffer.
+ * @param[in] end Points to the end of the buffer.
+ * @param[in] codec Codec for the header mode.
+ *
+ * @return 1 on success, or -1 if the buffer ends before the table does.
+ */
+static int skip_relocs
+    (o65_span_t *span, const uint8_t **ptr, const uint8_t *end,
+     const o65_codec_t *codec)
+{
+    o65_reloc_t reloc;
+    size_t len;
+    span->data = *ptr;
+    do {
+        if (codec->parse_reloc(*ptr, end - *ptr, &reloc, &len) < 0)
+            return -1;
+        *ptr += len;
+    } while (reloc.offset != 0);
+    span->size = *ptr - span->data;
+    return 1;
+}
+
+int o65_view_image(o65_image_view_t *view, const uint8_t *buf, size_t size)
+{
+    const uint8_t *ptr;
+    const uint8_t *end = buf + size;
+    const o65_codec_t *codec;
+    o65_size_t index;
+    size_t text_size;
+    size_t data_size;
+    size_t len;
+    int result;
+
+    /* Clear the view details before we start */
+    memset(view, 0, sizeof(o65_image_view_t));
+    view->start = buf;
+
+    /* Parse the header */
+    result = o65_parse_header(buf, size, &(view->header), &len);
+    if (result <= 0)
+        return result;
+    ptr = buf + len;
+    codec = o65_get_codec(&(view->header));
+
+    /* Find the extent of the header options */
+    view->options.data = ptr;
+    for (;;) {
+        if (ptr >= end)
+            return -1;
+        if (*ptr == 0)
+            break;
+        if (*ptr < 2)
+            return 0;
+        if ((size_t)(end - ptr) < *ptr)
+            return -1;
+        ptr += *ptr;
+    }
+    view->options.size = ptr - view->options.data;
+    ++ptr;
+
+    /* Find the .text and .data segments, which may be compressed */
+    result = o65_get_stored_sizes
+        (&(view->options), &(view->header), &text_size, &data_size);
+    if (result < 0)
+        return 0;
+    view->compressed = result;
+    view->text.data = ptr;
+    if ((size_t)(end - ptr) < text_size)
+        return -1;
+    view->text.size = text_size;
+    ptr += text_size;
+    view->data.data = ptr;
+    if ((size_t)(end - ptr) < data_size)
+        return -1;
+    view->data.size = data_size;
+    ptr += data_size;
+
+    /* Find the names of the external references */
+    view->externs.data = ptr;
+    if (get_count(&ptr, end, codec, &(view->num_externs)) < 0)
+        return -1;
+    view->externs.data = ptr;
+    for (index = 0; index < view->num_externs; ++index) {
+        if (skip_string(&ptr, end) < 0)
+            return -1;
+    }
+    view->externs.size = ptr - view->externs.data;
+
+    /* Find the relocation tables for the .text and .data segments */
+    if (skip_relocs(&(view->text_relocs), &ptr, end, codec) < 0)
+        return -1;
+    if (skip_relocs(&(view->data_relocs), &ptr, end, codec) < 0)
+        return -1;
+
+    /* Find the exported symbol definitions */
+    view->exports.data = ptr;
+    if (get_count(&ptr, end, codec, &(view->num_exports)) < 0)
+        return -1;
+    view->exports.data = ptr;
+    for (index = 0; index < view->num_exports; ++index) {
+        o65_size_t value;
+        if (skip_string(&ptr, end) < 0)
+            return -1;
+        if (ptr >= end)
+            return -1;
+        ++ptr; /* Segment identifier */
+        if (get_count(&ptr, end, codec, &value) < 0)
+            return -1;
+    }
+    view->exports.size = ptr - view->exports.data;
+
+    /* Done */
+    view->size = ptr - buf;
+    return 1;
+}
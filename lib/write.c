@@ -21,38 +21,12 @@
  */
 
 #include "o65file.h"
+#include "o65writer.h"
 #include <string.h>
 #include <stdlib.h>
 
-void o65_write_uint16(uint8_t *buf, uint16_t value)
+size_t o65_encode_header(uint8_t *buf, o65_header_t *header)
 {
-    buf[0] = (uint8_t)value;
-    buf[1] = (uint8_t)(value >> 8);
-}
-
-void o65_write_uint24(uint8_t *buf, uint32_t value)
-{
-    buf[0] = (uint8_t)value;
-    buf[1] = (uint8_t)(value >> 8);
-    buf[2] = (uint8_t)(value >> 16);
-}
-
-void o65_write_uint32(uint8_t *buf, uint32_t value)
-{
-    buf[0] = (uint8_t)value;
-    buf[1] = (uint8_t)(value >> 8);
-    buf[2] = (uint8_t)(value >> 16);
-    buf[3] = (uint8_t)(value >> 24);
-}
-
-int o65_write_header(FILE *file, o65_header_t *header)
-{
-    static uint8_t const magic[6] = {
-        0x01, 0x00, 0x6F, 0x36, 0x35, 0x00
-    };
-    uint8_t buf[38];
-    size_t size;
-
     /*
      * Page alignment can be specified in two different places.
      * Make sure that they are consistent.
@@ -85,12 +59,16 @@ int o65_write_header(FILE *file, o65_header_t *header)
         header->mode &= ~O65_MODE_SIMPLE;
     }
 
-    /* Write the magic number and version information */
-    if (fwrite(magic, 1, sizeof(magic), file) != sizeof(magic)) {
-        return -1;
-    }
+    /* Encode the magic number and version information */
+    buf[0] = O65_MAGIC_1;
+    buf[1] = O65_MAGIC_2;
+    buf[2] = O65_MAGIC_3;
+    buf[3] = O65_MAGIC_4;
+    buf[4] = O65_MAGIC_5;
+    buf[5] = O65_MAGIC_6;
 
-    /* Encode the rest of the header and write it */
+    /* Encode the rest of the header */
+    buf += 6;
     if ((header->mode & O65_MODE_32BIT) == 0) {
         /* 16-bit size fields */
         o65_write_uint16(buf,      header->mode);
@@ -103,7 +81,7 @@ int o65_write_header(FILE *file, o65_header_t *header)
         o65_write_uint16(buf + 14, header->zbase);
         o65_write_uint16(buf + 16, header->zlen);
         o65_write_uint16(buf + 18, header->stack);
-        size = 20;
+        return O65_HEADER_SIZE_16;
     } else {
         /* 32-bit size fields */
         o65_write_uint16(buf,      header->mode);
@@ -116,8 +94,14 @@ int o65_write_header(FILE *file, o65_header_t *header)
         o65_write_uint32(buf + 26, header->zbase);
         o65_write_uint32(buf + 30, header->zlen);
         o65_write_uint32(buf + 34, header->stack);
-        size = 38;
+        return O65_HEADER_SIZE_32;
     }
+}
+
+int o65_write_header(FILE *file, o65_header_t *header)
+{
+    uint8_t buf[O65_HEADER_SIZE_32];
+    size_t size = o65_encode_header(buf, header);
     if (fwrite(buf, 1, size, file) != size) {
         return -1;
     }
@@ -147,65 +131,29 @@ void o65_set_string_option
     option->type = type;
 }
 
+size_t o65_encode_reloc
+    (uint8_t *buf, const o65_header_t *header, const o65_reloc_t *reloc)
+{
+    return o65_get_codec(header)->encode_reloc(buf, reloc);
+}
+
 int o65_write_reloc
     (FILE *file, const o65_header_t *header, const o65_reloc_t *reloc)
 {
-    if (reloc->offset == 0 || reloc->offset == 255) {
-        /* Special single-byte relocation */
-        if (putc(reloc->offset, file) < 0) {
-            return -1;
-        }
-    } else {
-        /* Encode the relocation offset, type, and parameters */
-        if (putc(reloc->offset, file) < 0) {
-            return -1;
-        }
-        if (putc(reloc->type, file) < 0) {
-            return -1;
-        }
-        if ((reloc->type & O65_RELOC_SEGID) == O65_SEGID_UNDEF) {
-            /* Write the identifier of the external reference */
-            if (o65_write_count(file, header, reloc->undefid) < 0)
-                return -1;
-        }
-        switch (reloc->type & O65_RELOC_TYPE) {
-        case O65_RELOC_HIGH:
-            /* Include the low byte of the relocation address if not paged */
-            if ((header->mode & O65_MODE_PAGED) == 0) {
-                if (putc(reloc->extra & 0xFF, file) < 0) {
-                    return -1;
-                }
-            }
-            break;
-
-        case O65_RELOC_SEG:
-            /* Include the two low bytes of the relocation address */
-            if (putc(reloc->extra & 0xFF, file) < 0) {
-                return -1;
-            }
-            if (putc((reloc->extra >> 8) & 0xFF, file) < 0) {
-                return -1;
-            }
-            break;
-
-        default: break;
-        }
-    }
+    uint8_t buf[O65_MAX_RELOC_SIZE];
+    size_t size = o65_encode_reloc(buf, header, reloc);
+    if (fwrite(buf, 1, size, file) != size)
+        return -1;
     return 0;
 }
 
 int o65_write_count(FILE *file, const o65_header_t *header, o65_size_t count)
 {
+    const o65_codec_t *codec = o65_get_codec(header);
     uint8_t buf[4];
-    if ((header->mode & O65_MODE_32BIT) == 0) {
-        o65_write_uint16(buf, count);
-        if (fwrite(buf, 1, 2, file) != 2)
-            return -1;
-    } else {
-        o65_write_uint32(buf, count);
-        if (fwrite(buf, 1, 4, file) != 4)
-            return -1;
-    }
+    codec->put_count(buf, count);
+    if (fwrite(buf, 1, codec->count_size, file) != codec->count_size)
+        return -1;
     return 0;
 }
 
@@ -231,3 +179,185 @@ int o65_write_exported_symbol
         return -1;
     return o65_write_count(file, header, offset);
 }
+
+/** Inputs smaller than this are sorted with insertion sort */
+#define RELOC_RADIX_THRESHOLD 64
+
+void o65_reloc_encoder_init
+    (o65_reloc_encoder_t *encoder, o65_context_t *context)
+{
+    memset(encoder, 0, sizeof(o65_reloc_encoder_t));
+    encoder->context = context;
+}
+
+void o65_reloc_encoder_free(o65_reloc_encoder_t *encoder)
+{
+    o65_context_free(encoder->context, encoder->fixups);
+    o65_reloc_encoder_init(encoder, encoder->context);
+}
+
+int o65_reloc_encoder_add
+    (o65_reloc_encoder_t *encoder, o65_size_t address,
+     const o65_reloc_t *reloc)
+{
+    o65_reloc_fixup_t *fixup;
+    if (encoder->error)
+        return -1;
+    if (encoder->count >= encoder->max_count) {
+        size_t max_count = encoder->max_count ? encoder->max_count * 2 : 256;
+        fixup = (o65_reloc_fixup_t *)o65_context_realloc
+            (encoder->context, encoder->fixups,
+             max_count * sizeof(o65_reloc_fixup_t));
+        if (!fixup) {
+            encoder->error = 1;
+            return -1;
+        }
+        encoder->fixups = fixup;
+        encoder->max_count = max_count;
+    }
+    fixup = &(encoder->fixups[(encoder->count)++]);
+    fixup->address = address;
+    fixup->undefid = reloc->undefid;
+    fixup->extra = reloc->extra;
+    fixup->type = reloc->type;
+    return 0;
+}
+
+/**
+ * @brief Sorts relocations on address with a stable insertion sort.
+ *
+ * @param[in,out] fixups The relocations to sort.
+ * @param[in] count The number of relocations.
+ */
+static void insertion_sort_fixups(o65_reloc_fixup_t *fixups, size_t count)
+{
+    o65_reloc_fixup_t temp;
+    size_t index, posn;
+    for (index = 1; index < count; ++index) {
+        if (fixups[index - 1].address <= fixups[index].address)
+            continue;
+        temp = fixups[index];
+        posn = index;
+        while (posn > 0 && fixups[posn - 1].address > temp.address) {
+            fixups[posn] = fixups[posn - 1];
+            --posn;
+        }
+        fixups[posn] = temp;
+    }
+}
+
+/**
+ * @brief Sorts relocations on address with a stable LSD radix sort.
+ *
+ * @param[in,out] context Context to allocate temporary memory with.
+ * @param[in,out] fixups The relocations to sort.
+ * @param[in] count The number of relocations.
+ *
+ * @return Non-zero if OK, or zero if out of memory.
+ *
+ * Passes are skipped for address bytes that are the same in every
+ * relocation, so 16-bit images only need two passes.
+ */
+static int radix_sort_fixups
+    (o65_context_t *context, o65_reloc_fixup_t *fixups, size_t count)
+{
+    o65_reloc_fixup_t *temp;
+    o65_reloc_fixup_t *from = fixups;
+    o65_reloc_fixup_t *to;
+    size_t counts[256];
+    size_t index, total, n;
+    unsigned shift;
+
+    temp = (o65_reloc_fixup_t *)o65_context_alloc
+        (context, count * sizeof(o65_reloc_fixup_t));
+    if (!temp)
+        return 0;
+    to = temp;
+    for (shift = 0; shift < 32; shift += 8) {
+        /* Count the number of addresses with each byte value */
+        memset(counts, 0, sizeof(counts));
+        for (index = 0; index < count; ++index)
+            ++(counts[(from[index].address >> shift) & 0xFF]);
+        if (counts[(from[0].address >> shift) & 0xFF] == count)
+            continue;
+
+        /* Convert the counts into starting positions and scatter */
+        total = 0;
+        for (index = 0; index < 256; ++index) {
+            n = counts[index];
+            counts[index] = total;
+            total += n;
+        }
+        for (index = 0; index < count; ++index)
+            to[(counts[(from[index].address >> shift) & 0xFF])++] = from[index];
+        to = from;
+        from = (from == fixups) ? temp : fixups;
+    }
+    if (from != fixups)
+        memcpy(fixups, from, count * sizeof(o65_reloc_fixup_t));
+    o65_context_free(context, temp);
+    return 1;
+}
+
+int o65_reloc_encoder_write
+    (o65_reloc_encoder_t *encoder, o65_writer_t *writer, o65_size_t base)
+{
+    o65_reloc_fixup_t *fixups = encoder->fixups;
+    const o65_codec_t *codec = writer->codec;
+    o65_size_t last = base - 1;
+    o65_size_t delta;
+    size_t index, count;
+    o65_reloc_t reloc;
+    uint8_t *ptr;
+
+    /* Sort the relocations into ascending order of address */
+    if (encoder->error)
+        return -1;
+    if (encoder->count < RELOC_RADIX_THRESHOLD) {
+        insertion_sort_fixups(fixups, encoder->count);
+    } else if (!radix_sort_fixups
+                   (encoder->context, fixups, encoder->count)) {
+        encoder->error = 1;
+        return -1;
+    }
+
+    /* Remove duplicates, keeping the first of each that was added */
+    count = 0;
+    for (index = 0; index < encoder->count; ++index) {
+        if (count > 0 && fixups[count - 1].address == fixups[index].address)
+            continue;
+        fixups[count++] = fixups[index];
+    }
+    encoder->duplicates += encoder->count - count;
+    encoder->count = count;
+
+    /* Addresses cannot be before the start of the segment */
+    if (count > 0 && fixups[0].address < base)
+        return 0;
+
+    /* Encode the deltas between addresses, with skips for large gaps */
+    for (index = 0; index < count; ++index) {
+        delta = fixups[index].address - last;
+        if (delta > 254) {
+            size_t skips = (delta - 1) / 254;
+            if ((ptr = o65_writer_reserve(writer, skips)) == NULL)
+                return -1;
+            memset(ptr, 255, skips);
+            delta -= skips * 254;
+        }
+        reloc.offset = (uint8_t)delta;
+        reloc.type = fixups[index].type;
+        reloc.extra = fixups[index].extra;
+        reloc.undefid = fixups[index].undefid;
+        if ((ptr = o65_writer_reserve(writer, O65_MAX_RELOC_SIZE)) == NULL)
+            return -1;
+        writer->size -= O65_MAX_RELOC_SIZE - codec->encode_reloc(ptr, &reloc);
+        last = fixups[index].address;
+    }
+
+    /* Terminate the table */
+    if ((ptr = o65_writer_reserve(writer, 1)) == NULL)
+        return -1;
+    *ptr = 0;
+    return 1;
+}
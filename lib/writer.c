@@ -0,0 +1,195 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+
+#include "o65writer.h"
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+void o65_writer_init(o65_writer_t *writer, o65_context_t *context)
+{
+    memset(writer, 0, sizeof(o65_writer_t));
+    writer->codec = o65_get_codec(&(writer->header));
+    writer->context = context;
+}
+
+void o65_writer_free(o65_writer_t *writer)
+{
+    o65_context_free(writer->context, writer->data);
+    o65_writer_init(writer, writer->context);
+}
+
+uint8_t *o65_writer_reserve(o65_writer_t *writer, size_t len)
+{
+    uint8_t *ptr;
+    if (writer->error)
+        return NULL;
+    if ((writer->max_size - writer->size) < len) {
+        size_t max_size = writer->max_size ? writer->max_size : 4096;
+        while ((max_size - writer->size) < len)
+            max_size *= 2;
+        ptr = (uint8_t *)o65_context_realloc
+            (writer->context, writer->data, max_size);
+        if (!ptr) {
+            writer->error = 1;
+            return NULL;
+        }
+        writer->data = ptr;
+        writer->max_size = max_size;
+    }
+    ptr = writer->data + writer->size;
+    writer->size += len;
+    return ptr;
+}
+
+int o65_writer_header(o65_writer_t *writer, o65_header_t *header)
+{
+    uint8_t *ptr = o65_writer_reserve(writer, O65_HEADER_SIZE_32);
+    if (!ptr)
+        return -1;
+    writer->size -= O65_HEADER_SIZE_32 - o65_encode_header(ptr, header);
+    writer->header = *header;
+    writer->codec = o65_get_codec(header);
+    return 0;
+}
+
+int o65_writer_option(o65_writer_t *writer, const o65_option_t *option)
+{
+    if (!option || option->len == 0)
+        return o65_writer_bytes(writer, "", 1);
+    else
+        return o65_writer_bytes(writer, &(option->len), option->len);
+}
+
+int o65_writer_padding(o65_writer_t *writer, size_t alignment)
+{
+    size_t mask = alignment - 1;
+    size_t pad;
+    size_t len;
+    uint8_t shift;
+    uint8_t *ptr;
+
+    /* Only powers of two can be expressed in the option */
+    if (alignment < 2 || (alignment & mask) != 0)
+        return 0;
+    for (shift = 1; (((size_t)1) << shift) < alignment; ++shift)
+        ; /* Find the log2 of the alignment */
+
+    /* Determine how much padding is needed for the segments to start on
+     * an alignment boundary after the zero that terminates the options.
+     * Every padding option has a length, type, and shift byte at least. */
+    pad = (alignment - ((writer->size + 1) & mask)) & mask;
+    while (pad < 3)
+        pad += alignment;
+
+    /* Split the padding into options of up to 255 bytes, making sure
+     * that the remainder is never too small to form an option itself */
+    while (pad > 0) {
+        len = (pad > O65_MAX_OPT_SIZE) ? O65_MAX_OPT_SIZE : pad;
+        if ((pad - len) > 0 && (pad - len) < 3)
+            len = pad - 3;
+        ptr = o65_writer_reserve(writer, len);
+        if (!ptr)
+            return -1;
+        memset(ptr, 0, len);
+        ptr[0] = (uint8_t)len;
+        ptr[1] = O65_OPT_PADDING;
+        ptr[2] = shift;
+        pad -= len;
+    }
+    return 0;
+}
+
+int o65_writer_bytes(o65_writer_t *writer, const void *data, size_t len)
+{
+    uint8_t *ptr = o65_writer_reserve(writer, len);
+    if (!ptr)
+        return -1;
+    if (len)
+        memcpy(ptr, data, len);
+    return 0;
+}
+
+int o65_writer_count(o65_writer_t *writer, o65_size_t count)
+{
+    uint8_t *ptr = o65_writer_reserve(writer, writer->codec->count_size);
+    if (!ptr)
+        return -1;
+    writer->codec->put_count(ptr, count);
+    return 0;
+}
+
+int o65_writer_string(o65_writer_t *writer, const char *str)
+{
+    if (!str)
+        str = "";
+    return o65_writer_bytes(writer, str, strlen(str) + 1);
+}
+
+int o65_writer_reloc(o65_writer_t *writer, const o65_reloc_t *reloc)
+{
+    uint8_t *ptr = o65_writer_reserve(writer, O65_MAX_RELOC_SIZE);
+    if (!ptr)
+        return -1;
+    writer->size -= O65_MAX_RELOC_SIZE - writer->codec->encode_reloc(ptr, reloc);
+    return 0;
+}
+
+int o65_writer_exported_symbol
+    (o65_writer_t *writer, const char *name, uint8_t segID, o65_size_t offset)
+{
+    if (o65_writer_string(writer, name) < 0)
+        return -1;
+    if (o65_writer_bytes(writer, &segID, 1) < 0)
+        return -1;
+    return o65_writer_count(writer, offset);
+}
+
+int o65_writer_flush(o65_writer_t *writer, int fd)
+{
+    size_t posn = 0;
+    ssize_t len;
+    if (writer->error)
+        return o65_context_fail(writer->context, ENOMEM);
+    while (posn < writer->size) {
+        len = write(fd, writer->data + posn, writer->size - posn);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            return o65_context_fail(writer->context, errno);
+        }
+        posn += (size_t)len;
+    }
+    writer->size = 0;
+    return 0;
+}
+
+uint8_t *o65_writer_take(o65_writer_t *writer, size_t *size)
+{
+    uint8_t *data = writer->error ? NULL : writer->data;
+    *size = writer->error ? 0 : writer->size;
+    if (writer->error)
+        o65_context_free(writer->context, writer->data);
+    o65_writer_init(writer, writer->context);
+    return data;
+}
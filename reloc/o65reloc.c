@@ -21,100 +21,79 @@
  */
 
 #include "o65file.h"
+#include "o65arena.h"
+#include "o65dir.h"
+#include "o65load.h"
+#include "o65strings.h"
+#include "o65validate.h"
+#include "o65view.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
 #include <getopt.h>
 
-#define short_options "t:d:b:z:i:"
+#define short_options "t:d:b:z:i:n:"
 static struct option long_options[] = {
     {"text-address",        required_argument,  0,  't'},
     {"data-address",        required_argument,  0,  'd'},
     {"bss-address",         required_argument,  0,  'b'},
     {"zeropage-address",    required_argument,  0,  'z'},
     {"imports",             required_argument,  0,  'i'},
+    {"image",               required_argument,  0,  'n'},
     {0,                     0,                  0,    0},
 };
 
 /** Information about an imported symbol */
-typedef struct import_info_s import_info_t;
-struct import_info_s
+typedef struct
 {
-    /** Name of the symbol */
-    char *name;
-
     /** Value of the symbol */
     o65_size_t value;
 
-    /** Next import in the list */
-    import_info_t *next;
-};
+} import_info_t;
 
 /** Information to use when relocating an image */
 typedef struct
 {
-    /** Header that was loaded from the image */
-    o65_header_t header;
-
-    /** Address to load the .text segment to */
-    o65_size_t load_text_address;
-
-    /** Address to load the .data segment to, 0 for default location */
-    o65_size_t load_data_address;
-
-    /** Address to load the .bss segment to, 0 for default location */
-    o65_size_t load_bss_address;
+    /** Addresses to load the segments to, 0 for the default locations */
+    o65_load_addresses_t addresses;
 
-    /** Alignment to use on the image's .text, .data, and .bss segments */
-    o65_size_t alignment;
-
-    /** Address to load the .text segment to */
-    o65_size_t text_address;
-
-    /** Size of the .text segment after alignment */
-    o65_size_t text_size;
+    /** Final layout of the segments */
+    o65_layout_t layout;
 
     /** Contents of the .text segment */
     uint8_t *text_segment;
 
-    /** Address to load the .data segment to */
-    o65_size_t data_address;
-
-    /** Size of the .data segment after alignment */
-    o65_size_t data_size;
-
-    /** Size of the .data segment plus .bss if .bss needs to be zeroed */
-    o65_size_t data_plus_bss_size;
-
-    /** Contents of the .data segment */
+    /** Contents of the .data segment, plus .bss if .bss needs to be zeroed */
     uint8_t *data_segment;
 
-    /** Address to load the .bss segment to */
-    o65_size_t bss_address;
+    /** Pool of interned names; imported symbols have an import_info_t */
+    o65_string_pool_t names;
 
-    /** Size of the .bss segment after alignment */
-    o65_size_t bss_size;
+    /** Interned names of the external references in the image */
+    o65_string_t **extern_names;
 
-    /** Address to load the zero page segment to */
-    o65_size_t zeropage_address;
+    /** Name of the input file, for error reporting */
+    const char *filename;
 
-    /** Number of external references */
-    o65_size_t num_externs;
+    /** Library context for loading and relocating the image */
+    o65_context_t context;
 
-    /** Resolved addresses for the external references */
-    o65_size_t *externs;
-
-    /** List of imported symbols to resolve external references */
-    import_info_t *imports;
+    /** Arena that all memory for the relocation is allocated from */
+    o65_arena_t arena;
 
 } reloc_info_t;
 
 static void usage(const char *progname);
-static void file_error(FILE *file, const char *filename);
-static int load(reloc_info_t *info, FILE *file, const char *filename);
+static int load(reloc_info_t *info, const o65_image_view_t *view);
 static int load_imports(reloc_info_t *info, const char *filename);
-static void free_imports(reloc_info_t *info);
+static int find_image
+    (reloc_info_t *info, const char *filename,
+     const o65_mapped_file_t *file, o65_size_t image, off_t *offset);
+static int write_output
+    (const char *filename, const uint8_t *data1, size_t size1,
+     const uint8_t *data2, size_t size2);
 
 int main(int argc, char *argv[])
 {
@@ -123,38 +102,42 @@ int main(int argc, char *argv[])
     const char *output_file = 0;
     const char *data_output_file = 0;
     const char *imports_file = 0;
-    reloc_info_t info = {
-        .alignment = 1
-    };
-    FILE *infile;
-    FILE *outfile;
+    o65_size_t image = 0;
+    reloc_info_t info;
+    o65_mapped_file_t infile;
+    o65_image_view_t view;
+    off_t offset = 0;
     int result;
 
     /* Parse the command-line options */
+    memset(&info, 0, sizeof(info));
+    o65_context_init(&info.context);
+    o65_arena_init(&info.arena, &info.context, 0);
+    o65_string_pool_init(&info.names, &info.context);
     for (;;) {
         int opt = getopt_long(argc, argv, short_options, long_options, 0);
         if (opt < 0)
             break;
         switch (opt) {
         case 't':
-            info.load_text_address = strtoul(optarg, NULL, 0);
-            if (info.load_text_address == 0U) {
+            info.addresses.text_address = strtoul(optarg, NULL, 0);
+            if (info.addresses.text_address == 0U) {
                 fprintf(stderr, "%s: text load address cannot be zero\n", progname);
                 return 1;
             }
             break;
 
         case 'd':
-            info.load_data_address = strtoul(optarg, NULL, 0);
+            info.addresses.data_address = strtoul(optarg, NULL, 0);
             break;
 
         case 'b':
-            info.load_bss_address = strtoul(optarg, NULL, 0);
+            info.addresses.bss_address = strtoul(optarg, NULL, 0);
             break;
 
         case 'z':
-            info.zeropage_address = strtoul(optarg, NULL, 0);
-            if (info.zeropage_address >= 256U) {
+            info.addresses.zeropage_address = strtoul(optarg, NULL, 0);
+            if (info.addresses.zeropage_address >= 256U) {
                 fprintf(stderr, "%s: invalid zero page address\n", progname);
                 return 1;
             }
@@ -162,6 +145,8 @@ int main(int argc, char *argv[])
 
         case 'i': imports_file = optarg; break;
 
+        case 'n': image = strtoul(optarg, NULL, 0); break;
+
         default:
             usage(progname);
             return 1;
@@ -182,81 +167,76 @@ int main(int argc, char *argv[])
     /* Load the imports file */
     if (imports_file) {
         result = load_imports(&info, imports_file);
-        if (result <= 0)
+        if (result <= 0) {
+            o65_string_pool_free(&info.names);
+            o65_arena_free(&info.arena);
             return 1;
+        }
     }
 
-    /* Open the input .o65 file and read the header */
-    if ((infile = fopen(input_file, "rb")) == NULL) {
+    /* Map the input .o65 file into memory */
+    if (o65_map_file(&infile, &info.context, input_file) < 0) {
         perror(input_file);
+        o65_string_pool_free(&info.names);
+        o65_arena_free(&info.arena);
         return 1;
     }
-    result = o65_read_header(infile, &info.header);
-    if (result < 0) {
-        perror(input_file);
-        fclose(infile);
-        free_imports(&info);
+
+    /* Find the image to relocate if the file has chained images */
+    if (image > 0 &&
+            find_image(&info, input_file, &infile, image, &offset) <= 0) {
+        o65_string_pool_free(&info.names);
+        o65_arena_free(&info.arena);
+        o65_unmap_file(&infile);
         return 1;
+    }
+
+    /* Parse the image */
+    result = o65_view_image
+        (&view, infile.data + offset, infile.size - (size_t)offset);
+    if (result < 0) {
+        fprintf(stderr, "%s: unexpected EOF\n", input_file);
     } else if (result == 0) {
         fprintf(stderr, "%s: not in .o65 format\n", input_file);
-        fclose(infile);
-        free_imports(&info);
-        return 1;
+    } else {
+        /* Validate the image up front so that the relocations can be
+         * applied without checking each one.  If the image is invalid,
+         * then relocating it will report the problem in detail. */
+        o65_validate(&view, NULL);
+
+        /* Load and relocate the image */
+        info.filename = input_file;
+        result = load(&info, &view);
+        if (result < 0)
+            perror(input_file);
+        else if (result == 0)
+            fprintf(stderr, "%s: file is invalid\n", input_file);
     }
 
-    /* Load the input file */
-    result = load(&info, infile, input_file);
-    if (result < 0)
-        file_error(infile, input_file);
-    else if (result == 0)
-        fprintf(stderr, "%s: file is invalid\n", input_file);
-
     /* Write the relocated data to the output file(s) */
     if (result > 0) {
-        if ((outfile = fopen(output_file, "wb")) == NULL) {
-            perror(output_file);
-            result = -1;
+        if (!data_output_file) {
+            /* Write the .data segment to the same file as .text */
+            result = write_output
+                (output_file, info.text_segment, info.layout.text_size,
+                 info.data_segment, info.layout.data_load_size);
         } else {
-            if (fwrite(info.text_segment, 1, info.text_size, outfile)
-                    != info.text_size) {
-                perror(output_file);
-                result = -1;
-                fclose(outfile);
-            } else if (!data_output_file) {
-                /* Write the .data segment to the same file as .text */
-                if (fwrite(info.data_segment, 1, info.data_plus_bss_size, outfile)
-                        != info.data_plus_bss_size) {
-                    perror(output_file);
-                    result = -1;
-                }
-                fclose(outfile);
-            } else {
-                /* Write the .data segment to a different file */
-                fclose(outfile);
-                if ((outfile = fopen(data_output_file, "wb")) == NULL) {
-                    perror(data_output_file);
-                    result = -1;
-                } else {
-                    if (fwrite(info.data_segment, 1, info.data_plus_bss_size, outfile)
-                            != info.data_plus_bss_size) {
-                        perror(data_output_file);
-                        result = -1;
-                    }
-                    fclose(outfile);
-                }
+            /* Write the .data segment to a different file */
+            result = write_output
+                (output_file, info.text_segment, info.layout.text_size,
+                 NULL, 0);
+            if (result > 0) {
+                result = write_output
+                    (data_output_file, info.data_segment,
+                     info.layout.data_load_size, NULL, 0);
             }
         }
     }
 
     /* Clean up and exit */
-    if (info.text_segment)
-        free(info.text_segment);
-    if (info.data_segment)
-        free(info.data_segment);
-    if (info.externs)
-        free(info.externs);
-    free_imports(&info);
-    fclose(infile);
+    o65_string_pool_free(&info.names);
+    o65_arena_free(&info.arena);
+    o65_unmap_file(&infile);
     return (result <= 0) ? 1 : 0;
 }
 
@@ -268,6 +248,7 @@ int main(int argc, char *argv[])
 static void usage(const char *progname)
 {
     fprintf(stderr, "Usage: %s [options] input.o65 output.bin [data-output.bin]\n\n", progname);
+    fprintf(stderr, "A filename of '-' reads from standard input or writes to standard output.\n\n");
 
     fprintf(stderr, "    --text-address ADDRESS, -t ADDRESS\n");
     fprintf(stderr, "        Address to load the text segment to on the target system.\n");
@@ -286,384 +267,190 @@ static void usage(const char *progname)
 
     fprintf(stderr, "    --imports IMPFILE, -i IMPFILE\n");
     fprintf(stderr, "        File with a list of import addresses to resolve externals.\n\n");
-}
-
-/**
- * @brief Report an error from loading the input file.
- *
- * @param[in] file The file pointer.
- * @param[in] filename Name of the file.
- */
-static void file_error(FILE *file, const char *filename)
-{
-    if (feof(file))
-        fprintf(stderr, "%s: unexpected EOF\n", filename);
-    else
-        perror(filename);
-    fclose(file);
-}
 
-/**
- * @brief Aligns a size value.
- *
- * @param[in] size Size value to be aligned.
- * @param[in] alignment Alignment to use, which must be a power of 2.
- *
- * @return The aligned size value.
- */
-static o65_size_t align_size(o65_size_t size, o65_size_t alignment)
-{
-    return (size + alignment - 1) & ~(alignment - 1);
+    fprintf(stderr, "    --image N, -n N\n");
+    fprintf(stderr, "        Relocate image N from a file with chained images, where\n");
+    fprintf(stderr, "        the first image is 0.  Defaults to 0.\n\n");
 }
 
 /**
- * @brief Lay out the sections of the image into their final locations.
+ * @brief Finds the start of a specific image in a chained file.
  *
  * @param[in,out] info Relocation information for the file.
+ * @param[in] filename Name of the file.
+ * @param[in] file Contents of the file in memory.
+ * @param[in] image Index of the image to find, starting at zero.
+ * @param[out] offset Returns the offset of the image within the file.
  *
- * @return Non-zero if OK, or zero if out of memory.
+ * @return 1 if OK, 0 if the image does not exist or the file is invalid,
+ * or -1 if the file is truncated or out of memory.  An error message will
+ * have been printed.
  */
-static int layout_image(reloc_info_t *info)
+static int find_image
+    (reloc_info_t *info, const char *filename,
+     const o65_mapped_file_t *file, o65_size_t image, off_t *offset)
 {
-    /* Set the address and size of the .text segment */
-    info->text_address = info->load_text_address;
-    info->text_size = align_size(info->header.tlen, info->alignment);
+    o65_dir_t dir;
+    int result;
 
-    /* Set the address and size of the .data segment */
-    if (info->load_data_address) {
-        info->data_address = info->load_data_address;
-    } else {
-        info->data_address = info->text_address + info->text_size;
-    }
-    info->data_size = align_size(info->header.dlen, info->alignment);
-    info->data_plus_bss_size = info->data_size;
-
-    /* Set the address and size of the .bss segment.  We ignore the
-     * load address override if the "bsszero" mode is set because we
-     * need to clear that region with zeroes as part of the final
-     * relocated image.  We cannot do that if .bss is located elsewhere. */
-    info->bss_size = align_size(info->header.blen, info->alignment);
-    if ((info->header.mode & O65_MODE_BSSZERO) != 0) {
-        info->bss_address = info->data_address + info->data_size;
-        info->data_plus_bss_size += info->bss_size;
-    } else if (info->load_bss_address) {
-        info->bss_address = info->load_bss_address;
-    } else {
-        info->bss_address = info->data_address + info->data_size;
+    /* Scan the chain in the copy of the file that is already in memory.
+     * The file may have been decompressed or read from a pipe, so we
+     * cannot go back to the filesystem to scan it again. */
+    errno = 0;
+    result = o65_open_memory(&dir, &(info->context), file->data, file->size);
+    if (result < 0) {
+        if (errno)
+            perror(filename);
+        else
+            fprintf(stderr, "%s: unexpected EOF\n", filename);
+        return -1;
+    } else if (result == 0) {
+        fprintf(stderr, "%s: not in .o65 format\n", filename);
+        return 0;
     }
-
-    /* Allocate memory for the segments, cleared to zeroes initially */
-    info->text_segment = calloc(info->text_size ? info->text_size : 1, 1);
-    info->data_segment = calloc
-        (info->data_plus_bss_size ? info->data_plus_bss_size : 1, 1);
-    if (info->text_segment && info->data_segment)
-        return 1;
-    else
+    if (image >= dir.num_images) {
+        fprintf(stderr, "%s: image %lu does not exist, the file has %lu image%s\n",
+                filename, (unsigned long)image, (unsigned long)(dir.num_images),
+                dir.num_images == 1 ? "" : "s");
+        o65_close(&dir);
         return 0;
+    }
+    *offset = dir.images[image].offsets[O65_SECTION_HEADER];
+    o65_close(&dir);
+    return 1;
 }
 
 /**
- * @brief Resolve external references.
+ * @brief Resolves an external reference using the imports list.
  *
- * @param[in,out] info Relocation information for the file.
- * @param[in] file File to load from.
- * @param[in] filename Name of the file to load from, for error reporting.
+ * @param[in] user_data Relocation information for the file.
+ * @param[in] index Index of the external reference.
+ * @param[in] name Name of the external reference.
+ * @param[out] value Returns the address of the external reference.
  *
- * @return 1 on success, 0 if the file is invalid, and -1 on unexpected EOF
- * or a filesystem error.
+ * @return 1 if the reference was resolved, or 0 if it is unknown.
  */
-static int resolve_extern(reloc_info_t *info, FILE *file, const char *filename)
+static int resolve_import
+    (void *user_data, o65_size_t index, const char *name, o65_size_t *value)
 {
-    char name[O65_STRING_MAX];
-    o65_size_t index;
-    import_info_t *import;
-    int result;
-    int ok;
-
-    /* Read the number of external references in the file */
-    result = o65_read_count(file, &(info->header), &(info->num_externs));
-    if (result <= 0)
-        return result;
-
-    /* Nothing to do if the count is zero */
-    if (info->num_externs == 0)
+    const reloc_info_t *info = user_data;
+    const import_info_t *import;
+
+    /* The name was interned when the externs were decoded, so the
+     * import for it can be found without any string comparisons */
+    import = info->extern_names[index]->data;
+    if (import) {
+        *value = import->value;
         return 1;
-
-    /* Allocate a table to hold the resolved addresses */
-    info->externs = calloc(info->num_externs, sizeof(o65_size_t));
-    if (!(info->externs))
-        return -1;
-
-    /* Load the names of the externals and resolve them */
-    ok = 1;
-    for (index = 0; index < info->num_externs; ++index) {
-        /* Read the next string from the file */
-        result = o65_read_string(file, name, sizeof(name));
-        if (result < 0) {
-            break;
-        } else if (result == 0) {
-            fprintf(stderr, "%s: warning: symbol name '%s' was truncated\n",
-                    filename, name);
-        }
-
-        /* Find the name in the imports list */
-        import = info->imports;
-        while (import != NULL) {
-            if (!strcmp(import->name, name))
-                break;
-            import = import->next;
-        }
-        if (import != NULL) {
-            info->externs[index] = import->value;
-        } else {
-            fprintf(stderr, "%s: unresolved external reference '%s'\n",
-                    filename, name);
-            ok = 0;
-        }
     }
-    return ok;
+    fprintf(stderr, "%s: unresolved external reference '%s'\n",
+            info->filename, name);
+    return 0;
 }
 
 /**
- * @brief Resolve external references.
+ * @brief Load the input image and relocate it.
  *
  * @param[in,out] info Relocation information for the file.
- * @param[in] file File to load from.
- * @param[in] filename Name of the file to load from, for error reporting.
- * @param[in] data Points to the segment data to patch using relocations.
- * @param[in] size Size of the segment.
+ * @param[in] view View of the image in memory.
  *
- * @return 1 on success, 0 if the file is invalid, and -1 on unexpected EOF
- * or a filesystem error.
+ * @return 1 on success, 0 if the file is invalid, and -1 if out of memory.
  */
-static int relocate_segment
-    (reloc_info_t *info, FILE *file, const char *filename,
-     uint8_t *data, o65_size_t size)
+static int load(reloc_info_t *info, const o65_image_view_t *view)
 {
-    o65_reloc_t reloc;
-    o65_size_t addr;
-    o65_size_t adjust;
-    o65_size_t vector;
+    const char *filename = info->filename;
+    o65_layout_t *layout = &(info->layout);
     int result;
 
-    /* Relocations actually start at the segment base - 1 */
-    addr = ~((o65_size_t)0);
+    /* Lay out the segments into their final locations */
+    if (o65_layout_image
+            (layout, &(info->context), &(view->header), &(info->addresses))) {
+        /* Allocate memory for the segments */
+        info->text_segment = o65_arena_alloc(&(info->arena), layout->text_size);
+        info->data_segment = o65_arena_alloc
+            (&(info->arena), layout->data_load_size);
+        if (!(info->text_segment) || !(info->data_segment))
+            return -1;
 
-    /* Read and apply all relocations for the segment */
-    for (;;) {
-        /* Read the next relocation entry */
-        result = o65_read_reloc(file, &(info->header), &reloc);
+        /* Intern the names of the external references in one pass */
+        info->extern_names = o65_arena_calloc
+            (&(info->arena), view->num_externs, sizeof(o65_string_t *));
+        if (!(info->extern_names) && view->num_externs)
+            return -1;
+        result = o65_decode_externs
+            (&(info->names), view, info->extern_names);
         if (result <= 0)
             return result;
-        else if (reloc.offset == 0)
-            break;
-
-        /* Process skip relocations which advance by 254 bytes only */
-        if (reloc.offset == 255) {
-            addr += 254;
-            continue;
-        }
-
-        /* Find the address to apply the relocation at */
-        addr += reloc.offset;
-
-        /* Get the adjustment to apply based on the segment ID */
-        switch (reloc.type & O65_RELOC_SEGID) {
-        case O65_SEGID_UNDEF:
-            if (reloc.undefid < info->num_externs) {
-                adjust = info->externs[reloc.undefid];
-            } else {
-                fprintf(stderr, "%s: invalid external reference %lu\n",
-                        filename, (unsigned long)(reloc.undefid));
-                return 0;
-            }
-            break;
-
-        case O65_SEGID_TEXT:
-            adjust = info->text_address - info->header.tbase;
-            break;
 
-        case O65_SEGID_DATA:
-            adjust = info->data_address - info->header.dbase;
-            break;
-
-        case O65_SEGID_BSS:
-            adjust = info->bss_address - info->header.bbase;
-            break;
-
-        case O65_SEGID_ZEROPAGE:
-            adjust = info->zeropage_address - info->header.zbase;
-            break;
-
-        default:
-            /* ABS and other segment ID's are not allowed in relocations */
-            fprintf(stderr, "%s: invalid relocation segment ID %d\n",
-                    filename, reloc.type & O65_RELOC_SEGID);
-            return 0;
-        }
-
-        /* Apply the relocation.  See the ".o65" format spec for details:
-         * http://www.6502.org/users/andre/o65/fileformat.html */
-        if (addr >= size) {
-            fprintf(stderr, "%s: relocation is out of range\n", filename);
-            return 0;
-        }
-        switch (reloc.type & O65_RELOC_TYPE) {
-        case O65_RELOC_WORD:
-            /* 16-bit word address */
-            if ((addr + 1) >= size) {
-                fprintf(stderr, "%s: word relocation is out of range\n", filename);
-                return 0;
-            }
-            vector = o65_read_uint16(data + addr);
-            vector += adjust;
-            o65_write_uint16(data + addr, (uint16_t)vector);
-            break;
-
-        case O65_RELOC_SEGADR:
-            /* 24-bit segment address */
-            if ((addr + 2) >= size) {
-                fprintf(stderr, "%s: segment address relocation is out of range\n", filename);
-                return 0;
-            }
-            vector = o65_read_uint24(data + addr);
-            vector += adjust;
-            o65_write_uint24(data + addr, vector);
-            break;
-
-        case O65_RELOC_HIGH:
-            /* High byte from the code, low byte from the relocation */
-            vector = (((uint16_t)(data[addr])) << 8) | reloc.extra;
-            vector += adjust;
-            data[addr] = (uint8_t)(vector >> 8);
-            break;
-
-        case O65_RELOC_LOW:
-            /* Low byte from the code, high byte is irrelevant */
-            vector = data[addr];
-            vector += adjust;
-            data[addr] = (uint8_t)vector;
-            break;
-
-        case O65_RELOC_SEG:
-            /* Segment byte from the code, low 16 bits from the relocation */
-            vector = (((uint32_t)(data[addr])) << 16) | reloc.extra;
-            vector += adjust;
-            data[addr] = (uint8_t)(vector >> 16);
-            break;
-        }
-    }
-    return 1;
-}
-
-/**
- * @brief Load the input file and relocate it.
- *
- * @param[in,out] info Relocation information for the file.
- * @param[in] file File to load from.
- * @param[in] filename Name of the file to load from, for error reporting.
- *
- * @return 1 on success, 0 if the file is invalid, and -1 on unexpected EOF
- * or a filesystem error.
- */
-static int load(reloc_info_t *info, FILE *file, const char *filename)
-{
-    o65_option_t option;
-    int result;
-
-    /* Skip any header options that are present */
-    for (;;) {
-        result = o65_read_option(file, &option);
-        if (result <= 0)
+        /* Copy the segments into memory and relocate them.  The rest of
+         * the file contains exported symbols from this image.  Ignore them
+         * because we cannot encode exported symbols in ".bin" format. */
+        result = o65_relocate
+            (layout, view, info->text_segment, info->data_segment,
+             resolve_import, info);
+        if (result != 0)
             return result;
-        if (option.len == 0)
-            break;
     }
 
-    /* Must be an executable, not an object file, to be able to relocate it */
-    if (info->header.mode & O65_MODE_OBJ) {
+    /* Report why the image could not be loaded */
+    switch (layout->error) {
+    case O65_LOAD_ERROR_OBJECT:
         fprintf(stderr, "%s: cannot relocate object files\n", filename);
-        return 0;
-    }
-
-    /* Pick a default load address for the .text segment */
-    if (!info->load_text_address) {
-        info->load_text_address = info->header.tbase;
-        if (!info->load_text_address) {
-            fprintf(stderr, "%s: text load address cannot be zero\n", filename);
-            return 0;
-        }
+        break;
+
+    case O65_LOAD_ERROR_ADDRESS:
+        fprintf(stderr, "%s: text load address cannot be zero\n", filename);
+        break;
+
+    case O65_LOAD_ERROR_ALIGN_TEXT:
+    case O65_LOAD_ERROR_ALIGN_DATA:
+    case O65_LOAD_ERROR_ALIGN_BSS:
+        fprintf(stderr, "%s: %s load address 0x%lx is not aligned on a %d-byte boundary\n",
+                filename,
+                layout->error == O65_LOAD_ERROR_ALIGN_TEXT ? "text" :
+                layout->error == O65_LOAD_ERROR_ALIGN_DATA ? "data" : "bss",
+                (unsigned long)(layout->error_value), (int)(layout->alignment));
+        break;
+
+    case O65_LOAD_ERROR_SEGID:
+        fprintf(stderr, "%s: invalid relocation segment ID %d\n",
+                filename, (int)(layout->error_value));
+        break;
+
+    case O65_LOAD_ERROR_RANGE:
+        fprintf(stderr, "%s: relocation is out of range\n", filename);
+        break;
+
+    case O65_LOAD_ERROR_EXTERN:
+        fprintf(stderr, "%s: invalid external reference %lu\n",
+                filename, (unsigned long)(layout->error_value));
+        break;
+
+    case O65_LOAD_ERROR_SEGMENT:
+        fprintf(stderr, "%s: compressed %s segment is invalid\n", filename,
+                layout->error_value == O65_SEGID_TEXT ? "text" : "data");
+        break;
+
+    case O65_LOAD_ERROR_TRUNCATED:
+        fprintf(stderr, "%s: relocation table is truncated\n", filename);
+        break;
+
+    case O65_LOAD_ERROR_SIZE:
+        fprintf(stderr, "%s: %s segment is too large\n", filename,
+                layout->error_value == O65_SEGID_TEXT ? "text" :
+                layout->error_value == O65_SEGID_DATA ? "data" : "bss");
+        break;
+
+    case O65_LOAD_ERROR_UNRESOLVED:
+        /* Unresolved references have already been reported */
+        break;
+
+    default:
+        fprintf(stderr, "%s: cannot load image, error %d\n",
+                filename, layout->error);
+        break;
     }
-
-    /* Select the segment alignment and validate the load address */
-    switch (info->header.mode & O65_MODE_ALIGN) {
-    case O65_MODE_ALIGN_1:   info->alignment = 1; break;
-    case O65_MODE_ALIGN_2:   info->alignment = 2; break;
-    case O65_MODE_ALIGN_4:   info->alignment = 4; break;
-    case O65_MODE_ALIGN_256: info->alignment = 256; break;
-    }
-    if (info->header.mode & O65_MODE_PAGED) {
-        /* Override the alignment value and force page alignment */
-        info->alignment = 256;
-    }
-    if ((info->load_text_address & (~(info->alignment - 1))) != info->load_text_address) {
-        fprintf(stderr, "%s: text load address 0x%lx is not aligned on a %d-byte boundary\n",
-                filename, (unsigned long)info->load_text_address, (int)info->alignment);
-        return 0;
-    }
-
-    /* Check the alignment of the .data and .bss segments */
-    if ((info->load_data_address & (~(info->alignment - 1))) != info->load_data_address) {
-        fprintf(stderr, "%s: data load address 0x%lx is not aligned on a %d-byte boundary\n",
-                filename, (unsigned long)info->load_data_address, (int)info->alignment);
-        return 0;
-    }
-    if ((info->load_bss_address & (~(info->alignment - 1))) != info->load_bss_address) {
-        fprintf(stderr, "%s: bss load address 0x%lx is not aligned on a %d-byte boundary\n",
-                filename, (unsigned long)info->load_bss_address, (int)info->alignment);
-        return 0;
-    }
-
-    /* Lay out the segments into their final locations */
-    if (!layout_image(info))
-        return -1;
-
-    /* Load the contents of the .text and .data segments from the file */
-    if (info->header.tlen) {
-        if (fread(info->text_segment, 1, info->header.tlen, file)
-                != info->header.tlen) {
-            return -1;
-        }
-    }
-    if (info->header.dlen) {
-        if (fread(info->data_segment, 1, info->header.dlen, file)
-                != info->header.dlen) {
-            return -1;
-        }
-    }
-
-    /* Load and resolve the external references list */
-    result = resolve_extern(info, file, filename);
-    if (result <= 0)
-        return result;
-
-    /* Relocate the .text segment */
-    result = relocate_segment
-        (info, file, filename, info->text_segment, info->text_size);
-    if (result <= 0)
-        return result;
-
-    /* Relocate the .data segment */
-    result = relocate_segment
-        (info, file, filename, info->data_segment, info->data_size);
-    if (result <= 0)
-        return result;
-
-    /* The rest of the file contains exported symbols from this image.
-     * Ignore because we cannot encode exported symbols in ".bin" format. */
-
-    /* Done */
-    return 1;
+    return 0;
 }
 
 /**
@@ -680,6 +467,7 @@ static int load_imports(reloc_info_t *info, const char *filename)
     FILE *file;
     size_t len;
     size_t posn;
+    o65_string_t *name;
     import_info_t *import;
 
     /* Open the imports file */
@@ -709,12 +497,18 @@ static int load_imports(reloc_info_t *info, const char *filename)
             continue; /* No value present; ignore this line */
         buf[posn++] = '\0';
 
-        /* Allocate space for a new import definition */
-        import = calloc(1, sizeof(import_info_t));
-        import->name = strdup(buf);
+        /* Intern the name and attach the import definition to it.
+         * Later definitions of the same name replace earlier ones. */
+        name = o65_string_intern(&(info->names), buf, posn - 1);
+        if (name && !(name->data))
+            name->data = o65_arena_alloc(&(info->arena), sizeof(import_info_t));
+        if (!name || !(name->data)) {
+            fprintf(stderr, "out of memory\n");
+            fclose(file);
+            return -1;
+        }
+        import = name->data;
         import->value = strtoul(buf + posn, NULL, 0);
-        import->next = info->imports;
-        info->imports = import;
     }
 
     /* Done */
@@ -723,19 +517,44 @@ static int load_imports(reloc_info_t *info, const char *filename)
 }
 
 /**
- * @brief Frees the list of imports.
+ * @brief Writes one or two blocks of data to an output file.
  *
- * @param[in,out] info Relocation information containing the import list.
+ * @param[in] filename Name of the output file, or "-" for standard output.
+ * @param[in] data1 Points to the first block of data.
+ * @param[in] size1 Size of the first block of data.
+ * @param[in] data2 Points to the second block of data, or NULL.
+ * @param[in] size2 Size of the second block of data.
+ *
+ * @return 1 on success, or -1 on a filesystem error.  An error message
+ * will have been printed.
  */
-static void free_imports(reloc_info_t *info)
+static int write_output
+    (const char *filename, const uint8_t *data1, size_t size1,
+     const uint8_t *data2, size_t size2)
 {
-    import_info_t *current = info->imports;
-    import_info_t *next;
-    while (current != 0) {
-        next = current->next;
-        free(current->name);
-        free(current);
-        current = next;
+    FILE *file;
+    int ok;
+
+    /* Open the output file, or use standard output for "-" */
+    if (!strcmp(filename, "-")) {
+        file = stdout;
+    } else if ((file = fopen(filename, "wb")) == NULL) {
+        perror(filename);
+        return -1;
+    }
+
+    /* Write the data.  Standard output is flushed but not closed so
+     * that the result can be checked before the program exits. */
+    ok = fwrite(data1, 1, size1, file) == size1;
+    if (ok && data2)
+        ok = fwrite(data2, 1, size2, file) == size2;
+    if (file == stdout)
+        ok = (fflush(file) == 0) && ok;
+    else
+        ok = (fclose(file) == 0) && ok;
+    if (!ok) {
+        perror(filename);
+        return -1;
     }
-    info->imports = NULL;
+    return 1;
 }
@@ -0,0 +1,107 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65.hpp"
+#include "o65writer.h"
+#include "test.h"
+#include <cstring>
+
+/**
+ * @brief Encodes an image whose .text relocation table is given.
+ *
+ * @param[out] writer Returns the encoded image.
+ * @param[in] relocs Points to the encoded .text relocation table.
+ * @param[in] len Length of the table, including the terminator.
+ */
+static void build_image
+    (o65_writer_t *writer, const uint8_t *relocs, size_t len)
+{
+    static const uint8_t text[] = {0x00, 0x10, 0x00, 0x10};
+    o65_header_t header;
+
+    std::memset(&header, 0, sizeof(header));
+    header.tbase = 0x1000;
+    header.tlen = sizeof(text);
+    o65_writer_init(writer, nullptr);
+    CHECK(o65_writer_header(writer, &header) == 0);
+    CHECK(o65_writer_option(writer, nullptr) == 0);
+    CHECK(o65_writer_bytes(writer, text, sizeof(text)) == 0);
+    CHECK(o65_writer_count(writer, 0) == 0);
+    CHECK(o65_writer_bytes(writer, relocs, len) == 0);
+    CHECK(o65_writer_bytes(writer, "", 1) == 0); /* No .data relocations */
+    CHECK(o65_writer_count(writer, 0) == 0);
+}
+
+/**
+ * @brief Counts the .text relocations in an image.
+ *
+ * @param[in] relocs Points to the encoded .text relocation table.
+ * @param[in] len Length of the table, including the terminator.
+ * @param[out] error Returns the reason why the iteration stopped.
+ *
+ * @return The number of relocations before the iteration stopped.
+ */
+static int count_relocs(const uint8_t *relocs, size_t len, int *error)
+{
+    o65_writer_t writer;
+    o65::image_view view;
+    int count = 0;
+
+    build_image(&writer, relocs, len);
+    CHECK(view.parse(o65::bytes(writer.data, writer.size)) == 1);
+    o65::reloc_range range = view.text_relocs();
+    for (const auto &entry : range) {
+        CHECK(entry.type == O65_RELOC_WORD);
+        ++count;
+    }
+    *error = range.error();
+    o65_writer_free(&writer);
+    return count;
+}
+
+int main()
+{
+    static const uint8_t good[] = {1, 0x82, 2, 0x82, 0};
+    static const uint8_t range[] = {1, 0x82, 3, 0x82, 0};
+    static const uint8_t bad_extern[] = {1, 0x80, 0x00, 0x00, 0};
+    int error = -1;
+
+    CHECK(count_relocs(good, sizeof(good), &error) == 2);
+    CHECK(error == 0);
+    CHECK(count_relocs(range, sizeof(range), &error) == 1);
+    CHECK(error == O65_RELOC_ERROR_RANGE);
+    CHECK(count_relocs(bad_extern, sizeof(bad_extern), &error) == 0);
+    CHECK(error == O65_RELOC_ERROR_EXTERN);
+
+    /* Iterators that are not from a range still report on themselves */
+    o65_reloc_iter_t iter;
+    o65_header_t header;
+    o65_span_t span = {range, sizeof(range)};
+    std::memset(&header, 0, sizeof(header));
+    o65_reloc_iter_init(&iter, &header, &span, 0x1000, 4, 0);
+    o65::reloc_iterator it(iter);
+    CHECK(it != o65::reloc_iterator());
+    ++it;
+    CHECK(it == o65::reloc_iterator());
+    CHECK(it.error() == O65_RELOC_ERROR_RANGE);
+    return TEST_RESULT();
+}
@@ -0,0 +1,159 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65load.h"
+#include "test.h"
+#include <string.h>
+
+/**
+ * @brief Lays out an image with the default load addresses.
+ *
+ * @param[out] layout Returns the layout.
+ * @param[in] header Header for the image.
+ *
+ * @return The result of o65_layout_image().
+ */
+static int layout_header(o65_layout_t *layout, const o65_header_t *header)
+{
+    o65_load_addresses_t addresses;
+    memset(&addresses, 0, sizeof(addresses));
+    return o65_layout_image(layout, NULL, header, &addresses);
+}
+
+static void test_layout(void)
+{
+    o65_header_t header;
+    o65_layout_t layout;
+
+    memset(&header, 0, sizeof(header));
+    header.mode = O65_MODE_32BIT | O65_MODE_ALIGN_256;
+    header.tbase = 0x1000;
+    header.tlen = 0x123;
+    header.dlen = 0x10;
+    header.blen = 0x100;
+    CHECK(layout_header(&layout, &header) == 1);
+    CHECK(layout.text_size == 0x200);
+    CHECK(layout.data_address == 0x1200);
+    CHECK(layout.data_size == 0x100);
+    CHECK(layout.data_load_size == 0x100);
+    CHECK(layout.bss_address == 0x1300);
+
+    header.mode |= O65_MODE_BSSZERO;
+    CHECK(layout_header(&layout, &header) == 1);
+    CHECK(layout.data_load_size == 0x200);
+}
+
+static void test_layout_overflow(void)
+{
+    o65_header_t header;
+    o65_layout_t layout;
+
+    /* Segment sizes that wrap around to zero when they are aligned */
+    memset(&header, 0, sizeof(header));
+    header.mode = O65_MODE_32BIT | O65_MODE_PAGED;
+    header.tbase = 0x1000;
+    header.tlen = 0xFFFFFFF0u;
+    CHECK(layout_header(&layout, &header) == 0);
+    CHECK(layout.error == O65_LOAD_ERROR_SIZE);
+    CHECK(layout.error_value == O65_SEGID_TEXT);
+
+    header.tlen = 0;
+    header.dlen = 0xFFFFFF01u;
+    CHECK(layout_header(&layout, &header) == 0);
+    CHECK(layout.error == O65_LOAD_ERROR_SIZE);
+    CHECK(layout.error_value == O65_SEGID_DATA);
+
+    header.dlen = 0;
+    header.blen = 0xFFFFFFFFu;
+    CHECK(layout_header(&layout, &header) == 0);
+    CHECK(layout.error == O65_LOAD_ERROR_SIZE);
+    CHECK(layout.error_value == O65_SEGID_BSS);
+
+    /* .data and .bss fit separately, but not when they are combined */
+    header.mode |= O65_MODE_BSSZERO;
+    header.dlen = 0x80000000u;
+    header.blen = 0x80000000u;
+    CHECK(layout_header(&layout, &header) == 0);
+    CHECK(layout.error == O65_LOAD_ERROR_SIZE);
+    CHECK(layout.error_value == O65_SEGID_BSS);
+    header.blen = 0x7FFFFF00u;
+    CHECK(layout_header(&layout, &header) == 1);
+    CHECK(layout.data_load_size == 0xFFFFFF00u);
+}
+
+static void test_relocate_mismatch(void)
+{
+    static const uint8_t text[16] = {0};
+    static const uint8_t relocs[1] = {0};
+    uint8_t text_out[4];
+    uint8_t data_out[4];
+    o65_image_view_t view;
+    o65_header_t header;
+    o65_layout_t layout;
+
+    /* Layout for a header with a 4-byte .text segment */
+    memset(&header, 0, sizeof(header));
+    header.tbase = 0x1000;
+    header.tlen = sizeof(text_out);
+    CHECK(layout_header(&layout, &header) == 1);
+    CHECK(layout.text_size == sizeof(text_out));
+    CHECK(layout.data_load_size == 0);
+
+    /* View of an image with a larger .text segment */
+    memset(&view, 0, sizeof(view));
+    view.header = header;
+    view.header.tlen = sizeof(text);
+    view.text.data = text;
+    view.text.size = sizeof(text);
+    view.text_relocs.data = relocs;
+    view.text_relocs.size = sizeof(relocs);
+    view.data_relocs = view.text_relocs;
+    CHECK(o65_relocate_resolved
+            (&layout, &view, text_out, data_out, NULL) == 0);
+    CHECK(layout.error == O65_LOAD_ERROR_SIZE);
+    CHECK(layout.error_value == O65_SEGID_TEXT);
+
+    /* The same again for the .data segment */
+    view.header = header;
+    view.header.dlen = sizeof(text);
+    view.text.size = sizeof(text_out);
+    view.data = view.text;
+    view.data.size = sizeof(text);
+    CHECK(o65_relocate_resolved
+            (&layout, &view, text_out, data_out, NULL) == 0);
+    CHECK(layout.error == O65_LOAD_ERROR_SIZE);
+    CHECK(layout.error_value == O65_SEGID_DATA);
+
+    /* The matching image relocates */
+    view.header = header;
+    view.data.size = 0;
+    CHECK(o65_relocate_resolved
+            (&layout, &view, text_out, data_out, NULL) == 1);
+}
+
+int main(void)
+{
+    test_layout();
+    test_layout_overflow();
+    test_relocate_mismatch();
+    return TEST_RESULT();
+}
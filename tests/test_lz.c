@@ -0,0 +1,143 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65compress.h"
+#include "o65writer.h"
+#include "test.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SIZE 5000
+
+/**
+ * @brief Fills a buffer with a mixture of repetitive and noisy data.
+ *
+ * @param[out] buf The buffer to fill.
+ * @param[in] size Size of the buffer.
+ */
+static void fill_data(uint8_t *buf, size_t size)
+{
+    uint32_t seed = 0x12345678;
+    size_t posn;
+    for (posn = 0; posn < size; ++posn) {
+        seed = seed * 1103515245 + 12345;
+        if ((posn / 512) % 2)
+            buf[posn] = (uint8_t)(seed >> 24);
+        else
+            buf[posn] = (uint8_t)(posn % 37);
+    }
+}
+
+static void test_block(const uint8_t *data, size_t size)
+{
+    size_t bound = o65_lz_bound(size);
+    uint8_t *packed = malloc(bound);
+    uint8_t *unpacked = malloc(size + 1);
+    size_t packed_len, len;
+
+    packed_len = o65_lz_compress(packed, bound, data, size);
+    CHECK(packed_len > 0 && packed_len <= bound);
+    CHECK(o65_lz_decompress(unpacked, size, packed, packed_len, &len) == 1);
+    CHECK(len == size && !memcmp(unpacked, data, size));
+
+    /* Output that does not fit is rejected */
+    if (size > 0) {
+        CHECK(o65_lz_decompress
+                (unpacked, size - 1, packed, packed_len, &len) == 0);
+    }
+
+    free(packed);
+    free(unpacked);
+}
+
+static void test_segment(const uint8_t *data, size_t size)
+{
+    o65_writer_t writer;
+    o65_lz_stream_t stream;
+    uint8_t *unpacked = malloc(size + 1);
+    size_t stored, posn;
+
+    o65_writer_init(&writer, NULL);
+    CHECK(o65_lz_encode_segment(&writer, data, size, &stored) == 0);
+    CHECK(stored == writer.size && stored <= size);
+
+    /* Decode the whole segment at once */
+    memset(unpacked, 0, size + 1);
+    CHECK(o65_lz_decode_segment(unpacked, size, writer.data, stored) == 1);
+    CHECK(!memcmp(unpacked, data, size));
+    CHECK(o65_lz_decode_segment(unpacked, size + 1, writer.data, stored) == 0);
+
+    /* Decode the segment one byte at a time */
+    memset(unpacked, 0, size + 1);
+    o65_lz_stream_init(&stream, unpacked, size, stored);
+    for (posn = 0; posn < stored; ++posn)
+        CHECK(o65_lz_stream_feed(&stream, writer.data + posn, 1) == 1);
+    CHECK(o65_lz_stream_finish(&stream) == 1);
+    CHECK(!memcmp(unpacked, data, size));
+
+    /* The stream is not finished if any of the input is missing */
+    if (stored > 0) {
+        o65_lz_stream_init(&stream, unpacked, size, stored);
+        CHECK(o65_lz_stream_feed(&stream, writer.data, stored - 1) == 1);
+        CHECK(o65_lz_stream_finish(&stream) == 0);
+    }
+
+    o65_writer_free(&writer);
+    free(unpacked);
+}
+
+static void test_short_input(void)
+{
+    static const uint8_t gzip2[] = {0x1F, 0x8B};
+    static const uint8_t gzip3[] = {0x1F, 0x8B, 0x08};
+    static const uint8_t zlib2[] = {0x78, 0x9C};
+    static const uint8_t plain[] = {'o', 'k'};
+    uint8_t *out;
+    size_t out_size;
+
+    /* Inputs that are too short to hold a magic number are passed
+     * through, unless they are the start of a truncated stream */
+    CHECK(o65_decompress(NULL, gzip2, sizeof(gzip2), &out, &out_size) == 0);
+    free(out);
+    CHECK(o65_decompress(NULL, gzip3, sizeof(gzip3), &out, &out_size) == 0);
+    free(out);
+    CHECK(o65_decompress(NULL, zlib2, sizeof(zlib2), &out, &out_size) == 0);
+    free(out);
+    CHECK(o65_decompress(NULL, plain, sizeof(plain), &out, &out_size) == 1);
+    CHECK(out_size == sizeof(plain) && !memcmp(out, plain, sizeof(plain)));
+    free(out);
+}
+
+int main(void)
+{
+    static uint8_t data[TEST_SIZE];
+    static const size_t sizes[] = {0, 1, 15, 16, 300, 1024, TEST_SIZE};
+    size_t posn;
+
+    fill_data(data, sizeof(data));
+    for (posn = 0; posn < sizeof(sizes) / sizeof(sizes[0]); ++posn) {
+        test_block(data, sizes[posn]);
+        test_segment(data, sizes[posn]);
+    }
+    test_short_input();
+    return TEST_RESULT();
+}
@@ -0,0 +1,199 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65push.h"
+#include "o65writer.h"
+#include "test.h"
+#include <string.h>
+
+/**
+ * @brief Encodes a small image that exercises every kind of event.
+ *
+ * @param[out] writer Returns the encoded image.
+ */
+static void build_image(o65_writer_t *writer)
+{
+    static const uint8_t text[] = {0xA9, 0x00, 0x20, 0x00, 0x00, 0x60};
+    static const uint8_t data[] = {0x00, 0x10, 0x05, 0x10};
+    o65_header_t header;
+    o65_option_t option;
+    o65_reloc_t reloc;
+
+    memset(&header, 0, sizeof(header));
+    header.tbase = 0x1000;
+    header.tlen = sizeof(text);
+    header.dbase = 0x2000;
+    header.dlen = sizeof(data);
+    header.blen = 16;
+    o65_writer_init(writer, NULL);
+    CHECK(o65_writer_header(writer, &header) == 0);
+    option.len = 6;
+    option.type = O65_OPT_PROGRAM;
+    memcpy(option.data, "test", 4);
+    CHECK(o65_writer_option(writer, &option) == 0);
+    CHECK(o65_writer_option(writer, NULL) == 0);
+    CHECK(o65_writer_bytes(writer, text, sizeof(text)) == 0);
+    CHECK(o65_writer_bytes(writer, data, sizeof(data)) == 0);
+
+    /* External references */
+    CHECK(o65_writer_count(writer, 2) == 0);
+    CHECK(o65_writer_string(writer, "putchar") == 0);
+    CHECK(o65_writer_string(writer, "exit") == 0);
+
+    /* .text relocations: external #1 at 0x1003 */
+    memset(&reloc, 0, sizeof(reloc));
+    reloc.offset = 4;
+    reloc.type = O65_RELOC_WORD | O65_SEGID_UNDEF;
+    reloc.undefid = 1;
+    CHECK(o65_writer_reloc(writer, &reloc) == 0);
+    CHECK(o65_writer_bytes(writer, "", 1) == 0);
+
+    /* .data relocations: two words that point into .text */
+    memset(&reloc, 0, sizeof(reloc));
+    reloc.offset = 1;
+    reloc.type = O65_RELOC_WORD | O65_SEGID_TEXT;
+    CHECK(o65_writer_reloc(writer, &reloc) == 0);
+    reloc.offset = 2;
+    CHECK(o65_writer_reloc(writer, &reloc) == 0);
+    CHECK(o65_writer_bytes(writer, "", 1) == 0);
+
+    /* Exported symbols */
+    CHECK(o65_writer_count(writer, 1) == 0);
+    CHECK(o65_writer_exported_symbol
+            (writer, "main", O65_SEGID_TEXT, 0x1000) == 0);
+}
+
+/**
+ * @brief Records a digest of the events from the push parser.
+ */
+typedef struct
+{
+    unsigned long hash;     /**< Hash of the non-segment events */
+    unsigned counts[O65_EVENT_END + 1]; /**< Number of each kind of event */
+    size_t segment_bytes;   /**< Total size of the segment chunks */
+
+} digest_t;
+
+static void hash_value(digest_t *digest, unsigned long value)
+{
+    digest->hash = digest->hash * 31 + value;
+}
+
+static int record_event(void *user_data, const o65_event_t *event)
+{
+    digest_t *digest = (digest_t *)user_data;
+    size_t posn;
+
+    ++(digest->counts[event->type]);
+    switch (event->type) {
+    case O65_EVENT_TEXT:
+    case O65_EVENT_DATA:
+        /* Chunk boundaries depend upon how the input was fed */
+        digest->segment_bytes += event->size;
+        return 1;
+
+    case O65_EVENT_TEXT_RELOC:
+    case O65_EVENT_DATA_RELOC:
+        hash_value(digest, event->reloc.type);
+        hash_value(digest, event->reloc.extra);
+        hash_value(digest, event->reloc.undefid);
+        break;
+
+    case O65_EVENT_EXTERN:
+    case O65_EVENT_EXPORT:
+        for (posn = 0; posn < event->size; ++posn)
+            hash_value(digest, event->data[posn]);
+        hash_value(digest, event->segid);
+        hash_value(digest, event->value);
+        break;
+
+    default: break;
+    }
+    hash_value(digest, event->type);
+    hash_value(digest, event->index);
+    hash_value(digest, event->address);
+    return 1;
+}
+
+/**
+ * @brief Parses an image by feeding it in chunks of a fixed size.
+ *
+ * @param[out] digest Returns the digest of the events.
+ * @param[in] buf Points to the image.
+ * @param[in] size Size of the image.
+ * @param[in] chunk Size of each chunk.
+ *
+ * @return The result of o65_push_finish().
+ */
+static int parse_chunked
+    (digest_t *digest, const uint8_t *buf, size_t size, size_t chunk)
+{
+    o65_push_parser_t parser;
+    size_t posn, len;
+    int result;
+
+    memset(digest, 0, sizeof(digest_t));
+    o65_push_init(&parser, NULL, record_event, digest);
+    for (posn = 0; posn < size; posn += len) {
+        len = size - posn;
+        if (len > chunk)
+            len = chunk;
+        CHECK(o65_push_feed(&parser, buf + posn, len) == 1);
+    }
+    result = o65_push_finish(&parser);
+    o65_push_free(&parser);
+    return result;
+}
+
+int main(void)
+{
+    o65_writer_t writer;
+    digest_t whole, bytes;
+    size_t size;
+
+    build_image(&writer);
+
+    /* Feed the whole image at once */
+    CHECK(parse_chunked(&whole, writer.data, writer.size, writer.size) == 1);
+    CHECK(whole.counts[O65_EVENT_HEADER] == 1);
+    CHECK(whole.counts[O65_EVENT_OPTION] == 1);
+    CHECK(whole.counts[O65_EVENT_EXTERN] == 2);
+    CHECK(whole.counts[O65_EVENT_TEXT_RELOC] == 1);
+    CHECK(whole.counts[O65_EVENT_DATA_RELOC] == 2);
+    CHECK(whole.counts[O65_EVENT_EXPORT] == 1);
+    CHECK(whole.counts[O65_EVENT_END] == 1);
+    CHECK(whole.segment_bytes == 10);
+
+    /* Feeding a byte at a time must produce the same events */
+    CHECK(parse_chunked(&bytes, writer.data, writer.size, 1) == 1);
+    CHECK(bytes.hash == whole.hash);
+    CHECK(bytes.segment_bytes == whole.segment_bytes);
+    CHECK(bytes.counts[O65_EVENT_TEXT] == 6);
+    CHECK(bytes.counts[O65_EVENT_DATA] == 4);
+
+    /* Every truncation of the image is reported at the end */
+    for (size = 0; size < writer.size; ++size)
+        CHECK(parse_chunked(&bytes, writer.data, size, 3) == -1);
+
+    o65_writer_free(&writer);
+    return TEST_RESULT();
+}
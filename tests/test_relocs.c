@@ -0,0 +1,210 @@
+/*
+ * Copyright (C) 2023 Southern Storm Software, Pty Ltd.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a
+ * copy of this software and associated documentation files (the "Software"),
+ * to deal in the Software without restriction, including without limitation
+ * the rights to use, copy, modify, merge, publish, distribute, sublicense,
+ * and/or sell copies of the Software, and to permit persons to whom the
+ * Software is furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included
+ * in all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS
+ * OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING
+ * FROM, OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER
+ * DEALINGS IN THE SOFTWARE.
+ */
+
+#include "o65view.h"
+#include "test.h"
+#include <string.h>
+
+/**
+ * @brief Initializes an iterator over an encoded relocation table.
+ *
+ * @param[out] iter The iterator to initialize.
+ * @param[out] span Returns the span for the table.
+ * @param[in] mode Mode word for the header.
+ * @param[in] relocs Points to the encoded table.
+ * @param[in] len Length of the encoded table.
+ * @param[in] size Size of the segment.
+ */
+static void init_iter
+    (o65_reloc_iter_t *iter, o65_span_t *span, uint16_t mode,
+     const uint8_t *relocs, size_t len, o65_size_t size)
+{
+    o65_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.mode = mode;
+    span->data = relocs;
+    span->size = len;
+    o65_reloc_iter_init(iter, &header, span, 0x1000, size, 2);
+}
+
+static void test_iter_basic(void)
+{
+    /* WORD to .text at 0x1000, LOW to .data at 0x1005, then a WORD to
+     * external #1 after two skip-ahead entries at 0x1005 + 254 * 2 + 3 */
+    static const uint8_t relocs[] = {
+        1, 0x82, 5, 0x23, 255, 255, 3, 0x80, 0x01, 0x00, 0
+    };
+    o65_reloc_iter_t iter;
+    o65_reloc_entry_t entry;
+    o65_span_t span;
+
+    init_iter(&iter, &span, 0, relocs, sizeof(relocs), 0x400);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(entry.address == 0x1000);
+    CHECK(entry.offset == 0);
+    CHECK(entry.type == O65_RELOC_WORD);
+    CHECK(entry.segid == O65_SEGID_TEXT);
+    CHECK(entry.width == 2);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(entry.address == 0x1005);
+    CHECK(entry.type == O65_RELOC_LOW);
+    CHECK(entry.segid == O65_SEGID_DATA);
+    CHECK(entry.width == 1);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(entry.address == 0x1005 + 254 * 2 + 3);
+    CHECK(entry.type == O65_RELOC_WORD);
+    CHECK(entry.segid == O65_SEGID_UNDEF);
+    CHECK(entry.undefid == 1);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 0);
+    CHECK(iter.error == 0);
+}
+
+static void test_iter_high(void)
+{
+    /* HIGH relocation to .text, followed by a LOW relocation.  Without
+     * paging, the HIGH relocation carries the low byte of the address */
+    static const uint8_t unpaged[] = {1, 0x42, 0x34, 2, 0x22, 0};
+    static const uint8_t paged[] = {1, 0x42, 2, 0x22, 0};
+    o65_reloc_iter_t iter;
+    o65_reloc_entry_t entry;
+    o65_span_t span;
+
+    init_iter(&iter, &span, 0, unpaged, sizeof(unpaged), 0x100);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(entry.type == O65_RELOC_HIGH);
+    CHECK(entry.extra == 0x34);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(entry.type == O65_RELOC_LOW);
+    CHECK(entry.address == 0x1002);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 0);
+
+    init_iter(&iter, &span, O65_MODE_PAGED, paged, sizeof(paged), 0x100);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(entry.type == O65_RELOC_HIGH);
+    CHECK(entry.extra == 0);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(entry.type == O65_RELOC_LOW);
+    CHECK(entry.address == 0x1002);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 0);
+
+    /* The unpaged table is misread if the header says it is paged */
+    init_iter(&iter, &span, O65_MODE_PAGED, unpaged, sizeof(unpaged), 0x100);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(entry.address != 0x1002);
+}
+
+static void test_iter_errors(void)
+{
+    static const uint8_t truncated[] = {1, 0x82};
+    static const uint8_t no_end[] = {1, 0x82, 255};
+    static const uint8_t range[] = {1, 0x82, 3, 0x82, 0};
+    static const uint8_t past_end[] = {255, 255, 0};
+    static const uint8_t bad_extern[] = {1, 0x80, 0x02, 0x00, 0};
+    o65_reloc_iter_t iter;
+    o65_reloc_entry_t entry;
+    o65_span_t span;
+
+    /* Missing terminator after the last relocation */
+    init_iter(&iter, &span, 0, truncated, sizeof(truncated), 0x100);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == -1);
+    CHECK(iter.error == O65_RELOC_ERROR_TRUNCATED);
+
+    /* Missing terminator after a skip-ahead entry */
+    init_iter(&iter, &span, 0, no_end, sizeof(no_end), 0x400);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == -1);
+    CHECK(iter.error == O65_RELOC_ERROR_TRUNCATED);
+
+    /* Record cut off in the middle */
+    init_iter(&iter, &span, 0, truncated, 1, 0x100);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == -1);
+    CHECK(iter.error == O65_RELOC_ERROR_TRUNCATED);
+
+    /* WORD relocation that straddles the end of a 4-byte segment */
+    init_iter(&iter, &span, 0, range, sizeof(range), 4);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 1);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == -1);
+    CHECK(iter.error == O65_RELOC_ERROR_RANGE);
+
+    /* The iterator stays stopped once it has stopped */
+    CHECK(o65_reloc_iter_next(&iter, &entry) == -1);
+    CHECK(iter.error == O65_RELOC_ERROR_RANGE);
+
+    /* Skip-ahead entries that run past the end of the segment are
+     * harmless until a relocation is actually placed there */
+    init_iter(&iter, &span, 0, past_end, sizeof(past_end), 4);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == 0);
+
+    /* Only externals #0 and #1 exist */
+    init_iter(&iter, &span, 0, bad_extern, sizeof(bad_extern), 4);
+    CHECK(o65_reloc_iter_next(&iter, &entry) == -1);
+    CHECK(iter.error == O65_RELOC_ERROR_EXTERN);
+}
+
+static void test_range(void)
+{
+    /* WORD relocations to .text at 0x1000 and 0x1004 */
+    static const uint8_t relocs[] = {1, 0x82, 4, 0x82, 0};
+    static const struct {
+        o65_size_t start, end, count;
+    } ranges[] = {
+        {0,           0x1010, 2},
+        {0x0FFF,      0x1010, 2},
+        {0,           0x1001, 1},
+        {0,           0x0FFF, 0},
+        {0x1001,      0x1002, 1},   /* Second byte of the first WORD */
+        {0x1002,      0x1004, 0},
+        {0x1005,      0x1006, 1},
+        {0x1006,      0x2000, 0},
+        {0xFFFFFFF0u, 0x1001, 1}    /* Starts before the segment */
+    };
+    o65_header_t header;
+    o65_span_t span = {relocs, sizeof(relocs)};
+    o65_reloc_index_t index;
+    o65_reloc_table_t table;
+    size_t posn;
+
+    memset(&header, 0, sizeof(header));
+    memset(&table, 0, sizeof(table));
+    CHECK(o65_reloc_index_build(&index, NULL, &header, &span, 0x1000, 1, 0)
+            == 1);
+    for (posn = 0; posn < sizeof(ranges) / sizeof(ranges[0]); ++posn) {
+        CHECK(o65_decode_relocs_range
+                (&table, &index, ranges[posn].start, ranges[posn].end) == 1);
+        CHECK(table.count == ranges[posn].count);
+    }
+    CHECK(o65_decode_relocs_range(&table, &index, 0x1004, 0x1005) == 1);
+    CHECK(table.count == 1 && table.address[0] == 0x1004);
+    o65_free_relocs(&table);
+    o65_reloc_index_free(&index);
+}
+
+int main(void)
+{
+    test_iter_basic();
+    test_iter_high();
+    test_iter_errors();
+    test_range();
+    return TEST_RESULT();
+}